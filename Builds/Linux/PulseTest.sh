@@ -0,0 +1,148 @@
+#!/bin/sh
+# Test the PulseAudio backend against a null sink, on a running PulseAudio
+# server or PipeWire's, which needs pactl and pacat:
+#
+#   make clean && make PULSE=1 && ./PulseTest.sh
+#
+# Loads module-null-sink, checks listing, volume, mute, channels, metering,
+# watching and application sessions through VolCtl, and unloads the module
+# on exit. Prints each failed check and exits 1 if any failed.
+
+SINK=volctl_test
+SINK2=volctl_test2
+VOLCTL=./VolCtl
+TMP=$(mktemp -d)
+fails=0
+pacat_pid=
+
+fail()
+{
+	echo "FAIL: $*"
+	fails=$((fails + 1))
+}
+
+# near got expected: true if within 0.01
+near()
+{
+	awk -v a="$1" -v b="$2" 'BEGIN { d = a - b; exit !(d < 0.01 && d > -0.01) }'
+}
+
+cleanup()
+{
+	[ -n "$pacat_pid" ] && kill "$pacat_pid" 2>/dev/null
+	[ -n "$module" ] && pactl unload-module "$module"
+	[ -n "$module2" ] && pactl unload-module "$module2"
+	rm -rf "$TMP"
+}
+
+# start playing silence to the sink, as a session for the -a and -E tests
+start_pacat()
+{
+	pacat --device=$SINK < /dev/zero &
+	pacat_pid=$!
+	sleep 1
+}
+
+stop_pacat()
+{
+	kill "$pacat_pid"
+	wait "$pacat_pid" 2>/dev/null
+	pacat_pid=
+	sleep 0.5
+}
+
+if ! $VOLCTL -b pulse -l > /dev/null 2>&1; then
+	echo "$VOLCTL -b pulse fails, build with make PULSE=1 and start a server"
+	exit 1
+fi
+module=$(pactl load-module module-null-sink sink_name=$SINK \
+	sink_properties=device.description=VolCtlTest) || exit 1
+trap cleanup EXIT
+sleep 0.5
+
+# listing
+$VOLCTL -l | grep -q "^'VolCtlTest' '$SINK' 0$" || fail "-l doesn't list the null sink"
+
+# volume, mute and dB
+$VOLCTL -d $SINK -v 0.25 || fail "-v"
+v=$($VOLCTL -d $SINK -V)
+near "$v" 0.25 || fail "-V got $v, expected 0.25"
+pactl set-sink-volume $SINK 50%
+v=$($VOLCTL -d $SINK -V)
+near "$v" 0.5 || fail "-V after pactl got $v, expected 0.5"
+$VOLCTL -d $SINK -m 1 || fail "-m 1"
+[ "$($VOLCTL -d $SINK -M)" = 1 ] || fail "-M after -m 1"
+pactl set-sink-mute $SINK 0
+[ "$($VOLCTL -d $SINK -M)" = 0 ] || fail "-M after pactl unmute"
+$VOLCTL -d $SINK -q > /dev/null || fail "-q"
+$VOLCTL -d $SINK -y -6 || fail "-y"
+$VOLCTL -d $SINK -Y > /dev/null || fail "-Y"
+
+# channels, the null sink is stereo
+$VOLCTL -d $SINK -c 0.5,0.25 || fail "-c"
+set -- $($VOLCTL -d $SINK -e)
+[ $# -eq 2 ] || fail "-e got $# channels, expected 2"
+near "$1" 0.5 && near "$2" 0.25 || fail "-e got $*, expected 0.5 0.25"
+
+# metering the monitor source, which needs audio flowing
+$VOLCTL -d $SINK -v 1
+start_pacat
+(sleep 2) | $VOLCTL -d $SINK -k 20 > $TMP/meter
+n=$(wc -l < $TMP/meter)
+[ "$n" -ge 10 ] || fail "-k wrote $n readings in 2 seconds, expected about 40"
+grep -q ERR $TMP/meter && fail "-k readings have errors"
+
+# sessions, found through the subscription
+$VOLCTL -E | grep -q "^'pacat' $pacat_pid 'VolCtlTest'" || fail "-E doesn't list pacat"
+$VOLCTL -a pacat -v 0.5 || fail "-a -v"
+v=$($VOLCTL -a pacat -V)
+near "$v" 0.5 || fail "-a -V got $v, expected 0.5"
+$VOLCTL -a $pacat_pid -m 1 || fail "-a pid -m"
+[ "$($VOLCTL -a pacat -M)" = 1 ] || fail "-a -M after -a -m 1"
+stop_pacat
+$VOLCTL -E | grep -q "^'pacat'" && fail "-E lists pacat after it exited"
+
+# session churn in one process, through server mode
+{
+	for i in 1 2 3 4 5; do
+		start_pacat
+		echo "-E"
+		sleep 0.5
+		stop_pacat
+		echo "-E"
+		sleep 0.5
+	done
+} | $VOLCTL -S > $TMP/sessions
+n=$(grep -c "^'pacat'" $TMP/sessions)
+[ "$n" -eq 5 ] || fail "server -E listed pacat $n times over 5 runs, expected 5"
+
+# watching the sink, changes come from the subscription
+(sleep 2) | $VOLCTL -d $SINK -w > $TMP/watch &
+watch_pid=$!
+sleep 0.5
+pactl set-sink-volume $SINK 40%
+sleep 0.2
+pactl set-sink-mute $SINK 1
+wait $watch_pid
+grep -q " 0.400000 0$" $TMP/watch || fail "-w missed the volume change"
+grep -q " 1$" $TMP/watch || fail "-w missed the mute change"
+
+# watching all devices, including one added while watching
+(sleep 3) | $VOLCTL -W > $TMP/watchall &
+watch_pid=$!
+sleep 0.5
+module2=$(pactl load-module module-null-sink sink_name=$SINK2)
+sleep 0.5
+pactl set-sink-volume $SINK2 30%
+sleep 0.2
+pactl set-sink-volume $SINK 60%
+wait $watch_pid
+grep -q " 0.300000 " $TMP/watchall || fail "-W missed the change on the added sink"
+grep -q " 0.600000 " $TMP/watchall || fail "-W missed the change on the first sink"
+
+if [ $fails -gt 0 ]; then
+	echo "$fails failed"
+	exit 1
+fi
+echo "all passed"
+exit 0
@@ -0,0 +1,341 @@
+"""Python binding for the VolCtl shared library.
+
+Keeps one initialized VolCtl in the process, so each volume call costs a
+function call rather than starting VolCtl.exe and enumerating devices:
+
+    import volctl
+    with volctl.VolCtl() as vc:
+        dev = vc.find_dev("Speakers")
+        vc.set_vol(dev, 0.5)
+        print(vc.get_vol(dev), vc.get_mute(vc.default_dev(input=True)))
+
+The library is libvolctl.so on Linux and VolCtlLib.dll on Windows. It's
+looked for in $VOLCTL_LIB, next to this file, in the build directories of
+this tree, and then on the library path. Failed calls raise VolCtlError
+with the WadStatus and error text.
+"""
+
+import ctypes
+import ctypes.util
+import os
+import sys
+
+# WadRole
+ROLE_CONSOLE = 0
+ROLE_MULTIMEDIA = 1
+ROLE_COMMUNICATIONS = 2
+
+# WadMatch
+MATCH_EXACT = 0
+MATCH_NOCASE = 1
+MATCH_PREFIX = 2
+MATCH_SUBSTR = 3
+MATCH_BEST = 4
+
+# WadRampCurve
+RAMP_LINEAR = 0
+RAMP_DB = 1
+RAMP_SCURVE = 2
+
+# WadTaper
+TAPER_LINEAR = 0
+TAPER_AUDIO = 1
+TAPER_CUSTOM = 2
+
+# WadStatus values that callers act on
+OK = 0
+ERR_INVALID_ARG = 3
+ERR_NOT_INITIALIZED = 4
+ERR_INVALID_DEVICE = 6
+ERR_DEVICE_LOST = 17
+
+# device flags from WadCtlGetDevFlags
+_FLAG_INPUT = 1
+_FLAG_ACTIVE = 2
+_FLAG_DEFAULT = 4
+
+_VERSION = 1            # WAD_CTL_VERSION this binding was written for
+_NAME_LEN = 256         # WAD_NAME_LEN
+_DEV_NAME_LEN = 1024    # WAD_DEV_NAME_LEN
+_MAX_CHANNELS = 32      # WAD_MAX_CHANNELS
+
+
+class VolCtlError(Exception):
+    """A failed call, status is the WadStatus."""
+
+    def __init__(self, status, text):
+        super().__init__("%s (status %d)" % (text, status))
+        self.status = status
+        self.text = text
+
+
+class Device:
+    """A device from VolCtl.devices()."""
+
+    def __init__(self, index, name, dev_id, flags):
+        self.index = index
+        self.name = name
+        self.id = dev_id
+        self.is_input = bool(flags & _FLAG_INPUT)
+        self.is_active = bool(flags & _FLAG_ACTIVE)
+        self.is_default = bool(flags & _FLAG_DEFAULT)
+
+    def __repr__(self):
+        return "Device(%d, %r, %s)" % (self.index, self.name, "in" if self.is_input else "out")
+
+
+def _lib_paths():
+    name = "VolCtlLib.dll" if sys.platform == "win32" else "libvolctl.so"
+    here = os.path.dirname(os.path.abspath(__file__))
+    if os.environ.get("VOLCTL_LIB"):
+        yield os.environ["VOLCTL_LIB"]
+    yield os.path.join(here, name)
+    if sys.platform == "win32":
+        for vs in ("VisualStudio2017", "VisualStudio2013"):
+            for config in ("Release", "Debug"):
+                for arch in ("x64", ""):
+                    yield os.path.join(here, "..", "Builds", vs, arch, config, name)
+    else:
+        yield os.path.join(here, "..", "Builds", "Linux", name)
+    found = ctypes.util.find_library("volctl")
+    if found:
+        yield found
+
+
+def _load():
+    for path in _lib_paths():
+        if os.path.isabs(path) and not os.path.exists(path):
+            continue
+        try:
+            lib = ctypes.CDLL(path)
+            break
+        except OSError:
+            continue
+    else:
+        raise OSError("can't find the VolCtl library, set VOLCTL_LIB to its path")
+
+    c_int, c_float, c_char_p = ctypes.c_int, ctypes.c_float, ctypes.c_char_p
+    p_int, p_float, handle = ctypes.POINTER(c_int), ctypes.POINTER(c_float), ctypes.c_void_p
+    protos = {
+        "WadCtlVersion": (c_int, []),
+        "WadCtlCreate": (c_int, [c_char_p, c_int, ctypes.POINTER(handle)]),
+        "WadCtlDestroy": (None, [handle]),
+        "WadCtlSetCacheFile": (None, [handle, c_char_p]),
+        "WadCtlInit": (c_int, [handle, c_int]),
+        "WadCtlGetErrorText": (c_char_p, [handle]),
+        "WadCtlGetNumDevices": (c_int, [handle]),
+        "WadCtlGetDefaultDev": (c_int, [handle, c_int, p_int]),
+        "WadCtlFindDevByName": (c_int, [handle, c_char_p, c_int, p_int]),
+        "WadCtlFindDevById": (c_int, [handle, c_char_p, p_int]),
+        "WadCtlGetDevName": (c_int, [handle, c_int, c_char_p, c_int]),
+        "WadCtlGetDevId": (c_int, [handle, c_int, c_char_p, c_int]),
+        "WadCtlGetDevFlags": (c_int, [handle, c_int, p_int]),
+        "WadCtlGetVol": (c_int, [handle, c_int, p_float]),
+        "WadCtlSetVol": (c_int, [handle, c_int, c_float]),
+        "WadCtlGetMute": (c_int, [handle, c_int, p_int]),
+        "WadCtlSetMute": (c_int, [handle, c_int, c_int]),
+        "WadCtlGetChannelVols": (c_int, [handle, c_int, p_float, c_int, p_int]),
+        "WadCtlSetChannelVols": (c_int, [handle, c_int, p_float, c_int]),
+        "WadCtlRamp": (c_int, [handle, c_int, c_float, c_int, c_int]),
+        "WadCtlGetVolRange": (c_int, [handle, c_int, p_float, p_float, p_float]),
+        "WadCtlGetVolDb": (c_int, [handle, c_int, p_float]),
+        "WadCtlSetVolDb": (c_int, [handle, c_int, c_float]),
+        "WadCtlStepVolDb": (c_int, [handle, c_int, c_float, p_float]),
+        "WadCtlSetTaper": (c_int, [handle, c_int, c_int, p_float, c_int]),
+        "WadCtlGetVolPos": (c_int, [handle, c_int, p_float]),
+        "WadCtlSetVolPos": (c_int, [handle, c_int, c_float]),
+        "WadCtlEnableStats": (None, [handle, c_int]),
+        "WadCtlGetStats": (c_int, [handle, c_int, ctypes.POINTER(ctypes.c_double), c_int]),
+        "WadCtlResetStats": (None, [handle]),
+        "WadCtlStageName": (c_char_p, [c_int]),
+    }
+    for name, (restype, argtypes) in protos.items():
+        fn = getattr(lib, name)
+        fn.restype = restype
+        fn.argtypes = argtypes
+    if lib.WadCtlVersion() != _VERSION:
+        raise OSError("VolCtl library version %d, expected %d" % (lib.WadCtlVersion(), _VERSION))
+    return lib
+
+
+_lib = None
+
+
+def _encode(s):
+    return s.encode("utf-8") if s is not None else None
+
+
+class VolCtl:
+    """One VolCtl instance. backend is "wasapi", "pulse" or "sim", or None
+    for the platform default. lazy looks devices up as they're asked for,
+    which starts faster when only the default device is used. cache_file
+    keeps the device table between runs, as with VolCtl -K. stats records
+    latencies of init and volume and mute calls, as with VolCtl -Q.
+
+    An instance may be used from several threads at once, and ctypes
+    releases the GIL for each call, so calls on different threads overlap.
+    """
+
+    def __init__(self, backend=None, role=ROLE_MULTIMEDIA, lazy=False, cache_file=None, stats=False):
+        global _lib
+        self._ctl = None
+        if _lib is None:
+            _lib = _load()
+        ctl = ctypes.c_void_p()
+        status = _lib.WadCtlCreate(_encode(backend), role, ctypes.byref(ctl))
+        if status != OK:
+            raise VolCtlError(status, "can't create VolCtl with backend %r, role %d" % (backend, role))
+        self._ctl = ctl
+        if cache_file:
+            _lib.WadCtlSetCacheFile(self._ctl, _encode(cache_file))
+        if stats:
+            _lib.WadCtlEnableStats(self._ctl, 1)
+        self._check(_lib.WadCtlInit(self._ctl, int(lazy)))
+
+    def close(self):
+        """Release the instance, also done when it's collected."""
+        if self._ctl:
+            _lib.WadCtlDestroy(self._ctl)
+            self._ctl = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
+    def _check(self, status):
+        if status != OK:
+            raise VolCtlError(status, _lib.WadCtlGetErrorText(self._ctl).decode("utf-8", "replace"))
+
+    def num_devices(self):
+        return _lib.WadCtlGetNumDevices(self._ctl)
+
+    def devices(self, active_only=True):
+        """List devices, by default only the active ones."""
+        name = ctypes.create_string_buffer(_DEV_NAME_LEN)
+        dev_id = ctypes.create_string_buffer(_NAME_LEN)
+        flags = ctypes.c_int()
+        devs = []
+        for i in range(self.num_devices()):
+            self._check(_lib.WadCtlGetDevFlags(self._ctl, i, ctypes.byref(flags)))
+            if active_only and not flags.value & _FLAG_ACTIVE:
+                continue
+            self._check(_lib.WadCtlGetDevName(self._ctl, i, name, _DEV_NAME_LEN))
+            self._check(_lib.WadCtlGetDevId(self._ctl, i, dev_id, _NAME_LEN))
+            devs.append(Device(i, name.value.decode("utf-8", "replace"),
+                               dev_id.value.decode("utf-8", "replace"), flags.value))
+        return devs
+
+    def default_dev(self, input=False):
+        """Get the index of the default output, or input, device."""
+        index = ctypes.c_int()
+        self._check(_lib.WadCtlGetDefaultDev(self._ctl, int(input), ctypes.byref(index)))
+        return index.value
+
+    def find_dev(self, name, match=MATCH_BEST):
+        """Get the index of a device by name."""
+        index = ctypes.c_int()
+        self._check(_lib.WadCtlFindDevByName(self._ctl, _encode(name), match, ctypes.byref(index)))
+        return index.value
+
+    def find_dev_id(self, dev_id):
+        """Get the index of a device by ID."""
+        index = ctypes.c_int()
+        self._check(_lib.WadCtlFindDevById(self._ctl, _encode(dev_id), ctypes.byref(index)))
+        return index.value
+
+    def get_vol(self, dev):
+        vol = ctypes.c_float()
+        self._check(_lib.WadCtlGetVol(self._ctl, dev, ctypes.byref(vol)))
+        return vol.value
+
+    def set_vol(self, dev, vol):
+        self._check(_lib.WadCtlSetVol(self._ctl, dev, vol))
+
+    def get_mute(self, dev):
+        mute = ctypes.c_int()
+        self._check(_lib.WadCtlGetMute(self._ctl, dev, ctypes.byref(mute)))
+        return bool(mute.value)
+
+    def set_mute(self, dev, mute):
+        self._check(_lib.WadCtlSetMute(self._ctl, dev, int(bool(mute))))
+
+    def get_channels(self, dev):
+        """Get the channel volumes as a list."""
+        vols = (ctypes.c_float * _MAX_CHANNELS)()
+        num = ctypes.c_int()
+        self._check(_lib.WadCtlGetChannelVols(self._ctl, dev, vols, _MAX_CHANNELS, ctypes.byref(num)))
+        return list(vols[:num.value])
+
+    def set_channels(self, dev, vols):
+        """Set all channel volumes, one per channel."""
+        arr = (ctypes.c_float * len(vols))(*vols)
+        self._check(_lib.WadCtlSetChannelVols(self._ctl, dev, arr, len(vols)))
+
+    def ramp(self, dev, vol, msec, curve=RAMP_LINEAR):
+        """Ramp the volume to vol over msec, returning at once."""
+        self._check(_lib.WadCtlRamp(self._ctl, dev, vol, msec, curve))
+
+    def get_vol_range(self, dev):
+        """Get the dB range of a device as (min, max, step), step 0 if continuous."""
+        vals = [ctypes.c_float() for i in range(3)]
+        self._check(_lib.WadCtlGetVolRange(self._ctl, dev, *[ctypes.byref(v) for v in vals]))
+        return tuple(v.value for v in vals)
+
+    def get_vol_db(self, dev):
+        db = ctypes.c_float()
+        self._check(_lib.WadCtlGetVolDb(self._ctl, dev, ctypes.byref(db)))
+        return db.value
+
+    def set_vol_db(self, dev, db):
+        """Set volume in dB, clamped to the range and rounded to the step."""
+        self._check(_lib.WadCtlSetVolDb(self._ctl, dev, db))
+
+    def step_vol_db(self, dev, step_db):
+        """Step volume up, or down if negative, returning the new dB."""
+        db = ctypes.c_float()
+        self._check(_lib.WadCtlStepVolDb(self._ctl, dev, step_db, ctypes.byref(db)))
+        return db.value
+
+    def set_taper(self, dev, taper, points=()):
+        """Set the taper of a device, or all devices if dev is -1. points are
+        (position, dB) pairs for TAPER_CUSTOM."""
+        flat = [x for point in points for x in point]
+        arr = (ctypes.c_float * max(len(flat), 1))(*flat)
+        self._check(_lib.WadCtlSetTaper(self._ctl, dev, taper, arr, len(points)))
+
+    def get_vol_pos(self, dev):
+        """Get volume as a fader position on the taper."""
+        pos = ctypes.c_float()
+        self._check(_lib.WadCtlGetVolPos(self._ctl, dev, ctypes.byref(pos)))
+        return pos.value
+
+    def set_vol_pos(self, dev, pos):
+        self._check(_lib.WadCtlSetVolPos(self._ctl, dev, pos))
+
+    def enable_stats(self, enable=True):
+        _lib.WadCtlEnableStats(self._ctl, int(bool(enable)))
+
+    def get_stats(self):
+        """Get latencies of the stages recorded so far, as a dict of stage
+        name to a dict of count and minUsec, p50Usec, p99Usec, p999Usec and
+        maxUsec."""
+        keys = ("count", "minUsec", "p50Usec", "p99Usec", "p999Usec", "maxUsec")
+        vals = (ctypes.c_double * len(keys))()
+        stats = {}
+        stage = 0
+        name = _lib.WadCtlStageName(stage)
+        while name is not None:
+            self._check(_lib.WadCtlGetStats(self._ctl, stage, vals, len(keys)))
+            if vals[0] > 0:
+                stats[name.decode()] = dict(zip(keys, vals), count=int(vals[0]))
+            stage += 1
+            name = _lib.WadCtlStageName(stage)
+        return stats
+
+    def reset_stats(self):
+        _lib.WadCtlResetStats(self._ctl)
@@ -5,9 +5,26 @@
 #include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
 #include "WaGetopt.h"
 #include "WaLog.h"
 #include "VolCtl.h"
+#include "VolOut.h"
+#include "MiscDef.h"
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <windows.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "shell32.lib")
+#endif
+#endif
+
+#define THIS_FILE	"Main.cpp"
 
 void usage()
 {
@@ -19,13 +36,55 @@ void usage()
 	fprintf(stderr,"-O                list default output device for role\n");
 	fprintf(stderr,"-i                select default input device (default is default output device)\n");
 	fprintf(stderr,"-n deviceName     specify device name\n");
+	fprintf(stderr,"-N deviceName     specify device name, case insensitive, may be prefix or substring\n");
 	fprintf(stderr,"-d deviceId       specify device ID\n");
+	fprintf(stderr,"-D handle         specify device by handle, its index in a -F json listing, stable with -K\n");
 	fprintf(stderr,"-v vol            set volume, float between 0 and 1\n");
 	fprintf(stderr,"-V                get volume\n");
 	fprintf(stderr,"-m 0/1            set mute state: 1 == mute, 0 == no mute\n");
 	fprintf(stderr,"-M                get mute state\n");
+	fprintf(stderr,"-e                get channel volumes, space separated\n");
+	fprintf(stderr,"-c vol,vol,...    set channel volumes, one per channel\n");
+	fprintf(stderr,"-t dB,dB,...      trim channel volumes by dB, repeating for the remaining channels,\n");
+	fprintf(stderr, "                     so one value is for all channels and two are left and right\n");
+	fprintf(stderr,"-y dB             set volume in dB, on the device's scale\n");
+	fprintf(stderr,"-Y                get volume in dB\n");
+	fprintf(stderr,"-j dB             step volume up, or down if negative, by dB\n");
+	fprintf(stderr,"-q                get volume range in dB, format: min max step\n");
+	fprintf(stderr,"-z taper          with -v, -V, volume is a fader position on a taper: linear in dB,\n");
+	fprintf(stderr, "                     audio, or breakpoints pos:dB,pos:dB,... e.g. 0:-60,0.5:-20,1:0\n");
+	fprintf(stderr,"-u balance        set balance, -1 left to 1 right, the far side falls linearly\n");
+	fprintf(stderr,"-U balance        set balance with constant power\n");
+	fprintf(stderr,"-g devices        with -v, -V, -m, -M, act on several devices at once: all, in, out,\n");
+	fprintf(stderr, "                     or a name pattern with * and ?, each get line has format: 'name' value\n");
+	fprintf(stderr,"-E                list application sessions, on all devices unless one is selected,\n");
+	fprintf(stderr, "                     each line has format: 'process' pid 'device name' 'session id'\n");
+	fprintf(stderr,"-a app            with -v, -V, -m, -M, act on application sessions instead of the device,\n");
+	fprintf(stderr, "                     app is a process name, with or without extension, or PID\n");
+	fprintf(stderr,"-p file           save volume, mute and channels of all devices to a file\n");
+	fprintf(stderr,"-P file           restore a snapshot, setting only what changed\n");
+	fprintf(stderr,"-R msec           with -v, ramp to the volume over msec\n");
+	fprintf(stderr,"-C curve          ramp curve: linear (default), db, s\n");
+	fprintf(stderr,"-x deviceName     with -v and -R, crossfade from this device, which ramps to 0\n");
 	fprintf(stderr, "-r role          device role: 0 = console, 1 = multimedia (default), 2 = communication\n");
 	fprintf(stderr, "-s sec           sleep, to test caller timeouts\n");
+	fprintf(stderr, "-S               server mode, read commands from stdin, one per line\n");
+	fprintf(stderr, "-w               watch selected device, print volume and mute changes until stdin closes\n");
+	fprintf(stderr, "-W               watch all devices\n");
+	fprintf(stderr, "-k rate          meter peaks of the selected device, or with -g several, rate times a\n");
+	fprintf(stderr, "                     second up to %d, until stdin closes, each line has format:\n", WAD_METER_MAX_RATE);
+	fprintf(stderr, "                     date time index peak channelPeak...\n");
+	fprintf(stderr, "-B file          batch mode, run commands from file, one per line, - for stdin\n");
+	fprintf(stderr, "-L file          log to file\n");
+	fprintf(stderr, "-A               with -L, write log from a background thread\n");
+	fprintf(stderr, "-T count         time startup and count get volume calls on the selected device\n");
+	fprintf(stderr, "-Q               record latency stats of startup and volume and mute calls, and print\n");
+	fprintf(stderr, "                     them at exit, each line has format: stage count min p50 p99 p999 max,\n");
+	fprintf(stderr, "                     in usec. A -Q request, or -Q line with -w, -W or -k, prints them\n");
+	fprintf(stderr, "                     while running\n");
+	fprintf(stderr, "-b backend       audio backend, one of: %s\n", WadBackendNames());
+	fprintf(stderr, "-F format        output format: text (default), json, or bin for length-prefixed records\n");
+	fprintf(stderr, "-K file          device cache file, devices are enumerated only when they change\n");
 }
 
 typedef enum {
@@ -36,7 +95,19 @@ typedef enum {
 	SET_VOL,
 	GET_VOL,
 	SET_MUTE,
-	GET_MUTE
+	GET_MUTE,
+	LIST_SESSIONS,
+	SNAPSHOT,
+	RESTORE,
+	GET_CHANNELS,
+	SET_CHANNELS,
+	TRIM_CHANNELS,
+	SET_BALANCE,
+	SET_VOL_DB,
+	GET_VOL_DB,
+	STEP_VOL_DB,
+	GET_VOL_RANGE,
+	GET_STATS
 } COMMAND;
 
 typedef enum {
@@ -46,26 +117,68 @@ typedef enum {
 	NUM_ROLES
 } ROLE_ENUM;
 
-int gCommand = COMMAND::UNKNOWN;
-char *gDevName = NULL;
-char *gDevId = NULL;
-float gVol;		// vol argument
-bool gMute;		// mute argument
-bool gInput;	// select default input device
+// A single command and its device selection, as parsed from the
+// command line or from a server request line.
+typedef struct {
+	int command;
+	char *devName;
+	int nameMatch;	// WadMatch mode for devName
+	char *devId;
+	char *devHandle;	// device handle, a device table index, or null
+	float vol;		// vol argument
+	bool mute;		// mute argument
+	bool input;		// select default input device
+	int rampMsec;	// ramp time for set volume, 0 to set immediately
+	int rampCurve;	// WadRampCurve
+	char *fadeFrom;	// crossfade source device name, or null
+	char *app;		// application session process name or PID, or null
+	char *group;	// multi-device selection, or null
+	char *snapFile;	// snapshot file to save or restore
+	float chans[WAD_MAX_CHANNELS];	// channel volumes, or dB for trim
+	int numChans;
+	float balance;	// balance argument
+	int balanceLaw;	// WadBalanceLaw
+	float db;		// dB argument, to set or step by
+	bool hasTaper;	// T/F if vol is a fader position on taper
+	int taper;		// WadTaper
+	float taperPoints[2 * WAD_TAPER_MAX_POINTS];	// custom taper pos, dB pairs
+	int numTaperPoints;
+} VolCmd;
+
+// options that select a device and command, allowed in server requests
+#define CMD_OPTIONS	"lIOin:N:d:D:v:Vm:My:Yj:qz:ec:t:u:U:R:C:x:Ea:g:p:P:Q"
+
+// maximum length of a server request line and number of args
+#define MAX_LINE_LEN	1024
+#define MAX_LINE_ARGS	32
+
+VolCmd gCmd;	// command line command
 char* gLogFilename;	// log file name or null if none
+bool gAsyncLog;		// T/F if async logging
 int gRole;		// device role, affects defaults
 int gSleep;		// sleep time in sec, for testing subprocess.run timeouts
+bool gServer;	// T/F if server mode
+int gWatch;		// 0 = no watch, 1 = watch selected device, 2 = watch all
+int gMeterRate;		// peak meter readings per second, 0 if not metering
+char *gBatchFilename;	// batch file name, "-" for stdin, or null if none
+int gTimingCount;	// number of calls to time, 0 if not timing
+char *gBackendName;	// audio backend name, or null for the default
+char *gCacheFilename;	// device cache file name, or null if none
+int gFormat;		// WadFormat of command output
+VolOut *gOut;		// writes command output in gFormat
+std::mutex gOutLock;	// serializes output from other threads with stats queries
+bool gStats;		// T/F if recording latency stats
 
-ERole GetRole(int role)
+WadRole GetRole(int role)
 {
 	switch (role) {
 	case ROLE_ENUM::CONSOLE:
-		return ERole::eConsole;
+		return WAD_ROLE_CONSOLE;
 	default:
 	case ROLE_ENUM::MULTIMEDIA:
-		return ERole::eMultimedia;
+		return WAD_ROLE_MULTIMEDIA;
 	case ROLE_ENUM::COMMUNICATIONS:
-		return ERole::eCommunications;
+		return WAD_ROLE_COMMUNICATIONS;
 	}
 }
 
@@ -81,6 +194,244 @@ void main_error(char *fmt, ...)
 	exit(1);
 }
 
+/*
+ * Report a failed command with its WadStatus in the output format, and exit.
+ */
+void cmd_error(int status, char *fmt, ...)
+{
+	char errText[512];
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(errText, sizeof(errText), fmt, args);
+	va_end(args);
+	gOut->Error(status, errText);
+	exit(1);
+}
+
+/*
+ * Parse a comma separated list of floats, returns the number parsed or -1
+ * if not a list of up to max numbers.
+ */
+int parse_floats(const char *arg, float *vals, int max)
+{
+	char *end;
+	int n = 0;
+
+	for (;;) {
+		if (n == max)
+			return -1;
+		vals[n++] = (float) strtod(arg, &end);
+		if (end == arg)
+			return -1;
+		if (*end == 0)
+			return n;
+		if (*end != ',')
+			return -1;
+		arg = end + 1;
+	}
+}
+
+/*
+ * Parse a taper: linear, audio, or pos:dB breakpoints separated by commas.
+ * Returns 0, or -1 if not valid.
+ */
+int parse_taper(const char *arg, VolCmd *cmd)
+{
+	char *end;
+	int n = 0;
+
+	cmd->hasTaper = true;
+	cmd->numTaperPoints = 0;
+	if (!_stricmp(arg, "linear")) {
+		cmd->taper = WAD_TAPER_LINEAR;
+		return 0;
+	}
+	if (!_stricmp(arg, "audio")) {
+		cmd->taper = WAD_TAPER_AUDIO;
+		return 0;
+	}
+	cmd->taper = WAD_TAPER_CUSTOM;
+	for (;;) {
+		if (n == WAD_TAPER_MAX_POINTS)
+			return -1;
+		cmd->taperPoints[2 * n] = (float) strtod(arg, &end);
+		if (end == arg || *end != ':')
+			return -1;
+		arg = end + 1;
+		cmd->taperPoints[2 * n + 1] = (float) strtod(arg, &end);
+		if (end == arg)
+			return -1;
+		cmd->numTaperPoints = ++n;
+		if (*end == 0)
+			return 0;
+		if (*end != ',')
+			return -1;
+		arg = end + 1;
+	}
+}
+
+/*
+ * Parse a command option, shared by command line and server requests.
+ * Returns 1 if option handled, 0 if not a command option, -1 on error
+ * with message in errText.
+ */
+int parse_cmd_opt(int c, VolCmd *cmd, char *errText, size_t len)
+{
+	char *end;
+
+	switch (c) {
+	case 'l':
+		cmd->command = COMMAND::LIST_DEVS;
+		break;
+	case 'I':
+		cmd->command = COMMAND::LIST_DEFAULT_IN;
+		break;
+	case 'O':
+		cmd->command = COMMAND::LIST_DEFAULT_OUT;
+		break;
+	case 'i':
+		cmd->input = true;
+		break;
+	case 'n':
+		cmd->devName = optarg;
+		cmd->nameMatch = WAD_MATCH_EXACT;
+		break;
+	case 'N':
+		cmd->devName = optarg;
+		cmd->nameMatch = WAD_MATCH_BEST;
+		break;
+	case 'd':
+		cmd->devId = optarg;
+		break;
+	case 'D':
+		if (optarg[strspn(optarg, "0123456789")] != 0) {
+			_snprintf(errText, len, "illegal device handle '%s'", optarg);
+			return -1;
+		}
+		cmd->devHandle = optarg;
+		break;
+	case 'v':
+		cmd->command = COMMAND::SET_VOL;
+		cmd->vol = (float) atof(optarg);
+		if (cmd->vol < 0 || cmd->vol > 1) {
+			_snprintf(errText, len, "illegal volume, should be float between 0 and 1");
+			return -1;
+		}
+		break;
+	case 'V':
+		cmd->command = COMMAND::GET_VOL;
+		break;
+	case 'm':
+		cmd->command = COMMAND::SET_MUTE;
+		cmd->mute = (atoi(optarg) != 0);
+		break;
+	case 'M':
+		cmd->command = COMMAND::GET_MUTE;
+		break;
+	case 'y':
+	case 'j':
+		cmd->command = (c == 'y' ? COMMAND::SET_VOL_DB : COMMAND::STEP_VOL_DB);
+		cmd->db = (float) strtod(optarg, &end);
+		if (end == optarg || *end != 0) {
+			_snprintf(errText, len, "illegal dB '%s'", optarg);
+			return -1;
+		}
+		break;
+	case 'Y':
+		cmd->command = COMMAND::GET_VOL_DB;
+		break;
+	case 'q':
+		cmd->command = COMMAND::GET_VOL_RANGE;
+		break;
+	case 'z':
+		if (parse_taper(optarg, cmd) < 0) {
+			_snprintf(errText, len, "illegal taper '%s', should be linear, audio or pos:dB,pos:dB,...", optarg);
+			return -1;
+		}
+		break;
+	case 'e':
+		cmd->command = COMMAND::GET_CHANNELS;
+		break;
+	case 'c':
+	case 't':
+		cmd->command = (c == 'c' ? COMMAND::SET_CHANNELS : COMMAND::TRIM_CHANNELS);
+		cmd->numChans = parse_floats(optarg, cmd->chans, WAD_MAX_CHANNELS);
+		if (cmd->numChans < 0) {
+			_snprintf(errText, len, "illegal channel list '%s', should be comma separated floats", optarg);
+			return -1;
+		}
+		for (int i = 0; c == 'c' && i < cmd->numChans; i++) {
+			if (cmd->chans[i] < 0 || cmd->chans[i] > 1) {
+				_snprintf(errText, len, "illegal channel volume, should be float between 0 and 1");
+				return -1;
+			}
+		}
+		break;
+	case 'u':
+	case 'U':
+		cmd->command = COMMAND::SET_BALANCE;
+		cmd->balance = (float) atof(optarg);
+		cmd->balanceLaw = (c == 'u' ? WAD_BALANCE_LINEAR : WAD_BALANCE_POWER);
+		if (cmd->balance < -1 || cmd->balance > 1) {
+			_snprintf(errText, len, "illegal balance, should be float between -1 and 1");
+			return -1;
+		}
+		break;
+	case 'R':
+		cmd->rampMsec = atoi(optarg);
+		if (cmd->rampMsec < 0) {
+			_snprintf(errText, len, "illegal ramp time %d", cmd->rampMsec);
+			return -1;
+		}
+		break;
+	case 'C':
+		if (!_stricmp(optarg, "linear"))
+			cmd->rampCurve = WAD_RAMP_LINEAR;
+		else if (!_stricmp(optarg, "db"))
+			cmd->rampCurve = WAD_RAMP_DB;
+		else if (!_stricmp(optarg, "s"))
+			cmd->rampCurve = WAD_RAMP_SCURVE;
+		else {
+			_snprintf(errText, len, "unknown ramp curve '%s'", optarg);
+			return -1;
+		}
+		break;
+	case 'x':
+		cmd->fadeFrom = optarg;
+		break;
+	case 'E':
+		cmd->command = COMMAND::LIST_SESSIONS;
+		break;
+	case 'a':
+		cmd->app = optarg;
+		break;
+	case 'g':
+		cmd->group = optarg;
+		break;
+	case 'p':
+		cmd->command = COMMAND::SNAPSHOT;
+		cmd->snapFile = optarg;
+		break;
+	case 'P':
+		cmd->command = COMMAND::RESTORE;
+		cmd->snapFile = optarg;
+		break;
+	case 'Q':
+		cmd->command = COMMAND::GET_STATS;
+		break;
+	case '?':
+		_snprintf(errText, len, "unknown option '%c'", optopt);
+		return -1;
+	case ':':
+		_snprintf(errText, len, "missing argument for option '%c'", optopt);
+		return -1;
+	default:
+		return 0;
+	}
+	return 1;
+}
+
 /*
  * Parse command line arguments.
  */
@@ -88,62 +439,66 @@ void parse_args(int argc, char **argv)
 {
 	int c;
 	int nargs;
+	char errText[256];
 	
-	while ((c = WaGetopt(argc, argv, "lIOin:d:v:Vm:MhL:r:s:")) > 0) {
+	while ((c = WaGetopt(argc, argv, CMD_OPTIONS "hL:Ar:s:SwWk:B:T:b:F:K:")) > 0) {
 		switch (c) {
-		case 'l':
-			gCommand = COMMAND::LIST_DEVS;
-			break;
-		case 'I':
-			gCommand = COMMAND::LIST_DEFAULT_IN;
-			break;
-		case 'O':
-			gCommand = COMMAND::LIST_DEFAULT_OUT;
-			break;
 		case 'L':
 			gLogFilename = optarg;
 			break;
+		case 'A':
+			gAsyncLog = true;
+			break;
 		case 'r':
 			gRole = atoi(optarg);
 			if (gRole < 0 || gRole >= ROLE_ENUM::NUM_ROLES)
 				main_error("illegal role %d", gRole);
-		case 'i':
-			gInput = true;
 			break;
-		case 'n':
-			gDevName = optarg;
+		case 's':
+			gSleep = atoi(optarg);
 			break;
-		case 'd':
-			gDevId = optarg;
+		case 'S':
+			gServer = true;
 			break;
-		case 'v':
-			gCommand = COMMAND::SET_VOL;
-			gVol = (float) atof(optarg);
-			if (gVol < 0 || gVol > 1)
-				main_error("illegal volume, should be float between 0 and 1\n");
+		case 'w':
+			gWatch = 1;
 			break;
-		case 'V':
-			gCommand = COMMAND::GET_VOL;
+		case 'W':
+			gWatch = 2;
 			break;
-		case 'm':
-			gCommand = COMMAND::SET_MUTE;
-			gMute = (atoi(optarg) != 0);
+		case 'k':
+			gMeterRate = atoi(optarg);
+			if (gMeterRate <= 0 || gMeterRate > WAD_METER_MAX_RATE)
+				main_error("illegal meter rate %d", gMeterRate);
 			break;
-		case 'M':
-			gCommand = COMMAND::GET_MUTE;
+		case 'B':
+			gBatchFilename = optarg;
 			break;
-		case 's':
-			gSleep = atoi(optarg);
+		case 'T':
+			gTimingCount = atoi(optarg);
+			if (gTimingCount <= 0)
+				main_error("illegal timing count %d", gTimingCount);
+			break;
+		case 'Q':
+			gStats = true;
+			break;
+		case 'b':
+			gBackendName = optarg;
+			break;
+		case 'K':
+			gCacheFilename = optarg;
+			break;
+		case 'F':
+			if ((gFormat = VolOutFormat(optarg)) < 0)
+				main_error("unknown format '%s', available: text json bin", optarg);
 			break;
 		case 'h':
 			usage();
 			exit(0);
 			break;
-		case '?':
-			main_error("unknown option '%c'\n",optopt);
-			break;
-		case ':':
-			main_error("missing argument for option '%c'\n",optopt);
+		default:
+			if (parse_cmd_opt(c, &gCmd, errText, sizeof(errText)) < 0)
+				main_error("%s", errText);
 			break;
 		}
 	}
@@ -153,83 +508,849 @@ void parse_args(int argc, char **argv)
 	nargs = argc - optind;
 	if (nargs > 0)
 		main_error("extra arguments");
-	if (gCommand == COMMAND::UNKNOWN)
+	if (gCmd.command == COMMAND::UNKNOWN && !gServer && !gWatch && !gMeterRate && !gBatchFilename
+		&& !gTimingCount && !gStats)
 		main_error("no command specified");
 }
 
-void PrintDev(WadDevInfo& info)
+/*
+ * Split a request line into args, in place. Args are separated by white
+ * space, and double quotes group an arg containing spaces. argv[0] is set to
+ * the program name so the result can be passed to WaGetopt. Returns argc.
+ */
+int split_line(char *line, char **argv, int maxArgs)
 {
-	printf("'%s' '%s' %d\n", info.name, info.devId, info.isInput);
+	int argc = 0;
+	char *s = line;
+	argv[argc++] = "VolCtl";
+	while (argc < maxArgs) {
+		while (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')
+			s++;
+		if (*s == 0)
+			break;
+		if (*s == '"') {
+			argv[argc++] = ++s;
+			while (*s && *s != '"')
+				s++;
+		}
+		else {
+			argv[argc++] = s;
+			while (*s && *s != ' ' && *s != '\t' && *s != '\r' && *s != '\n')
+				s++;
+		}
+		if (*s == 0)
+			break;
+		*s++ = 0;
+	}
+	return argc;
 }
 
-int doCtl()
+/*
+ * Parse a server request, returns WAD_OK or error with message in errText.
+ */
+int parse_request(int argc, char **argv, VolCmd *cmd, char *errText, size_t len)
 {
+	int c, status;
+	memset(cmd, 0, sizeof(VolCmd));
+	WaGetoptReset();
+	while ((c = WaGetopt(argc, argv, CMD_OPTIONS)) > 0) {
+		if ((status = parse_cmd_opt(c, cmd, errText, len)) <= 0) {
+			// keep the text of a bad argument
+			if (status == 0)
+				_snprintf(errText, len, "option '%c' not allowed in request", c);
+			return WAD_ERR_INVALID_ARG;
+		}
+	}
+	if (optind < argc) {
+		_snprintf(errText, len, "extra arguments");
+		return WAD_ERR_INVALID_ARG;
+	}
+	if (cmd->command == COMMAND::UNKNOWN) {
+		_snprintf(errText, len, "no command specified");
+		return WAD_ERR_INVALID_ARG;
+	}
+	return WAD_OK;
+}
+
+/*
+ * Find the device selected by a command, the default device unless a
+ * device handle, ID or name is specified.
+ */
+int find_dev(VolCtl& volCtl, VolCmd *cmd, int *pDevIndex)
+{
+	char errText[256];
 	WadDevInfo info;
-	VolCtl volCtl(GetRole(gRole));
-	int status = volCtl.Init();
-	if (status != 0)
-		main_error("error initializing: %s", volCtl.GetErrorText());
 
-	// set default device
-	int devIndex = (gInput ? volCtl.GetDefaultInDevIndex() : volCtl.GetDefaultOutDevIndex());
+	if (cmd->devHandle != NULL) {
+		// a handle is an index into the complete table
+		*pDevIndex = atoi(cmd->devHandle);
+		if (*pDevIndex >= volCtl.GetNumDevices() || volCtl.GetDevInfo(*pDevIndex, &info) != WAD_OK
+			|| !info.isActive) {
+			_snprintf(errText, sizeof(errText), "no active device with handle %s", cmd->devHandle);
+			volCtl.SetErrorText(errText);
+			return WAD_ERR_INVALID_DEVICE;
+		}
+	}
+	else if (cmd->devId != NULL) {
+		*pDevIndex = volCtl.FindDevById(cmd->devId);
+		if (*pDevIndex == -1) {
+			_snprintf(errText, sizeof(errText), "can't find device ID '%s'", cmd->devId);
+			volCtl.SetErrorText(errText);
+			return WAD_ERR_INVALID_DEVICE;
+		}
+	}
+	else if (cmd->devName != NULL) {
+		*pDevIndex = volCtl.FindDevByName(cmd->devName, cmd->nameMatch);
+		if (*pDevIndex == -1) {
+			_snprintf(errText, sizeof(errText), "can't find device name '%s'", cmd->devName);
+			volCtl.SetErrorText(errText);
+			return WAD_ERR_INVALID_DEVICE;
+		}
+	}
+	else
+		*pDevIndex = (cmd->input ? volCtl.GetDefaultInDevIndex() : volCtl.GetDefaultOutDevIndex());
+	return WAD_OK;
+}
+
+/*
+ * Run a volume or mute command on the sessions of an application, on the
+ * selected device or all devices if none selected. Sets act on every
+ * matching session, gets report the first.
+ */
+int run_session_cmd(VolCtl& volCtl, VolCmd *cmd, VolOut& out)
+{
+	char errText[256];
+	int devIndex = -1;
+	int sesIndex, status;
+	float vol = 0;
+	bool mute = false;
+
+	if (cmd->devHandle != NULL || cmd->devId != NULL || cmd->devName != NULL || cmd->input) {
+		if ((status = find_dev(volCtl, cmd, &devIndex)) != WAD_OK)
+			return status;
+	}
+	if (cmd->rampMsec > 0) {
+		volCtl.SetErrorText("ramps not supported for sessions");
+		return WAD_ERR_UNSUPPORTED;
+	}
+	if ((sesIndex = volCtl.FindSession(devIndex, cmd->app)) == -1) {
+		_snprintf(errText, sizeof(errText), "can't find application '%s'", cmd->app);
+		volCtl.SetErrorText(errText);
+		return WAD_ERR_INVALID_SESSION;
+	}
+	switch (cmd->command) {
+	case COMMAND::GET_VOL:
+		if ((status = volCtl.GetSessionVol(sesIndex, &vol)) != WAD_OK)
+			return status;
+		out.Vol(vol);
+		break;
+	case COMMAND::GET_MUTE:
+		if ((status = volCtl.GetSessionMute(sesIndex, &mute)) != WAD_OK)
+			return status;
+		out.Mute(mute);
+		break;
+	case COMMAND::SET_VOL:
+	case COMMAND::SET_MUTE:
+		for (; sesIndex != -1; sesIndex = volCtl.FindSession(devIndex, cmd->app, sesIndex + 1)) {
+			if (cmd->command == COMMAND::SET_VOL)
+				status = volCtl.SetSessionVol(sesIndex, cmd->vol);
+			else
+				status = volCtl.SetSessionMute(sesIndex, cmd->mute);
+			if (status != WAD_OK)
+				return status;
+		}
+		out.Done();
+		break;
+	}
+	return WAD_OK;
+}
+
+/*
+ * Get the WadSelect for a -g argument.
+ */
+int group_select(const char *group)
+{
+	if (!_stricmp(group, "all"))
+		return WAD_SELECT_ALL;
+	if (!_stricmp(group, "in"))
+		return WAD_SELECT_INPUTS;
+	if (!_stricmp(group, "out"))
+		return WAD_SELECT_OUTPUTS;
+	return WAD_SELECT_NAME;
+}
+
+/*
+ * Run a volume or mute command on a group of devices at once. Gets list
+ * a result per device, with the status for devices that failed.
+ */
+int run_group_cmd(VolCtl& volCtl, VolCmd *cmd, VolOut& out)
+{
+	WadDevResult *results;
+	WadDevInfo info;
+	int *devIndexes;
+	int i, num, select, op, status;
+
+	if (cmd->rampMsec > 0 || cmd->app != NULL) {
+		volCtl.SetErrorText("-g can't be used with -R or -a");
+		return WAD_ERR_INVALID_ARG;
+	}
+	select = group_select(cmd->group);
+	switch (cmd->command) {
+	case COMMAND::SET_VOL:
+		op = WAD_OP_SET_VOL;
+		break;
+	case COMMAND::GET_VOL:
+		op = WAD_OP_GET_VOL;
+		break;
+	case COMMAND::SET_MUTE:
+		op = WAD_OP_SET_MUTE;
+		break;
+	default:
+		op = WAD_OP_GET_MUTE;
+		break;
+	}
+	num = MAX(volCtl.GetNumDevices(), 1);
+	devIndexes = (int *) malloc(num * sizeof(int));
+	results = (WadDevResult *) malloc(num * sizeof(WadDevResult));
+	if ((num = volCtl.SelectDevices(select, cmd->group, devIndexes, num)) < 0) {
+		status = WAD_ERR_INTERNAL;
+		goto run_group_cmd_exit;
+	}
+	status = volCtl.AccessMulti(devIndexes, num, op, cmd->vol, cmd->mute, results);
+	if (cmd->command == COMMAND::SET_VOL || cmd->command == COMMAND::SET_MUTE) {
+		if (status == WAD_OK)
+			out.Done();
+		goto run_group_cmd_exit;
+	}
+	status = WAD_OK;
+	out.BeginList(num, "devices");
+	for (i = 0; i < num; i++) {
+		if (volCtl.GetDevInfo(results[i].devIndex, &info) != WAD_OK)
+			info.name = "";
+		out.DevResult(results[i], info.name, op);
+	}
+	out.EndList();
+run_group_cmd_exit:
+	free(devIndexes);
+	free(results);
+	return status;
+}
+
+/*
+ * List the sessions on the selected device, or all devices.
+ */
+int list_sessions(VolCtl& volCtl, VolCmd *cmd, VolOut& out)
+{
+	WadSessionInfo *sessions;
+	WadDevInfo info;
+	int devIndex = -1;
+	int i, numSes, numActive, status;
+
+	if (cmd->devHandle != NULL || cmd->devId != NULL || cmd->devName != NULL || cmd->input) {
+		if ((status = find_dev(volCtl, cmd, &devIndex)) != WAD_OK)
+			return status;
+	}
+	if ((status = volCtl.UpdateSessions(devIndex)) != WAD_OK)
+		return status;
+	// copy first, as for devices
+	numSes = volCtl.GetNumSessions();
+	sessions = (WadSessionInfo *) malloc(MAX(numSes, 1) * sizeof(WadSessionInfo));
+	numActive = 0;
+	for (i = 0; i < numSes; i++) {
+		if (volCtl.GetSessionInfo(i, &sessions[numActive]) != WAD_OK)
+			continue;
+		if (sessions[numActive].isActive && (devIndex == -1 || sessions[numActive].devIndex == devIndex))
+			numActive++;
+		else
+			free(sessions[numActive].sessionId);
+	}
+	out.BeginList(numActive, "sessions");
+	for (i = 0; i < numActive; i++) {
+		if (volCtl.GetDevInfo(sessions[i].devIndex, &info) != WAD_OK)
+			info.name = "";
+		out.Session(sessions[i], info.name);
+	}
+	out.EndList();
+	for (i = 0; i < numActive; i++)
+		free(sessions[i].sessionId);
+	free(sessions);
+	return WAD_OK;
+}
+
+/*
+ * Is a device the default for its direction
+ */
+bool is_default(VolCtl& volCtl, int devIndex, WadDevInfo& info)
+{
+	return devIndex == (info.isInput ? volCtl.GetDefaultInDevIndex() : volCtl.GetDefaultOutDevIndex());
+}
+
+/*
+ * Write the latency stats of the stages timed so far, as a list.
+ */
+int write_stats(VolCtl& volCtl, VolOut& out)
+{
+	WadStageStats stats[WAD_NUM_STAGES];
+	int stages[WAD_NUM_STAGES];
+	int i, num = 0;
+
+	if (!gStats) {
+		volCtl.SetErrorText("stats not recorded, start with -Q");
+		return WAD_ERR_INVALID_ARG;
+	}
+	for (i = 0; i < WAD_NUM_STAGES; i++) {
+		if (volCtl.GetStats(i, &stats[num]) == WAD_OK && stats[num].count > 0)
+			stages[num++] = i;
+	}
+	out.BeginList(num, "stats");
+	for (i = 0; i < num; i++)
+		out.Stage(WadStageName(stages[i]), stats[i]);
+	out.EndList();
+	return WAD_OK;
+}
+
+/*
+ * Answer a -Q line in watch and meter mode, where changes and readings are
+ * written from other threads.
+ */
+void query_stats(VolCtl& volCtl)
+{
+	std::lock_guard<std::mutex> guard(gOutLock);
+	if (write_stats(volCtl, *gOut) != WAD_OK)
+		gOut->Error(WAD_ERR_INVALID_ARG, volCtl.GetErrorText());
+	fflush(stdout);
+}
+
+/*
+ * Execute a command on an initialized VolCtl, writing results to out. In
+ * reply mode, set volume returns while a ramp runs. Returns WAD_OK or error
+ * with message in volCtl error text.
+ */
+int run_cmd(VolCtl& volCtl, VolCmd *cmd, VolOut& out, bool reply)
+{
+	WadDevInfo info;
+	int status;
+
+	int devIndex = -1;
 
-	// set device if devId or devName specified
-	if (gDevId != NULL) {
-		devIndex = volCtl.FindDevById(gDevId);
-		if (devIndex == -1)
-			main_error("can't find device ID '%s'", gDevId);
+	if (cmd->command == COMMAND::LIST_SESSIONS)
+		return list_sessions(volCtl, cmd, out);
+	if (cmd->hasTaper && (cmd->rampMsec > 0 || cmd->group != NULL || cmd->app != NULL)) {
+		volCtl.SetErrorText("-z can't be used with -R, -g or -a");
+		return WAD_ERR_INVALID_ARG;
 	}
-	else if (gDevName != NULL) {
-		devIndex = volCtl.FindDevByName(gDevName);
-		if (devIndex == -1)
-			main_error("can't find device name '%s'", gDevName);
+	if (cmd->group != NULL || cmd->app != NULL) {
+		switch (cmd->command) {
+		case COMMAND::GET_VOL:
+		case COMMAND::SET_VOL:
+		case COMMAND::GET_MUTE:
+		case COMMAND::SET_MUTE:
+			if (cmd->group != NULL)
+				return run_group_cmd(volCtl, cmd, out);
+			return run_session_cmd(volCtl, cmd, out);
+		case COMMAND::GET_CHANNELS:
+		case COMMAND::SET_CHANNELS:
+		case COMMAND::TRIM_CHANNELS:
+		case COMMAND::SET_BALANCE:
+		case COMMAND::SET_VOL_DB:
+		case COMMAND::GET_VOL_DB:
+		case COMMAND::STEP_VOL_DB:
+		case COMMAND::GET_VOL_RANGE:
+			volCtl.SetErrorText("channel and dB commands can't be used with -g or -a");
+			return WAD_ERR_INVALID_ARG;
+		}
 	}
-	int numDevs = volCtl.GetNumDevices();
+	// only vol, mute, channel and dB commands act on a device, so don't look
+	// one up for listing, it may cost a device lookup when lazy
+	switch (cmd->command) {
+	case COMMAND::GET_VOL:
+	case COMMAND::SET_VOL:
+	case COMMAND::GET_MUTE:
+	case COMMAND::SET_MUTE:
+	case COMMAND::GET_CHANNELS:
+	case COMMAND::SET_CHANNELS:
+	case COMMAND::TRIM_CHANNELS:
+	case COMMAND::SET_BALANCE:
+	case COMMAND::SET_VOL_DB:
+	case COMMAND::GET_VOL_DB:
+	case COMMAND::STEP_VOL_DB:
+	case COMMAND::GET_VOL_RANGE:
+		if ((status = find_dev(volCtl, cmd, &devIndex)) != WAD_OK)
+			return status;
+		break;
+	}
+	// a taper only changes what -v and -V mean
+	if (cmd->hasTaper && (cmd->command == COMMAND::GET_VOL || cmd->command == COMMAND::SET_VOL)
+			&& (status = volCtl.SetTaper(devIndex, cmd->taper, cmd->taperPoints,
+			cmd->numTaperPoints)) != WAD_OK)
+		return status;
 	float vol = 0;
+	float db, minDb, maxDb, stepDb;
+	float chans[WAD_MAX_CHANNELS];
 	bool mute = false;
+	int fromIndex, numChans;
+	int numDevs, numActive, numSets;
+	WadDevInfo *devs;
+	int *devIndexes;
 
-	switch (gCommand) {
+	switch (cmd->command) {
 	case COMMAND::LIST_DEVS:
+		// copy active devices first, the table may change underneath us
+		// when tracking device notifications
+		numDevs = volCtl.GetNumDevices();
+		devs = (WadDevInfo *) malloc(MAX(numDevs, 1) * sizeof(WadDevInfo));
+		devIndexes = (int *) malloc(MAX(numDevs, 1) * sizeof(int));
+		numActive = 0;
 		for (int i = 0; i < numDevs; i++) {
-			volCtl.GetDevInfo(i, &info);
-			PrintDev(info);
+			if (volCtl.GetDevInfo(i, &devs[numActive]) == WAD_OK && devs[numActive].isActive)
+				devIndexes[numActive++] = i;
 		}
+		out.BeginList(numActive, "devices");
+		for (int i = 0; i < numActive; i++)
+			out.Device(devIndexes[i], devs[i], is_default(volCtl, devIndexes[i], devs[i]));
+		out.EndList();
+		free(devs);
+		free(devIndexes);
 		break;
 	case COMMAND::LIST_DEFAULT_IN:
-		volCtl.GetDevInfo(volCtl.GetDefaultInDevIndex(), &info);
-		PrintDev(info);
-		break;
 	case COMMAND::LIST_DEFAULT_OUT:
-		volCtl.GetDevInfo(volCtl.GetDefaultOutDevIndex(), &info);
-		PrintDev(info);
+		devIndex = (cmd->command == COMMAND::LIST_DEFAULT_IN ?
+			volCtl.GetDefaultInDevIndex() : volCtl.GetDefaultOutDevIndex());
+		if ((status = volCtl.GetDevInfo(devIndex, &info)) != WAD_OK) {
+			volCtl.SetErrorText("no default device");
+			return status;
+		}
+		out.BeginList(1, "devices");
+		out.Device(devIndex, info, true);
+		out.EndList();
 		break;
 	case COMMAND::GET_VOL:
-		volCtl.GetVol(devIndex, &vol);
-		printf("%f\n", vol);
+		if (cmd->hasTaper)
+			status = volCtl.GetVolPos(devIndex, &vol);
+		else
+			status = volCtl.GetVol(devIndex, &vol);
+		if (status != WAD_OK)
+			return status;
+		out.Vol(vol);
 		break;
 	case COMMAND::SET_VOL:
-		volCtl.SetVol(devIndex, gVol);
+		if (cmd->fadeFrom != NULL && cmd->rampMsec > 0) {
+			if ((fromIndex = volCtl.FindDevByName(cmd->fadeFrom, WAD_MATCH_BEST)) == -1) {
+				char errText[256];
+				_snprintf(errText, sizeof(errText), "can't find device name '%s'", cmd->fadeFrom);
+				volCtl.SetErrorText(errText);
+				return WAD_ERR_INVALID_DEVICE;
+			}
+			status = volCtl.Crossfade(fromIndex, devIndex, cmd->vol, cmd->rampMsec, cmd->rampCurve);
+		}
+		else if (cmd->rampMsec > 0)
+			status = volCtl.Ramp(devIndex, cmd->vol, cmd->rampMsec, cmd->rampCurve);
+		else if (cmd->hasTaper)
+			status = volCtl.SetVolPos(devIndex, cmd->vol);
+		else
+			status = volCtl.SetVol(devIndex, cmd->vol);
+		if (status != WAD_OK)
+			return status;
+		// requests return while the ramp runs, the command line waits
+		if (!reply)
+			volCtl.WaitRamp(-1);
+		out.Done();
 		break;
 	case COMMAND::GET_MUTE:
-		volCtl.GetMute(devIndex, &mute);
-		printf("%d\n", mute);
+		if ((status = volCtl.GetMute(devIndex, &mute)) != WAD_OK)
+			return status;
+		out.Mute(mute);
 		break;
 	case COMMAND::SET_MUTE:
-		volCtl.SetMute(devIndex, gMute);
+		if ((status = volCtl.SetMute(devIndex, cmd->mute)) != WAD_OK)
+			return status;
+		out.Done();
+		break;
+	case COMMAND::GET_CHANNELS:
+		if ((status = volCtl.GetChannelVols(devIndex, chans, &numChans)) != WAD_OK)
+			return status;
+		out.Channels(chans, numChans);
+		break;
+	case COMMAND::SET_CHANNELS:
+		if ((status = volCtl.SetChannelVols(devIndex, cmd->chans, cmd->numChans)) != WAD_OK)
+			return status;
+		out.Done();
+		break;
+	case COMMAND::TRIM_CHANNELS:
+		if ((status = volCtl.ApplyChannelDb(devIndex, cmd->chans, cmd->numChans)) != WAD_OK)
+			return status;
+		out.Done();
+		break;
+	case COMMAND::SET_BALANCE:
+		if ((status = volCtl.SetBalance(devIndex, cmd->balance, cmd->balanceLaw)) != WAD_OK)
+			return status;
+		out.Done();
 		break;
+	case COMMAND::SET_VOL_DB:
+		if ((status = volCtl.SetVolDb(devIndex, cmd->db)) != WAD_OK)
+			return status;
+		out.Done();
+		break;
+	case COMMAND::GET_VOL_DB:
+		if ((status = volCtl.GetVolDb(devIndex, &db)) != WAD_OK)
+			return status;
+		out.Db(db);
+		break;
+	case COMMAND::STEP_VOL_DB:
+		if ((status = volCtl.StepVolDb(devIndex, cmd->db, &db)) != WAD_OK)
+			return status;
+		out.Db(db);
+		break;
+	case COMMAND::GET_VOL_RANGE:
+		if ((status = volCtl.GetVolRange(devIndex, &minDb, &maxDb, &stepDb)) != WAD_OK)
+			return status;
+		out.VolRange(minDb, maxDb, stepDb);
+		break;
+	case COMMAND::SNAPSHOT:
+		if ((status = volCtl.SaveSnapshot(cmd->snapFile)) != WAD_OK)
+			return status;
+		out.Done();
+		break;
+	case COMMAND::RESTORE:
+		if ((status = volCtl.RestoreSnapshot(cmd->snapFile, &numSets)) != WAD_OK)
+			return status;
+		WA_LOG(2, (THIS_FILE, "restore made %d sets", numSets));
+		out.Done();
+		break;
+	case COMMAND::GET_STATS:
+		return write_stats(volCtl, out);
 	}
+	return WAD_OK;
+}
+
+/*
+ * Run requests read from a stream, one per line, using the same options
+ * as the command line, e.g. "-i -V" or "-n \"Speakers\" -v 0.5". Each
+ * request is answered with one line, "OK [result]" or "ERR status text",
+ * and device lists follow the "OK count" line, or with one JSON line or
+ * binary response with -F. Blank lines and lines starting with '#' are
+ * skipped. Stops at "q" or end of input. Returns the number of failed
+ * requests.
+ */
+int run_requests(VolCtl& volCtl, FILE *fp, bool flush)
+{
+	char line[MAX_LINE_LEN];
+	char *args[MAX_LINE_ARGS];
+	char errText[256];
+	VolCmd cmd;
+	int argc, status;
+	int numErrors = 0;
+
+	gOut->SetReply(true);
+	while (fgets(line, sizeof(line), fp)) {
+		argc = split_line(line, args, MAX_LINE_ARGS);
+		if (argc < 2 || args[1][0] == '#')
+			continue;
+		if (!strcmp(args[1], "q"))
+			break;
+		status = parse_request(argc, args, &cmd, errText, sizeof(errText));
+		if (status != WAD_OK)
+			gOut->Error(status, errText);
+		else if ((status = run_cmd(volCtl, &cmd, *gOut, true)) != WAD_OK)
+			gOut->Error(status, volCtl.GetErrorText());
+		if (status != WAD_OK)
+			numErrors++;
+		if (flush)
+			fflush(stdout);
+	}
+	return numErrors;
+}
+
+/*
+ * Server mode: answer requests from stdin, flushing after each reply.
+ * The VolCtl is initialized once, so a request costs a device lookup
+ * and the volume call.
+ */
+int doServer(VolCtl& volCtl)
+{
+	WA_LOG(2, (THIS_FILE, "server started"));
+	run_requests(volCtl, stdin, true);
+	WA_LOG(2, (THIS_FILE, "server exiting"));
 	return 0;
 }
 
+/*
+ * Batch mode: run all commands in a file against one initialized VolCtl.
+ * Returns 1 if any command failed.
+ */
+int doBatch(VolCtl& volCtl)
+{
+	FILE *fp = stdin;
+	int numErrors;
+
+	if (strcmp(gBatchFilename, "-")) {
+		if ((fp = fopen(gBatchFilename, "r")) == NULL)
+			main_error("can't open batch file '%s'", gBatchFilename);
+	}
+	numErrors = run_requests(volCtl, fp, false);
+	volCtl.WaitRamp(-1);
+	if (fp != stdin)
+		fclose(fp);
+	WA_LOG(2, (THIS_FILE, "batch done, %d errors", numErrors));
+	return numErrors > 0;
+}
+
+/*
+ * Write a volume change, called on a system thread.
+ */
+void watch_fn(void *arg, int devIndex, float vol, bool mute)
+{
+	long long msec = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	std::lock_guard<std::mutex> guard(gOutLock);
+	((VolOut *) arg)->Change(msec, devIndex, vol, mute);
+}
+
+/*
+ * Watch mode: print a line for each volume or mute change on the selected
+ * device, or all devices, until stdin is closed or "q" is read. Each line
+ * has the date, time, device index, volume and mute state. With all devices,
+ * the index is that of the -l listing, and devices added later are watched.
+ */
+int doWatch(VolCtl& volCtl)
+{
+	char line[MAX_LINE_LEN];
+	int status;
+	int devIndex = -1;
+
+	if (gWatch == 1) {
+		if ((status = find_dev(volCtl, &gCmd, &devIndex)) != WAD_OK)
+			cmd_error(status, "%s", volCtl.GetErrorText());
+	}
+	else if ((status = volCtl.EnableDeviceNotify(true)) != WAD_OK)
+		cmd_error(status, "error enabling device notifications: %s", volCtl.GetErrorText());
+	if ((status = volCtl.Watch(devIndex, watch_fn, gOut)) != WAD_OK)
+		cmd_error(status, "error watching: %s", volCtl.GetErrorText());
+	while (fgets(line, sizeof(line), stdin)) {
+		if (line[0] == 'q')
+			break;
+		if (!strncmp(line, "-Q", 2))
+			query_stats(volCtl);
+	}
+	volCtl.Unwatch(-1);
+	return 0;
+}
+
+#define METER_BATCH	64		// readings written at a time
+
+/*
+ * Meter mode: print peak meter readings of the selected device, or the -g
+ * devices, until stdin is closed or "q" is read. Readings are written from
+ * a thread of their own, in batches, so a slow reader of stdout doesn't
+ * hold up the meter, which drops the oldest readings if it gets behind.
+ */
+int doMeter(VolCtl& volCtl)
+{
+	char line[MAX_LINE_LEN];
+	int *devIndexes;
+	int num, status;
+	std::atomic<bool> stop(false);
+
+	num = MAX(volCtl.GetNumDevices(), 1);
+	devIndexes = (int *) malloc(num * sizeof(int));
+	if (gCmd.group) {
+		if ((num = volCtl.SelectDevices(group_select(gCmd.group), gCmd.group, devIndexes, num)) <= 0)
+			cmd_error(WAD_ERR_INVALID_DEVICE, "no devices match '%s'", gCmd.group);
+	}
+	else {
+		if ((status = find_dev(volCtl, &gCmd, &devIndexes[0])) != WAD_OK)
+			cmd_error(status, "%s", volCtl.GetErrorText());
+		num = 1;
+	}
+	if ((status = volCtl.StartMeter(devIndexes, num, gMeterRate)) != WAD_OK)
+		cmd_error(status, "error starting meter: %s", volCtl.GetErrorText());
+	std::thread writer([&volCtl, &stop] {
+		WadMeterSample batch[METER_BATCH];
+		long dropped = 0;
+		int n;
+		while (!stop) {
+			if ((n = volCtl.ReadMeter(batch, METER_BATCH, 100, &dropped)) > 0) {
+				std::lock_guard<std::mutex> guard(gOutLock);
+				gOut->Meter(batch, n);
+			}
+			if (dropped > 0)
+				WA_LOG(1, (THIS_FILE, "meter: dropped %ld readings", dropped));
+		}
+	});
+	while (fgets(line, sizeof(line), stdin)) {
+		if (line[0] == 'q')
+			break;
+		if (!strncmp(line, "-Q", 2))
+			query_stats(volCtl);
+	}
+	// stopping wakes the writer if it's waiting for readings
+	stop = true;
+	volCtl.StopMeter();
+	writer.join();
+	free(devIndexes);
+	return 0;
+}
+
+double get_seconds()
+{
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * Create the backend selected with -b, or the default.
+ */
+WadBackend *create_backend()
+{
+	WadBackend *backend = WadCreateBackend(gBackendName);
+	if (!backend && gBackendName)
+		main_error("unknown backend '%s', available: %s", gBackendName, WadBackendNames());
+	return backend;
+}
+
+/*
+ * Time startup, eager and lazy initialization, and with -K from the device
+ * cache, followed by a get volume on the selected device, and print time
+ * per startup. Then time repeated get
+ * volume calls with the interface cache disabled and then enabled, and
+ * print calls per second.
+ */
+int doTiming(VolCtl& volCtl)
+{
+	int i, j, status;
+	float vol;
+	double t;
+	int devIndex;
+	int numInits = MAX(gTimingCount / 100, 1);
+	const char *initNames[] = { "eager", "lazy", "cache" };
+
+	for (j = 0; j < (gCacheFilename ? 3 : 2); j++) {
+		t = get_seconds();
+		for (i = 0; i < numInits; i++) {
+			VolCtl initCtl(GetRole(gRole), create_backend());
+			if (j == 2)
+				initCtl.SetCacheFile(gCacheFilename);
+			if ((status = initCtl.Init(j == 1)) != WAD_OK
+				|| (status = find_dev(initCtl, &gCmd, &devIndex)) != WAD_OK
+				|| (status = initCtl.GetVol(devIndex, &vol)) != WAD_OK)
+				main_error("%s", initCtl.GetErrorText());
+		}
+		t = get_seconds() - t;
+		printf("Init %-5s %d inits %.3f sec %.3f msec/init\n", initNames[j],
+			numInits, t, 1000 * t / numInits);
+	}
+	if ((status = find_dev(volCtl, &gCmd, &devIndex)) != WAD_OK)
+		main_error("%s", volCtl.GetErrorText());
+
+	for (j = 0; j < 2; j++) {
+		volCtl.SetInterfaceCache(j != 0);
+		t = get_seconds();
+		for (i = 0; i < gTimingCount; i++) {
+			if ((status = volCtl.GetVol(devIndex, &vol)) != WAD_OK)
+				main_error("%s", volCtl.GetErrorText());
+		}
+		t = get_seconds() - t;
+		printf("GetVol %-9s %d calls %.3f sec %.0f ops/sec\n", j ? "cached" : "uncached",
+			gTimingCount, t, gTimingCount / t);
+	}
+	return 0;
+}
+
+int doCtl()
+{
+	VolCtl volCtl(GetRole(gRole), create_backend());
+	if (gCacheFilename)
+		volCtl.SetCacheFile(gCacheFilename);
+	// before Init, so its stages are timed
+	volCtl.EnableStats(gStats);
+	// A server answers many requests, so enumerate up front for
+	// consistent latency. Otherwise only look up the devices needed.
+	int status = volCtl.Init(!gServer && gWatch != 2 && !(gMeterRate && gCmd.group));
+	if (status != 0)
+		cmd_error(status, "error initializing: %s", volCtl.GetErrorText());
+
+	if (gServer) {
+		// track device changes while running
+		if ((status = volCtl.EnableDeviceNotify(true)) != WAD_OK)
+			cmd_error(status, "error enabling device notifications: %s", volCtl.GetErrorText());
+		status = doServer(volCtl);
+	}
+	else if (gWatch)
+		status = doWatch(volCtl);
+	else if (gMeterRate)
+		status = doMeter(volCtl);
+	else if (gBatchFilename)
+		status = doBatch(volCtl);
+	else if (gTimingCount)
+		status = doTiming(volCtl);
+	else if (gCmd.command != COMMAND::UNKNOWN) {
+		status = run_cmd(volCtl, &gCmd, *gOut, false);
+		if (status != WAD_OK)
+			cmd_error(status, "%s", volCtl.GetErrorText());
+	}
+	if (gStats)
+		write_stats(volCtl, *gOut);
+	return status;
+}
+
+#ifdef _WIN32
+/*
+ * Device names are UTF-8, so take the arguments from the wide command line
+ * rather than the ANSI code page, which can't hold every name. The strings
+ * are kept until exit, as options point into them. Returns NULL on error.
+ */
+char **utf8_args(int *pArgc)
+{
+	LPWSTR *wideArgv = CommandLineToArgvW(GetCommandLineW(), pArgc);
+	char **argv;
+	int i, n;
+
+	if (!wideArgv)
+		return NULL;
+	argv = (char **) calloc(*pArgc + 1, sizeof(char *));
+	for (i = 0; argv && i < *pArgc; i++) {
+		n = WideCharToMultiByte(CP_UTF8, 0, wideArgv[i], -1, NULL, 0, NULL, NULL);
+		if ((argv[i] = (char *) malloc(MAX(n, 1))) == NULL) {
+			argv = NULL;
+			break;
+		}
+		argv[i][0] = 0;
+		WideCharToMultiByte(CP_UTF8, 0, wideArgv[i], -1, argv[i], n, NULL, NULL);
+	}
+	LocalFree(wideArgv);
+	return argv;
+}
+#endif
+
 int main(int argc, char* argv[])
 {
+#ifdef _WIN32
+	char **utf8Argv;
+	int utf8Argc;
+
+	if ((utf8Argv = utf8_args(&utf8Argc)) != NULL) {
+		argc = utf8Argc;
+		argv = utf8Argv;
+	}
+	// names are written, and server requests read, as UTF-8
+	SetConsoleOutputCP(CP_UTF8);
+	SetConsoleCP(CP_UTF8);
+#endif
 	parse_args(argc, argv);
+#ifdef _WIN32
+	if (gFormat == WAD_FORMAT_BIN)
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	gOut = VolOutCreate(gFormat, stdout);
 	if (gLogFilename) {
 		WaLogOpen(gLogFilename, TRUE);
+		if (gAsyncLog)
+			WaLogSetAsync(TRUE, 1024, WA_LOG_ASYNC_DROP);
 	}
 	if (gSleep > 0)
-		Sleep(gSleep * 1000);
+		std::this_thread::sleep_for(std::chrono::seconds(gSleep));
 	int status = doCtl();
 	WaLogClose();
+	delete gOut;
 	return status;
 }
@@ -41,6 +41,26 @@
 #define UNUSED(x) (void)(x)
 #endif
 
+/*
+ * Microsoft names for string functions.
+ */
+#ifndef _WIN32
+#include <strings.h>
+#define _snprintf	snprintf
+#define _stricmp	strcasecmp
+#define _strnicmp	strncasecmp
+#define _strdup		strdup
+#endif
+
+/*
+ * Thread local storage, VS2013 doesn't have C++11 thread_local.
+ */
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define THREAD_LOCAL	__declspec(thread)
+#else
+#define THREAD_LOCAL	thread_local
+#endif
+
 // This is a simple way to do compile time assertions. If the test is not true,
 // then the array will have a negative number of elements and the compiler will
 // produce an error.
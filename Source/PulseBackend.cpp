@@ -0,0 +1,1497 @@
+//
+// Audio device backend using the PulseAudio asynchronous API.
+//
+// All calls into libpulse are made with the mainloop locked. Callbacks run
+// on the mainloop thread with the lock held, and signal the mainloop so
+// callers waiting in WaitOp() wake up.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "PulseBackend.h"
+#include "MiscDef.h"
+#include "WaLog.h"
+
+#define THIS_FILE	"PulseBackend.cpp"
+
+// lock the mainloop for the rest of the scope
+class PulseLock {
+	pa_threaded_mainloop *m;
+public:
+	PulseLock(pa_threaded_mainloop *_m) : m(_m) { pa_threaded_mainloop_lock(m); }
+	~PulseLock() { pa_threaded_mainloop_unlock(m); }
+};
+#define PULSE_LOCK() PulseLock pulseLockGuard(mainloop)
+
+// a sink or source
+struct PulseDev {
+	uint32_t index;
+	bool isInput;
+	bool isActive;
+	char name[WAD_NAME_LEN];	// PulseAudio name, used as device ID
+	char desc[WAD_DEV_NAME_LEN];	// description, used as device name
+	char monitor[WAD_NAME_LEN];	// monitor source of a sink, for metering
+	pa_channel_map map;		// speaker position of each channel
+	pa_cvolume volume;
+	bool mute;
+};
+
+// a sink input or source output
+struct PulseSession {
+	uint32_t index;
+	bool isInput;			// T/F if source output
+	uint32_t dev;			// sink or source index
+	unsigned long pid;
+	char procName[WAD_NAME_LEN];
+	pa_cvolume volume;
+	bool mute;
+};
+
+// an open device or session
+typedef struct {
+	uint32_t index;
+	bool isInput;
+	pa_cvolume volume;		// last known channel volumes
+} PulseHandle;
+
+// a peak meter, a peak detecting record stream on a source or on the
+// monitor source of a sink
+typedef struct {
+	PulseBackend *pBackend;
+	pa_stream *stream;
+	int numChannels;
+	float peaks[WAD_MAX_CHANNELS];	// highest per channel since last read
+	bool failed;			// stream failed, e.g., device removed
+} PulseMeter;
+
+struct PulseWatch {
+	char name[WAD_NAME_LEN];
+	bool isInput;
+	int devIndex;
+	WadVolChangeFn *fn;
+	void *arg;
+	PulseWatch *next;
+};
+
+enum {
+	PULSE_EV_STATE = 0,		// device added or removed
+	PULSE_EV_DEFAULT,		// default device changed
+	PULSE_EV_NAME,			// description changed
+	PULSE_EV_VOLUME,		// volume or mute changed
+	PULSE_EV_SESSION,		// session added or removed
+};
+
+struct PulseEvent {
+	int type;
+	char devId[WAD_NAME_LEN];	// empty if no default device
+	bool isInput;
+	bool isActive;
+	float vol;
+	bool mute;
+	char sessionId[WAD_NAME_LEN];
+	unsigned long pid;
+	char procName[WAD_NAME_LEN];
+};
+
+// reply to a request
+typedef struct {
+	PulseBackend *pBackend;
+	int found;				// number of devices found, or success
+	PulseDev dev;			// last device found
+} PulseQuery;
+
+static float CvolToFloat(const pa_cvolume *v)
+{
+	return (float) pa_cvolume_max(v) / PA_VOLUME_NORM;
+}
+
+// PulseAudio strings are UTF-8
+static void CopyStr(char *dst, const char *src, size_t len)
+{
+	WadCopyUtf8(dst, src ? src : "", len);
+}
+
+static void FormatSessionId(bool isInput, uint32_t index, char *sessionId, size_t len)
+{
+	_snprintf(sessionId, len, "%s-%u", isInput ? "source-output" : "sink-input", index);
+}
+
+static void SinkToDev(const pa_sink_info *i, PulseDev *pDev)
+{
+	memset(pDev, 0, sizeof(PulseDev));
+	pDev->index = i->index;
+	pDev->isInput = false;
+	pDev->isActive = true;
+	CopyStr(pDev->name, i->name, sizeof(pDev->name));
+	CopyStr(pDev->desc, i->description, sizeof(pDev->desc));
+	CopyStr(pDev->monitor, i->monitor_source_name, sizeof(pDev->monitor));
+	pDev->map = i->channel_map;
+	pDev->volume = i->volume;
+	pDev->mute = i->mute != 0;
+}
+
+// returns false for monitor sources, which aren't devices
+static bool SourceToDev(const pa_source_info *i, PulseDev *pDev)
+{
+	if (i->monitor_of_sink != PA_INVALID_INDEX)
+		return false;
+	memset(pDev, 0, sizeof(PulseDev));
+	pDev->index = i->index;
+	pDev->isInput = true;
+	pDev->isActive = true;
+	CopyStr(pDev->name, i->name, sizeof(pDev->name));
+	CopyStr(pDev->desc, i->description, sizeof(pDev->desc));
+	pDev->map = i->channel_map;
+	pDev->volume = i->volume;
+	pDev->mute = i->mute != 0;
+	return true;
+}
+
+PulseBackend::PulseBackend()
+{
+	mainloop = NULL;
+	context = NULL;
+	devs = NULL;
+	numDevs = 0;
+	devsSize = 0;
+	memset(defaultSink, 0, sizeof(defaultSink));
+	memset(defaultSource, 0, sizeof(defaultSource));
+	listValid[0] = listValid[1] = false;
+	serverValid = false;
+	isSubscribed = false;
+	stopEvents = false;
+	listener = NULL;
+	watches = NULL;
+	numSesWatches = 0;
+}
+
+PulseBackend::~PulseBackend()
+{
+	PulseWatch *pWatch;
+
+	if (eventThread.joinable()) {
+		{
+			std::lock_guard<std::mutex> guard(eventLock);
+			stopEvents = true;
+		}
+		eventCond.notify_one();
+		eventThread.join();
+	}
+	while (!eventQueue.empty()) {
+		delete eventQueue.front();
+		eventQueue.pop_front();
+	}
+	if (mainloop)
+		pa_threaded_mainloop_stop(mainloop);
+	if (context) {
+		pa_context_disconnect(context);
+		pa_context_unref(context);
+	}
+	if (mainloop)
+		pa_threaded_mainloop_free(mainloop);
+	while (watches) {
+		pWatch = watches;
+		watches = pWatch->next;
+		delete pWatch;
+	}
+	free(devs);
+}
+
+const char *PulseBackend::GetName()
+{
+	return "pulse";
+}
+
+int PulseBackend::Error(const char *funcName)
+{
+	int err = context ? pa_context_errno(context) : PA_ERR_INTERNAL;
+	SetErrorText("%s: %s", funcName, pa_strerror(err));
+	WA_LOG(1, (THIS_FILE, errorText));
+	return err == PA_ERR_NOENTITY ? WAD_ERR_DEVICE_LOST : WAD_ERR_INTERNAL;
+}
+
+//
+// Wait for an operation to complete, with the mainloop locked. Returns
+// false if the operation couldn't be issued or the connection failed.
+//
+bool PulseBackend::WaitOp(pa_operation *op)
+{
+	if (!op)
+		return false;
+	while (pa_operation_get_state(op) == PA_OPERATION_RUNNING)
+		pa_threaded_mainloop_wait(mainloop);
+	pa_operation_unref(op);
+	return PA_CONTEXT_IS_GOOD(pa_context_get_state(context));
+}
+
+//=============================================================================
+//
+// Known devices
+//
+
+PulseDev *PulseBackend::FindDev(const char *name, int isInput)
+{
+	int i;
+	for (i = 0; i < numDevs; i++) {
+		if ((isInput == -1 || devs[i].isInput == (isInput != 0)) && !strcmp(devs[i].name, name))
+			return &devs[i];
+	}
+	return NULL;
+}
+
+PulseDev *PulseBackend::FindDevByIndex(uint32_t index, bool isInput)
+{
+	int i;
+	for (i = 0; i < numDevs; i++) {
+		if (devs[i].isActive && devs[i].index == index && devs[i].isInput == isInput)
+			return &devs[i];
+	}
+	return NULL;
+}
+
+// Add or update a known device, returns NULL if out of memory
+PulseDev *PulseBackend::UpdateDev(const PulseDev *pNew)
+{
+	PulseDev *pDev = FindDev(pNew->name, pNew->isInput);
+
+	if (!pDev) {
+		if (numDevs >= devsSize) {
+			int newSize = devsSize ? 2 * devsSize : 16;
+			PulseDev *newDevs = (PulseDev *) realloc(devs, newSize * sizeof(PulseDev));
+			if (!newDevs)
+				return NULL;
+			devs = newDevs;
+			devsSize = newSize;
+		}
+		pDev = &devs[numDevs++];
+	}
+	*pDev = *pNew;
+	return pDev;
+}
+
+void PulseBackend::SinkInfoCb(pa_context *c, const pa_sink_info *i, int eol, void *userdata)
+{
+	PulseQuery *pQuery = (PulseQuery *) userdata;
+	UNUSED(c);
+	if (eol == 0 && i) {
+		SinkToDev(i, &pQuery->dev);
+		pQuery->pBackend->UpdateDev(&pQuery->dev);
+		pQuery->found++;
+	}
+	pa_threaded_mainloop_signal(pQuery->pBackend->mainloop, 0);
+}
+
+void PulseBackend::SourceInfoCb(pa_context *c, const pa_source_info *i, int eol, void *userdata)
+{
+	PulseQuery *pQuery = (PulseQuery *) userdata;
+	PulseDev dev;
+	UNUSED(c);
+	if (eol == 0 && i && SourceToDev(i, &dev)) {
+		pQuery->dev = dev;
+		pQuery->pBackend->UpdateDev(&dev);
+		pQuery->found++;
+	}
+	pa_threaded_mainloop_signal(pQuery->pBackend->mainloop, 0);
+}
+
+void PulseBackend::ServerInfoCb(pa_context *c, const pa_server_info *i, void *userdata)
+{
+	PulseQuery *pQuery = (PulseQuery *) userdata;
+	PulseBackend *pBackend = pQuery->pBackend;
+	UNUSED(c);
+	if (i) {
+		CopyStr(pBackend->defaultSink, i->default_sink_name, sizeof(pBackend->defaultSink));
+		CopyStr(pBackend->defaultSource, i->default_source_name, sizeof(pBackend->defaultSource));
+		pQuery->found++;
+	}
+	pa_threaded_mainloop_signal(pBackend->mainloop, 0);
+}
+
+void PulseBackend::SuccessCb(pa_context *c, int success, void *userdata)
+{
+	PulseQuery *pQuery = (PulseQuery *) userdata;
+	UNUSED(c);
+	pQuery->found = success;
+	pa_threaded_mainloop_signal(pQuery->pBackend->mainloop, 0);
+}
+
+void PulseBackend::ContextStateCb(pa_context *c, void *userdata)
+{
+	PulseBackend *pBackend = (PulseBackend *) userdata;
+	UNUSED(c);
+	// wake up waiters, e.g., if the connection failed
+	pa_threaded_mainloop_signal(pBackend->mainloop, 0);
+}
+
+//
+// Get all sinks and sources, and the defaults if server, issuing the
+// requests together so they take one round trip. Devices not listed are
+// marked inactive.
+//
+int PulseBackend::QueryLists(bool server)
+{
+	PulseQuery sinkQuery = { this, 0 };
+	PulseQuery sourceQuery = { this, 0 };
+	PulseQuery serverQuery = { this, 0 };
+	pa_operation *sinkOp, *sourceOp, *serverOp = NULL;
+	bool ok;
+	int i;
+
+	for (i = 0; i < numDevs; i++)
+		devs[i].isActive = false;
+	sinkOp = pa_context_get_sink_info_list(context, SinkInfoCb, &sinkQuery);
+	sourceOp = pa_context_get_source_info_list(context, SourceInfoCb, &sourceQuery);
+	if (server)
+		serverOp = pa_context_get_server_info(context, ServerInfoCb, &serverQuery);
+	ok = WaitOp(sinkOp);
+	ok = WaitOp(sourceOp) && ok;
+	if (server)
+		ok = WaitOp(serverOp) && ok;
+	if (!ok)
+		return Error("QueryLists");
+	listValid[0] = listValid[1] = true;
+	if (server)
+		serverValid = true;
+	WA_LOG(2, (THIS_FILE, "QueryLists: %d sinks %d sources", sinkQuery.found, sourceQuery.found));
+	return WAD_OK;
+}
+
+//
+// Get the sink and the source with a name, in one round trip. Returns the
+// number found. A known device that isn't found is marked inactive.
+//
+int PulseBackend::QueryDev(const char *name)
+{
+	PulseQuery sinkQuery = { this, 0 };
+	PulseQuery sourceQuery = { this, 0 };
+	pa_operation *sinkOp, *sourceOp;
+	PulseDev *pDev;
+
+	if ((pDev = FindDev(name, false)) != NULL)
+		pDev->isActive = false;
+	if ((pDev = FindDev(name, true)) != NULL)
+		pDev->isActive = false;
+	sinkOp = pa_context_get_sink_info_by_name(context, name, SinkInfoCb, &sinkQuery);
+	sourceOp = pa_context_get_source_info_by_name(context, name, SourceInfoCb, &sourceQuery);
+	// one of these fails with no such entity
+	WaitOp(sinkOp);
+	WaitOp(sourceOp);
+	return sinkQuery.found + sourceQuery.found;
+}
+
+//=============================================================================
+//
+// WadBackend
+//
+
+int PulseBackend::Init(int role)
+{
+	pa_context_state_t state;
+
+	UNUSED(role);
+	mainloop = pa_threaded_mainloop_new();
+	if (!mainloop) {
+		SetErrorText("pa_threaded_mainloop_new failed");
+		return WAD_ERR_INTERNAL;
+	}
+	context = pa_context_new(pa_threaded_mainloop_get_api(mainloop), "VolCtl");
+	if (!context) {
+		SetErrorText("pa_context_new failed");
+		return WAD_ERR_INTERNAL;
+	}
+	pa_context_set_state_callback(context, ContextStateCb, this);
+	PULSE_LOCK();
+	if (pa_context_connect(context, NULL, PA_CONTEXT_NOFLAGS, NULL) < 0)
+		return Error("pa_context_connect");
+	if (pa_threaded_mainloop_start(mainloop) < 0) {
+		SetErrorText("pa_threaded_mainloop_start failed");
+		return WAD_ERR_INTERNAL;
+	}
+	while ((state = pa_context_get_state(context)) != PA_CONTEXT_READY) {
+		if (!PA_CONTEXT_IS_GOOD(state))
+			return Error("pa_context_connect");
+		pa_threaded_mainloop_wait(mainloop);
+	}
+	// prefetch, so the front end's enumeration and default lookups don't
+	// need more round trips
+	return QueryLists(true);
+}
+
+int PulseBackend::EnumDevices(bool isInput, bool getNames, WadEnumFn *fn, void *arg)
+{
+	PulseDev *list;
+	int i, n = 0;
+	int status;
+
+	{
+		PULSE_LOCK();
+		if (!listValid[isInput] && (status = QueryLists(false)) != WAD_OK)
+			return status;
+		// without events the list goes stale
+		if (!isSubscribed)
+			listValid[isInput] = false;
+		list = (PulseDev *) malloc(MAX(numDevs, 1) * sizeof(PulseDev));
+		if (!list) {
+			SetErrorText("out of memory");
+			return WAD_ERR_INTERNAL;
+		}
+		for (i = 0; i < numDevs; i++) {
+			if (devs[i].isInput == isInput && devs[i].isActive)
+				list[n++] = devs[i];
+		}
+	}
+	// call without the lock, in case fn calls back
+	for (i = 0; i < n; i++)
+		fn(arg, list[i].name, getNames ? list[i].desc : NULL);
+	free(list);
+	return WAD_OK;
+}
+
+int PulseBackend::GetDefaultDev(bool isInput, char *devId, size_t len)
+{
+	PulseQuery query = { this, 0 };
+
+	PULSE_LOCK();
+	if (!serverValid) {
+		if (!WaitOp(pa_context_get_server_info(context, ServerInfoCb, &query)))
+			return Error("pa_context_get_server_info");
+	}
+	if (!isSubscribed)
+		serverValid = false;
+	CopyStr(devId, isInput ? defaultSource : defaultSink, len);
+	if (!devId[0]) {
+		SetErrorText("no default %s device", isInput ? "input" : "output");
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	return WAD_OK;
+}
+
+int PulseBackend::GetDevState(const char *devId, bool *pIsActive, bool *pIsInput)
+{
+	PulseDev *pDev;
+
+	PULSE_LOCK();
+	pDev = FindDev(devId);
+	if (!pDev || !isSubscribed) {
+		QueryDev(devId);
+		pDev = FindDev(devId);
+	}
+	if (!pDev) {
+		SetErrorText("unknown device ID '%s'", devId);
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	*pIsActive = pDev->isActive;
+	*pIsInput = pDev->isInput;
+	return WAD_OK;
+}
+
+int PulseBackend::GetDevName(const char *devId, char *name, size_t len)
+{
+	PulseDev *pDev;
+
+	PULSE_LOCK();
+	pDev = FindDev(devId);
+	if (!pDev) {
+		QueryDev(devId);
+		pDev = FindDev(devId);
+	}
+	if (!pDev) {
+		SetErrorText("unknown device ID '%s'", devId);
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	CopyStr(name, pDev->desc, len);
+	return WAD_OK;
+}
+
+int PulseBackend::OpenDev(const char *devId, WadHandle *phDev)
+{
+	PulseDev *pDev;
+	PulseHandle *pHandle;
+
+	PULSE_LOCK();
+	pDev = FindDev(devId);
+	if (!pDev || !pDev->isActive) {
+		QueryDev(devId);
+		pDev = FindDev(devId);
+	}
+	if (!pDev || !pDev->isActive) {
+		SetErrorText("OpenDev: device '%s' not available", devId);
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	pHandle = (PulseHandle *) malloc(sizeof(PulseHandle));
+	if (!pHandle) {
+		SetErrorText("out of memory");
+		return WAD_ERR_INTERNAL;
+	}
+	pHandle->index = pDev->index;
+	pHandle->isInput = pDev->isInput;
+	pHandle->volume = pDev->volume;
+	*phDev = pHandle;
+	return WAD_OK;
+}
+
+void PulseBackend::CloseDev(WadHandle hDev)
+{
+	free(hDev);
+}
+
+//
+// Get the current state of an open device, with the mainloop locked.
+//
+int PulseBackend::QueryHandle(WadHandle hDev, PulseDev *pDev)
+{
+	PulseHandle *pHandle = (PulseHandle *) hDev;
+	PulseQuery query = { this, 0 };
+	pa_operation *op;
+
+	if (pHandle->isInput)
+		op = pa_context_get_source_info_by_index(context, pHandle->index, SourceInfoCb, &query);
+	else
+		op = pa_context_get_sink_info_by_index(context, pHandle->index, SinkInfoCb, &query);
+	WaitOp(op);
+	if (!query.found) {
+		SetErrorText("device removed");
+		return WAD_ERR_DEVICE_LOST;
+	}
+	pHandle->volume = query.dev.volume;
+	*pDev = query.dev;
+	return WAD_OK;
+}
+
+int PulseBackend::GetVol(WadHandle hDev, float *pVol)
+{
+	PulseDev dev;
+	int status;
+
+	PULSE_LOCK();
+	if ((status = QueryHandle(hDev, &dev)) != WAD_OK)
+		return status;
+	*pVol = CvolToFloat(&dev.volume);
+	return WAD_OK;
+}
+
+int PulseBackend::GetMute(WadHandle hDev, bool *pMute)
+{
+	PulseDev dev;
+	int status;
+
+	PULSE_LOCK();
+	if ((status = QueryHandle(hDev, &dev)) != WAD_OK)
+		return status;
+	*pMute = dev.mute;
+	return WAD_OK;
+}
+
+//
+// Scale the last known channel volumes so the loudest is at vol, which
+// keeps the balance without asking for the current volumes first.
+//
+int PulseBackend::SetVol(WadHandle hDev, float vol)
+{
+	PulseHandle *pHandle = (PulseHandle *) hDev;
+	PulseQuery query = { this, 0 };
+	pa_cvolume cv;
+	pa_operation *op;
+
+	PULSE_LOCK();
+	// read under the lock, a get on another thread updates it
+	cv = pHandle->volume;
+	pa_cvolume_scale(&cv, (pa_volume_t) (vol * PA_VOLUME_NORM + 0.5f));
+	if (pHandle->isInput)
+		op = pa_context_set_source_volume_by_index(context, pHandle->index, &cv, SuccessCb, &query);
+	else
+		op = pa_context_set_sink_volume_by_index(context, pHandle->index, &cv, SuccessCb, &query);
+	if (!WaitOp(op) || !query.found)
+		return Error(pHandle->isInput ? "pa_context_set_source_volume_by_index" :
+			"pa_context_set_sink_volume_by_index");
+	pHandle->volume = cv;
+	return WAD_OK;
+}
+
+int PulseBackend::SetMute(WadHandle hDev, bool mute)
+{
+	PulseHandle *pHandle = (PulseHandle *) hDev;
+	PulseQuery query = { this, 0 };
+	pa_operation *op;
+
+	PULSE_LOCK();
+	if (pHandle->isInput)
+		op = pa_context_set_source_mute_by_index(context, pHandle->index, mute, SuccessCb, &query);
+	else
+		op = pa_context_set_sink_mute_by_index(context, pHandle->index, mute, SuccessCb, &query);
+	if (!WaitOp(op) || !query.found)
+		return Error(pHandle->isInput ? "pa_context_set_source_mute_by_index" :
+			"pa_context_set_sink_mute_by_index");
+	return WAD_OK;
+}
+
+int PulseBackend::GetChannelCount(WadHandle hDev, int *pNum)
+{
+	PulseDev dev;
+	int status;
+
+	PULSE_LOCK();
+	if ((status = QueryHandle(hDev, &dev)) != WAD_OK)
+		return status;
+	*pNum = MIN(dev.volume.channels, WAD_MAX_CHANNELS);
+	return WAD_OK;
+}
+
+int PulseBackend::GetChannelVols(WadHandle hDev, float *vols, int *pNum)
+{
+	PulseDev dev;
+	int i, status;
+
+	PULSE_LOCK();
+	if ((status = QueryHandle(hDev, &dev)) != WAD_OK)
+		return status;
+	*pNum = MIN(dev.volume.channels, WAD_MAX_CHANNELS);
+	for (i = 0; i < *pNum; i++)
+		vols[i] = (float) dev.volume.values[i] / PA_VOLUME_NORM;
+	return WAD_OK;
+}
+
+int PulseBackend::GetChannelSides(const char *devId, unsigned char *sides, int *pNum)
+{
+	PulseDev *pDev;
+	int i;
+
+	PULSE_LOCK();
+	pDev = FindDev(devId);
+	if (!pDev) {
+		QueryDev(devId);
+		pDev = FindDev(devId);
+	}
+	if (!pDev) {
+		SetErrorText("unknown device ID '%s'", devId);
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	*pNum = MIN(pDev->map.channels, WAD_MAX_CHANNELS);
+	for (i = 0; i < *pNum; i++) {
+		if (pa_channel_position_is_left(pDev->map.map[i]))
+			sides[i] = WAD_SIDE_LEFT;
+		else if (pa_channel_position_is_right(pDev->map.map[i]))
+			sides[i] = WAD_SIDE_RIGHT;
+		else
+			sides[i] = WAD_SIDE_CENTER;
+	}
+	return WAD_OK;
+}
+
+//
+// Channel volumes are a pa_cvolume already, so all channels are set with
+// one request, on the channel map last seen.
+//
+int PulseBackend::SetChannelVols(WadHandle hDev, const float *vols, int num)
+{
+	PulseHandle *pHandle = (PulseHandle *) hDev;
+	PulseQuery query = { this, 0 };
+	pa_cvolume cv;
+	pa_operation *op;
+	int i;
+
+	PULSE_LOCK();
+	cv = pHandle->volume;
+	if (num != cv.channels) {
+		SetErrorText("SetChannelVols: %d channels given, device has %d", num, cv.channels);
+		return WAD_ERR_INVALID_ARG;
+	}
+	for (i = 0; i < num; i++)
+		cv.values[i] = (pa_volume_t) (vols[i] * PA_VOLUME_NORM + 0.5f);
+	if (pHandle->isInput)
+		op = pa_context_set_source_volume_by_index(context, pHandle->index, &cv, SuccessCb, &query);
+	else
+		op = pa_context_set_sink_volume_by_index(context, pHandle->index, &cv, SuccessCb, &query);
+	if (!WaitOp(op) || !query.found)
+		return Error(pHandle->isInput ? "pa_context_set_source_volume_by_index" :
+			"pa_context_set_sink_volume_by_index");
+	pHandle->volume = cv;
+	return WAD_OK;
+}
+
+//
+// PulseAudio volumes are software dB on a cubic curve, 0 dB at
+// PA_VOLUME_NORM, so dB is converted from the device volume. The curve
+// goes down to -inf, which is cut off where nothing can be heard.
+//
+#define PULSE_DB_FLOOR	(-100.0f)	// dB of volume 0
+
+int PulseBackend::GetVolRange(WadHandle hDev, float *pMinDb, float *pMaxDb, float *pStepDb)
+{
+	UNUSED(hDev);
+	*pMinDb = PULSE_DB_FLOOR;
+	*pMaxDb = 0;
+	*pStepDb = 0;
+	return WAD_OK;
+}
+
+int PulseBackend::GetVolDb(WadHandle hDev, float *pDb)
+{
+	float vol;
+	int status;
+
+	if ((status = GetVol(hDev, &vol)) != WAD_OK)
+		return status;
+	*pDb = MAX((float) pa_sw_volume_to_dB((pa_volume_t) (vol * PA_VOLUME_NORM + 0.5f)), PULSE_DB_FLOOR);
+	return WAD_OK;
+}
+
+int PulseBackend::SetVolDb(WadHandle hDev, float db)
+{
+	if (db <= PULSE_DB_FLOOR)
+		return SetVol(hDev, 0);
+	return SetVol(hDev, (float) pa_sw_volume_from_dB(db) / PA_VOLUME_NORM);
+}
+
+//=============================================================================
+//
+// Peak meters
+//
+// PulseAudio has no meter to read, so a meter is a record stream with peak
+// detection, where the server sends the peak of each channel over short
+// intervals rather than the audio. The peaks are collected as they arrive
+// on the mainloop thread, and a read takes the highest since the last.
+//
+
+#define PULSE_METER_RATE	200		// peaks per second, twice the fastest sampling
+
+void PulseBackend::MeterStateCb(pa_stream *s, void *userdata)
+{
+	PulseMeter *pMeter = (PulseMeter *) userdata;
+	if (!PA_STREAM_IS_GOOD(pa_stream_get_state(s)))
+		pMeter->failed = true;
+	// wake up OpenMeter
+	pa_threaded_mainloop_signal(pMeter->pBackend->mainloop, 0);
+}
+
+// disconnect and free a meter, with the mainloop locked
+static void FreeMeter(PulseMeter *pMeter)
+{
+	pa_stream_set_state_callback(pMeter->stream, NULL, NULL);
+	pa_stream_set_read_callback(pMeter->stream, NULL, NULL);
+	pa_stream_disconnect(pMeter->stream);
+	pa_stream_unref(pMeter->stream);
+	free(pMeter);
+}
+
+void PulseBackend::MeterReadCb(pa_stream *s, size_t nbytes, void *userdata)
+{
+	PulseMeter *pMeter = (PulseMeter *) userdata;
+	const float *data;
+	size_t i, n;
+
+	while (pa_stream_readable_size(s) > 0) {
+		if (pa_stream_peek(s, (const void **) &data, &nbytes) < 0)
+			return;
+		// data is NULL for a hole in the stream
+		n = data ? nbytes / sizeof(float) : 0;
+		for (i = 0; i < n; i++) {
+			int ch = (int) (i % pMeter->numChannels);
+			pMeter->peaks[ch] = MAX(pMeter->peaks[ch], data[i]);
+		}
+		if (nbytes > 0)
+			pa_stream_drop(s);
+	}
+}
+
+//
+// Connect the stream with the device's channels and without remapping, so
+// the peaks are per device channel, and wait until it's ready.
+//
+int PulseBackend::OpenMeter(const char *devId, WadHandle *phMeter)
+{
+	PulseDev *pDev;
+	PulseMeter *pMeter;
+	pa_sample_spec ss;
+	pa_channel_map map;
+	pa_buffer_attr attr;
+	pa_stream_state_t state;
+	const char *source;
+
+	PULSE_LOCK();
+	pDev = FindDev(devId);
+	if (!pDev || !pDev->isActive) {
+		QueryDev(devId);
+		pDev = FindDev(devId);
+	}
+	if (!pDev || !pDev->isActive || (!pDev->isInput && !pDev->monitor[0])) {
+		SetErrorText("OpenMeter: device '%s' not available", devId);
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	source = pDev->isInput ? pDev->name : pDev->monitor;
+	pMeter = (PulseMeter *) calloc(1, sizeof(PulseMeter));
+	if (!pMeter) {
+		SetErrorText("out of memory");
+		return WAD_ERR_INTERNAL;
+	}
+	pMeter->pBackend = this;
+	pMeter->numChannels = MAX(MIN(pDev->volume.channels, WAD_MAX_CHANNELS), 1);
+	ss.format = PA_SAMPLE_FLOAT32NE;
+	ss.rate = PULSE_METER_RATE;
+	ss.channels = (uint8_t) pMeter->numChannels;
+	pa_channel_map_init_extend(&map, ss.channels, PA_CHANNEL_MAP_DEFAULT);
+	if (!(pMeter->stream = pa_stream_new(context, "Peak meter", &ss, &map))) {
+		free(pMeter);
+		return Error("pa_stream_new");
+	}
+	pa_stream_set_state_callback(pMeter->stream, MeterStateCb, pMeter);
+	pa_stream_set_read_callback(pMeter->stream, MeterReadCb, pMeter);
+	// a fragment per peak, so they arrive as they're measured
+	memset(&attr, 0xff, sizeof(attr));
+	attr.fragsize = (uint32_t) (ss.channels * sizeof(float));
+	if (pa_stream_connect_record(pMeter->stream, source, &attr, (pa_stream_flags_t)
+		(PA_STREAM_PEAK_DETECT | PA_STREAM_ADJUST_LATENCY | PA_STREAM_DONT_MOVE |
+		PA_STREAM_NO_REMAP_CHANNELS)) < 0) {
+		FreeMeter(pMeter);
+		return Error("pa_stream_connect_record");
+	}
+	while ((state = pa_stream_get_state(pMeter->stream)) == PA_STREAM_CREATING)
+		pa_threaded_mainloop_wait(mainloop);
+	if (state != PA_STREAM_READY) {
+		FreeMeter(pMeter);
+		return Error("pa_stream_connect_record");
+	}
+	*phMeter = pMeter;
+	return WAD_OK;
+}
+
+void PulseBackend::CloseMeter(WadHandle hMeter)
+{
+	PULSE_LOCK();
+	FreeMeter((PulseMeter *) hMeter);
+}
+
+int PulseBackend::GetPeaks(WadHandle hMeter, float *pPeak, float *chanPeaks, int *pNum)
+{
+	PulseMeter *pMeter = (PulseMeter *) hMeter;
+	int i;
+
+	PULSE_LOCK();
+	if (pMeter->failed) {
+		SetErrorText("GetPeaks: device removed");
+		return WAD_ERR_DEVICE_LOST;
+	}
+	*pPeak = 0;
+	for (i = 0; i < pMeter->numChannels; i++) {
+		chanPeaks[i] = pMeter->peaks[i];
+		*pPeak = MAX(*pPeak, chanPeaks[i]);
+		pMeter->peaks[i] = 0;
+	}
+	*pNum = pMeter->numChannels;
+	return WAD_OK;
+}
+
+//=============================================================================
+//
+// Change events
+//
+// Once subscribed the known devices and defaults are kept current from
+// events, so lookups don't need a round trip. Events only carry an index,
+// so added and changed devices are asked for, and the replies compared
+// with what was known to find what changed.
+//
+
+//
+// Subscribe to change events and start the event thread, with the
+// mainloop locked.
+//
+int PulseBackend::Subscribe()
+{
+	PulseQuery query = { this, 0 };
+	int status;
+
+	if (isSubscribed)
+		return WAD_OK;
+	pa_context_set_subscribe_callback(context, SubscribeCb, this);
+	if (!WaitOp(pa_context_subscribe(context, (pa_subscription_mask_t)
+		(PA_SUBSCRIPTION_MASK_SINK | PA_SUBSCRIPTION_MASK_SOURCE | PA_SUBSCRIPTION_MASK_SERVER |
+		PA_SUBSCRIPTION_MASK_SINK_INPUT | PA_SUBSCRIPTION_MASK_SOURCE_OUTPUT),
+		SuccessCb, &query)) || !query.found)
+		return Error("pa_context_subscribe");
+	// current state to compare events with
+	if ((status = QueryLists(true)) != WAD_OK)
+		return status;
+	isSubscribed = true;
+	if (!eventThread.joinable())
+		eventThread = std::thread(&PulseBackend::EventLoop, this);
+	return WAD_OK;
+}
+
+void PulseBackend::SubscribeCb(pa_context *c, pa_subscription_event_type_t t, uint32_t index, void *userdata)
+{
+	PulseBackend *pBackend = (PulseBackend *) userdata;
+	int facility = t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK;
+	int type = t & PA_SUBSCRIPTION_EVENT_TYPE_MASK;
+	bool isInput = facility == PA_SUBSCRIPTION_EVENT_SOURCE;
+	PulseDev *pDev;
+	PulseEvent *pEvent;
+	pa_operation *op = NULL;
+
+	if (facility == PA_SUBSCRIPTION_EVENT_SERVER) {
+		op = pa_context_get_server_info(c, EventServerCb, pBackend);
+	}
+	else if (facility == PA_SUBSCRIPTION_EVENT_SINK_INPUT || facility == PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT) {
+		isInput = facility == PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT;
+		if (pBackend->numSesWatches == 0)
+			return;
+		if (type == PA_SUBSCRIPTION_EVENT_REMOVE) {
+			// the device is gone with the stream, session IDs are unique without it
+			pEvent = new PulseEvent();
+			pEvent->type = PULSE_EV_SESSION;
+			FormatSessionId(isInput, index, pEvent->sessionId, sizeof(pEvent->sessionId));
+			pEvent->isInput = isInput;
+			pBackend->QueueEvent(pEvent);
+		}
+		// new, or changed which includes moving to another device
+		else if (isInput) {
+			op = pa_context_get_source_output_info(c, index, EventSourceOutputCb, pBackend);
+		}
+		else {
+			op = pa_context_get_sink_input_info(c, index, EventSinkInputCb, pBackend);
+		}
+	}
+	else if (facility != PA_SUBSCRIPTION_EVENT_SINK && facility != PA_SUBSCRIPTION_EVENT_SOURCE) {
+		return;
+	}
+	else if (type == PA_SUBSCRIPTION_EVENT_REMOVE) {
+		if ((pDev = pBackend->FindDevByIndex(index, isInput)) != NULL) {
+			pDev->isActive = false;
+			pEvent = new PulseEvent();
+			pEvent->type = PULSE_EV_STATE;
+			CopyStr(pEvent->devId, pDev->name, sizeof(pEvent->devId));
+			pEvent->isInput = isInput;
+			pEvent->isActive = false;
+			pBackend->QueueEvent(pEvent);
+		}
+	}
+	// new or changed, ask for the details without waiting
+	else if (isInput) {
+		op = pa_context_get_source_info_by_index(c, index, EventSourceCb, pBackend);
+	}
+	else {
+		op = pa_context_get_sink_info_by_index(c, index, EventSinkCb, pBackend);
+	}
+	if (op)
+		pa_operation_unref(op);
+}
+
+void PulseBackend::EventSinkCb(pa_context *c, const pa_sink_info *i, int eol, void *userdata)
+{
+	PulseDev dev;
+	UNUSED(c);
+	if (eol == 0 && i) {
+		SinkToDev(i, &dev);
+		((PulseBackend *) userdata)->OnDevInfo(&dev);
+	}
+}
+
+void PulseBackend::EventSourceCb(pa_context *c, const pa_source_info *i, int eol, void *userdata)
+{
+	PulseDev dev;
+	UNUSED(c);
+	if (eol == 0 && i && SourceToDev(i, &dev))
+		((PulseBackend *) userdata)->OnDevInfo(&dev);
+}
+
+//
+// Compare a device reply to an event with the known device, and queue
+// events for what changed.
+//
+void PulseBackend::OnDevInfo(const PulseDev *pDev)
+{
+	PulseDev *pOld = FindDev(pDev->name, pDev->isInput);
+	PulseEvent *pEvent;
+	int type = -1;
+
+	if (!pOld || !pOld->isActive)
+		type = PULSE_EV_STATE;
+	else if (strcmp(pOld->desc, pDev->desc))
+		type = PULSE_EV_NAME;
+	else if (!pa_cvolume_equal(&pOld->volume, &pDev->volume) || pOld->mute != pDev->mute)
+		type = PULSE_EV_VOLUME;
+	UpdateDev(pDev);
+	if (type == -1)
+		return;
+	pEvent = new PulseEvent();
+	pEvent->type = type;
+	CopyStr(pEvent->devId, pDev->name, sizeof(pEvent->devId));
+	pEvent->isInput = pDev->isInput;
+	pEvent->isActive = true;
+	pEvent->vol = CvolToFloat(&pDev->volume);
+	pEvent->mute = pDev->mute;
+	QueueEvent(pEvent);
+}
+
+void PulseBackend::EventServerCb(pa_context *c, const pa_server_info *i, void *userdata)
+{
+	PulseBackend *pBackend = (PulseBackend *) userdata;
+	PulseEvent *pEvent;
+	char *defaults[2] = { pBackend->defaultSink, pBackend->defaultSource };
+	const char *names[2];
+	int isInput;
+	UNUSED(c);
+
+	if (!i)
+		return;
+	names[0] = i->default_sink_name ? i->default_sink_name : "";
+	names[1] = i->default_source_name ? i->default_source_name : "";
+	for (isInput = 0; isInput < 2; isInput++) {
+		if (!strcmp(defaults[isInput], names[isInput]))
+			continue;
+		CopyStr(defaults[isInput], names[isInput], WAD_NAME_LEN);
+		pEvent = new PulseEvent();
+		pEvent->type = PULSE_EV_DEFAULT;
+		CopyStr(pEvent->devId, names[isInput], sizeof(pEvent->devId));
+		pEvent->isInput = isInput != 0;
+		pBackend->QueueEvent(pEvent);
+	}
+}
+
+void PulseBackend::QueueEvent(PulseEvent *pEvent)
+{
+	{
+		std::lock_guard<std::mutex> guard(eventLock);
+		eventQueue.push_back(pEvent);
+	}
+	eventCond.notify_one();
+}
+
+//
+// Deliver events to the listener and watches, on the event thread.
+//
+void PulseBackend::EventLoop()
+{
+	PulseEvent *pEvent;
+	PulseWatch *pWatch;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> guard(eventLock);
+			while (eventQueue.empty() && !stopEvents)
+				eventCond.wait(guard);
+			if (stopEvents)
+				break;
+			pEvent = eventQueue.front();
+			eventQueue.pop_front();
+		}
+		if (pEvent->type == PULSE_EV_SESSION) {
+			std::lock_guard<std::recursive_mutex> guard(listenerLock);
+			if (listener)
+				listener->OnSessionState(pEvent->devId[0] ? pEvent->devId : NULL, pEvent->sessionId,
+					pEvent->pid, pEvent->procName, pEvent->isActive);
+		}
+		else if (pEvent->type == PULSE_EV_VOLUME) {
+			std::lock_guard<std::recursive_mutex> guard(watchLock);
+			for (pWatch = watches; pWatch; pWatch = pWatch->next) {
+				if (pWatch->isInput == pEvent->isInput && !strcmp(pWatch->name, pEvent->devId))
+					pWatch->fn(pWatch->arg, pWatch->devIndex, pEvent->vol, pEvent->mute);
+			}
+		}
+		else {
+			std::lock_guard<std::recursive_mutex> guard(listenerLock);
+			if (listener) {
+				switch (pEvent->type) {
+				case PULSE_EV_STATE:
+					listener->OnDeviceState(pEvent->devId, pEvent->isActive, pEvent->isInput);
+					break;
+				case PULSE_EV_DEFAULT:
+					listener->OnDefaultDevice(pEvent->isInput, pEvent->devId[0] ? pEvent->devId : NULL);
+					break;
+				case PULSE_EV_NAME:
+					listener->OnDeviceName(pEvent->devId);
+					break;
+				}
+			}
+		}
+		delete pEvent;
+	}
+}
+
+int PulseBackend::SetListener(WadBackendListener *_listener)
+{
+	int status = WAD_OK;
+
+	if (_listener) {
+		PULSE_LOCK();
+		status = Subscribe();
+	}
+	// blocks until any callback in progress returns
+	std::lock_guard<std::recursive_mutex> guard(listenerLock);
+	if (status == WAD_OK)
+		listener = _listener;
+	return status;
+}
+
+int PulseBackend::Watch(const char *devId, int devIndex, WadVolChangeFn *fn, void *arg, WadHandle *phWatch)
+{
+	PulseWatch *pWatch;
+	PulseDev *pDev;
+	int status;
+
+	{
+		PULSE_LOCK();
+		if ((status = Subscribe()) != WAD_OK)
+			return status;
+		pDev = FindDev(devId);
+		if (!pDev || !pDev->isActive) {
+			SetErrorText("Watch: device '%s' not available", devId);
+			return WAD_ERR_INVALID_DEVICE;
+		}
+		pWatch = new PulseWatch();
+		CopyStr(pWatch->name, devId, sizeof(pWatch->name));
+		pWatch->isInput = pDev->isInput;
+	}
+	pWatch->devIndex = devIndex;
+	pWatch->fn = fn;
+	pWatch->arg = arg;
+	std::lock_guard<std::recursive_mutex> guard(watchLock);
+	pWatch->next = watches;
+	watches = pWatch;
+	*phWatch = pWatch;
+	return WAD_OK;
+}
+
+void PulseBackend::Unwatch(WadHandle hWatch)
+{
+	PulseWatch **ppWatch;
+
+	// blocks until any callback in progress returns
+	std::lock_guard<std::recursive_mutex> guard(watchLock);
+	for (ppWatch = &watches; *ppWatch; ppWatch = &(*ppWatch)->next) {
+		if (*ppWatch == hWatch) {
+			*ppWatch = (*ppWatch)->next;
+			delete (PulseWatch *) hWatch;
+			break;
+		}
+	}
+}
+
+//=============================================================================
+//
+// Sessions
+//
+
+static bool ParseSessionId(const char *sessionId, bool *pIsInput, uint32_t *pIndex)
+{
+	const char *s;
+
+	if (!strncmp(sessionId, "sink-input-", 11)) {
+		*pIsInput = false;
+		s = sessionId + 11;
+	}
+	else if (!strncmp(sessionId, "source-output-", 14)) {
+		*pIsInput = true;
+		s = sessionId + 14;
+	}
+	else
+		return false;
+	*pIndex = (uint32_t) strtoul(s, NULL, 10);
+	return *s != 0;
+}
+
+// process of a stream, falling back to the application and stream names
+static void ProplistToSession(const pa_proplist *props, const char *name, PulseSession *pSes)
+{
+	const char *s;
+
+	s = pa_proplist_gets(props, PA_PROP_APPLICATION_PROCESS_ID);
+	pSes->pid = s ? strtoul(s, NULL, 10) : 0;
+	if ((s = pa_proplist_gets(props, PA_PROP_APPLICATION_PROCESS_BINARY)) == NULL &&
+		(s = pa_proplist_gets(props, PA_PROP_APPLICATION_NAME)) == NULL)
+		s = name;
+	CopyStr(pSes->procName, s, sizeof(pSes->procName));
+}
+
+static void SinkInputToSession(const pa_sink_input_info *i, PulseSession *pSes)
+{
+	memset(pSes, 0, sizeof(PulseSession));
+	pSes->index = i->index;
+	pSes->isInput = false;
+	pSes->dev = i->sink;
+	pSes->volume = i->volume;
+	pSes->mute = i->mute != 0;
+	ProplistToSession(i->proplist, i->name, pSes);
+}
+
+static void SourceOutputToSession(const pa_source_output_info *i, PulseSession *pSes)
+{
+	memset(pSes, 0, sizeof(PulseSession));
+	pSes->index = i->index;
+	pSes->isInput = true;
+	pSes->dev = i->source;
+	pSes->volume = i->volume;
+	pSes->mute = i->mute != 0;
+	ProplistToSession(i->proplist, i->name, pSes);
+}
+
+// reply to a session request, collecting the sessions of one device or one
+// session by index
+typedef struct {
+	PulseBackend *pBackend;
+	uint32_t dev;			// device to collect, or PA_INVALID_INDEX for any
+	PulseSession *list;
+	int found;
+	int size;
+} PulseSessionQuery;
+
+static void AddToQuery(PulseSessionQuery *pQuery, const PulseSession *pSes)
+{
+	PulseSession *newList;
+
+	if (pQuery->dev != PA_INVALID_INDEX && pSes->dev != pQuery->dev)
+		return;
+	if (pQuery->found >= pQuery->size) {
+		int newSize = pQuery->size ? 2 * pQuery->size : 8;
+		if ((newList = (PulseSession *) realloc(pQuery->list, newSize * sizeof(PulseSession))) == NULL)
+			return;
+		pQuery->list = newList;
+		pQuery->size = newSize;
+	}
+	pQuery->list[pQuery->found++] = *pSes;
+}
+
+void PulseBackend::SinkInputCb(pa_context *c, const pa_sink_input_info *i, int eol, void *userdata)
+{
+	PulseSessionQuery *pQuery = (PulseSessionQuery *) userdata;
+	PulseSession ses;
+	UNUSED(c);
+	if (eol == 0 && i) {
+		SinkInputToSession(i, &ses);
+		AddToQuery(pQuery, &ses);
+	}
+	pa_threaded_mainloop_signal(pQuery->pBackend->mainloop, 0);
+}
+
+void PulseBackend::SourceOutputCb(pa_context *c, const pa_source_output_info *i, int eol, void *userdata)
+{
+	PulseSessionQuery *pQuery = (PulseSessionQuery *) userdata;
+	PulseSession ses;
+	UNUSED(c);
+	if (eol == 0 && i) {
+		SourceOutputToSession(i, &ses);
+		AddToQuery(pQuery, &ses);
+	}
+	pa_threaded_mainloop_signal(pQuery->pBackend->mainloop, 0);
+}
+
+int PulseBackend::EnumSessions(const char *devId, WadSessionEnumFn *fn, void *arg)
+{
+	PulseSessionQuery query = { this, 0, NULL, 0, 0 };
+	char sessionId[WAD_NAME_LEN];
+	PulseDev *pDev;
+	pa_operation *op;
+	int i;
+
+	{
+		PULSE_LOCK();
+		pDev = FindDev(devId);
+		if (!pDev || !pDev->isActive) {
+			QueryDev(devId);
+			pDev = FindDev(devId);
+		}
+		if (!pDev || !pDev->isActive) {
+			SetErrorText("EnumSessions: device '%s' not available", devId);
+			return WAD_ERR_INVALID_DEVICE;
+		}
+		query.dev = pDev->index;
+		if (pDev->isInput)
+			op = pa_context_get_source_output_info_list(context, SourceOutputCb, &query);
+		else
+			op = pa_context_get_sink_input_info_list(context, SinkInputCb, &query);
+		if (!WaitOp(op)) {
+			free(query.list);
+			return Error("EnumSessions");
+		}
+	}
+	// call without the lock, in case fn calls back
+	for (i = 0; i < query.found; i++) {
+		FormatSessionId(query.list[i].isInput, query.list[i].index, sessionId, sizeof(sessionId));
+		fn(arg, sessionId, query.list[i].pid, query.list[i].procName);
+	}
+	free(query.list);
+	return WAD_OK;
+}
+
+//
+// Get the current state of an open session, with the mainloop locked.
+//
+int PulseBackend::QuerySession(WadHandle hSes, PulseSession *pSes)
+{
+	PulseHandle *pHandle = (PulseHandle *) hSes;
+	PulseSessionQuery query = { this, PA_INVALID_INDEX, NULL, 0, 0 };
+	pa_operation *op;
+
+	if (pHandle->isInput)
+		op = pa_context_get_source_output_info(context, pHandle->index, SourceOutputCb, &query);
+	else
+		op = pa_context_get_sink_input_info(context, pHandle->index, SinkInputCb, &query);
+	WaitOp(op);
+	if (!query.found) {
+		free(query.list);
+		SetErrorText("session expired");
+		return WAD_ERR_DEVICE_LOST;
+	}
+	*pSes = query.list[0];
+	free(query.list);
+	pHandle->volume = pSes->volume;
+	return WAD_OK;
+}
+
+int PulseBackend::OpenSession(const char *devId, const char *sessionId, WadHandle *phSes)
+{
+	PulseHandle *pHandle;
+	PulseSession ses;
+	int status;
+
+	UNUSED(devId);
+	pHandle = (PulseHandle *) malloc(sizeof(PulseHandle));
+	if (!pHandle) {
+		SetErrorText("out of memory");
+		return WAD_ERR_INTERNAL;
+	}
+	if (!ParseSessionId(sessionId, &pHandle->isInput, &pHandle->index)) {
+		free(pHandle);
+		SetErrorText("OpenSession: invalid session ID '%s'", sessionId);
+		return WAD_ERR_INVALID_ARG;
+	}
+	PULSE_LOCK();
+	if ((status = QuerySession(pHandle, &ses)) != WAD_OK) {
+		free(pHandle);
+		return status;
+	}
+	*phSes = pHandle;
+	return WAD_OK;
+}
+
+void PulseBackend::CloseSession(WadHandle hSes)
+{
+	free(hSes);
+}
+
+int PulseBackend::GetSessionVol(WadHandle hSes, float *pVol)
+{
+	PulseSession ses;
+	int status;
+
+	PULSE_LOCK();
+	if ((status = QuerySession(hSes, &ses)) != WAD_OK)
+		return status;
+	*pVol = CvolToFloat(&ses.volume);
+	return WAD_OK;
+}
+
+int PulseBackend::GetSessionMute(WadHandle hSes, bool *pMute)
+{
+	PulseSession ses;
+	int status;
+
+	PULSE_LOCK();
+	if ((status = QuerySession(hSes, &ses)) != WAD_OK)
+		return status;
+	*pMute = ses.mute;
+	return WAD_OK;
+}
+
+// like SetVol, scales the last known channel volumes
+int PulseBackend::SetSessionVol(WadHandle hSes, float vol)
+{
+	PulseHandle *pHandle = (PulseHandle *) hSes;
+	PulseQuery query = { this, 0 };
+	pa_cvolume cv;
+	pa_operation *op;
+
+	PULSE_LOCK();
+	cv = pHandle->volume;
+	pa_cvolume_scale(&cv, (pa_volume_t) (vol * PA_VOLUME_NORM + 0.5f));
+	if (pHandle->isInput)
+		op = pa_context_set_source_output_volume(context, pHandle->index, &cv, SuccessCb, &query);
+	else
+		op = pa_context_set_sink_input_volume(context, pHandle->index, &cv, SuccessCb, &query);
+	if (!WaitOp(op) || !query.found)
+		return Error(pHandle->isInput ? "pa_context_set_source_output_volume" :
+			"pa_context_set_sink_input_volume");
+	pHandle->volume = cv;
+	return WAD_OK;
+}
+
+int PulseBackend::SetSessionMute(WadHandle hSes, bool mute)
+{
+	PulseHandle *pHandle = (PulseHandle *) hSes;
+	PulseQuery query = { this, 0 };
+	pa_operation *op;
+
+	PULSE_LOCK();
+	if (pHandle->isInput)
+		op = pa_context_set_source_output_mute(context, pHandle->index, mute, SuccessCb, &query);
+	else
+		op = pa_context_set_sink_input_mute(context, pHandle->index, mute, SuccessCb, &query);
+	if (!WaitOp(op) || !query.found)
+		return Error(pHandle->isInput ? "pa_context_set_source_output_mute" :
+			"pa_context_set_sink_input_mute");
+	return WAD_OK;
+}
+
+void PulseBackend::EventSinkInputCb(pa_context *c, const pa_sink_input_info *i, int eol, void *userdata)
+{
+	PulseSession ses;
+	UNUSED(c);
+	if (eol == 0 && i) {
+		SinkInputToSession(i, &ses);
+		((PulseBackend *) userdata)->OnSessionInfo(&ses);
+	}
+}
+
+void PulseBackend::EventSourceOutputCb(pa_context *c, const pa_source_output_info *i, int eol, void *userdata)
+{
+	PulseSession ses;
+	UNUSED(c);
+	if (eol == 0 && i) {
+		SourceOutputToSession(i, &ses);
+		((PulseBackend *) userdata)->OnSessionInfo(&ses);
+	}
+}
+
+// Queue a session reply to an event for the listener, on the mainloop thread
+void PulseBackend::OnSessionInfo(const PulseSession *pSes)
+{
+	PulseDev *pDev = FindDevByIndex(pSes->dev, pSes->isInput);
+	PulseEvent *pEvent;
+
+	if (!pDev)
+		return;
+	pEvent = new PulseEvent();
+	pEvent->type = PULSE_EV_SESSION;
+	CopyStr(pEvent->devId, pDev->name, sizeof(pEvent->devId));
+	pEvent->isInput = pSes->isInput;
+	pEvent->isActive = true;
+	FormatSessionId(pSes->isInput, pSes->index, pEvent->sessionId, sizeof(pEvent->sessionId));
+	pEvent->pid = pSes->pid;
+	CopyStr(pEvent->procName, pSes->procName, sizeof(pEvent->procName));
+	QueueEvent(pEvent);
+}
+
+int PulseBackend::WatchSessions(const char *devId, WadHandle *phWatch)
+{
+	PulseDev *pDev;
+	int status;
+
+	PULSE_LOCK();
+	if ((status = Subscribe()) != WAD_OK)
+		return status;
+	pDev = FindDev(devId);
+	if (!pDev || !pDev->isActive) {
+		SetErrorText("WatchSessions: device '%s' not available", devId);
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	numSesWatches++;
+	// nothing per device to keep, any non-NULL handle will do
+	*phWatch = pDev;
+	return WAD_OK;
+}
+
+void PulseBackend::UnwatchSessions(WadHandle hWatch)
+{
+	UNUSED(hWatch);
+	PULSE_LOCK();
+	numSesWatches--;
+}
@@ -0,0 +1,141 @@
+/** PulseAudio backend
+
+Devices are PulseAudio sinks (outputs) and sources (inputs), excluding
+monitor sources, identified by their PulseAudio name. This also works with
+PipeWire through its PulseAudio server. Device names are the sink or source
+description, and volume is the loudest channel relative to PA_VOLUME_NORM.
+
+The asynchronous API is used from a threaded mainloop. Requests that don't
+depend on each other are issued together and waited for once, so Init
+fetches sinks, sources and server defaults in one round trip, and a device
+lookup by ID asks for the sink and source of that name at the same time.
+Replies are kept, so a volume change is one round trip, scaling the last
+known channel volumes to keep the balance. Change events arrive on the
+mainloop thread and are passed to the listener and watches on a separate
+thread, so callbacks can call back into the backend.
+
+Sessions are the sink inputs of a sink and the source outputs of a
+source, with IDs like "sink-input-12", named by the process binary.
+Session events are sent for all devices once any is watched, and the
+listener ignores devices it isn't tracking.
+
+Peak meters are record streams with peak detection, on a source or on a
+sink's monitor source.
+
+PulseAudio has no per-role default devices, so the role is ignored.
+
+@file PulseBackend.h
+*/
+#ifndef _PULSE_BACKEND_H
+#define _PULSE_BACKEND_H
+
+#include <pulse/pulseaudio.h>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include "WadBackend.h"
+
+struct PulseDev;
+struct PulseWatch;
+struct PulseEvent;
+struct PulseSession;
+
+class PulseBackend : public WadBackend {
+protected:
+	pa_threaded_mainloop *mainloop;
+	pa_context *context;
+	// known devices, updated by replies and events, guarded by the mainloop lock
+	PulseDev *devs;
+	int numDevs;
+	int devsSize;
+	char defaultSink[WAD_NAME_LEN];
+	char defaultSource[WAD_NAME_LEN];
+	bool listValid[2];			//!< T/F if device list is current, by isInput
+	bool serverValid;			//!< T/F if defaults are current
+	bool isSubscribed;			//!< T/F if change events keep the above current
+	// change events, delivered on eventThread
+	std::thread eventThread;
+	std::mutex eventLock;		//!< guards eventQueue and stopEvents
+	std::condition_variable eventCond;
+	std::deque<PulseEvent *> eventQueue;
+	bool stopEvents;
+	std::recursive_mutex listenerLock;	//!< held while calling listener
+	WadBackendListener *listener;
+	std::recursive_mutex watchLock;	//!< guards watches, held while calling them
+	PulseWatch *watches;
+	int numSesWatches;			//!< number of session watches, guarded by the mainloop lock
+
+	bool WaitOp(pa_operation *op);
+	int Error(const char *funcName);
+	PulseDev *FindDev(const char *name, int isInput = -1);
+	PulseDev *FindDevByIndex(uint32_t index, bool isInput);
+	PulseDev *UpdateDev(const PulseDev *pNew);
+	int QueryDev(const char *name);
+	int QueryLists(bool server);
+	int QueryHandle(WadHandle hDev, PulseDev *pDev);
+	int QuerySession(WadHandle hSes, PulseSession *pSes);
+	int Subscribe();
+	void QueueEvent(PulseEvent *pEvent);
+	void EventLoop();
+
+	// mainloop callbacks
+	static void ContextStateCb(pa_context *c, void *userdata);
+	static void SinkInfoCb(pa_context *c, const pa_sink_info *i, int eol, void *userdata);
+	static void SourceInfoCb(pa_context *c, const pa_source_info *i, int eol, void *userdata);
+	static void ServerInfoCb(pa_context *c, const pa_server_info *i, void *userdata);
+	static void SuccessCb(pa_context *c, int success, void *userdata);
+	static void SubscribeCb(pa_context *c, pa_subscription_event_type_t t, uint32_t index, void *userdata);
+	static void EventSinkCb(pa_context *c, const pa_sink_info *i, int eol, void *userdata);
+	static void EventSourceCb(pa_context *c, const pa_source_info *i, int eol, void *userdata);
+	static void EventServerCb(pa_context *c, const pa_server_info *i, void *userdata);
+	static void SinkInputCb(pa_context *c, const pa_sink_input_info *i, int eol, void *userdata);
+	static void SourceOutputCb(pa_context *c, const pa_source_output_info *i, int eol, void *userdata);
+	static void EventSinkInputCb(pa_context *c, const pa_sink_input_info *i, int eol, void *userdata);
+	static void EventSourceOutputCb(pa_context *c, const pa_source_output_info *i, int eol, void *userdata);
+	static void MeterStateCb(pa_stream *s, void *userdata);
+	static void MeterReadCb(pa_stream *s, size_t nbytes, void *userdata);
+	void OnSessionInfo(const PulseSession *pSes);
+	void OnDevInfo(const PulseDev *pDev);
+
+public:
+	PulseBackend();
+	~PulseBackend();
+
+	const char *GetName();
+	int Init(int role);
+	int EnumDevices(bool isInput, bool getNames, WadEnumFn *fn, void *arg);
+	int GetDefaultDev(bool isInput, char *devId, size_t len);
+	int GetDevState(const char *devId, bool *pIsActive, bool *pIsInput);
+	int GetDevName(const char *devId, char *name, size_t len);
+	int OpenDev(const char *devId, WadHandle *phDev);
+	void CloseDev(WadHandle hDev);
+	int GetVol(WadHandle hDev, float *pVol);
+	int SetVol(WadHandle hDev, float vol);
+	int GetMute(WadHandle hDev, bool *pMute);
+	int SetMute(WadHandle hDev, bool mute);
+	int GetChannelCount(WadHandle hDev, int *pNum);
+	int GetChannelVols(WadHandle hDev, float *vols, int *pNum);
+	int SetChannelVols(WadHandle hDev, const float *vols, int num);
+	int GetChannelSides(const char *devId, unsigned char *sides, int *pNum);
+	int GetVolRange(WadHandle hDev, float *pMinDb, float *pMaxDb, float *pStepDb);
+	int GetVolDb(WadHandle hDev, float *pDb);
+	int SetVolDb(WadHandle hDev, float db);
+	int OpenMeter(const char *devId, WadHandle *phMeter);
+	void CloseMeter(WadHandle hMeter);
+	int GetPeaks(WadHandle hMeter, float *pPeak, float *chanPeaks, int *pNum);
+	int SetListener(WadBackendListener *listener);
+	int Watch(const char *devId, int devIndex, WadVolChangeFn *fn, void *arg, WadHandle *phWatch);
+	void Unwatch(WadHandle hWatch);
+	int EnumSessions(const char *devId, WadSessionEnumFn *fn, void *arg);
+	int WatchSessions(const char *devId, WadHandle *phWatch);
+	void UnwatchSessions(WadHandle hWatch);
+	int OpenSession(const char *devId, const char *sessionId, WadHandle *phSes);
+	void CloseSession(WadHandle hSes);
+	int GetSessionVol(WadHandle hSes, float *pVol);
+	int SetSessionVol(WadHandle hSes, float vol);
+	int GetSessionMute(WadHandle hSes, bool *pMute);
+	int SetSessionMute(WadHandle hSes, bool mute);
+};
+
+#endif
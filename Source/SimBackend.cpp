@@ -0,0 +1,744 @@
+//
+// Simulated audio device backend.
+//
+// Devices are named and numbered like WASAPI endpoints so the front end
+// sees realistic IDs and names. Latency under a millisecond is spun, since
+// sleeping that briefly isn't accurate on most systems.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <chrono>
+#include <thread>
+#include "SimBackend.h"
+#include "MiscDef.h"
+#include "WaLog.h"
+
+#define THIS_FILE	"SimBackend.cpp"
+
+#define SIM_MAX_NOTIFY	16		// watches called per change
+#define SIM_CHANNELS	2		// channels of each device, until set
+#define SIM_LEVEL_HZ	0.5		// rate the simulated audio level swells at
+// dB range of a typical sound card, volume 0 is the bottom of the range
+#define SIM_MIN_DB		(-65.25f)
+#define SIM_MAX_DB		0.0f
+#define SIM_STEP_DB		0.03125f
+// session IDs are a device ID with an instance part, as Windows builds them
+#define SIM_SES_ID_LEN	(WAD_NAME_LEN + 80)
+
+struct SimDev {
+	char id[WAD_NAME_LEN];
+	char name[WAD_DEV_NAME_LEN];
+	bool isInput;
+	bool isActive;
+	float vol;			// loudest channel
+	bool mute;
+	int numSesWatch;	// number of session watches
+	int numChannels;
+	float chanVols[WAD_MAX_CHANNELS];
+};
+
+struct SimSession {
+	char id[SIM_SES_ID_LEN];
+	int dev;
+	unsigned long pid;
+	char procName[WAD_NAME_LEN];
+	bool isActive;
+	float vol;
+	bool mute;
+};
+
+struct SimWatch {
+	int dev;
+	int devIndex;
+	WadVolChangeFn *fn;
+	void *arg;
+	SimWatch *next;
+};
+
+// handles are device numbers plus one, so never NULL
+#define DEV_TO_HANDLE(dev)	((WadHandle) (intptr_t) ((dev) + 1))
+#define HANDLE_TO_DEV(h)	((int) (intptr_t) (h) - 1)
+// session handles are the same with session numbers
+#define HANDLE_TO_SES(h)	HANDLE_TO_DEV(h)
+
+SimBackend::SimBackend(int _numInputs, int _numOutputs, int _latencyUsec) :
+	numInputs(_numInputs), numOutputs(_numOutputs), latencyUsec(_latencyUsec)
+{
+	devs = NULL;
+	numDevs = 0;
+	watches = NULL;
+	sessions = NULL;
+	numSessions = 0;
+	sessionsSize = 0;
+	listener = NULL;
+}
+
+SimBackend::~SimBackend()
+{
+	SimWatch *pWatch;
+	while (watches) {
+		pWatch = watches;
+		watches = pWatch->next;
+		delete pWatch;
+	}
+	free(sessions);
+	free(devs);
+}
+
+const char *SimBackend::GetName()
+{
+	return "sim";
+}
+
+void SimBackend::Delay()
+{
+	std::chrono::steady_clock::time_point end;
+
+	if (latencyUsec <= 0)
+		return;
+	if (latencyUsec >= 1000) {
+		std::this_thread::sleep_for(std::chrono::microseconds(latencyUsec));
+		return;
+	}
+	end = std::chrono::steady_clock::now() + std::chrono::microseconds(latencyUsec);
+	while (std::chrono::steady_clock::now() < end)
+		;
+}
+
+void SimBackend::SetLatency(int usec)
+{
+	latencyUsec = usec;
+}
+
+int SimBackend::Init(int role)
+{
+	int i;
+	SimDev *pDev;
+
+	UNUSED(role);
+	Delay();
+	numDevs = numInputs + numOutputs;
+	devs = (SimDev *) calloc(MAX(numDevs, 1), sizeof(SimDev));
+	if (!devs) {
+		SetErrorText("out of memory");
+		return WAD_ERR_INTERNAL;
+	}
+	for (i = 0; i < numDevs; i++) {
+		pDev = &devs[i];
+		pDev->isInput = i < numInputs;
+		pDev->isActive = true;
+		pDev->vol = 0.5f;
+		pDev->numChannels = SIM_CHANNELS;
+		pDev->chanVols[0] = pDev->chanVols[1] = pDev->vol;
+		// WASAPI style IDs, capture endpoints are {0.0.1...}
+		_snprintf(pDev->id, sizeof(pDev->id), "{0.0.%d.00000000}.{%08x-5afe-4a1d-9d5c-%012x}",
+			pDev->isInput, 0x51ad0000 + i, i);
+		if (pDev->isInput)
+			_snprintf(pDev->name, sizeof(pDev->name), "Microphone %d (Simulated Audio)", i + 1);
+		else
+			_snprintf(pDev->name, sizeof(pDev->name), "Speakers %d (Simulated Audio)", i - numInputs + 1);
+	}
+	if (numOutputs > 0) {
+		AddSession(numInputs, 0, "System Sounds");
+		AddSession(numInputs, 4100, "player.exe");
+		AddSession(numInputs, 4200, "chat.exe");
+	}
+	WA_LOG(2, (THIS_FILE, "Init: %d inputs %d outputs latency %d usec", numInputs, numOutputs,
+		latencyUsec));
+	return WAD_OK;
+}
+
+int SimBackend::FindDev(const char *devId)
+{
+	int i;
+	for (i = 0; i < numDevs; i++) {
+		if (!strcmp(devs[i].id, devId))
+			return i;
+	}
+	return -1;
+}
+
+int SimBackend::EnumDevices(bool isInput, bool getNames, WadEnumFn *fn, void *arg)
+{
+	int i;
+
+	Delay();
+	for (i = 0; i < numDevs; i++) {
+		if (devs[i].isInput == isInput && devs[i].isActive) {
+			// a name is read from each device's properties, a call per device
+			if (getNames)
+				Delay();
+			fn(arg, devs[i].id, getNames ? devs[i].name : NULL);
+		}
+	}
+	return WAD_OK;
+}
+
+int SimBackend::GetDefaultDev(bool isInput, char *devId, size_t len)
+{
+	int i;
+
+	Delay();
+	std::lock_guard<std::mutex> guard(simLock);
+	for (i = 0; i < numDevs; i++) {
+		if (devs[i].isInput == isInput && devs[i].isActive) {
+			strncpy(devId, devs[i].id, len - 1);
+			devId[len - 1] = 0;
+			return WAD_OK;
+		}
+	}
+	SetErrorText("no default %s device", isInput ? "input" : "output");
+	return WAD_ERR_INVALID_DEVICE;
+}
+
+int SimBackend::GetDevState(const char *devId, bool *pIsActive, bool *pIsInput)
+{
+	int dev;
+
+	Delay();
+	std::lock_guard<std::mutex> guard(simLock);
+	if ((dev = FindDev(devId)) < 0) {
+		SetErrorText("unknown device ID '%s'", devId);
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	*pIsActive = devs[dev].isActive;
+	*pIsInput = devs[dev].isInput;
+	return WAD_OK;
+}
+
+int SimBackend::GetDevName(const char *devId, char *name, size_t len)
+{
+	int dev;
+
+	Delay();
+	if ((dev = FindDev(devId)) < 0) {
+		SetErrorText("unknown device ID '%s'", devId);
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	WadCopyUtf8(name, devs[dev].name, len);
+	return WAD_OK;
+}
+
+int SimBackend::OpenDev(const char *devId, WadHandle *phDev)
+{
+	int dev;
+
+	Delay();
+	std::lock_guard<std::mutex> guard(simLock);
+	dev = FindDev(devId);
+	if (dev < 0 || !devs[dev].isActive) {
+		SetErrorText("OpenDev: device '%s' not available", devId);
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	*phDev = DEV_TO_HANDLE(dev);
+	return WAD_OK;
+}
+
+void SimBackend::CloseDev(WadHandle hDev)
+{
+	UNUSED(hDev);
+}
+
+// Check handle, with simLock held
+#define CHECK_DEV(dev, funcName) \
+	if (!devs[dev].isActive) { \
+		SetErrorText("%s: device removed", funcName); \
+		return WAD_ERR_DEVICE_LOST; \
+	}
+
+int SimBackend::GetVol(WadHandle hDev, float *pVol)
+{
+	int dev = HANDLE_TO_DEV(hDev);
+
+	Delay();
+	std::lock_guard<std::mutex> guard(simLock);
+	CHECK_DEV(dev, "GetVol");
+	*pVol = devs[dev].vol;
+	return WAD_OK;
+}
+
+// Scale the channels so the loudest is at vol, as WASAPI and PulseAudio do
+int SimBackend::SetVol(WadHandle hDev, float vol)
+{
+	int dev = HANDLE_TO_DEV(hDev);
+	SimDev *pDev = &devs[dev];
+	int i;
+
+	Delay();
+	{
+		std::lock_guard<std::mutex> guard(simLock);
+		CHECK_DEV(dev, "SetVol");
+		for (i = 0; i < pDev->numChannels; i++)
+			pDev->chanVols[i] = pDev->vol > 0 ? pDev->chanVols[i] * vol / pDev->vol : vol;
+		pDev->vol = vol;
+	}
+	NotifyWatches(dev);
+	return WAD_OK;
+}
+
+int SimBackend::GetVolRange(WadHandle hDev, float *pMinDb, float *pMaxDb, float *pStepDb)
+{
+	int dev = HANDLE_TO_DEV(hDev);
+
+	Delay();
+	std::lock_guard<std::mutex> guard(simLock);
+	CHECK_DEV(dev, "GetVolRange");
+	*pMinDb = SIM_MIN_DB;
+	*pMaxDb = SIM_MAX_DB;
+	*pStepDb = SIM_STEP_DB;
+	return WAD_OK;
+}
+
+// volume is amplitude, dB are 20 * log10 of it, within the range
+int SimBackend::GetVolDb(WadHandle hDev, float *pDb)
+{
+	float vol;
+	int status;
+
+	if ((status = GetVol(hDev, &vol)) != WAD_OK)
+		return status;
+	*pDb = vol > 0 ? MAX(20 * log10f(vol), SIM_MIN_DB) : SIM_MIN_DB;
+	return WAD_OK;
+}
+
+int SimBackend::SetVolDb(WadHandle hDev, float db)
+{
+	if (db < SIM_MIN_DB || db > SIM_MAX_DB) {
+		SetErrorText("SetVolDb: %.2f dB is out of range", db);
+		return WAD_ERR_INVALID_ARG;
+	}
+	// snapped to a step, as a sound card does
+	db = SIM_MIN_DB + floorf((db - SIM_MIN_DB) / SIM_STEP_DB + 0.5f) * SIM_STEP_DB;
+	return SetVol(hDev, db <= SIM_MIN_DB ? 0 : powf(10, db / 20));
+}
+
+int SimBackend::GetMute(WadHandle hDev, bool *pMute)
+{
+	int dev = HANDLE_TO_DEV(hDev);
+
+	Delay();
+	std::lock_guard<std::mutex> guard(simLock);
+	CHECK_DEV(dev, "GetMute");
+	*pMute = devs[dev].mute;
+	return WAD_OK;
+}
+
+int SimBackend::SetMute(WadHandle hDev, bool mute)
+{
+	int dev = HANDLE_TO_DEV(hDev);
+
+	Delay();
+	{
+		std::lock_guard<std::mutex> guard(simLock);
+		CHECK_DEV(dev, "SetMute");
+		devs[dev].mute = mute;
+	}
+	NotifyWatches(dev);
+	return WAD_OK;
+}
+
+int SimBackend::GetChannelCount(WadHandle hDev, int *pNum)
+{
+	int dev = HANDLE_TO_DEV(hDev);
+
+	Delay();
+	std::lock_guard<std::mutex> guard(simLock);
+	CHECK_DEV(dev, "GetChannelCount");
+	*pNum = devs[dev].numChannels;
+	return WAD_OK;
+}
+
+int SimBackend::GetChannelVols(WadHandle hDev, float *vols, int *pNum)
+{
+	int dev = HANDLE_TO_DEV(hDev);
+
+	Delay();
+	std::lock_guard<std::mutex> guard(simLock);
+	CHECK_DEV(dev, "GetChannelVols");
+	*pNum = devs[dev].numChannels;
+	memcpy(vols, devs[dev].chanVols, *pNum * sizeof(float));
+	return WAD_OK;
+}
+
+int SimBackend::SetChannelVols(WadHandle hDev, const float *vols, int num)
+{
+	int dev = HANDLE_TO_DEV(hDev);
+	SimDev *pDev = &devs[dev];
+	int i;
+
+	Delay();
+	{
+		std::lock_guard<std::mutex> guard(simLock);
+		CHECK_DEV(dev, "SetChannelVols");
+		if (num != pDev->numChannels) {
+			SetErrorText("SetChannelVols: %d channels given, device has %d", num, pDev->numChannels);
+			return WAD_ERR_INVALID_ARG;
+		}
+		pDev->vol = 0;
+		for (i = 0; i < num; i++) {
+			pDev->chanVols[i] = vols[i];
+			pDev->vol = MAX(pDev->vol, vols[i]);
+		}
+	}
+	NotifyWatches(dev);
+	return WAD_OK;
+}
+
+int SimBackend::SetListener(WadBackendListener *_listener)
+{
+	std::lock_guard<std::mutex> guard(simLock);
+	listener = _listener;
+	return WAD_OK;
+}
+
+int SimBackend::Watch(const char *devId, int devIndex, WadVolChangeFn *fn, void *arg, WadHandle *phWatch)
+{
+	SimWatch *pWatch;
+	int dev;
+
+	Delay();
+	std::lock_guard<std::mutex> guard(simLock);
+	if ((dev = FindDev(devId)) < 0) {
+		SetErrorText("Watch: unknown device ID '%s'", devId);
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	pWatch = new SimWatch;
+	pWatch->dev = dev;
+	pWatch->devIndex = devIndex;
+	pWatch->fn = fn;
+	pWatch->arg = arg;
+	pWatch->next = watches;
+	watches = pWatch;
+	*phWatch = pWatch;
+	return WAD_OK;
+}
+
+void SimBackend::Unwatch(WadHandle hWatch)
+{
+	SimWatch **ppWatch;
+
+	std::lock_guard<std::mutex> guard(simLock);
+	for (ppWatch = &watches; *ppWatch; ppWatch = &(*ppWatch)->next) {
+		if (*ppWatch == hWatch) {
+			*ppWatch = (*ppWatch)->next;
+			delete (SimWatch *) hWatch;
+			break;
+		}
+	}
+}
+
+//
+// Call the watches of a device with its current volume and mute. The
+// callbacks are collected under the lock and called without it, so they
+// may call back into the backend.
+//
+void SimBackend::NotifyWatches(int dev)
+{
+	SimWatch calls[SIM_MAX_NOTIFY];
+	SimWatch *pWatch;
+	float vol;
+	bool mute;
+	int i, n = 0;
+
+	{
+		std::lock_guard<std::mutex> guard(simLock);
+		for (pWatch = watches; pWatch && n < SIM_MAX_NOTIFY; pWatch = pWatch->next) {
+			if (pWatch->dev == dev)
+				calls[n++] = *pWatch;
+		}
+		vol = devs[dev].vol;
+		mute = devs[dev].mute;
+	}
+	for (i = 0; i < n; i++)
+		calls[i].fn(calls[i].arg, calls[i].devIndex, vol, mute);
+}
+
+//
+// Plug or unplug a device and tell the listener, as the audio system would.
+//
+int SimBackend::SetDevActive(int dev, bool isActive)
+{
+	WadBackendListener *pListener;
+	char id[WAD_NAME_LEN];
+	bool isInput;
+
+	{
+		std::lock_guard<std::mutex> guard(simLock);
+		if (dev < 0 || dev >= numDevs) {
+			SetErrorText("SetDevActive: device %d is not valid", dev);
+			return WAD_ERR_INVALID_DEVICE;
+		}
+		devs[dev].isActive = isActive;
+		strcpy(id, devs[dev].id);
+		isInput = devs[dev].isInput;
+		pListener = listener;
+	}
+	if (pListener)
+		pListener->OnDeviceState(id, isActive, isInput);
+	return WAD_OK;
+}
+
+int SimBackend::OpenMeter(const char *devId, WadHandle *phMeter)
+{
+	return OpenDev(devId, phMeter);
+}
+
+void SimBackend::CloseMeter(WadHandle hMeter)
+{
+	UNUSED(hMeter);
+}
+
+//
+// The simulated audio swells and fades, a little out of step on each
+// channel, scaled by the channel volume, and silent when muted.
+//
+int SimBackend::GetPeaks(WadHandle hMeter, float *pPeak, float *chanPeaks, int *pNum)
+{
+	int dev = HANDLE_TO_DEV(hMeter);
+	double t = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	float phase = (float) fmod(t * SIM_LEVEL_HZ, 1.0) * 6.2831853f;
+	int i;
+
+	Delay();
+	std::lock_guard<std::mutex> guard(simLock);
+	CHECK_DEV(dev, "GetPeaks");
+	*pNum = devs[dev].numChannels;
+	*pPeak = 0;
+	for (i = 0; i < *pNum; i++) {
+		chanPeaks[i] = devs[dev].mute ? 0 : devs[dev].chanVols[i] * (0.5f + 0.5f * sinf(phase + i));
+		*pPeak = MAX(*pPeak, chanPeaks[i]);
+	}
+	return WAD_OK;
+}
+
+//
+// Change the channel layout of a device, e.g., to 6 for 5.1, with every
+// channel at the device volume.
+//
+int SimBackend::SetNumChannels(int dev, int num)
+{
+	int i;
+
+	std::lock_guard<std::mutex> guard(simLock);
+	if (dev < 0 || dev >= numDevs || num < 1 || num > WAD_MAX_CHANNELS) {
+		SetErrorText("SetNumChannels: device %d or %d channels is not valid", dev, num);
+		return WAD_ERR_INVALID_ARG;
+	}
+	devs[dev].numChannels = num;
+	for (i = 0; i < num; i++)
+		devs[dev].chanVols[i] = devs[dev].vol;
+	return WAD_OK;
+}
+
+//=============================================================================
+//
+// Sessions
+//
+// Session IDs follow the WASAPI session instance format, device ID and a
+// per-process part, so they are unique across devices.
+//
+
+int SimBackend::FindSession(const char *sessionId)
+{
+	int i;
+	for (i = 0; i < numSessions; i++) {
+		if (!strcmp(sessions[i].id, sessionId))
+			return i;
+	}
+	return -1;
+}
+
+int SimBackend::EnumSessions(const char *devId, WadSessionEnumFn *fn, void *arg)
+{
+	SimSession *list;
+	int dev, i, n = 0;
+
+	Delay();
+	{
+		std::lock_guard<std::mutex> guard(simLock);
+		if ((dev = FindDev(devId)) < 0 || !devs[dev].isActive) {
+			SetErrorText("EnumSessions: device '%s' not available", devId);
+			return WAD_ERR_INVALID_DEVICE;
+		}
+		list = (SimSession *) malloc(MAX(numSessions, 1) * sizeof(SimSession));
+		if (!list) {
+			SetErrorText("out of memory");
+			return WAD_ERR_INTERNAL;
+		}
+		for (i = 0; i < numSessions; i++) {
+			if (sessions[i].dev == dev && sessions[i].isActive)
+				list[n++] = sessions[i];
+		}
+	}
+	// call without the lock, in case fn calls back
+	for (i = 0; i < n; i++)
+		fn(arg, list[i].id, list[i].pid, list[i].procName);
+	free(list);
+	return WAD_OK;
+}
+
+int SimBackend::WatchSessions(const char *devId, WadHandle *phWatch)
+{
+	int dev;
+
+	Delay();
+	std::lock_guard<std::mutex> guard(simLock);
+	if ((dev = FindDev(devId)) < 0) {
+		SetErrorText("WatchSessions: unknown device ID '%s'", devId);
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	devs[dev].numSesWatch++;
+	*phWatch = DEV_TO_HANDLE(dev);
+	return WAD_OK;
+}
+
+void SimBackend::UnwatchSessions(WadHandle hWatch)
+{
+	std::lock_guard<std::mutex> guard(simLock);
+	devs[HANDLE_TO_DEV(hWatch)].numSesWatch--;
+}
+
+int SimBackend::OpenSession(const char *devId, const char *sessionId, WadHandle *phSes)
+{
+	int ses;
+
+	UNUSED(devId);
+	Delay();
+	std::lock_guard<std::mutex> guard(simLock);
+	ses = FindSession(sessionId);
+	if (ses < 0 || !sessions[ses].isActive) {
+		SetErrorText("OpenSession: session '%s' not available", sessionId);
+		return WAD_ERR_DEVICE_LOST;
+	}
+	*phSes = DEV_TO_HANDLE(ses);
+	return WAD_OK;
+}
+
+void SimBackend::CloseSession(WadHandle hSes)
+{
+	UNUSED(hSes);
+}
+
+// Check session handle, with simLock held
+#define CHECK_SES(ses, funcName) \
+	if (!sessions[ses].isActive || !devs[sessions[ses].dev].isActive) { \
+		SetErrorText("%s: session expired", funcName); \
+		return WAD_ERR_DEVICE_LOST; \
+	}
+
+int SimBackend::GetSessionVol(WadHandle hSes, float *pVol)
+{
+	int ses = HANDLE_TO_SES(hSes);
+
+	Delay();
+	std::lock_guard<std::mutex> guard(simLock);
+	CHECK_SES(ses, "GetSessionVol");
+	*pVol = sessions[ses].vol;
+	return WAD_OK;
+}
+
+int SimBackend::SetSessionVol(WadHandle hSes, float vol)
+{
+	int ses = HANDLE_TO_SES(hSes);
+
+	Delay();
+	std::lock_guard<std::mutex> guard(simLock);
+	CHECK_SES(ses, "SetSessionVol");
+	sessions[ses].vol = vol;
+	return WAD_OK;
+}
+
+int SimBackend::GetSessionMute(WadHandle hSes, bool *pMute)
+{
+	int ses = HANDLE_TO_SES(hSes);
+
+	Delay();
+	std::lock_guard<std::mutex> guard(simLock);
+	CHECK_SES(ses, "GetSessionMute");
+	*pMute = sessions[ses].mute;
+	return WAD_OK;
+}
+
+int SimBackend::SetSessionMute(WadHandle hSes, bool mute)
+{
+	int ses = HANDLE_TO_SES(hSes);
+
+	Delay();
+	std::lock_guard<std::mutex> guard(simLock);
+	CHECK_SES(ses, "SetSessionMute");
+	sessions[ses].mute = mute;
+	return WAD_OK;
+}
+
+//
+// Tell the listener a session started or expired, if its device has
+// session watches.
+//
+void SimBackend::NotifySession(int ses)
+{
+	WadBackendListener *pListener;
+	SimSession session;
+	char devId[WAD_NAME_LEN];
+
+	{
+		std::lock_guard<std::mutex> guard(simLock);
+		session = sessions[ses];
+		strcpy(devId, devs[session.dev].id);
+		pListener = devs[session.dev].numSesWatch > 0 ? listener : NULL;
+	}
+	if (pListener)
+		pListener->OnSessionState(devId, session.id, session.pid, session.procName, session.isActive);
+}
+
+int SimBackend::AddSession(int dev, unsigned long pid, const char *procName)
+{
+	SimSession *pSes;
+	int ses;
+
+	{
+		std::lock_guard<std::mutex> guard(simLock);
+		if (dev < 0 || dev >= numDevs) {
+			SetErrorText("AddSession: device %d is not valid", dev);
+			return -1;
+		}
+		if (numSessions >= sessionsSize) {
+			int newSize = sessionsSize ? 2 * sessionsSize : 8;
+			SimSession *newSessions = (SimSession *) realloc(sessions, newSize * sizeof(SimSession));
+			if (!newSessions) {
+				SetErrorText("out of memory");
+				return -1;
+			}
+			sessions = newSessions;
+			sessionsSize = newSize;
+		}
+		ses = numSessions++;
+		pSes = &sessions[ses];
+		memset(pSes, 0, sizeof(SimSession));
+		_snprintf(pSes->id, sizeof(pSes->id), "%s|#%%b{%08x-5afe-4a1d-9d5c-%012x}|%lu", devs[dev].id,
+			0x51ad5000 + ses, ses, pid);
+		pSes->dev = dev;
+		pSes->pid = pid;
+		strncpy(pSes->procName, procName, sizeof(pSes->procName) - 1);
+		pSes->isActive = true;
+		pSes->vol = 1.0f;
+	}
+	NotifySession(ses);
+	return ses;
+}
+
+int SimBackend::EndSession(int ses)
+{
+	{
+		std::lock_guard<std::mutex> guard(simLock);
+		if (ses < 0 || ses >= numSessions) {
+			SetErrorText("EndSession: session %d is not valid", ses);
+			return WAD_ERR_INVALID_SESSION;
+		}
+		sessions[ses].isActive = false;
+	}
+	NotifySession(ses);
+	return WAD_OK;
+}
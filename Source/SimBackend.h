@@ -0,0 +1,97 @@
+/** Simulated audio device backend
+
+An in-process backend with a configurable number of input and output
+devices and a fixed latency added to each call, standing in for a real
+audio system in benchmarks and on machines without one. Volume, channel
+volumes and mute are kept in memory, and watches fire on every change.
+Volume in dB has the range and step of a typical sound card.
+Peak meters follow a slow swell scaled by the channel volumes.
+The first output device starts with a few application sessions, and more
+can be added.
+
+@file SimBackend.h
+*/
+#ifndef _SIM_BACKEND_H
+#define _SIM_BACKEND_H
+
+#include <mutex>
+#include "WadBackend.h"
+
+struct SimDev;
+struct SimWatch;
+struct SimSession;
+
+class SimBackend : public WadBackend {
+protected:
+	int numInputs;				//!< number of input devices
+	int numOutputs;				//!< number of output devices
+	int latencyUsec;			//!< latency added to each call
+	SimDev *devs;				//!< devices, inputs first, allocated by Init
+	int numDevs;
+	SimWatch *watches;			//!< list of watches
+	SimSession *sessions;		//!< sessions, allocated
+	int numSessions;
+	int sessionsSize;
+	WadBackendListener *listener;
+	std::mutex simLock;			//!< guards devices and watches
+	//! Wait for the simulated latency
+	void Delay();
+	//! Find device by ID, return -1 if not found
+	int FindDev(const char *devId);
+	//! Call watches for a device, without simLock held
+	void NotifyWatches(int dev);
+	int FindSession(const char *sessionId);
+	//! Tell the listener about a session if its device is watched
+	void NotifySession(int ses);
+
+public:
+	SimBackend(int numInputs = 2, int numOutputs = 4, int latencyUsec = 0);
+	~SimBackend();
+
+	const char *GetName();
+	int Init(int role);
+	int EnumDevices(bool isInput, bool getNames, WadEnumFn *fn, void *arg);
+	int GetDefaultDev(bool isInput, char *devId, size_t len);
+	int GetDevState(const char *devId, bool *pIsActive, bool *pIsInput);
+	int GetDevName(const char *devId, char *name, size_t len);
+	int OpenDev(const char *devId, WadHandle *phDev);
+	void CloseDev(WadHandle hDev);
+	int GetVol(WadHandle hDev, float *pVol);
+	int SetVol(WadHandle hDev, float vol);
+	int GetMute(WadHandle hDev, bool *pMute);
+	int SetMute(WadHandle hDev, bool mute);
+	int GetChannelCount(WadHandle hDev, int *pNum);
+	int GetChannelVols(WadHandle hDev, float *vols, int *pNum);
+	int SetChannelVols(WadHandle hDev, const float *vols, int num);
+	int GetVolRange(WadHandle hDev, float *pMinDb, float *pMaxDb, float *pStepDb);
+	int GetVolDb(WadHandle hDev, float *pDb);
+	int SetVolDb(WadHandle hDev, float db);
+	int OpenMeter(const char *devId, WadHandle *phMeter);
+	void CloseMeter(WadHandle hMeter);
+	int GetPeaks(WadHandle hMeter, float *pPeak, float *chanPeaks, int *pNum);
+	int SetListener(WadBackendListener *listener);
+	int Watch(const char *devId, int devIndex, WadVolChangeFn *fn, void *arg, WadHandle *phWatch);
+	void Unwatch(WadHandle hWatch);
+	int EnumSessions(const char *devId, WadSessionEnumFn *fn, void *arg);
+	int WatchSessions(const char *devId, WadHandle *phWatch);
+	void UnwatchSessions(WadHandle hWatch);
+	int OpenSession(const char *devId, const char *sessionId, WadHandle *phSes);
+	void CloseSession(WadHandle hSes);
+	int GetSessionVol(WadHandle hSes, float *pVol);
+	int SetSessionVol(WadHandle hSes, float vol);
+	int GetSessionMute(WadHandle hSes, bool *pMute);
+	int SetSessionMute(WadHandle hSes, bool mute);
+
+	//! Change the per-call latency
+	void SetLatency(int usec);
+	//! Simulate a device being plugged or unplugged, by index, inputs first
+	int SetDevActive(int dev, bool isActive);
+	//! Set the number of channels of a device, by index, 2 by default
+	int SetNumChannels(int dev, int num);
+	//! Simulate an application starting a session on a device, returns its number
+	int AddSession(int dev, unsigned long pid, const char *procName);
+	//! Simulate a session expiring, by number
+	int EndSession(int ses);
+};
+
+#endif
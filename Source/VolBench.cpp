@@ -0,0 +1,486 @@
+//
+// Micro-benchmarks for the VolCtl API and WaLog, run against the simulated
+// backend so they don't depend on the audio hardware or system.
+//
+// Each benchmark times every call and reports calls per second and latency
+// percentiles in microseconds.
+//
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <chrono>
+#include "WaGetopt.h"
+#include "WaLog.h"
+#include "VolCtl.h"
+#include "SimBackend.h"
+#include "WadGain.h"
+#include "MiscDef.h"
+
+int gNumInputs = 2;			// simulated input devices
+int gNumOutputs = 8;		// simulated output devices
+int gLatency = 0;			// simulated latency per backend call, usec
+int gIterations = 100000;	// calls per benchmark
+char *gLogFilename = (char *) "VolBench.log";	// log file for WaLog benchmarks
+char *gFilter;				// only run benchmarks containing this, or null
+
+typedef void BenchFn(void *arg, int i);
+
+#define BENCH_CHANNELS	8		// channels per device for the gain kernels, 7.1
+
+// state shared by the benchmark functions
+typedef struct {
+	VolCtl *pVolCtl;
+	int numDev;
+	const char **names;		// device names, from the device table
+	char (*upperNames)[WAD_DEV_NAME_LEN];	// device names in upper case
+	char (*prefixes)[WAD_DEV_NAME_LEN];	// device name prefixes
+	const char **ids;		// device IDs, from the device table
+	int *devIndexes;		// all devices, for sweeps
+	WadDevResult *results;
+	bool lazy;
+	const char *cacheFile;	// device cache for Init, or null
+	float *db;				// channel trims in dB, for the gain kernels
+	float *gains;
+	float *vols;
+	int numChannels;		// channels of all devices
+} BenchCtx;
+
+void main_error(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args,fmt);
+	vfprintf(stderr,fmt,args);
+	va_end(args);
+	if (fmt[strlen(fmt)-1] != '\n')
+		fprintf(stderr,"\n");
+	exit(1);
+}
+
+void usage()
+{
+	fprintf(stderr, "usage: VolBench [options]\n");
+	fprintf(stderr, "  -i inputs    number of simulated input devices (%d)\n", gNumInputs);
+	fprintf(stderr, "  -o outputs   number of simulated output devices (%d)\n", gNumOutputs);
+	fprintf(stderr, "  -l usec      simulated latency per backend call (%d)\n", gLatency);
+	fprintf(stderr, "  -n count     calls per benchmark (%d)\n", gIterations);
+	fprintf(stderr, "  -L file      log file for WaLog benchmarks (%s)\n", gLogFilename);
+	fprintf(stderr, "  -b name      only run benchmarks whose name contains name\n");
+	exit(1);
+}
+
+void parse_args(int argc, char **argv)
+{
+	int c;
+
+	while ((c = WaGetopt(argc, argv, (char *) "hi:o:l:n:L:b:")) != -1) {
+		switch (c) {
+		case 'i':
+			gNumInputs = atoi(optarg);
+			break;
+		case 'o':
+			gNumOutputs = atoi(optarg);
+			break;
+		case 'l':
+			gLatency = atoi(optarg);
+			break;
+		case 'n':
+			gIterations = atoi(optarg);
+			break;
+		case 'L':
+			gLogFilename = optarg;
+			break;
+		case 'b':
+			gFilter = optarg;
+			break;
+		case 'h':
+		case '?':
+		case ':':
+		default:
+			usage();
+			break;
+		}
+	}
+	if (gNumInputs < 0 || gNumOutputs < 0 || gNumInputs + gNumOutputs < 1)
+		main_error("need at least one device");
+	if (gIterations < 1)
+		main_error("illegal count %d", gIterations);
+}
+
+static int CompareDouble(const void *a, const void *b)
+{
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+// value at percentile of sorted samples
+static double Percentile(double *samples, int n, double pct)
+{
+	int i = (int) (pct / 100.0 * (n - 1) + 0.5);
+	return samples[MIN(i, n - 1)];
+}
+
+//
+// Call fn count times, timing each call, and print the results.
+//
+void run_bench(const char *name, BenchFn *fn, void *arg, int count)
+{
+	std::chrono::steady_clock::time_point start, end, t0, t1;
+	double *samples;
+	double total;
+	int i;
+
+	if (gFilter && !strstr(name, gFilter))
+		return;
+	samples = (double *) malloc(count * sizeof(double));
+	if (!samples)
+		main_error("out of memory");
+	start = std::chrono::steady_clock::now();
+	t0 = start;
+	for (i = 0; i < count; i++) {
+		fn(arg, i);
+		t1 = std::chrono::steady_clock::now();
+		samples[i] = std::chrono::duration<double, std::micro>(t1 - t0).count();
+		t0 = t1;
+	}
+	end = t0;
+	total = std::chrono::duration<double>(end - start).count();
+	qsort(samples, count, sizeof(double), CompareDouble);
+	printf("%-24s %8d %12.0f %9.2f %9.2f %9.2f %9.2f\n", name, count,
+		total > 0 ? count / total : 0.0,
+		Percentile(samples, count, 50), Percentile(samples, count, 90),
+		Percentile(samples, count, 99), samples[count - 1]);
+	fflush(stdout);
+	free(samples);
+}
+
+//=============================================================================
+//
+// Benchmark functions
+//
+
+VolCtl *new_volctl(int latency)
+{
+	return new VolCtl(WAD_ROLE_COMMUNICATIONS, new SimBackend(gNumInputs, gNumOutputs, latency));
+}
+
+void init_fn(void *arg, int i)
+{
+	BenchCtx *pCtx = (BenchCtx *) arg;
+	VolCtl *pVolCtl = new_volctl(gLatency);
+	UNUSED(i);
+	if (pCtx->cacheFile)
+		pVolCtl->SetCacheFile(pCtx->cacheFile);
+	if (pVolCtl->Init(pCtx->lazy) != WAD_OK)
+		main_error("Init: %s", pVolCtl->GetErrorText());
+	// a lazy Init does no work until a device is needed
+	if (pVolCtl->GetDefaultOutDevIndex() < 0)
+		main_error("no default output device");
+	delete pVolCtl;
+}
+
+void find_exact_fn(void *arg, int i)
+{
+	BenchCtx *pCtx = (BenchCtx *) arg;
+	if (pCtx->pVolCtl->FindDevByName(pCtx->names[i % pCtx->numDev], WAD_MATCH_EXACT) < 0)
+		main_error("FindDevByName failed");
+}
+
+void find_nocase_fn(void *arg, int i)
+{
+	BenchCtx *pCtx = (BenchCtx *) arg;
+	if (pCtx->pVolCtl->FindDevByName(pCtx->upperNames[i % pCtx->numDev], WAD_MATCH_NOCASE) < 0)
+		main_error("FindDevByName failed");
+}
+
+void find_prefix_fn(void *arg, int i)
+{
+	BenchCtx *pCtx = (BenchCtx *) arg;
+	if (pCtx->pVolCtl->FindDevByName(pCtx->prefixes[i % pCtx->numDev], WAD_MATCH_PREFIX) < 0)
+		main_error("FindDevByName failed");
+}
+
+void find_substr_fn(void *arg, int i)
+{
+	BenchCtx *pCtx = (BenchCtx *) arg;
+	// skip the first character so it isn't a prefix
+	if (pCtx->pVolCtl->FindDevByName(pCtx->prefixes[i % pCtx->numDev] + 1, WAD_MATCH_SUBSTR) < 0)
+		main_error("FindDevByName failed");
+}
+
+void find_id_fn(void *arg, int i)
+{
+	BenchCtx *pCtx = (BenchCtx *) arg;
+	if (pCtx->pVolCtl->FindDevById(pCtx->ids[i % pCtx->numDev]) < 0)
+		main_error("FindDevById failed");
+}
+
+void get_vol_fn(void *arg, int i)
+{
+	BenchCtx *pCtx = (BenchCtx *) arg;
+	float vol;
+	if (pCtx->pVolCtl->GetVol(i % pCtx->numDev, &vol) != WAD_OK)
+		main_error("GetVol: %s", pCtx->pVolCtl->GetErrorText());
+}
+
+void set_vol_fn(void *arg, int i)
+{
+	BenchCtx *pCtx = (BenchCtx *) arg;
+	if (pCtx->pVolCtl->SetVol(i % pCtx->numDev, (i % 101) / 100.0f) != WAD_OK)
+		main_error("SetVol: %s", pCtx->pVolCtl->GetErrorText());
+}
+
+void get_mute_fn(void *arg, int i)
+{
+	BenchCtx *pCtx = (BenchCtx *) arg;
+	bool mute;
+	if (pCtx->pVolCtl->GetMute(i % pCtx->numDev, &mute) != WAD_OK)
+		main_error("GetMute: %s", pCtx->pVolCtl->GetErrorText());
+}
+
+void set_mute_fn(void *arg, int i)
+{
+	BenchCtx *pCtx = (BenchCtx *) arg;
+	if (pCtx->pVolCtl->SetMute(i % pCtx->numDev, (i & 1) != 0) != WAD_OK)
+		main_error("SetMute: %s", pCtx->pVolCtl->GetErrorText());
+}
+
+// get volume of every device, one after another
+void sweep_serial_fn(void *arg, int i)
+{
+	BenchCtx *pCtx = (BenchCtx *) arg;
+	float vol;
+	int dev;
+	UNUSED(i);
+	for (dev = 0; dev < pCtx->numDev; dev++) {
+		if (pCtx->pVolCtl->GetVol(dev, &vol) != WAD_OK)
+			main_error("GetVol: %s", pCtx->pVolCtl->GetErrorText());
+	}
+}
+
+// get volume of every device on the worker pool
+void sweep_pool_fn(void *arg, int i)
+{
+	BenchCtx *pCtx = (BenchCtx *) arg;
+	UNUSED(i);
+	if (pCtx->pVolCtl->AccessMulti(pCtx->devIndexes, pCtx->numDev, WAD_OP_GET_VOL, 0, false,
+		pCtx->results) != WAD_OK)
+		main_error("AccessMulti: %s", pCtx->pVolCtl->GetErrorText());
+}
+
+void set_vol_db_fn(void *arg, int i)
+{
+	BenchCtx *pCtx = (BenchCtx *) arg;
+	if (pCtx->pVolCtl->SetVolDb(i % pCtx->numDev, -(float) (i % 60)) != WAD_OK)
+		main_error("SetVolDb: %s", pCtx->pVolCtl->GetErrorText());
+}
+
+void apply_db_fn(void *arg, int i)
+{
+	BenchCtx *pCtx = (BenchCtx *) arg;
+	// each pass over the devices undoes the last, so volumes stay in range
+	float trim = ((i / pCtx->numDev) & 1) ? 0.5f : -0.5f;
+	float db[2] = { trim, -trim };
+	if (pCtx->pVolCtl->ApplyChannelDb(i % pCtx->numDev, db, 2) != WAD_OK)
+		main_error("ApplyChannelDb: %s", pCtx->pVolCtl->GetErrorText());
+}
+
+// fader position to dB and back on the audio taper, with the device's tables
+void taper_table_fn(void *arg, int i)
+{
+	BenchCtx *pCtx = (BenchCtx *) arg;
+	float db, pos;
+	if (pCtx->pVolCtl->PosToDb(i % pCtx->numDev, (i % 1000) / 1000.0f, &db) != WAD_OK
+			|| pCtx->pVolCtl->DbToPos(i % pCtx->numDev, db, &pos) != WAD_OK)
+		main_error("PosToDb: %s", pCtx->pVolCtl->GetErrorText());
+}
+
+// the same conversions computed each time, volatile so they aren't dropped
+void taper_libm_fn(void *arg, int i)
+{
+	volatile float db, pos;
+	float p = (i % 1000) / 1000.0f;
+	UNUSED(arg);
+	db = p > 0 ? 60 * log10f(p) : -65.25f;
+	pos = powf(10, db / 60);
+	UNUSED(pos);
+}
+
+// dB trims of every channel of every device, a libm call per channel. The
+// trimmed volumes go to gains, so each call starts from the same volumes.
+void gain_scalar_fn(void *arg, int i)
+{
+	BenchCtx *pCtx = (BenchCtx *) arg;
+	float v;
+	int ch;
+	UNUSED(i);
+	for (ch = 0; ch < pCtx->numChannels; ch++) {
+		v = pCtx->vols[ch] * powf(10, pCtx->db[ch] / 20);
+		pCtx->gains[ch] = v < 0 ? 0 : (v > 1 ? 1 : v);
+	}
+}
+
+// the same with the WadGain kernels
+void gain_kernel_fn(void *arg, int i)
+{
+	BenchCtx *pCtx = (BenchCtx *) arg;
+	UNUSED(i);
+	WadDbToGains(pCtx->db, pCtx->gains, pCtx->numChannels);
+	WadApplyGains(pCtx->gains, pCtx->vols, pCtx->numChannels);
+}
+
+void null_log_fn(void *arg, int level, const char *buf)
+{
+	UNUSED(arg);
+	UNUSED(level);
+	UNUSED(buf);
+}
+
+void log_fn(void *arg, int i)
+{
+	UNUSED(arg);
+	WA_LOG(3, ("VolBench", "SetVol devIndex=%d vol=%f", i, i / 1000.0f));
+}
+
+void log_flush_fn(void *arg, int i)
+{
+	UNUSED(arg);
+	WA_LOG(1, ("VolBench", "SetVol devIndex=%d vol=%f", i, i / 1000.0f));
+}
+
+//=============================================================================
+
+void bench_volctl()
+{
+	BenchCtx ctx;
+	WadDevInfo info;
+	int numInits = MAX(gIterations / 100, 1);
+	int i, j;
+
+	memset(&ctx, 0, sizeof(ctx));
+	// Init creates the device table, so fewer calls
+	ctx.lazy = false;
+	run_bench("Init", init_fn, &ctx, numInits);
+	ctx.lazy = true;
+	run_bench("Init lazy", init_fn, &ctx, numInits);
+	// the first Init writes the cache, the rest read it
+	ctx.lazy = false;
+	ctx.cacheFile = "VolBench.cache";
+	remove(ctx.cacheFile);
+	run_bench("Init cache", init_fn, &ctx, numInits);
+	remove(ctx.cacheFile);
+	ctx.cacheFile = NULL;
+
+	ctx.pVolCtl = new_volctl(gLatency);
+	if (ctx.pVolCtl->Init() != WAD_OK)
+		main_error("Init: %s", ctx.pVolCtl->GetErrorText());
+	ctx.numDev = ctx.pVolCtl->GetNumDevices();
+	ctx.names = (const char **) malloc(ctx.numDev * sizeof(const char *));
+	ctx.upperNames = (char (*)[WAD_DEV_NAME_LEN]) malloc(ctx.numDev * WAD_DEV_NAME_LEN);
+	ctx.prefixes = (char (*)[WAD_DEV_NAME_LEN]) malloc(ctx.numDev * WAD_DEV_NAME_LEN);
+	ctx.ids = (const char **) malloc(ctx.numDev * sizeof(const char *));
+	for (i = 0; i < ctx.numDev; i++) {
+		if (ctx.pVolCtl->GetDevInfo(i, &info) != WAD_OK)
+			main_error("GetDevInfo: %s", ctx.pVolCtl->GetErrorText());
+		ctx.names[i] = info.name;
+		ctx.ids[i] = info.devId;
+		for (j = 0; info.name[j] && j < WAD_DEV_NAME_LEN - 1; j++)
+			ctx.upperNames[i][j] = toupper((unsigned char) info.name[j]);
+		ctx.upperNames[i][j] = 0;
+		// "Speakers 12 (" matches only one device
+		WadCopyUtf8(ctx.prefixes[i], info.name, WAD_DEV_NAME_LEN);
+		if (strchr(ctx.prefixes[i], '('))
+			strchr(ctx.prefixes[i], '(')[1] = 0;
+	}
+	run_bench("FindDevByName exact", find_exact_fn, &ctx, gIterations);
+	run_bench("FindDevByName nocase", find_nocase_fn, &ctx, gIterations);
+	run_bench("FindDevByName prefix", find_prefix_fn, &ctx, gIterations);
+	run_bench("FindDevByName substr", find_substr_fn, &ctx, gIterations);
+	run_bench("FindDevById", find_id_fn, &ctx, gIterations);
+	run_bench("GetVol", get_vol_fn, &ctx, gIterations);
+	run_bench("SetVol", set_vol_fn, &ctx, gIterations);
+	run_bench("GetMute", get_mute_fn, &ctx, gIterations);
+	run_bench("SetMute", set_mute_fn, &ctx, gIterations);
+	run_bench("ApplyChannelDb", apply_db_fn, &ctx, gIterations);
+	run_bench("SetVolDb", set_vol_db_fn, &ctx, gIterations);
+	if (ctx.pVolCtl->SetTaper(-1, WAD_TAPER_AUDIO) != WAD_OK)
+		main_error("SetTaper: %s", ctx.pVolCtl->GetErrorText());
+	run_bench("Taper table", taper_table_fn, &ctx, gIterations);
+	run_bench("Taper libm", taper_libm_fn, &ctx, gIterations);
+	// a sweep is a call per device
+	ctx.devIndexes = (int *) malloc(ctx.numDev * sizeof(int));
+	ctx.results = (WadDevResult *) malloc(ctx.numDev * sizeof(WadDevResult));
+	for (i = 0; i < ctx.numDev; i++)
+		ctx.devIndexes[i] = i;
+	run_bench("GetVol sweep serial", sweep_serial_fn, &ctx, MAX(gIterations / ctx.numDev, 1));
+	run_bench("GetVol sweep pool", sweep_pool_fn, &ctx, MAX(gIterations / ctx.numDev, 1));
+	ctx.pVolCtl->SetInterfaceCache(false);
+	run_bench("GetVol uncached", get_vol_fn, &ctx, gIterations);
+	run_bench("SetVol uncached", set_vol_fn, &ctx, gIterations);
+	delete ctx.pVolCtl;
+	free(ctx.names);
+	free(ctx.upperNames);
+	free(ctx.prefixes);
+	free(ctx.ids);
+	free(ctx.devIndexes);
+	free(ctx.results);
+}
+
+void bench_gain()
+{
+	BenchCtx ctx;
+	int i;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.numChannels = (gNumInputs + gNumOutputs) * BENCH_CHANNELS;
+	ctx.db = (float *) malloc(ctx.numChannels * sizeof(float));
+	ctx.gains = (float *) malloc(ctx.numChannels * sizeof(float));
+	ctx.vols = (float *) malloc(ctx.numChannels * sizeof(float));
+	// trims from -12 to +6 dB, some of which clamp
+	for (i = 0; i < ctx.numChannels; i++) {
+		ctx.db[i] = -12.0f + (i % 19);
+		ctx.vols[i] = 0.5f;
+	}
+	run_bench("Channel dB scalar", gain_scalar_fn, &ctx, gIterations);
+	run_bench("Channel dB kernel", gain_kernel_fn, &ctx, gIterations);
+	free(ctx.db);
+	free(ctx.gains);
+	free(ctx.vols);
+}
+
+void bench_walog()
+{
+	int level = WaLogGetLevel();
+
+	WaLogSetLevel(3);
+	// formatting only
+	WaLogSetLogFn(null_log_fn, NULL);
+	run_bench("WaLog format", log_fn, NULL, gIterations);
+	if (!WaLogOpen(gLogFilename, FALSE))
+		main_error("can't open log file %s", gLogFilename);
+	run_bench("WaLog file", log_fn, NULL, gIterations);
+	run_bench("WaLog file flush", log_flush_fn, NULL, gIterations);
+	WaLogSetAsync(TRUE, 1024, WA_LOG_ASYNC_BLOCK);
+	run_bench("WaLog file async", log_fn, NULL, gIterations);
+	WaLogClose();
+	remove(gLogFilename);
+	WaLogSetLevel(level);
+}
+
+int main(int argc, char **argv)
+{
+	parse_args(argc, argv);
+	printf("%d inputs, %d outputs, latency %d usec\n", gNumInputs, gNumOutputs, gLatency);
+	printf("%-24s %8s %12s %9s %9s %9s %9s\n", "benchmark", "calls", "calls/sec",
+		"p50 us", "p90 us", "p99 us", "max us");
+	// no logging from VolCtl while timing it
+	WaLogSetLevel(0);
+	bench_volctl();
+	bench_gain();
+	bench_walog();
+	return 0;
+}
@@ -1,385 +1,564 @@
 //
-// Volume control using Windows Audio Services API (WASAPI).
-//
-// Internally we use char for characters and use multi-byte character
-// conversion from UNICODE if required. This code should compile with
-// either multi-byte or UNICODE set.
+// Volume control front end. The device table, lookup and error handling
+// live here, and everything that talks to the audio system goes through a
+// WadBackend, WASAPI on Windows.
 //
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <chrono>
+#ifdef _WIN32
+#include <windows.h>
+#include <mmsystem.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "winmm.lib")
+#endif
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "VolCtl.h"
 #include "MiscDef.h"
 #include "WaLog.h"
-#include "EndpointVolume.h"
-#include "Functiondiscoverykeys_devpkey.h"
-#include "Strsafe.h"
 
 #define THIS_FILE	"VolCtl.cpp"
 
-#ifdef _MSC_VER
-#pragma warning(disable : 4244 4995)
-#endif
-
-#define CHECK(hr, retval, funcName) \
-	if (FAILED(hr)) { \
-		char tmpStr[128]; \
-		GetAudioClientResultStr(hr, tmpStr, sizeof(tmpStr)); \
-		_snprintf(errorText, sizeof(errorText), "%s returned %x (%s)", funcName, hr, tmpStr); \
-		WA_LOG(1, (THIS_FILE, errorText)); \
-		return retval; \
-	}
-
-#define CHECK_GOTO(hr, retval, funcName, label) \
-	if (FAILED(hr)) { \
-		char tmpStr[128]; \
-		GetAudioClientResultStr(hr, tmpStr, sizeof(tmpStr)); \
-		_snprintf(errorText, sizeof(errorText), "%s returned %x (%s)", funcName, hr, tmpStr); \
-		WA_LOG(1, (THIS_FILE, errorText)); \
-		status = retval; \
-		goto label; \
-	}
-
-#define CHECK_HANDLE(h, retval, funcName) \
-	if (h == NULL) { \
-		DWORD err = GetLastError(); \
-		char tmpStr[128]; \
-		GetWindowsErrorStr(err, tmpStr, sizeof(tmpStr)); \
-		_snprintf(errorText, sizeof(errorText), "%s error: %x (%s)", funcName, err, tmpStr); \
-		WA_LOG(1, (THIS_FILE, errorText)); \
-		return retval; \
-	}
-
-#define CHECK_HANDLE_GOTO(h, retval, funcName, label) \
-	if (h == NULL) { \
-		DWORD err = GetLastError(); \
-		char tmpStr[128]; \
-		GetWindowsErrorStr(err, tmpStr, sizeof(tmpStr)); \
-		_snprintf(errorText, sizeof(errorText), "%s error: %x (%s)", funcName, err, tmpStr); \
-		WA_LOG(1, (THIS_FILE, errorText)); \
-		status = retval; \
-		goto label; \
-	}
-
 #define CHECK_INIT() \
 	if (!isInitialized) { \
 		SetErrorText("device not initialized"); \
 		return WAD_ERR_NOT_INITIALIZED; \
 	}
 
-#define CHECK_OPEN() \
-	if (!isOpen) { \
-		SetErrorText("device not open"); \
-		return WAD_ERR_NOT_OPEN; \
-	}
-
-template <class T> void SafeRelease(T **ppT)
-{
-    if (*ppT)
-    {
-        (*ppT)->Release();
-        *ppT = NULL;
-    }
-}
-
-const CLSID CLSID_MMDeviceEnumerator = __uuidof(MMDeviceEnumerator);
-const IID IID_IMMDeviceEnumerator = __uuidof(IMMDeviceEnumerator);
-const IID IID_IAudioClient = __uuidof(IAudioClient);
-const IID IID_IAudioRenderClient = __uuidof(IAudioRenderClient);
-const IID IID_IAudioCaptureClient = __uuidof(IAudioCaptureClient);
-const IID IID_IAudioEndpointVolume = __uuidof(IAudioEndpointVolume);
-const IID IID_ISimpleAudioVolume = __uuidof(ISimpleAudioVolume);
-const IID IID_IAudioClock = __uuidof(IAudioClock);
-
-static bool GetWindowsErrorStr(HRESULT hr, char *errStr, size_t len)
-{
-	LPVOID lpMsgBuf = NULL;
-	FormatMessage( 
-		FORMAT_MESSAGE_ALLOCATE_BUFFER | 
-		FORMAT_MESSAGE_FROM_SYSTEM | 
-		FORMAT_MESSAGE_IGNORE_INSERTS,
-		NULL,
-		hr,
-		MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), // Default language
-		(LPTSTR) &lpMsgBuf,
-		0,
-		NULL 
-		);
-	if (!lpMsgBuf) {
-		errStr[0] = 0;
+// guard device table for the rest of the scope
+#define DEV_LOCK() std::lock_guard<std::recursive_mutex> devLockGuard(devLock)
+
+// read the published device table as pSnap for the rest of the scope
+#define SNAP_READ() SnapRead snapRead(snapEpoch, snapReaders, devSnap); WadDevSnap *pSnap = snapRead.pSnap
+
+class SnapRead {
+	std::atomic<int> *pReaders;
+public:
+	WadDevSnap *pSnap;
+	SnapRead(std::atomic<unsigned>& epoch, std::atomic<int> *readers, std::atomic<WadDevSnap *>& snap)
+	{
+		unsigned e;
+		// counted in the current epoch before loading, and counted again if
+		// the epoch moved on meanwhile, so a writer can't pass the epoch
+		// without seeing this reader
+		for (;;) {
+			e = epoch.load();
+			pReaders = &readers[e & 1];
+			(*pReaders)++;
+			if (epoch.load() == e)
+				break;
+			(*pReaders)--;
+		}
+		pSnap = snap.load();
+	}
+	~SnapRead() { (*pReaders)--; }
+};
+
+// published copy of the device table, see Device lookup
+struct WadDevSnap {
+	int numDev;
+	WadDevInfo *devTab;			// copy of the device table, sharing its strings
+	int defaultInDev;
+	int defaultOutDev;
+	bool isEnumerated;
+	int *idHash;				// hash of devId to device index, -1 if empty
+	int *nameHash;				// hash of lower case name to device index, -1 if empty
+	int hashSize;				// size of hash tables, power of 2
+	unsigned int *idHashes;		// hash of each device's ID
+	unsigned int *nameHashes;	// hash of each device's lower case name
+	int *nameOrder;				// device indexes sorted by lower case name
+	WadDbScale **scales;		// dB scale of each device or NULL, see Volume in dB
+	WadDbScale *oldScales;		// scales replaced while this copy was published
+	unsigned epoch;				// epoch it was replaced in
+	WadDevSnap *pNext;			// next retired copy, older
+};
+
+static void FreeScales(WadDbScale *pScale);
+
+static void FreeSnap(WadDevSnap *pSnap)
+{
+	if (!pSnap)
+		return;
+	FreeScales(pSnap->oldScales);
+	free(pSnap->scales);
+	free(pSnap->devTab);
+	free(pSnap->idHash);
+	free(pSnap->nameHash);
+	free(pSnap->idHashes);
+	free(pSnap->nameHashes);
+	free(pSnap->nameOrder);
+	free(pSnap);
+}
+
+// state of a device kept out of the published table, indexed like devTab
+struct WadDevState {
+	WadDevHandle *pHandle;		// cached backend handle or NULL, guarded by handleLock
+	WadHandle hWatch;			// volume change watch or NULL
+	WadRamp *pRamp;				// volume ramp in progress or NULL
+	WadDbScale *pScale;			// dB range and taper tables or NULL
+	bool hasSessions;			// T/F if sessions indexed and kept current
+	WadHandle hSesWatch;		// session notifications or NULL
+};
+
+#define DEV_UNRESOLVED	(-2)	// default device not looked up yet
+
+// return backend errors with the backend error text
+#define CHECK_BACKEND(call) \
+	{ \
+		int backendStatus = (call); \
+		if (backendStatus != WAD_OK) \
+			return BackendError(backendStatus); \
+	}
+
+//=============================================================================
+//
+// VolCtl
+//
+
+VolCtl::VolCtl(int _role, WadBackend *_backend) :
+	role(_role)
+{
+	// discovery
+	backend = _backend ? _backend : WadCreateBackend(NULL);
+	if (backend)
+		backend->SetStats(&stats);
+	numDev = 0;
+	devTab = NULL;
+	devState = NULL;
+	devTabSize = 0;
+	strBlocks = NULL;
+	devSnap = NULL;
+	snapEpoch = 0;
+	snapReaders[0] = 0;
+	snapReaders[1] = 0;
+	retiredSnaps = NULL;
+	cacheFile = NULL;
+	cacheDirty = false;
+	defaultInDev = DEV_UNRESOLVED;
+	defaultOutDev = DEV_UNRESOLVED;
+	isLazy = false;
+	isEnumerated = false;
+	isNotify = false;
+	watchAllFn = NULL;
+	watchAllArg = NULL;
+	numSes = 0;
+	sesTabSize = 0;
+	sesTab = NULL;
+	sesState = NULL;
+	sesHash = NULL;
+	freeSes = -1;
+	poolSize = 0;
+	numWorkers = 0;
+	poolJob = NULL;
+	poolJobSeq = 0;
+	poolBusy = 0;
+	poolStop = false;
+	rampTick = 0;
+	numRamps = 0;
+	rampStop = false;
+	rampSerial = 0;
+	meter = NULL;
+	taper = WAD_TAPER_LINEAR;
+	numTaperPoints = 0;
+	isInitialized = false;
+	useIfCache = true;
+	// readers always have a table, empty until Init
+	PublishTable();
+}
+
+THREAD_LOCAL char VolCtl::errorText[256];
+
+int VolCtl::BackendError(int status)
+{
+	_snprintf(errorText, sizeof(errorText), "%s", backend->GetErrorText());
+	return status;
+}
+
+//
+// Device names and IDs are kept in a string table, blocks that are only
+// appended to and freed with the VolCtl. The device table and its published
+// copies hold pointers into it, so a copy costs the same whatever the length
+// of the names, and a name handed out stays good. A renamed device gets a
+// new copy of its name, and the old one stays for readers of older copies.
+// Added to with devLock held.
+//
+
+#define STR_BLOCK_SIZE	4096
+
+struct WadStrBlock {
+	WadStrBlock *pNext;
+	size_t size;				// bytes in data
+	size_t used;				// bytes of data filled
+	char data[1];
+};
+
+const char *VolCtl::AddString(const char *str)
+{
+	WadStrBlock *pBlock = strBlocks;
+	size_t len = strlen(str) + 1;
+	size_t size;
+	char *p;
+
+	if (len == 1)
+		return "";
+	if (!pBlock || pBlock->size - pBlock->used < len) {
+		size = MAX(len, STR_BLOCK_SIZE);
+		pBlock = (WadStrBlock *) malloc(offsetof(WadStrBlock, data) + size);
+		if (!pBlock)
+			return NULL;
+		pBlock->size = size;
+		pBlock->used = 0;
+		// a long string gets a block of its own, behind the one being filled
+		if (strBlocks && len > STR_BLOCK_SIZE / 2) {
+			pBlock->pNext = strBlocks->pNext;
+			strBlocks->pNext = pBlock;
+		}
+		else {
+			pBlock->pNext = strBlocks;
+			strBlocks = pBlock;
+		}
+	}
+	p = pBlock->data + pBlock->used;
+	memcpy(p, str, len);
+	pBlock->used += len;
+	return p;
+}
+
+//
+// Add a device to the table, returns the index or -1 on error. The name
+// is set now if given, otherwise read on demand by EnsureName(). Doesn't
+// update the lookup indexes.
+//
+int VolCtl::AddDevice(const char *devId, bool isInput, const char *name)
+{
+	WadDevInfo *pInfo;
+	const char *idStr, *nameStr;
+	int index = numDev;
+
+	// grow table, which volume calls use for handles without devLock
+	if (numDev >= devTabSize) {
+		std::lock_guard<std::mutex> guard(handleLock);
+		int newSize = devTabSize ? 2 * devTabSize : 16;
+		WadDevInfo *newTab = (WadDevInfo *) realloc(devTab, newSize * sizeof(WadDevInfo));
+		WadDevState *newState;
+		if (newTab)
+			devTab = newTab;
+		newState = newTab ? (WadDevState *) realloc(devState, newSize * sizeof(WadDevState)) : NULL;
+		if (!newState) {
+			SetErrorText("out of memory");
+			return -1;
+		}
+		devState = newState;
+		memset(devTab + devTabSize, 0, (newSize - devTabSize) * sizeof(WadDevInfo));
+		memset(devState + devTabSize, 0, (newSize - devTabSize) * sizeof(WadDevState));
+		devTabSize = newSize;
+	}
+	idStr = AddString(devId);
+	nameStr = AddString(name ? name : "");
+	if (!idStr || !nameStr) {
+		SetErrorText("out of memory");
+		return -1;
+	}
+	pInfo = &devTab[index];
+	pInfo->isInput = isInput;
+	pInfo->isActive = true;
+	pInfo->devId = idStr;
+	pInfo->name = nameStr;
+	pInfo->hasName = name != NULL;
+	numDev++;
+	WA_LOG(2, (THIS_FILE, "%d: '%s' '%s' isInput %d", index, pInfo->name, pInfo->devId,
+		pInfo->isInput));
+	return index;
+}
+
+//
+// Add a device by ID without enumerating, returns the index or -1 if not
+// found or not active.
+//
+int VolCtl::AddDeviceById(const char *devId, bool getName)
+{
+	char name[WAD_DEV_NAME_LEN];
+	bool isActive, isInput;
+	int devIndex;
+
+	// only active devices are in the table, as when enumerating
+	if (backend->GetDevState(devId, &isActive, &isInput) != WAD_OK || !isActive)
+		return -1;
+	if (getName && backend->GetDevName(devId, name, sizeof(name)) != WAD_OK) {
+		BackendError(WAD_ERR_INTERNAL);
+		return -1;
+	}
+	devIndex = AddDevice(devId, isInput, getName ? name : NULL);
+	PublishTable();
+	cacheDirty = true;
+	return devIndex;
+}
+
+// Read the name of a device added lazily, memoized in the device table.
+bool VolCtl::EnsureName(int devIndex)
+{
+	WadDevInfo *pInfo = &devTab[devIndex];
+	char name[WAD_DEV_NAME_LEN];
+	const char *str;
+
+	if (pInfo->hasName)
+		return true;
+	if (backend->GetDevName(pInfo->devId, name, sizeof(name)) != WAD_OK) {
+		BackendError(WAD_ERR_INTERNAL);
 		return false;
 	}
-#ifdef UNICODE
-	WideCharToMultiByte(CP_ACP, 0, (WCHAR *) lpMsgBuf, wcslen((WCHAR *) lpMsgBuf), errStr, len, NULL, NULL);
-#else
-	strncpy(errStr, (char *) lpMsgBuf, len);
-#endif
-	// clobber trailing newline
-	if (errStr[strlen(errStr)-1] == '\n')
-		errStr[strlen(errStr)-1] = 0;
-	// clobber trailing CR
-	if (errStr[strlen(errStr)-1] == '\r')
-		errStr[strlen(errStr)-1] = 0;
-	LocalFree(lpMsgBuf);
+	// a name read again after a change notification is often the same
+	if (strcmp(name, pInfo->name)) {
+		if ((str = AddString(name)) == NULL) {
+			SetErrorText("out of memory");
+			return false;
+		}
+		pInfo->name = str;
+	}
+	pInfo->hasName = true;
 	return true;
 }
 
-// do we really have to do this ourselves?
 typedef struct {
-	HRESULT hr;
-	char *desc;
-} ErrTabEntry;
-#define MAKE_ENTRY(result) { result, #result } 
-ErrTabEntry gErrTab[] = {
-	MAKE_ENTRY(AUDCLNT_E_NOT_INITIALIZED),
-	MAKE_ENTRY(AUDCLNT_E_ALREADY_INITIALIZED),
-	MAKE_ENTRY(AUDCLNT_E_WRONG_ENDPOINT_TYPE),
-	MAKE_ENTRY(AUDCLNT_E_DEVICE_INVALIDATED),
-	MAKE_ENTRY(AUDCLNT_E_NOT_STOPPED),
-	MAKE_ENTRY(AUDCLNT_E_BUFFER_TOO_LARGE),
-	MAKE_ENTRY(AUDCLNT_E_OUT_OF_ORDER),
-	MAKE_ENTRY(AUDCLNT_E_UNSUPPORTED_FORMAT),
-	MAKE_ENTRY(AUDCLNT_E_INVALID_SIZE),
-	MAKE_ENTRY(AUDCLNT_E_DEVICE_IN_USE),
-	MAKE_ENTRY(AUDCLNT_E_BUFFER_OPERATION_PENDING),
-	MAKE_ENTRY(AUDCLNT_E_THREAD_NOT_REGISTERED),
-	MAKE_ENTRY(AUDCLNT_E_EXCLUSIVE_MODE_NOT_ALLOWED),
-	MAKE_ENTRY(AUDCLNT_E_ENDPOINT_CREATE_FAILED),
-	MAKE_ENTRY(AUDCLNT_E_SERVICE_NOT_RUNNING),
-	MAKE_ENTRY(AUDCLNT_E_EVENTHANDLE_NOT_EXPECTED),
-	MAKE_ENTRY(AUDCLNT_E_EXCLUSIVE_MODE_ONLY),
-	MAKE_ENTRY(AUDCLNT_E_BUFDURATION_PERIOD_NOT_EQUAL),
-	MAKE_ENTRY(AUDCLNT_E_EVENTHANDLE_NOT_SET),
-	MAKE_ENTRY(AUDCLNT_E_INCORRECT_BUFFER_SIZE),
-	MAKE_ENTRY(AUDCLNT_E_BUFFER_SIZE_ERROR),
-	MAKE_ENTRY(AUDCLNT_E_CPUUSAGE_EXCEEDED),
-#if MSC_VER >= 1600
-	// these not defined in Win SDK v6.0a
-	MAKE_ENTRY(AUDCLNT_E_BUFFER_ERROR),
-	MAKE_ENTRY(AUDCLNT_E_BUFFER_SIZE_NOT_ALIGNED),
-	MAKE_ENTRY(AUDCLNT_E_INVALID_DEVICE_PERIOD),
-#endif
-	MAKE_ENTRY(AUDCLNT_S_BUFFER_EMPTY),
-	MAKE_ENTRY(AUDCLNT_S_THREAD_ALREADY_REGISTERED),
-	MAKE_ENTRY(AUDCLNT_S_POSITION_STALLED)
-};
+	VolCtl *pVolCtl;
+	bool isInput;
+	int status;
+} EnumCtx;
 
-static bool GetAudioClientResultStr(HRESULT hr, char *errStr, size_t len)
+// Called by the backend for each device of an enumeration
+void VolCtl::EnumFn(void *arg, const char *devId, const char *name)
 {
-	size_t i;
-	size_t n = sizeof(gErrTab) / sizeof(ErrTabEntry);
-	for (i = 0; i < n; i++) {
-		if (gErrTab[i].hr == hr) {
-			strncpy(errStr, gErrTab[i].desc, len);
-			return true;
+	EnumCtx *pCtx = (EnumCtx *) arg;
+	VolCtl *pVolCtl = pCtx->pVolCtl;
+	WadDevInfo *pInfo;
+	const char *str;
+	int index;
+
+	if (pCtx->status != WAD_OK)
+		return;
+	index = pVolCtl->LookupId(devId);
+	if (index >= 0) {
+		// the name may have changed since a cached device was saved
+		pInfo = &pVolCtl->devTab[index];
+		if (strcmp(name, pInfo->name)) {
+			if ((str = pVolCtl->AddString(name)) == NULL) {
+				pVolCtl->SetErrorText("out of memory");
+				pCtx->status = WAD_ERR_INTERNAL;
+				return;
+			}
+			pInfo->name = str;
 		}
+		pInfo->hasName = true;
+		pInfo->isActive = true;
 	}
-	return GetWindowsErrorStr(hr, errStr, len);
+	else if (pVolCtl->AddDevice(devId, pCtx->isInput, name) < 0)
+		pCtx->status = WAD_ERR_INTERNAL;
 }
 
 //
-//  Retrieves the device friendly name for a device, comverted to multi-byte characters.
+// Enumerate active devices in one direction. Devices already in the table
+// keep their index and get their name, others are added.
 //
-bool VolCtl::GetDeviceName(IMMDevice *device, char *devName, size_t len)
+int VolCtl::EnumerateFlow(bool isInput)
 {
-    HRESULT hr;
-    IPropertyStore *propertyStore;
-    PROPVARIANT friendlyName;
+	EnumCtx ctx;
 
-	hr = device->OpenPropertyStore(STGM_READ, &propertyStore);
-    if (FAILED(hr))
-    {
-        _snprintf(errorText, sizeof(errorText), "OpenPropertyStore returned %x", hr);
-		WA_LOG(1, (THIS_FILE, errorText));
-        return false;
-    }
-
-    PropVariantInit(&friendlyName);
-    hr = propertyStore->GetValue(PKEY_Device_FriendlyName, &friendlyName);
-    SafeRelease(&propertyStore);
-    if (FAILED(hr))
-    {
-        _snprintf(errorText, sizeof(errorText), "GetValue returned %x", hr);
-		WA_LOG(1, (THIS_FILE, errorText));
-        return false;
-    }
-	if (friendlyName.vt == VT_LPWSTR) {
-		// copy wide to multi-byte
-		WideCharToMultiByte(CP_ACP, 0, friendlyName.pwszVal, wcslen(friendlyName.pwszVal), devName, len, NULL, NULL);
+	ctx.pVolCtl = this;
+	ctx.isInput = isInput;
+	ctx.status = WAD_OK;
+	CHECK_BACKEND(backend->EnumDevices(isInput, true, EnumFn, &ctx));
+	return ctx.status;
+}
+
+//
+// Complete the device table with all active devices, capture devices first.
+//
+int VolCtl::EnumerateAll()
+{
+	int status;
+
+	if (isEnumerated)
+		return WAD_OK;
+	if ((status = EnumerateFlow(true)) != WAD_OK)
+		return status;
+	if ((status = EnumerateFlow(false)) != WAD_OK)
+		return status;
+	isEnumerated = true;
+	PublishTable();
+	WA_LOG(2, (THIS_FILE, "%d devices", numDev));
+	return WAD_OK;
+}
+
+//
+// Look up the default device for the role, adding it to the table if
+// needed. If there is no default, the first device of the direction is
+// used once the table is enumerated. Until then none isn't kept, so the
+// next call looks again. Returns the index or -1 if none.
+//
+int VolCtl::ResolveDefault(bool isInput)
+{
+	char devId[WAD_NAME_LEN];
+	int *pDefault = isInput ? &defaultInDev : &defaultOutDev;
+	int devIndex = -1;
+	int status;
+	int i;
+
+	if (*pDefault != DEV_UNRESOLVED)
+		return *pDefault;
+	status = backend->GetDefaultDev(isInput, devId, sizeof(devId));
+	if (status == WAD_OK) {
+		devIndex = LookupId(devId);
+		if (devIndex == -1)
+			devIndex = AddDeviceById(devId, !isLazy);
 	}
-	else {
-		// should never happen
-		devName[0] = 0;
+	else if (status != WAD_ERR_INVALID_DEVICE) {
+		WA_LOG(1, (THIS_FILE, "ResolveDefault: %s", backend->GetErrorText()));
+	}
+	if (devIndex == -1 && isEnumerated) {
+		for (i = 0; i < numDev; i++) {
+			if (devTab[i].isInput == isInput && devTab[i].isActive) {
+				devIndex = i;
+				break;
+			}
+		}
 	}
-    PropVariantClear(&friendlyName);
-    return true;
+	if (devIndex == -1 && !isEnumerated)
+		return -1;
+	*pDefault = devIndex;
+	PublishTable();
+	return devIndex;
 }
 
-//=============================================================================
 //
-// VolCtl
+// Initialize. Normally all active devices are enumerated and named up
+// front. With lazy set only the backend is connected, and devices are
+// added as they are needed: the default device for a role, a device looked
+// up by ID, or everything for a name lookup or device listing. Names of
+// lazily added devices are read when first asked for. With a cache file,
+// the table is read from the cache if current, either way, and otherwise
+// enumerated and saved.
 //
-
-VolCtl::VolCtl(ERole _role) :
-	role(_role)
+int VolCtl::Init(bool lazy)
 {
-	// discovery
-	pEnumerator = NULL;
-	numDev = 0;
-	devTab = NULL;
-	defaultInDev = -1;
-	defaultOutDev = -1;
-	// streaming
-	pCaptureDevice = NULL;
-	pRenderDevice = NULL;
-	isInitialized = false;
-	memset(errorText, 0, sizeof(errorText));
-}
-
-int VolCtl::Init()
-{
-	HRESULT hr;
-	IMMDeviceCollection *pRenderCollection = NULL;
-	IMMDeviceCollection *pCaptureCollection = NULL;
-	UINT numRender = 0;
-	UINT numCapture = 0;
-	IMMDevice *pDevice;
-	UINT i, index;
-	LPWSTR defaultCaptureId = NULL;
-	LPWSTR defaultRenderId = NULL;
-	int status = 0;
-
-	// initialize COM
-	hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
-	// returns S_FALSE if already initialized
-	CHECK_GOTO(hr, WAD_ERR_INTERNAL, "CoInitializeEx", Init_exit);
-	// create the enumerator
-	hr = CoCreateInstance(
-		CLSID_MMDeviceEnumerator, NULL,
-		CLSCTX_ALL, IID_IMMDeviceEnumerator,
-		(void**)&pEnumerator);
-	CHECK_GOTO(hr, WAD_ERR_INTERNAL, "CoCreateInstance", Init_exit);
-	// get the default capture device id, if any
-	hr = pEnumerator->GetDefaultAudioEndpoint(eCapture, role, &pDevice);
-	if (hr != E_NOTFOUND) {
-		CHECK_GOTO(hr, WAD_ERR_INTERNAL, "GetDefaultAudioEndpoint", Init_exit);
-		hr = pDevice->GetId(&defaultCaptureId);
-		CHECK_GOTO(hr, WAD_ERR_INTERNAL, "GetId", Init_exit);
-	}
-	// get the default render device id, if any
-	hr = pEnumerator->GetDefaultAudioEndpoint(eRender, role, &pDevice);
-	if (hr != E_NOTFOUND) {
-		CHECK_GOTO(hr, WAD_ERR_INTERNAL, "GetDefaultAudioEndpoint", Init_exit);
-		hr = pDevice->GetId(&defaultRenderId);
-		CHECK_GOTO(hr, WAD_ERR_INTERNAL, "GetId", Init_exit);
-	}
-	// enumerate capture devices
-	hr = pEnumerator->EnumAudioEndpoints(
-		eCapture, DEVICE_STATE_ACTIVE,
-		&pCaptureCollection);
-	CHECK_GOTO(hr, WAD_ERR_INTERNAL, "EnumAudioEndpoints", Init_exit);
-	// get count
-	hr = pCaptureCollection->GetCount(&numCapture);
-	CHECK_GOTO(hr, WAD_ERR_INTERNAL, "GetCount", Init_exit);
-	// enumerate render devices
-	hr = pEnumerator->EnumAudioEndpoints(
-		eRender, DEVICE_STATE_ACTIVE,
-		&pRenderCollection);
-	CHECK_GOTO(hr, WAD_ERR_INTERNAL, "EnumAudioEndpoints", Init_exit);
-	// get count
-	hr = pRenderCollection->GetCount(&numRender);
-	CHECK_GOTO(hr, WAD_ERR_INTERNAL, "GetCount", Init_exit);
-	numDev = numCapture + numRender;
-	WA_LOG(2, (THIS_FILE, "%d devices:", numDev));
-	// allocate device table
-	devTab = (WadDevInfo *) calloc(numDev, sizeof(WadDevInfo));
-	// build table starting with capture devices
-	for (i = 0; i < numCapture; i++) {
-		index = i;
-		hr = pCaptureCollection->Item(i, &pDevice);
-		CHECK_GOTO(hr, WAD_ERR_INTERNAL, "Item", Init_exit);
-		// get the device ID
-		hr = pDevice->GetId(&devTab[index].id);
-		CHECK_GOTO(hr, WAD_ERR_INTERNAL, "GetId", Init_exit);
-		// check if default
-		if (defaultCaptureId && !wcscmp(defaultCaptureId, devTab[index].id))
-			defaultInDev = index;
-		// Just fill in a default number of channels.
-		// It would be nice to know how many channels are supported!
-		// It looks like you have to actually try opening the device
-		// with different WAV parameters, is this really so?
-		devTab[index].isInput = true;
-		// get the name
-		if (!GetDeviceName(pDevice, devTab[index].name, sizeof(devTab[index].name))) {
-			status = WAD_ERR_INTERNAL;
-			goto Init_exit;
-		}
-		// convert ID to multibyte
-		WideCharToMultiByte(CP_ACP, 0, devTab[index].id, wcslen(devTab[index].id), devTab[index].devId, WAD_NAME_LEN, NULL, NULL);
-		WA_LOG(2, (THIS_FILE, "%d: '%s' '%s' isInput %d", index, devTab[index].name, devTab[index].devId,
-			devTab[index].isInput));
-	}
-	// render devices
-	for (i = 0; i < numRender; i++) {
-		index = i + numCapture;
-		hr = pRenderCollection->Item(i, &pDevice);
-		CHECK_GOTO(hr, WAD_ERR_INTERNAL, "Item", Init_exit);
-		// get the device ID
-		hr = pDevice->GetId(&devTab[index].id);
-		CHECK_GOTO(hr, WAD_ERR_INTERNAL, "GetId", Init_exit);
-		// check if default
-		if (defaultRenderId && !wcscmp(defaultRenderId, devTab[index].id))
-			defaultOutDev = index;
-		// Just fill in a default number channels
-		devTab[index].isInput = false;
-		// get the name
-		if (!GetDeviceName(pDevice, devTab[index].name, sizeof(devTab[index].name))) {
-			status = WAD_ERR_INTERNAL;
-			goto Init_exit;
-		}
-		// convert ID to multibyte
-		WideCharToMultiByte(CP_ACP, 0, devTab[index].id, wcslen(devTab[index].id), devTab[index].devId, WAD_NAME_LEN, NULL, NULL);
-		WA_LOG(2, (THIS_FILE, "%d: '%s' '%s' isInput %d", index, devTab[index].name, devTab[index].devId,
-			devTab[index].isInput));
-	}
-	// adjust default devices
-	if (defaultInDev == -1 && numCapture > 0)
-		defaultInDev = 0;
-	if (defaultOutDev == -1 && numRender > 0)
-		defaultOutDev = numCapture;
-Init_exit:
-	// free default ids
-	if (defaultCaptureId)
-		CoTaskMemFree(defaultCaptureId);
-	if (defaultRenderId)
-		CoTaskMemFree(defaultRenderId);
-	if (status != WAD_OK) {
-		SafeRelease(&pEnumerator);
-		isInitialized = false;
+	long long initStart = stats.Start();
+	long long start;
+	bool isCached = false;
+	int status;
+
+	if (!backend) {
+		SetErrorText("no audio backend available");
+		return WAD_ERR_UNSUPPORTED;
 	}
-	else
-		isInitialized = true;
-	return status;
+	isLazy = lazy;
+	start = stats.Start();
+	status = backend->Init(role);
+	stats.End(WAD_STAGE_BACKEND_INIT, start);
+	if (status != WAD_OK)
+		return BackendError(status);
+	isInitialized = true;
+	if (cacheFile) {
+		start = stats.Start();
+		isCached = (LoadCache() == WAD_OK);
+		stats.End(WAD_STAGE_LOAD_CACHE, start);
+	}
+	if (cacheFile ? !isCached : !lazy) {
+		start = stats.Start();
+		status = EnumerateAll();
+		stats.End(WAD_STAGE_ENUMERATE, start);
+		if (status != WAD_OK) {
+			isInitialized = false;
+			return status;
+		}
+		start = stats.Start();
+		ResolveDefault(true);
+		ResolveDefault(false);
+		stats.End(WAD_STAGE_DEFAULT, start);
+		if (cacheFile)
+			SaveCache();
+	}
+	stats.End(WAD_STAGE_INIT, initStart);
+	WA_LOG(2, (THIS_FILE, "Init: %s backend", backend->GetName()));
+	return WAD_OK;
 }
 
 
 VolCtl::~VolCtl()
 {
 	int i;
-	if (isInitialized) {
-		SafeRelease(&pEnumerator);
-		if (devTab) {
-			for (i = 0; i < numDev; i++)
-				CoTaskMemFree(devTab[i].id);
-			free(devTab);
-			devTab = NULL;
+	if (rampThread.joinable()) {
+		{
+			DEV_LOCK();
+			rampStop = true;
+		}
+		rampCond.notify_all();
+		rampThread.join();
+	}
+	// workers and the meter thread hold their own backend handles
+	StopPool();
+	StopMeter();
+	EnableDeviceNotify(false);
+	// keep devices seen while running
+	if (cacheFile && cacheDirty && isEnumerated)
+		SaveCache();
+	free(cacheFile);
+	cacheFile = NULL;
+	if (devTab) {
+		for (i = 0; i < numDev; i++) {
+			EndRamp(i);
+			UnwatchDevice(i);
+			InvalidateSessions(i);
+			InvalidateDevice(i);
+			FreeScale(i);
 		}
-		numDev = 0;
-		isInitialized = false;
+		free(devTab);
+		devTab = NULL;
+		free(devState);
+		devState = NULL;
 	}
+	while (strBlocks) {
+		WadStrBlock *pBlock = strBlocks;
+		strBlocks = pBlock->pNext;
+		free(pBlock);
+	}
+	// sessions of devices never indexed, should there be any
+	for (i = 0; i < numSes; i++)
+		EndSession(i);
+	free(sesTab);
+	sesTab = NULL;
+	free(sesState);
+	sesState = NULL;
+	free(sesHash);
+	sesHash = NULL;
+	freeSes = -1;
+	numSes = 0;
+	sesTabSize = 0;
+	// no readers are left
+	while (retiredSnaps) {
+		WadDevSnap *pSnap = retiredSnaps;
+		retiredSnaps = pSnap->pNext;
+		FreeSnap(pSnap);
+	}
+	FreeSnap(devSnap.exchange(NULL));
+	numDev = 0;
+	devTabSize = 0;
+	delete backend;
+	backend = NULL;
+	isInitialized = false;
 }
 
-void VolCtl::SetErrorText(char *text)
+void VolCtl::SetErrorText(const char *text)
 {
 	int i;
-	for (i = 0; text[i] && i < sizeof(errorText) - 1; i++)
+	for (i = 0; text[i] && i < (int) sizeof(errorText) - 1; i++)
 		errorText[i] = text[i];
 	errorText[i] = 0;
 }
@@ -389,151 +568,3264 @@ const char* VolCtl::GetErrorText()
 	return errorText;
 }
 
+// Returns number of devices, enumerating all if lazy
 int VolCtl::GetNumDevices()
 {
+	{
+		SNAP_READ();
+		if (pSnap->isEnumerated || !isInitialized)
+			return pSnap->numDev;
+	}
+	DEV_LOCK();
+	if (!isEnumerated)
+		EnumerateAll();
 	return numDev;
 }
 
-int VolCtl::GetDevInfo(int devId, WadDevInfo *pInfo)
+int VolCtl::GetDevInfo(int devIndex, WadDevInfo *pInfo)
 {
 	CHECK_INIT();
-	if (devId >= 0 && devId < numDev) {
-		// copy
-		*pInfo = devTab[devId];
-		return WAD_OK;
+	{
+		SNAP_READ();
+		if (devIndex < 0 || devIndex >= pSnap->numDev)
+			return WAD_ERR_INVALID_DEVICE;
+		// names and IDs point into the string table, so this is a few pointers
+		if (pSnap->devTab[devIndex].hasName) {
+			*pInfo = pSnap->devTab[devIndex];
+			return WAD_OK;
+		}
 	}
-	return WAD_ERR_INVALID_DEVICE;
+	// added lazily, read the name and publish it
+	DEV_LOCK();
+	if (!EnsureName(devIndex))
+		return WAD_ERR_INTERNAL;
+	PublishTable();
+	*pInfo = devSnap.load()->devTab[devIndex];
+	return WAD_OK;
 }
 
 int VolCtl::GetDefaultInDevIndex()
 {
-	return defaultInDev;
+	if (!isInitialized)
+		return -1;
+	{
+		SNAP_READ();
+		if (pSnap->defaultInDev != DEV_UNRESOLVED)
+			return pSnap->defaultInDev;
+	}
+	DEV_LOCK();
+	return ResolveDefault(true);
 }
 
 int VolCtl::GetDefaultOutDevIndex()
 {
-	return defaultOutDev;
+	if (!isInitialized)
+		return -1;
+	{
+		SNAP_READ();
+		if (pSnap->defaultOutDev != DEV_UNRESOLVED)
+			return pSnap->defaultOutDev;
+	}
+	DEV_LOCK();
+	return ResolveDefault(false);
 }
 
-// Lookup by id, return -1 if not found
-int VolCtl::FindDevById(const char* devId)
+//=============================================================================
+//
+// Device lookup
+//
+// Lookups read a copy of the device table published through devSnap, so
+// callers on several threads don't wait on devLock, or on an enumeration
+// in progress. Changes to the table are made with devLock held, and then a
+// new copy replaces the old one with one atomic store.
+//
+// Replaced copies are freed by epochs. Readers are counted in one of two
+// counts, by the parity of the epoch they started in. A change moves the
+// epoch on once the count of the other parity, which then only has readers
+// of the epoch before last, drops to 0, and a copy replaced in epoch e is
+// freed once the epoch reaches e + 2, when every reader that could have
+// loaded it is done. Readers are short, so under constant load the old count
+// still drains, and copies are freed a change or two later.
+//
+// Devices are indexed by ID and by lower case name in open addressed hash
+// tables, built with each copy, so lookups don't scan the device table.
+// Entries are inserted in device table order so the first of several
+// devices with the same name is found first, as with a linear search. The
+// hashes of IDs and names, and the name order, are carried over from the
+// last copy, with only the added and renamed devices hashed, and sorted and
+// merged in, so adding devices one by one, as lazy lookups do, doesn't hash
+// and sort the whole table each time.
+//
+
+// FNV-1a hash, optionally of lower case string
+static unsigned int HashStr(const char *s, bool noCase)
 {
-	int devIndex = -1;
-	for (int i = 0; i < numDev; i++) {
-		if (!strcmp(devId, devTab[i].devId)) {
-			devIndex = i;
-			break;
-		}
+	unsigned int h = 2166136261u;
+	for (; *s; s++) {
+		h ^= noCase ? (unsigned char) tolower((unsigned char) *s) : (unsigned char) *s;
+		h *= 16777619u;
 	}
-	return devIndex;
+	return h;
 }
 
-// Lookup by name, return -1 if not found
-int VolCtl::FindDevByName(const char* devName)
+// case insensitive substring search
+static const char *StrStrNoCase(const char *str, const char *sub)
 {
-	int devIndex = -1;
-	for (int i = 0; i < numDev; i++) {
-		if (!strcmp(devName, devTab[i].name)) {
-			devIndex = i;
-			break;
-		}
+	size_t n = strlen(sub);
+	for (; *str; str++) {
+		if (!_strnicmp(str, sub, n))
+			return str;
 	}
-	return devIndex;
+	return n ? NULL : str;
 }
 
-int VolCtl::AccessVol(int devIndex, bool setVol, float *pVol)
+// a device in name order, ties in table order
+typedef struct {
+	const char *name;
+	int devIndex;
+} NameKey;
+
+static int CompareNameKey(const void *a, const void *b)
 {
-	HRESULT hr;
-	IMMDevice *pDevice;
-	IAudioEndpointVolume *pAudioEndpointVolume;
+	const NameKey *pA = (const NameKey *) a;
+	const NameKey *pB = (const NameKey *) b;
+	int cmp = _stricmp(pA->name, pB->name);
+	return cmp ? cmp : pA->devIndex - pB->devIndex;
+}
 
-	// check device
-	if (devIndex < 0 || devIndex >= numDev) {
-		_snprintf(errorText, sizeof(errorText), "AccessVol: device %d is not valid", devIndex);
-		WA_LOG(1, (THIS_FILE, errorText));
-		return WAD_ERR_INVALID_DEVICE;
+// T/F if device i has the same name in the last copy, names are in the
+// string table, so a renamed device has a new pointer
+static bool SameName(const WadDevSnap *pSnap, const WadDevSnap *pPrev, int i)
+{
+	return pPrev && i < pPrev->numDev && pSnap->devTab[i].name == pPrev->devTab[i].name;
+}
+
+//
+// Build the name order of a copy by merging the devices of the last copy
+// that kept their names, in their order, with the rest, sorted. Returns
+// false if out of memory.
+//
+static bool BuildNameOrder(WadDevSnap *pSnap, const WadDevSnap *pPrev)
+{
+	WadDevInfo *devTab = pSnap->devTab;
+	int *nameOrder = pSnap->nameOrder;
+	NameKey *keys, old;
+	int i, j, k, n;
+	int numKeys = 0;
+
+	keys = (NameKey *) malloc(MAX(pSnap->numDev, 1) * sizeof(NameKey));
+	if (!keys)
+		return false;
+	for (i = 0; i < pSnap->numDev; i++) {
+		if (!SameName(pSnap, pPrev, i)) {
+			keys[numKeys].name = devTab[i].name;
+			keys[numKeys].devIndex = i;
+			numKeys++;
+		}
 	}
-	// get device
-	hr = pEnumerator->GetDevice(devTab[devIndex].id, &pDevice);
-	CHECK(hr, WAD_ERR_INTERNAL, "GetDevice");
-	hr = pDevice->Activate(IID_IAudioEndpointVolume, CLSCTX_ALL, NULL,
-		(void **) &pAudioEndpointVolume);
-	CHECK(hr, WAD_ERR_INTERNAL, "Activate");
+	qsort(keys, numKeys, sizeof(NameKey), CompareNameKey);
+	j = 0;
+	k = 0;
+	for (n = 0; n < pSnap->numDev; n++) {
+		// next device of the last copy with the same name
+		while (pPrev && j < pPrev->numDev && !SameName(pSnap, pPrev, pPrev->nameOrder[j]))
+			j++;
+		if (!pPrev || j >= pPrev->numDev) {
+			nameOrder[n] = keys[k++].devIndex;
+			continue;
+		}
+		old.devIndex = pPrev->nameOrder[j];
+		old.name = devTab[old.devIndex].name;
+		if (k < numKeys && CompareNameKey(&keys[k], &old) < 0)
+			nameOrder[n] = keys[k++].devIndex;
+		else {
+			nameOrder[n] = old.devIndex;
+			j++;
+		}
+	}
+	free(keys);
+	return true;
+}
+
+// Build the lookup indexes of a table copy, returns false if out of memory
+static bool BuildIndex(WadDevSnap *pSnap, const WadDevSnap *pPrev)
+{
+	WadDevInfo *devTab = pSnap->devTab;
+	int *idHash, *nameHash;
+	unsigned int *idHashes, *nameHashes;
+	int i, k;
+	unsigned int mask;
 
-	// set or get volume
-	if (setVol) {
-		hr = pAudioEndpointVolume->SetMasterVolumeLevelScalar(*pVol, NULL);
-		CHECK(hr, WAD_ERR_INTERNAL, "SetMasterVolumeLevelScalar");
+	for (pSnap->hashSize = 16; pSnap->hashSize < 2 * pSnap->numDev; pSnap->hashSize *= 2)
+		;
+	mask = pSnap->hashSize - 1;
+	idHash = pSnap->idHash = (int *) malloc(pSnap->hashSize * sizeof(int));
+	nameHash = pSnap->nameHash = (int *) malloc(pSnap->hashSize * sizeof(int));
+	idHashes = pSnap->idHashes = (unsigned int *) malloc((pSnap->numDev + 1) * sizeof(unsigned int));
+	nameHashes = pSnap->nameHashes = (unsigned int *) malloc((pSnap->numDev + 1) * sizeof(unsigned int));
+	pSnap->nameOrder = (int *) malloc((pSnap->numDev + 1) * sizeof(int));
+	if (!idHash || !nameHash || !idHashes || !nameHashes || !pSnap->nameOrder)
+		return false;
+	for (i = 0; i < pSnap->hashSize; i++)
+		idHash[i] = nameHash[i] = -1;
+	for (i = 0; i < pSnap->numDev; i++) {
+		// a device keeps its ID
+		idHashes[i] = pPrev && i < pPrev->numDev ? pPrev->idHashes[i] : HashStr(devTab[i].devId, false);
+		nameHashes[i] = SameName(pSnap, pPrev, i) ? pPrev->nameHashes[i] : HashStr(devTab[i].name, true);
+		// linear probing
+		for (k = idHashes[i] & mask; idHash[k] != -1; k = (k + 1) & mask)
+			;
+		idHash[k] = i;
+		// devices added lazily have no name yet, which would all collide
+		if (!devTab[i].hasName)
+			continue;
+		for (k = nameHashes[i] & mask; nameHash[k] != -1; k = (k + 1) & mask)
+			;
+		nameHash[k] = i;
 	}
-	else {
-		hr = pAudioEndpointVolume->GetMasterVolumeLevelScalar(pVol);
-		CHECK(hr, WAD_ERR_INTERNAL, "GetMasterVolumeLevelScalar");
+	return BuildNameOrder(pSnap, pPrev);
+}
+
+//
+// Copy the device table, defaults and indexes for readers, and replace the
+// published copy, with devLock held. If out of memory readers keep the
+// last copy.
+//
+void VolCtl::PublishTable()
+{
+	WadDevSnap *pSnap;
+	WadDevSnap *pOld;
+	int i;
+
+	pSnap = (WadDevSnap *) calloc(1, sizeof(WadDevSnap));
+	if (!pSnap)
+		goto PublishTable_error;
+	pSnap->devTab = (WadDevInfo *) malloc(MAX(numDev, 1) * sizeof(WadDevInfo));
+	if (!pSnap->devTab)
+		goto PublishTable_error;
+	// handles are kept in devState, so the entries only change with devLock held
+	if (numDev > 0)
+		memcpy(pSnap->devTab, devTab, numDev * sizeof(WadDevInfo));
+	pSnap->numDev = numDev;
+	pSnap->defaultInDev = defaultInDev;
+	pSnap->defaultOutDev = defaultOutDev;
+	pSnap->isEnumerated = isEnumerated;
+	pSnap->scales = (WadDbScale **) malloc(MAX(numDev, 1) * sizeof(WadDbScale *));
+	if (!pSnap->scales)
+		goto PublishTable_error;
+	for (i = 0; i < numDev; i++)
+		pSnap->scales[i] = devState[i].pScale;
+	// the published copy isn't freed while devLock is held
+	if (!BuildIndex(pSnap, devSnap.load()))
+		goto PublishTable_error;
+	pOld = devSnap.exchange(pSnap);
+	if (pOld) {
+		pOld->epoch = snapEpoch.load();
+		pOld->pNext = retiredSnaps;
+		retiredSnaps = pOld;
 	}
+	FreeRetired();
+	return;
 
-	// clean up
-	SafeRelease(&pAudioEndpointVolume);
-	SafeRelease(&pDevice);
-	return WAD_OK;
+PublishTable_error:
+	WA_LOG(1, (THIS_FILE, "PublishTable: out of memory"));
+	FreeSnap(pSnap);
 }
 
+//
+// Move the epoch on as far as readers allow, and free the replaced table
+// copies no reader can have, with devLock held. Retired copies are newest
+// first, so once one is old enough the rest are too.
+//
+void VolCtl::FreeRetired()
+{
+	WadDevSnap **ppSnap = &retiredSnaps;
+	WadDevSnap *pSnap;
+	unsigned epoch = snapEpoch.load();
+	int i;
 
-int VolCtl::AccessMute(int devIndex, bool setMute, bool *pMute)
+	for (i = 0; i < 2 && snapReaders[(epoch + 1) & 1].load() == 0; i++)
+		snapEpoch.store(++epoch);
+	while (*ppSnap && epoch - (*ppSnap)->epoch < 2)
+		ppSnap = &(*ppSnap)->pNext;
+	while ((pSnap = *ppSnap) != NULL) {
+		*ppSnap = pSnap->pNext;
+		FreeSnap(pSnap);
+	}
+}
+
+// Lookup by id in a table copy, return -1 if not found
+static int SnapLookupId(WadDevSnap *pSnap, const char *devId)
 {
-	HRESULT hr;
-	IMMDevice *pDevice;
-	IAudioEndpointVolume *pAudioEndpointVolume;
-	BOOL bMute;
+	unsigned int mask = pSnap->hashSize - 1;
+	int k;
 
-	// check device
-	if (devIndex < 0 || devIndex >= numDev) {
-		_snprintf(errorText, sizeof(errorText), "AccessMute: device %d is not valid", devIndex);
-		WA_LOG(1, (THIS_FILE, errorText));
-		return WAD_ERR_INVALID_DEVICE;
+	for (k = HashStr(devId, false) & mask; pSnap->idHash[k] != -1; k = (k + 1) & mask) {
+		if (!strcmp(devId, pSnap->devTab[pSnap->idHash[k]].devId))
+			return pSnap->idHash[k];
 	}
-	// get device
-	hr = pEnumerator->GetDevice(devTab[devIndex].id, &pDevice);
-	CHECK(hr, WAD_ERR_INTERNAL, "GetDevice");
-	hr = pDevice->Activate(IID_IAudioEndpointVolume, CLSCTX_ALL, NULL,
-		(void **) &pAudioEndpointVolume);
-	CHECK(hr, WAD_ERR_INTERNAL, "Activate");
+	return -1;
+}
 
-	// set or get volume
-	if (setMute) {
-		bMute = *pMute;
-		hr = pAudioEndpointVolume->SetMute(bMute, NULL);
-		CHECK(hr, WAD_ERR_INTERNAL, "SetMute");
+// Binary search sorted names for the first in name order with prefix,
+// return -1 if none.
+static int SnapFindPrefix(WadDevSnap *pSnap, const char *prefix)
+{
+	WadDevInfo *devTab = pSnap->devTab;
+	int *nameOrder = pSnap->nameOrder;
+	size_t n = strlen(prefix);
+	int lo = 0;
+	int hi = pSnap->numDev;
+	int mid;
+	// find first name not less than prefix
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (_strnicmp(devTab[nameOrder[mid]].name, prefix, n) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
-	else {
-		hr = pAudioEndpointVolume->GetMute(&bMute);
-		CHECK(hr, WAD_ERR_INTERNAL, "GetMute");
-		*pMute = bMute != 0;
+	for (; lo < pSnap->numDev && !_strnicmp(devTab[nameOrder[lo]].name, prefix, n); lo++) {
+		if (devTab[nameOrder[lo]].isActive)
+			return nameOrder[lo];
 	}
+	return -1;
+}
 
-	// clean up
-	SafeRelease(&pAudioEndpointVolume);
-	SafeRelease(&pDevice);
-	return WAD_OK;
+// Lookup by name in a table copy using a WadMatch mode, return -1 if not found
+static int SnapFindName(WadDevSnap *pSnap, const char *devName, int match)
+{
+	WadDevInfo *devTab = pSnap->devTab;
+	unsigned int mask = pSnap->hashSize - 1;
+	int k, i;
+	int devIndex = -1;
+
+	switch (match) {
+	case WAD_MATCH_EXACT:
+	case WAD_MATCH_NOCASE:
+		for (k = HashStr(devName, true) & mask; pSnap->nameHash[k] != -1; k = (k + 1) & mask) {
+			i = pSnap->nameHash[k];
+			if (!devTab[i].isActive)
+				continue;
+			if (match == WAD_MATCH_EXACT ? !strcmp(devName, devTab[i].name) : !_stricmp(devName, devTab[i].name))
+				return i;
+		}
+		break;
+	case WAD_MATCH_PREFIX:
+		devIndex = SnapFindPrefix(pSnap, devName);
+		break;
+	case WAD_MATCH_SUBSTR:
+		// substrings aren't indexed, so this scans
+		for (i = 0; i < pSnap->numDev; i++) {
+			if (devTab[i].isActive && StrStrNoCase(devTab[i].name, devName)) {
+				devIndex = i;
+				break;
+			}
+		}
+		break;
+	case WAD_MATCH_BEST:
+		for (i = WAD_MATCH_EXACT; i < WAD_MATCH_BEST && devIndex == -1; i++)
+			devIndex = SnapFindName(pSnap, devName, i);
+		break;
+	}
+	return devIndex;
 }
 
-int VolCtl::SetVol(int devIndex, float vol)
+// Lookup by id in the published table, with devLock held so it isn't freed
+int VolCtl::LookupId(const char* devId)
 {
-	WA_LOG(2, (THIS_FILE, "SetVol devIndex=%d vol=%f", devIndex, vol));
-	return AccessVol(devIndex, true, &vol);
+	return SnapLookupId(devSnap.load(), devId);
 }
 
-int VolCtl::GetVol(int devIndex, float *pVol)
+// Check a device index against the published table, without devLock
+bool VolCtl::IsActiveDev(int devIndex)
 {
-	return AccessVol(devIndex, false, pVol);
+	SNAP_READ();
+	return devIndex >= 0 && devIndex < pSnap->numDev && pSnap->devTab[devIndex].isActive;
 }
 
-int VolCtl::SetMute(int devIndex, bool mute)
+// Lookup by id, return -1 if not found
+int VolCtl::FindDevById(const char* devId)
 {
-	WA_LOG(2, (THIS_FILE, "SetMute devIndex=%d mute=%d", devIndex, mute));
-	return AccessMute(devIndex, true, &mute);
+	int devIndex;
+
+	{
+		SNAP_READ();
+		devIndex = SnapLookupId(pSnap, devId);
+		if (devIndex >= 0)
+			return pSnap->devTab[devIndex].isActive ? devIndex : -1;
+		if (pSnap->isEnumerated || !isInitialized)
+			return -1;
+	}
+	// if lazy, the device may not be in the table yet
+	DEV_LOCK();
+	devIndex = LookupId(devId);
+	if (devIndex == -1 && !isEnumerated)
+		devIndex = AddDeviceById(devId, false);
+	if (devIndex >= 0 && !devTab[devIndex].isActive)
+		devIndex = -1;
+	return devIndex;
 }
 
-int VolCtl::GetMute(int devIndex, bool *pMute)
+// Lookup by name using a WadMatch mode, return -1 if not found
+int VolCtl::FindDevByName(const char* devName, int match)
 {
-	return AccessMute(devIndex, false, pMute);
+	{
+		SNAP_READ();
+		if (pSnap->isEnumerated || !isInitialized)
+			return SnapFindName(pSnap, devName, match);
+	}
+	// need all the names
+	DEV_LOCK();
+	if (!isEnumerated && EnumerateAll() != WAD_OK)
+		return -1;
+	return SnapFindName(devSnap.load(), devName, match);
+}
+
+//=============================================================================
+//
+// Device cache
+//
+// Enumerating the devices and reading their names is most of the cost of a
+// short run, though the devices rarely change. With a cache file the table
+// is read from a memory map of the file, and checked against the audio
+// system by counting the active devices each way and looking up the default
+// devices, a few cheap calls. Devices keep their table index across runs,
+// also when a stale cache is replaced, so an index is a short stable handle
+// for a device. A device swapped for another without changing the counts
+// or defaults isn't noticed until used: volume calls on the old one fail,
+// and a lookup of the new ID adds it.
+//
+
+#define CACHE_MAGIC		"WADCACHE"
+#define CACHE_VERSION	2
+
+// file header, followed by an entry per device in table order, then the
+// strings, UTF-8 and null terminated
+typedef struct {
+	char magic[8];				// CACHE_MAGIC, not terminated
+	uint32_t version;			// CACHE_VERSION
+	uint32_t numDev;			// number of entries
+	uint32_t numActive[2];		// active output and input devices
+	char backend[32];			// backend name
+	uint32_t stringsLen;		// bytes of strings
+} CacheHeader;
+
+typedef struct {
+	uint32_t idOffset;			// offset of device ID in the strings
+	uint32_t nameOffset;		// offset of name in the strings
+	uint8_t isInput;
+	uint8_t isActive;
+	uint8_t pad[2];
+} CacheEntry;
+
+// Map a file for reading, returns NULL if missing or empty
+static const void *MapFile(const char *path, size_t *pLen)
+{
+	const void *data = NULL;
+#ifdef _WIN32
+	HANDLE hFile, hMap;
+	LARGE_INTEGER size;
+
+	hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return NULL;
+	if (GetFileSizeEx(hFile, &size) && size.QuadPart > 0) {
+		// the view keeps the mapping open
+		if ((hMap = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL)) != NULL) {
+			data = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(hMap);
+		}
+		*pLen = (size_t) size.QuadPart;
+	}
+	CloseHandle(hFile);
+#else
+	struct stat st;
+	void *p;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return NULL;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED)
+			data = p;
+		*pLen = st.st_size;
+	}
+	close(fd);
+#endif
+	return data;
+}
+
+static void UnmapFile(const void *data, size_t len)
+{
+#ifdef _WIN32
+	UNUSED(len);
+	UnmapViewOfFile(data);
+#else
+	munmap((void *) data, len);
+#endif
+}
+
+void VolCtl::SetCacheFile(const char *path)
+{
+	free(cacheFile);
+	cacheFile = NULL;
+	if (path) {
+		cacheFile = (char *) malloc(strlen(path) + 1);
+		strcpy(cacheFile, path);
+	}
 }
 
+//
+// Fill the device table from the cache file, returns WAD_OK if the cache is
+// current. Otherwise the cached devices are left in the table inactive, so
+// the enumeration that follows gives them their old indexes.
+//
+int VolCtl::LoadCache()
+{
+	const CacheHeader *pHdr;
+	const CacheEntry *pEntry;
+	const char *strings;
+	unsigned numActive[2];
+	unsigned numRecords;
+	size_t len = 0;
+	unsigned i;
+	int index;
+	const void *data = MapFile(cacheFile, &len);
+
+	if (!data) {
+		WA_LOG(2, (THIS_FILE, "LoadCache: no cache '%s'", cacheFile));
+		return WAD_ERR_INVALID_ARG;
+	}
+	pHdr = (const CacheHeader *) data;
+	if (len < sizeof(CacheHeader) || memcmp(pHdr->magic, CACHE_MAGIC, sizeof(pHdr->magic))
+		|| pHdr->version != CACHE_VERSION
+		|| pHdr->numDev > (len - sizeof(CacheHeader)) / sizeof(CacheEntry)
+		|| pHdr->stringsLen != len - sizeof(CacheHeader) - pHdr->numDev * sizeof(CacheEntry)
+		|| pHdr->stringsLen == 0 || ((const char *) data)[len - 1] != 0
+		|| strncmp(pHdr->backend, backend->GetName(), sizeof(pHdr->backend))) {
+		WA_LOG(1, (THIS_FILE, "LoadCache: '%s' isn't a %s device cache", cacheFile, backend->GetName()));
+		UnmapFile(data, len);
+		return WAD_ERR_INVALID_ARG;
+	}
+	// the strings end with a null, so one at a checked offset can't run past them
+	pEntry = (const CacheEntry *) (pHdr + 1);
+	strings = (const char *) (pEntry + pHdr->numDev);
+	for (i = 0; i < pHdr->numDev; i++, pEntry++) {
+		if (pEntry->idOffset >= pHdr->stringsLen || pEntry->nameOffset >= pHdr->stringsLen)
+			break;
+		index = AddDevice(strings + pEntry->idOffset, pEntry->isInput != 0, strings + pEntry->nameOffset);
+		if (index < 0)
+			break;
+		devTab[index].isActive = pEntry->isActive != 0;
+	}
+	numRecords = pHdr->numDev;
+	numActive[0] = pHdr->numActive[0];
+	numActive[1] = pHdr->numActive[1];
+	UnmapFile(data, len);
+	PublishTable();
+	// a record that didn't load means the file is damaged, so enumerate instead
+	if (i < numRecords || !IsCacheCurrent(numActive)) {
+		WA_LOG(2, (THIS_FILE, "LoadCache: '%s' stale", cacheFile));
+		for (index = 0; index < numDev; index++)
+			devTab[index].isActive = false;
+		defaultInDev = DEV_UNRESOLVED;
+		defaultOutDev = DEV_UNRESOLVED;
+		PublishTable();
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	isEnumerated = true;
+	PublishTable();
+	WA_LOG(2, (THIS_FILE, "LoadCache: %d devices from '%s'", numDev, cacheFile));
+	return WAD_OK;
+}
+
+//
+// Check the cached table against the audio system: the same number of
+// active devices each way, and the default devices active in the table,
+// which resolves the defaults.
+//
+bool VolCtl::IsCacheCurrent(const unsigned *numActive)
+{
+	char devId[WAD_NAME_LEN];
+	int *pDefault;
+	int dir, count, index, status;
+
+	for (dir = 0; dir < 2; dir++) {
+		bool isInput = dir != 0;
+		if (backend->CountDevices(isInput, &count) != WAD_OK || count != (int) numActive[dir])
+			return false;
+		status = backend->GetDefaultDev(isInput, devId, sizeof(devId));
+		// no default is resolved later, as without a cache
+		if (status == WAD_ERR_INVALID_DEVICE)
+			continue;
+		if (status != WAD_OK)
+			return false;
+		index = LookupId(devId);
+		if (index < 0 || !devTab[index].isActive || devTab[index].isInput != isInput)
+			return false;
+		pDefault = isInput ? &defaultInDev : &defaultOutDev;
+		*pDefault = index;
+	}
+	return true;
+}
+
+//
+// Write the device table to the cache file. The file is written under
+// another name and renamed, so a process starting meanwhile reads the old
+// or the new cache.
+//
+int VolCtl::SaveCache()
+{
+	CacheHeader hdr;
+	CacheEntry entry;
+	char *tmpName;
+	size_t len;
+	uint32_t offset;
+	FILE *fp;
+	int i, status;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.version = CACHE_VERSION;
+	hdr.numDev = numDev;
+	strncpy(hdr.backend, backend->GetName(), sizeof(hdr.backend) - 1);
+	for (i = 0; i < numDev; i++) {
+		// devices added by notification may not be named yet
+		if (devTab[i].isActive) {
+			EnsureName(i);
+			hdr.numActive[devTab[i].isInput]++;
+		}
+		hdr.stringsLen += (uint32_t) (strlen(devTab[i].devId) + strlen(devTab[i].name) + 2);
+	}
+	len = strlen(cacheFile) + 32;
+	tmpName = (char *) malloc(len);
+#ifdef _WIN32
+	_snprintf(tmpName, len, "%s.%lu", cacheFile, GetCurrentProcessId());
+#else
+	_snprintf(tmpName, len, "%s.%d", cacheFile, (int) getpid());
+#endif
+	if ((fp = fopen(tmpName, "wb")) == NULL) {
+		WA_LOG(1, (THIS_FILE, "SaveCache: can't create '%s'", tmpName));
+		free(tmpName);
+		return WAD_ERR_INTERNAL;
+	}
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	offset = 0;
+	for (i = 0; i < numDev; i++) {
+		memset(&entry, 0, sizeof(entry));
+		entry.idOffset = offset;
+		offset += (uint32_t) strlen(devTab[i].devId) + 1;
+		entry.nameOffset = offset;
+		offset += (uint32_t) strlen(devTab[i].name) + 1;
+		entry.isInput = devTab[i].isInput;
+		entry.isActive = devTab[i].isActive;
+		fwrite(&entry, sizeof(entry), 1, fp);
+	}
+	for (i = 0; i < numDev; i++) {
+		fwrite(devTab[i].devId, strlen(devTab[i].devId) + 1, 1, fp);
+		fwrite(devTab[i].name, strlen(devTab[i].name) + 1, 1, fp);
+	}
+	status = ferror(fp) ? WAD_ERR_INTERNAL : WAD_OK;
+	if (fclose(fp) != 0)
+		status = WAD_ERR_INTERNAL;
+#ifdef _WIN32
+	if (status == WAD_OK && !MoveFileExA(tmpName, cacheFile, MOVEFILE_REPLACE_EXISTING))
+		status = WAD_ERR_INTERNAL;
+#else
+	if (status == WAD_OK && rename(tmpName, cacheFile) != 0)
+		status = WAD_ERR_INTERNAL;
+#endif
+	if (status != WAD_OK) {
+		WA_LOG(1, (THIS_FILE, "SaveCache: can't write '%s'", cacheFile));
+		remove(tmpName);
+	}
+	else {
+		cacheDirty = false;
+		WA_LOG(2, (THIS_FILE, "SaveCache: %d devices to '%s'", numDev, cacheFile));
+	}
+	free(tmpName);
+	return status;
+}
+
+//=============================================================================
+//
+// Device notifications
+//
+// The backend reports device changes and VolCtl patches the device table,
+// so a long running VolCtl doesn't need to re-enumerate. Removed devices
+// keep their table index and are marked inactive, so indexes held by
+// callers never refer to a different device. Notifications arrive on a
+// system thread, so the device table is changed with devLock held, and
+// then published to readers.
+//
+
+int VolCtl::EnableDeviceNotify(bool enable)
+{
+	if (enable && !isNotify) {
+		CHECK_INIT();
+		CHECK_BACKEND(backend->SetListener(this));
+		isNotify = true;
+	}
+	else if (!enable && isNotify) {
+		{
+			DEV_LOCK();
+			// without notifications session tables go stale
+			for (int i = 0; i < numDev; i++) {
+				if (devState[i].hSesWatch) {
+					backend->UnwatchSessions(devState[i].hSesWatch);
+					devState[i].hSesWatch = NULL;
+				}
+				devState[i].hasSessions = false;
+			}
+		}
+		// blocks until any callback in progress returns
+		backend->SetListener(NULL);
+		isNotify = false;
+	}
+	return WAD_OK;
+}
+
+//
+// Device added, removed or changed state.
+//
+void VolCtl::OnDeviceState(const char *devId, bool isActive, bool isInput)
+{
+	int devIndex;
+
+	DEV_LOCK();
+	devIndex = LookupId(devId);
+	if (devIndex >= 0) {
+		devTab[devIndex].isActive = isActive;
+		if (!isActive) {
+			EndRamp(devIndex);
+			UnwatchDevice(devIndex);
+			InvalidateSessions(devIndex);
+			InvalidateDevice(devIndex);
+			// look up the default again when next asked
+			if (defaultInDev == devIndex)
+				defaultInDev = DEV_UNRESOLVED;
+			if (defaultOutDev == devIndex)
+				defaultOutDev = DEV_UNRESOLVED;
+		}
+	}
+	// if lazy, new devices are added when looked up
+	else if (isActive && isEnumerated)
+		devIndex = AddDeviceById(devId, true);
+	cacheDirty = true;
+	PublishTable();
+	// watch new or returning devices if watching all
+	if (devIndex >= 0 && devTab[devIndex].isActive && watchAllFn && !devState[devIndex].hWatch)
+		WatchDevice(devIndex, watchAllFn, watchAllArg);
+	WA_LOG(3, (THIS_FILE, "OnDeviceState: device %d isActive %d isInput %d", devIndex, isActive,
+		isInput));
+}
+
+void VolCtl::OnDefaultDevice(bool isInput, const char *devId)
+{
+	int devIndex = -1;
+
+	DEV_LOCK();
+	if (devId) {
+		devIndex = LookupId(devId);
+		if (devIndex == -1)
+			devIndex = AddDeviceById(devId, !isLazy);
+	}
+	if (isInput)
+		defaultInDev = devIndex;
+	else
+		defaultOutDev = devIndex;
+	PublishTable();
+	WA_LOG(3, (THIS_FILE, "OnDefaultDevice: %s device %d", isInput ? "input" : "output", devIndex));
+}
+
+void VolCtl::OnDeviceName(const char *devId)
+{
+	int devIndex;
+
+	DEV_LOCK();
+	devIndex = LookupId(devId);
+	if (devIndex >= 0 && devTab[devIndex].hasName) {
+		devTab[devIndex].hasName = false;
+		EnsureName(devIndex);
+		PublishTable();
+		cacheDirty = true;
+	}
+}
+
+//=============================================================================
+//
+// Volume change notifications
+//
+// Changes by the user or other applications are pushed to the caller by
+// the backend rather than polled.
+//
+
+int VolCtl::WatchDevice(int devIndex, WadVolChangeFn *fn, void *arg)
+{
+	UnwatchDevice(devIndex);
+	CHECK_BACKEND(backend->Watch(devTab[devIndex].devId, devIndex, fn, arg, &devState[devIndex].hWatch));
+	return WAD_OK;
+}
+
+void VolCtl::UnwatchDevice(int devIndex)
+{
+	if (devState[devIndex].hWatch) {
+		backend->Unwatch(devState[devIndex].hWatch);
+		devState[devIndex].hWatch = NULL;
+	}
+}
+
+//
+// Watch one device, or all active devices if devIndex is -1. When watching
+// all with device notifications enabled, added devices are watched too.
+//
+int VolCtl::Watch(int devIndex, WadVolChangeFn *fn, void *arg)
+{
+	int i;
+	int status = WAD_OK;
+
+	CHECK_INIT();
+	DEV_LOCK();
+	if (devIndex == -1) {
+		if (!isEnumerated && (status = EnumerateAll()) != WAD_OK)
+			return status;
+		watchAllFn = fn;
+		watchAllArg = arg;
+		for (i = 0; i < numDev && status == WAD_OK; i++) {
+			if (devTab[i].isActive)
+				status = WatchDevice(i, fn, arg);
+		}
+		return status;
+	}
+	if (devIndex < 0 || devIndex >= numDev || !devTab[devIndex].isActive) {
+		_snprintf(errorText, sizeof(errorText), "Watch: device %d is not valid", devIndex);
+		WA_LOG(1, (THIS_FILE, errorText));
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	return WatchDevice(devIndex, fn, arg);
+}
+
+int VolCtl::Unwatch(int devIndex)
+{
+	int i;
+
+	DEV_LOCK();
+	if (devIndex == -1) {
+		watchAllFn = NULL;
+		watchAllArg = NULL;
+		for (i = 0; i < numDev; i++)
+			UnwatchDevice(i);
+		return WAD_OK;
+	}
+	if (devIndex < 0 || devIndex >= numDev)
+		return WAD_ERR_INVALID_DEVICE;
+	UnwatchDevice(devIndex);
+	return WAD_OK;
+}
+
+//
+// A cached backend handle, counted so calls on several threads can use it
+// while it's dropped from the cache. The last call using a dropped handle
+// closes it.
+//
+struct WadDevHandle {
+	WadHandle hDev;
+	int refs;					// calls using the handle, guarded by handleLock
+};
+
+//
+// Get the backend handle for a device. Opening a handle can take several
+// calls into the audio system, so when caching is enabled the handle is
+// kept for the lifetime of the device table entry. It's opened without
+// handleLock, and if another thread caches one meanwhile, this one is
+// closed when released.
+//
+int VolCtl::OpenHandle(int devIndex, WadDevHandle **ppHandle)
+{
+	const char *devId;
+	WadDevHandle *pHandle;
+	WadHandle hDev;
+	long long start;
+	int status;
+
+	{
+		std::lock_guard<std::mutex> guard(handleLock);
+		if ((pHandle = devState[devIndex].pHandle) != NULL) {
+			pHandle->refs++;
+			*ppHandle = pHandle;
+			return WAD_OK;
+		}
+		// the string stays put, the table may grow meanwhile
+		devId = devTab[devIndex].devId;
+	}
+	start = stats.Start();
+	status = backend->OpenDev(devId, &hDev);
+	stats.End(WAD_STAGE_OPEN, start);
+	if (status != WAD_OK)
+		return BackendError(status);
+	pHandle = new WadDevHandle();
+	pHandle->hDev = hDev;
+	pHandle->refs = 1;
+	{
+		std::lock_guard<std::mutex> guard(handleLock);
+		if (useIfCache && !devState[devIndex].pHandle)
+			devState[devIndex].pHandle = pHandle;
+	}
+	*ppHandle = pHandle;
+	return WAD_OK;
+}
+
+//
+// Release a handle from OpenHandle. A cached handle goes stale if the
+// device was removed, so if isLost it's dropped, and the next call opens
+// a new one in case the device has come back.
+//
+void VolCtl::ReleaseHandle(int devIndex, WadDevHandle *pHandle, bool isLost)
+{
+	bool isLast;
+
+	{
+		std::lock_guard<std::mutex> guard(handleLock);
+		if (isLost && devState[devIndex].pHandle == pHandle)
+			devState[devIndex].pHandle = NULL;
+		isLast = --pHandle->refs == 0 && devState[devIndex].pHandle != pHandle;
+	}
+	if (isLast) {
+		backend->CloseDev(pHandle->hDev);
+		delete pHandle;
+	}
+}
+
+void VolCtl::InvalidateDevice(int devIndex)
+{
+	WadDevHandle *pHandle;
+
+	{
+		std::lock_guard<std::mutex> guard(handleLock);
+		pHandle = devState[devIndex].pHandle;
+		devState[devIndex].pHandle = NULL;
+		// closed by the last call still using it
+		if (pHandle && pHandle->refs > 0)
+			pHandle = NULL;
+	}
+	if (pHandle) {
+		backend->CloseDev(pHandle->hDev);
+		delete pHandle;
+	}
+}
+
+void VolCtl::SetInterfaceCache(bool enable)
+{
+	DEV_LOCK();
+	int i;
+	{
+		std::lock_guard<std::mutex> guard(handleLock);
+		useIfCache = enable;
+	}
+	if (!enable) {
+		for (i = 0; i < numDev; i++)
+			InvalidateDevice(i);
+	}
+}
+
+//
+// Volume and mute calls don't take devLock, so calls on several threads
+// run at once, and aren't held up by a change to the device table. The
+// device is checked in the published table, and the handle is counted so
+// it stays open while in use. With stats enabled, the whole call and the
+// backend call are timed.
+//
+int VolCtl::AccessVol(int devIndex, bool setVol, float *pVol)
+{
+	WadDevHandle *pHandle;
+	long long accessStart = stats.Start();
+	long long start;
+	int status;
+	int tries = 2;
+
+	// check device
+	if (!IsActiveDev(devIndex)) {
+		_snprintf(errorText, sizeof(errorText), "AccessVol: device %d is not valid", devIndex);
+		WA_LOG(1, (THIS_FILE, errorText));
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	do {
+		status = OpenHandle(devIndex, &pHandle);
+		if (status != WAD_OK)
+			return status;
+		// set or get volume
+		start = stats.Start();
+		if (setVol)
+			status = backend->SetVol(pHandle->hDev, *pVol);
+		else
+			status = backend->GetVol(pHandle->hDev, pVol);
+		stats.End(setVol ? WAD_STAGE_SET_VOL : WAD_STAGE_GET_VOL, start);
+		// try again with a new handle in case the device has come back
+		ReleaseHandle(devIndex, pHandle, status == WAD_ERR_DEVICE_LOST);
+	} while (status == WAD_ERR_DEVICE_LOST && --tries > 0);
+	stats.End(WAD_STAGE_ACCESS_VOL, accessStart);
+	if (status != WAD_OK)
+		return BackendError(status);
+	return WAD_OK;
+}
+
+
+int VolCtl::AccessMute(int devIndex, bool setMute, bool *pMute)
+{
+	WadDevHandle *pHandle;
+	long long accessStart = stats.Start();
+	long long start;
+	int status;
+	int tries = 2;
+
+	// check device
+	if (!IsActiveDev(devIndex)) {
+		_snprintf(errorText, sizeof(errorText), "AccessMute: device %d is not valid", devIndex);
+		WA_LOG(1, (THIS_FILE, errorText));
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	do {
+		status = OpenHandle(devIndex, &pHandle);
+		if (status != WAD_OK)
+			return status;
+		// set or get mute
+		start = stats.Start();
+		if (setMute)
+			status = backend->SetMute(pHandle->hDev, *pMute);
+		else
+			status = backend->GetMute(pHandle->hDev, pMute);
+		stats.End(setMute ? WAD_STAGE_SET_MUTE : WAD_STAGE_GET_MUTE, start);
+		ReleaseHandle(devIndex, pHandle, status == WAD_ERR_DEVICE_LOST);
+	} while (status == WAD_ERR_DEVICE_LOST && --tries > 0);
+	stats.End(WAD_STAGE_ACCESS_MUTE, accessStart);
+	if (status != WAD_OK)
+		return BackendError(status);
+	return WAD_OK;
+}
+
+int VolCtl::SetVol(int devIndex, float vol)
+{
+	WA_LOG(2, (THIS_FILE, "SetVol devIndex=%d vol=%f", devIndex, vol));
+	// a direct set overrides a ramp in progress
+	if (numRamps > 0) {
+		DEV_LOCK();
+		if (devIndex >= 0 && devIndex < numDev)
+			EndRamp(devIndex);
+	}
+	return AccessVol(devIndex, true, &vol);
+}
+
+int VolCtl::GetVol(int devIndex, float *pVol)
+{
+	return AccessVol(devIndex, false, pVol);
+}
+
+int VolCtl::SetMute(int devIndex, bool mute)
+{
+	WA_LOG(2, (THIS_FILE, "SetMute devIndex=%d mute=%d", devIndex, mute));
+	return AccessMute(devIndex, true, &mute);
+}
+
+int VolCtl::GetMute(int devIndex, bool *pMute)
+{
+	return AccessMute(devIndex, false, pMute);
+}
+
+//=============================================================================
+//
+// Channel volumes
+//
+// The channels of a device are read and written as a whole, one backend
+// call each way, and the arithmetic in between runs over all channels at
+// once with the WadGain kernels. Changing one channel is a read and a write
+// of all of them, which keeps the others as they were.
+//
+
+enum ChanOp {
+	CHAN_COUNT = 0,
+	CHAN_GET,
+	CHAN_SET,
+};
+
+int VolCtl::AccessChannels(int devIndex, int op, float *vols, int *pNum)
+{
+	WadDevHandle *pHandle;
+	int status;
+	int tries = 2;
+
+	DEV_LOCK();
+	// check device
+	if (devIndex < 0 || devIndex >= numDev || !devTab[devIndex].isActive) {
+		_snprintf(errorText, sizeof(errorText), "AccessChannels: device %d is not valid", devIndex);
+		WA_LOG(1, (THIS_FILE, errorText));
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	do {
+		status = OpenHandle(devIndex, &pHandle);
+		if (status != WAD_OK)
+			return status;
+		switch (op) {
+		case CHAN_COUNT:
+			status = backend->GetChannelCount(pHandle->hDev, pNum);
+			break;
+		case CHAN_GET:
+			status = backend->GetChannelVols(pHandle->hDev, vols, pNum);
+			break;
+		default:
+			status = backend->SetChannelVols(pHandle->hDev, vols, *pNum);
+			break;
+		}
+		ReleaseHandle(devIndex, pHandle, status == WAD_ERR_DEVICE_LOST);
+	} while (status == WAD_ERR_DEVICE_LOST && --tries > 0);
+	if (status != WAD_OK)
+		return BackendError(status);
+	return WAD_OK;
+}
+
+int VolCtl::GetChannelCount(int devIndex, int *pNum)
+{
+	return AccessChannels(devIndex, CHAN_COUNT, NULL, pNum);
+}
+
+int VolCtl::GetChannelVols(int devIndex, float *vols, int *pNum)
+{
+	return AccessChannels(devIndex, CHAN_GET, vols, pNum);
+}
+
+int VolCtl::SetChannelVols(int devIndex, const float *vols, int num)
+{
+	float v[WAD_MAX_CHANNELS];
+
+	WA_LOG(2, (THIS_FILE, "SetChannelVols devIndex=%d num=%d", devIndex, num));
+	if (num < 1 || num > WAD_MAX_CHANNELS) {
+		SetErrorText("SetChannelVols: number of channels is not valid");
+		return WAD_ERR_INVALID_ARG;
+	}
+	memcpy(v, vols, num * sizeof(float));
+	WadClampVols(v, num);
+	DEV_LOCK();
+	if (devIndex >= 0 && devIndex < numDev)
+		EndRamp(devIndex);
+	return AccessChannels(devIndex, CHAN_SET, v, &num);
+}
+
+int VolCtl::GetChannelVol(int devIndex, int chan, float *pVol)
+{
+	float vols[WAD_MAX_CHANNELS];
+	int num, status;
+
+	if ((status = AccessChannels(devIndex, CHAN_GET, vols, &num)) != WAD_OK)
+		return status;
+	if (chan < 0 || chan >= num) {
+		_snprintf(errorText, sizeof(errorText), "GetChannelVol: channel %d is not valid", chan);
+		return WAD_ERR_INVALID_ARG;
+	}
+	*pVol = vols[chan];
+	return WAD_OK;
+}
+
+int VolCtl::SetChannelVol(int devIndex, int chan, float vol)
+{
+	float vols[WAD_MAX_CHANNELS];
+	int num, status;
+
+	WA_LOG(2, (THIS_FILE, "SetChannelVol devIndex=%d chan=%d vol=%f", devIndex, chan, vol));
+	DEV_LOCK();
+	if ((status = AccessChannels(devIndex, CHAN_GET, vols, &num)) != WAD_OK)
+		return status;
+	if (chan < 0 || chan >= num) {
+		_snprintf(errorText, sizeof(errorText), "SetChannelVol: channel %d is not valid", chan);
+		return WAD_ERR_INVALID_ARG;
+	}
+	vols[chan] = vol;
+	WadClampVols(&vols[chan], 1);
+	EndRamp(devIndex);
+	return AccessChannels(devIndex, CHAN_SET, vols, &num);
+}
+
+int VolCtl::ApplyChannelGains(int devIndex, const float *gains, int num)
+{
+	float vols[WAD_MAX_CHANNELS], g[WAD_MAX_CHANNELS];
+	int i, n, status;
+
+	WA_LOG(2, (THIS_FILE, "ApplyChannelGains devIndex=%d num=%d", devIndex, num));
+	DEV_LOCK();
+	if ((status = AccessChannels(devIndex, CHAN_GET, vols, &n)) != WAD_OK)
+		return status;
+	if (num < 1 || num > n) {
+		_snprintf(errorText, sizeof(errorText), "ApplyChannelGains: %d gains for %d channels", num, n);
+		return WAD_ERR_INVALID_ARG;
+	}
+	for (i = 0; i < n; i++)
+		g[i] = gains[i % num];
+	WadApplyGains(vols, g, n);
+	EndRamp(devIndex);
+	return AccessChannels(devIndex, CHAN_SET, vols, &n);
+}
+
+int VolCtl::ApplyChannelDb(int devIndex, const float *db, int num)
+{
+	float gains[WAD_MAX_CHANNELS];
+
+	if (num < 1 || num > WAD_MAX_CHANNELS) {
+		SetErrorText("ApplyChannelDb: number of gains is not valid");
+		return WAD_ERR_INVALID_ARG;
+	}
+	WadDbToGains(db, gains, num);
+	return ApplyChannelGains(devIndex, gains, num);
+}
+
+//
+// Balance is set from the loudest channel rather than applied on top of
+// the current channels, so setting it again replaces it instead of adding up.
+// Channels go left or right by speaker position, and a backend that doesn't
+// know the layout gets the usual one for the channel count.
+//
+int VolCtl::SetBalance(int devIndex, float balance, int law)
+{
+	float vols[WAD_MAX_CHANNELS], gains[WAD_MAX_CHANNELS];
+	unsigned char sides[WAD_MAX_CHANNELS];
+	float vol;
+	int i, num, numSides, status;
+
+	WA_LOG(2, (THIS_FILE, "SetBalance devIndex=%d balance=%f law=%d", devIndex, balance, law));
+	DEV_LOCK();
+	if ((status = AccessChannels(devIndex, CHAN_GET, vols, &num)) != WAD_OK)
+		return status;
+	vol = WadMaxVol(vols, num);
+	for (i = 0; i < num; i++)
+		vols[i] = vol;
+	if (backend->GetChannelSides(devTab[devIndex].devId, sides, &numSides) != WAD_OK
+			|| numSides != num)
+		WadMaskToSides(WadDefaultSpeakerMask(num), sides, num);
+	WadBalanceGains(balance, law, sides, gains, num);
+	WadApplyGains(vols, gains, num);
+	EndRamp(devIndex);
+	return AccessChannels(devIndex, CHAN_SET, vols, &num);
+}
+
+//=============================================================================
+//
+// Volume in dB
+//
+// dB go to the backend as they are, on the device's own scale, so steps are
+// exact. Fader positions are mapped to dB by a taper, which would need a
+// log10 or pow for every conversion, so each device gets a table of dB at
+// evenly spaced positions and one of positions at evenly spaced dB, built
+// the first time from the device's range, and a conversion is a lookup and
+// a straight line between two entries. Scales are published with the copy
+// of the device table and never changed, so conversions read them without
+// devLock; a new taper replaces them, and the old ones are freed with the
+// last copy that can point to them.
+//
+
+enum DbOp {
+	DB_RANGE = 0,
+	DB_GET,
+	DB_SET,
+};
+
+#define TAPER_SIZE		256		// table intervals, within 0.01 dB of the audio taper
+#define TAPER_AUDIO_DB	60.0f	// dB per decade of position, amplitude is position cubed
+
+struct WadDbScale {
+	float minDb;
+	float maxDb;
+	float stepDb;			// 0 if continuous
+	int taper;				// WadTaper
+	float points[2 * WAD_TAPER_MAX_POINTS];	// custom taper breakpoints
+	int numPoints;
+	float posToDb[TAPER_SIZE + 1];	// dB at positions 0..1
+	float dbToPos[TAPER_SIZE + 1];	// position at minDb..maxDb
+	WadDbScale *pNext;		// next replaced scale
+};
+
+static void FreeScales(WadDbScale *pScale)
+{
+	WadDbScale *pNext;
+
+	for (; pScale; pScale = pNext) {
+		pNext = pScale->pNext;
+		delete pScale;
+	}
+}
+
+int VolCtl::AccessDb(int devIndex, int op, float *vals)
+{
+	WadDevHandle *pHandle;
+	int status;
+	int tries = 2;
+
+	DEV_LOCK();
+	// check device
+	if (devIndex < 0 || devIndex >= numDev || !devTab[devIndex].isActive) {
+		_snprintf(errorText, sizeof(errorText), "AccessDb: device %d is not valid", devIndex);
+		WA_LOG(1, (THIS_FILE, errorText));
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	do {
+		status = OpenHandle(devIndex, &pHandle);
+		if (status != WAD_OK)
+			return status;
+		switch (op) {
+		case DB_RANGE:
+			status = backend->GetVolRange(pHandle->hDev, &vals[0], &vals[1], &vals[2]);
+			break;
+		case DB_GET:
+			status = backend->GetVolDb(pHandle->hDev, vals);
+			break;
+		default:
+			status = backend->SetVolDb(pHandle->hDev, *vals);
+			break;
+		}
+		ReleaseHandle(devIndex, pHandle, status == WAD_ERR_DEVICE_LOST);
+	} while (status == WAD_ERR_DEVICE_LOST && --tries > 0);
+	if (status != WAD_OK)
+		return BackendError(status);
+	return WAD_OK;
+}
+
+// dB at pos on a custom taper, flat beyond the end points
+static float CustomDb(const float *points, int num, float pos)
+{
+	int i;
+
+	if (pos <= points[0])
+		return points[1];
+	for (i = 1; i < num; i++) {
+		if (pos <= points[2 * i])
+			return points[2 * i - 1] + (points[2 * i + 1] - points[2 * i - 1])
+				* (pos - points[2 * i - 2]) / (points[2 * i] - points[2 * i - 2]);
+	}
+	return points[2 * num - 1];
+}
+
+// lowest position at db on a custom taper
+static float CustomPos(const float *points, int num, float db)
+{
+	int i;
+
+	if (db <= points[1])
+		return points[0];
+	for (i = 1; i < num; i++) {
+		if (db <= points[2 * i + 1])
+			return points[2 * i - 2] + (points[2 * i] - points[2 * i - 2])
+				* (db - points[2 * i - 1]) / (points[2 * i + 1] - points[2 * i - 1]);
+	}
+	return points[2 * num - 2];
+}
+
+//
+// Fill the tables of a scale from its range and taper, the only place
+// the taper curves are computed.
+//
+void VolCtl::BuildScale(WadDbScale *pScale)
+{
+	float range = pScale->maxDb - pScale->minDb;
+	float pos, db;
+	int i;
+
+	for (i = 0; i <= TAPER_SIZE; i++) {
+		pos = (float) i / TAPER_SIZE;
+		db = pScale->minDb + range * i / TAPER_SIZE;
+		switch (pScale->taper) {
+		case WAD_TAPER_AUDIO:
+			pScale->posToDb[i] = pos > 0 ? pScale->maxDb + TAPER_AUDIO_DB * log10f(pos) : pScale->minDb;
+			pScale->dbToPos[i] = powf(10, (db - pScale->maxDb) / TAPER_AUDIO_DB);
+			break;
+		case WAD_TAPER_CUSTOM:
+			pScale->posToDb[i] = CustomDb(pScale->points, pScale->numPoints, pos);
+			pScale->dbToPos[i] = CustomPos(pScale->points, pScale->numPoints, db);
+			break;
+		default:
+			pScale->posToDb[i] = pScale->minDb + range * pos;
+			pScale->dbToPos[i] = pos;
+			break;
+		}
+		pScale->posToDb[i] = MAX(MIN(pScale->posToDb[i], pScale->maxDb), pScale->minDb);
+		pScale->dbToPos[i] = MAX(MIN(pScale->dbToPos[i], 1.0f), 0.0f);
+	}
+}
+
+void VolCtl::FreeScale(int devIndex)
+{
+	delete devState[devIndex].pScale;
+	devState[devIndex].pScale = NULL;
+}
+
+//
+// Replace the scale of a device, with devLock held, and publish the table
+// unless publish is false. Readers may still have the old scale, so it is
+// kept with the published copy, which points to it, until that is freed.
+//
+void VolCtl::ReplaceScale(int devIndex, WadDbScale *pScale, bool publish)
+{
+	WadDbScale *pOld = devState[devIndex].pScale;
+	WadDevSnap *pSnap = devSnap.load();
+
+	devState[devIndex].pScale = pScale;
+	if (pOld) {
+		if (pSnap) {
+			pOld->pNext = pSnap->oldScales;
+			pSnap->oldScales = pOld;
+		}
+		else
+			delete pOld;
+	}
+	if (publish)
+		PublishTable();
+}
+
+int VolCtl::GetScale(int devIndex, WadDbScale **ppScale)
+{
+	WadDbScale *pScale;
+	float range[3];
+	int status;
+
+	DEV_LOCK();
+	if (devIndex >= 0 && devIndex < numDev && devState[devIndex].pScale) {
+		*ppScale = devState[devIndex].pScale;
+		return WAD_OK;
+	}
+	if ((status = AccessDb(devIndex, DB_RANGE, range)) != WAD_OK)
+		return status;
+	pScale = new WadDbScale();
+	pScale->minDb = range[0];
+	pScale->maxDb = MAX(range[1], range[0]);
+	pScale->stepDb = MAX(range[2], 0.0f);
+	pScale->taper = taper;
+	memcpy(pScale->points, taperPoints, sizeof(taperPoints));
+	pScale->numPoints = numTaperPoints;
+	BuildScale(pScale);
+	ReplaceScale(devIndex, pScale, true);
+	WA_LOG(2, (THIS_FILE, "%d: dB range %.2f to %.2f step %.4f", devIndex, pScale->minDb,
+		pScale->maxDb, pScale->stepDb));
+	*ppScale = pScale;
+	return WAD_OK;
+}
+
+// value at x in a table spread evenly over x0..x1
+static float Lookup(const float *table, float x0, float x1, float x)
+{
+	float f;
+	int i;
+
+	if (x1 <= x0)
+		return table[0];
+	f = (x - x0) / (x1 - x0) * TAPER_SIZE;
+	f = MAX(MIN(f, (float) TAPER_SIZE), 0.0f);
+	i = MIN((int) f, TAPER_SIZE - 1);
+	return table[i] + (table[i + 1] - table[i]) * (f - i);
+}
+
+int VolCtl::GetVolRange(int devIndex, float *pMinDb, float *pMaxDb, float *pStepDb)
+{
+	WadDbScale *pScale;
+	int status;
+
+	DEV_LOCK();
+	if ((status = GetScale(devIndex, &pScale)) != WAD_OK)
+		return status;
+	*pMinDb = pScale->minDb;
+	*pMaxDb = pScale->maxDb;
+	*pStepDb = pScale->stepDb;
+	return WAD_OK;
+}
+
+int VolCtl::GetVolDb(int devIndex, float *pDb)
+{
+	return AccessDb(devIndex, DB_GET, pDb);
+}
+
+int VolCtl::SetVolDb(int devIndex, float db)
+{
+	WadDbScale *pScale;
+	int status;
+
+	WA_LOG(2, (THIS_FILE, "SetVolDb devIndex=%d db=%f", devIndex, db));
+	DEV_LOCK();
+	if ((status = GetScale(devIndex, &pScale)) != WAD_OK)
+		return status;
+	db = MAX(MIN(db, pScale->maxDb), pScale->minDb);
+	if (pScale->stepDb > 0) {
+		db = pScale->minDb + floorf((db - pScale->minDb) / pScale->stepDb + 0.5f) * pScale->stepDb;
+		db = MIN(db, pScale->maxDb);
+	}
+	EndRamp(devIndex);
+	return AccessDb(devIndex, DB_SET, &db);
+}
+
+int VolCtl::StepVolDb(int devIndex, float stepDb, float *pDb)
+{
+	WadDbScale *pScale;
+	float db, from, to;
+	int status;
+
+	DEV_LOCK();
+	if ((status = GetScale(devIndex, &pScale)) != WAD_OK
+			|| (status = AccessDb(devIndex, DB_GET, &db)) != WAD_OK)
+		return status;
+	if (pScale->stepDb > 0 && stepDb != 0) {
+		// a step that rounds back to where it started moves one device step
+		from = floorf((db - pScale->minDb) / pScale->stepDb + 0.5f);
+		to = floorf((db + stepDb - pScale->minDb) / pScale->stepDb + 0.5f);
+		if (to == from)
+			to += stepDb > 0 ? 1 : -1;
+		db = pScale->minDb + to * pScale->stepDb;
+	}
+	else
+		db += stepDb;
+	if ((status = SetVolDb(devIndex, db)) != WAD_OK)
+		return status;
+	if (pDb)
+		return AccessDb(devIndex, DB_GET, pDb);
+	return WAD_OK;
+}
+
+int VolCtl::SetTaper(int devIndex, int taper, const float *points, int numPoints)
+{
+	WadDbScale *pScale;
+	int i, status;
+
+	if (taper < WAD_TAPER_LINEAR || taper > WAD_TAPER_CUSTOM) {
+		SetErrorText("SetTaper: invalid taper");
+		return WAD_ERR_INVALID_ARG;
+	}
+	if (taper == WAD_TAPER_CUSTOM) {
+		if (numPoints < 2 || numPoints > WAD_TAPER_MAX_POINTS) {
+			SetErrorText("SetTaper: a custom taper needs 2 to 16 points");
+			return WAD_ERR_INVALID_ARG;
+		}
+		for (i = 1; i < numPoints; i++) {
+			if (points[2 * i] <= points[2 * i - 2] || points[2 * i + 1] < points[2 * i - 1]) {
+				SetErrorText("SetTaper: positions must increase and dB must not decrease");
+				return WAD_ERR_INVALID_ARG;
+			}
+		}
+	}
+	else
+		numPoints = 0;
+	DEV_LOCK();
+	if (devIndex == -1) {
+		// the default, and every device that has a table
+		this->taper = taper;
+		memcpy(taperPoints, points, 2 * numPoints * sizeof(float));
+		numTaperPoints = numPoints;
+		for (i = 0; i < numDev; i++) {
+			if (devState[i].pScale)
+				ReplaceScale(i, NewTaper(devState[i].pScale, taper, points, numPoints), false);
+		}
+		PublishTable();
+		return WAD_OK;
+	}
+	if ((status = GetScale(devIndex, &pScale)) != WAD_OK)
+		return status;
+	ReplaceScale(devIndex, NewTaper(pScale, taper, points, numPoints), true);
+	return WAD_OK;
+}
+
+// Returns a copy of a scale with another taper
+WadDbScale *VolCtl::NewTaper(const WadDbScale *pFrom, int taper, const float *points, int numPoints)
+{
+	WadDbScale *pScale = new WadDbScale();
+
+	pScale->minDb = pFrom->minDb;
+	pScale->maxDb = pFrom->maxDb;
+	pScale->stepDb = pFrom->stepDb;
+	pScale->taper = taper;
+	memcpy(pScale->points, points, 2 * numPoints * sizeof(float));
+	pScale->numPoints = numPoints;
+	BuildScale(pScale);
+	return pScale;
+}
+
+int VolCtl::PosToDb(int devIndex, float pos, float *pDb)
+{
+	WadDbScale *pScale;
+	int status;
+
+	{
+		SNAP_READ();
+		if (devIndex >= 0 && devIndex < pSnap->numDev && (pScale = pSnap->scales[devIndex]) != NULL) {
+			*pDb = Lookup(pScale->posToDb, 0, 1, pos);
+			return WAD_OK;
+		}
+	}
+	// no scale yet
+	DEV_LOCK();
+	if ((status = GetScale(devIndex, &pScale)) != WAD_OK)
+		return status;
+	*pDb = Lookup(pScale->posToDb, 0, 1, pos);
+	return WAD_OK;
+}
+
+int VolCtl::DbToPos(int devIndex, float db, float *pPos)
+{
+	WadDbScale *pScale;
+	int status;
+
+	{
+		SNAP_READ();
+		if (devIndex >= 0 && devIndex < pSnap->numDev && (pScale = pSnap->scales[devIndex]) != NULL) {
+			*pPos = Lookup(pScale->dbToPos, pScale->minDb, pScale->maxDb, db);
+			return WAD_OK;
+		}
+	}
+	// no scale yet
+	DEV_LOCK();
+	if ((status = GetScale(devIndex, &pScale)) != WAD_OK)
+		return status;
+	*pPos = Lookup(pScale->dbToPos, pScale->minDb, pScale->maxDb, db);
+	return WAD_OK;
+}
+
+int VolCtl::SetVolPos(int devIndex, float pos)
+{
+	float db;
+	int status;
+
+	DEV_LOCK();
+	if ((status = PosToDb(devIndex, pos, &db)) != WAD_OK)
+		return status;
+	return SetVolDb(devIndex, db);
+}
+
+int VolCtl::GetVolPos(int devIndex, float *pPos)
+{
+	float db;
+	int status;
+
+	DEV_LOCK();
+	if ((status = AccessDb(devIndex, DB_GET, &db)) != WAD_OK)
+		return status;
+	return DbToPos(devIndex, db, pPos);
+}
+
+//=============================================================================
+//
+// Volume ramps
+//
+// Ramps are stepped by one thread at a fixed tick, so all ramps in progress
+// are updated together and ramps started between two ticks stay in step,
+// e.g., both sides of a crossfade. Ticks are scheduled from the thread
+// start time rather than the previous tick, so late wakeups don't add up.
+//
+// Each tick works out the volumes with devLock held, and sets them without
+// it, through the handle path of SetVol, so a fade doesn't hold up other
+// calls behind device I/O. The sets are made with rampSetLock held, and a
+// ramp ended from another thread waits on it, so a set of the tick in
+// progress can't land after the caller's own.
+//
+
+struct WadRamp {
+	float startVol;
+	float target;
+	float vol;				// last volume set
+	int curve;
+	long startTick;
+	long numTicks;
+	unsigned serial;		// tells a ramp from one that replaced it
+};
+
+// a volume set of one tick
+struct WadRampStep {
+	int devIndex;
+	float vol;
+	unsigned serial;		// of the ramp
+	bool isLast;			// the ramp is done after this set
+	bool isFailed;
+};
+
+#define RAMP_DB_FLOOR	(-60.0f)	// dB ramps start or end here for 0
+
+static float VolToDb(float vol)
+{
+	return vol > 0.001f ? 20 * log10f(vol) : RAMP_DB_FLOOR;
+}
+
+// volume at fraction t of a ramp
+static float RampVol(WadRamp *pRamp, float t)
+{
+	switch (pRamp->curve) {
+	case WAD_RAMP_DB:
+	{
+		float db0 = VolToDb(pRamp->startVol);
+		float db1 = VolToDb(pRamp->target);
+		return powf(10, (db0 + (db1 - db0) * t) / 20);
+	}
+	case WAD_RAMP_SCURVE:
+		t = t * t * (3 - 2 * t);
+		break;
+	}
+	return pRamp->startVol + (pRamp->target - pRamp->startVol) * t;
+}
+
+//
+// Start or retarget a ramp, with devLock held. A ramp in progress is
+// replaced by one starting from where it got to.
+//
+int VolCtl::StartRamp(int devIndex, float target, int msec, int curve)
+{
+	WadRamp *pRamp;
+	float vol;
+	int status;
+
+	if (devIndex < 0 || devIndex >= numDev || !devTab[devIndex].isActive) {
+		_snprintf(errorText, sizeof(errorText), "Ramp: device %d is not valid", devIndex);
+		WA_LOG(1, (THIS_FILE, errorText));
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	if (target < 0 || target > 1 || msec < 0 || curve < WAD_RAMP_LINEAR || curve > WAD_RAMP_SCURVE) {
+		SetErrorText("Ramp: invalid argument");
+		return WAD_ERR_INVALID_ARG;
+	}
+	pRamp = devState[devIndex].pRamp;
+	if (pRamp)
+		vol = pRamp->vol;
+	else if ((status = GetVol(devIndex, &vol)) != WAD_OK)
+		return status;
+	if (!pRamp) {
+		pRamp = new WadRamp();
+		devState[devIndex].pRamp = pRamp;
+		numRamps++;
+	}
+	pRamp->startVol = vol;
+	pRamp->target = target;
+	pRamp->vol = vol;
+	pRamp->curve = curve;
+	pRamp->startTick = rampTick;
+	pRamp->numTicks = MAX((msec + WAD_RAMP_TICK_MSEC / 2) / WAD_RAMP_TICK_MSEC, 1);
+	pRamp->serial = ++rampSerial;
+	WA_LOG(2, (THIS_FILE, "Ramp devIndex=%d %f to %f in %ld ticks curve %d", devIndex, vol, target,
+		pRamp->numTicks, curve));
+	if (!rampThread.joinable())
+		rampThread = std::thread(&VolCtl::RampLoop, this);
+	rampCond.notify_all();
+	return WAD_OK;
+}
+
+void VolCtl::EndRamp(int devIndex)
+{
+	if (devState[devIndex].pRamp) {
+		delete devState[devIndex].pRamp;
+		devState[devIndex].pRamp = NULL;
+		numRamps--;
+		rampCond.notify_all();
+		// wait for sets of the tick in progress
+		if (std::this_thread::get_id() != rampThread.get_id())
+			std::lock_guard<std::mutex> waitGuard(rampSetLock);
+	}
+}
+
+// Work out the sets of all ramps for this tick, with devLock held. Returns
+// the number of steps.
+int VolCtl::UpdateRamps(WadRampStep *steps)
+{
+	WadRamp *pRamp;
+	long step;
+	int i;
+	int num = 0;
+
+	for (i = 0; i < numDev; i++) {
+		if ((pRamp = devState[i].pRamp) == NULL)
+			continue;
+		step = rampTick - pRamp->startTick;
+		pRamp->vol = step >= pRamp->numTicks ? pRamp->target :
+			RampVol(pRamp, (float) step / pRamp->numTicks);
+		steps[num].devIndex = i;
+		steps[num].vol = pRamp->vol;
+		steps[num].serial = pRamp->serial;
+		steps[num].isLast = step >= pRamp->numTicks;
+		steps[num].isFailed = false;
+		num++;
+	}
+	return num;
+}
+
+// End the ramps that are done or failed, unless replaced meanwhile, with
+// devLock held
+void VolCtl::EndRamps(const WadRampStep *steps, int num)
+{
+	WadRamp *pRamp;
+	int i;
+
+	for (i = 0; i < num; i++) {
+		pRamp = devState[steps[i].devIndex].pRamp;
+		if ((steps[i].isLast || steps[i].isFailed) && pRamp && pRamp->serial == steps[i].serial)
+			EndRamp(steps[i].devIndex);
+	}
+}
+
+void VolCtl::RampLoop()
+{
+	std::unique_lock<std::recursive_mutex> guard(devLock);
+	std::chrono::steady_clock::time_point next;
+	WadRampStep *steps = NULL;
+	int stepsSize = 0;
+	int i, num;
+	bool isIdle = true;
+	bool isBackendThread = backend->ThreadInit() == WAD_OK;
+
+#ifdef _WIN32
+	// default timer resolution is too coarse for the tick
+	timeBeginPeriod(1);
+#endif
+	while (!rampStop) {
+		if (numRamps == 0) {
+			isIdle = true;
+			rampCond.wait(guard);
+			continue;
+		}
+		if (isIdle) {
+			next = std::chrono::steady_clock::now();
+			isIdle = false;
+		}
+		next += std::chrono::milliseconds(WAD_RAMP_TICK_MSEC);
+		guard.unlock();
+		std::this_thread::sleep_until(next);
+		guard.lock();
+		rampTick++;
+		if (stepsSize < numDev) {
+			free(steps);
+			stepsSize = devTabSize;
+			if ((steps = (WadRampStep *) malloc(stepsSize * sizeof(WadRampStep))) == NULL) {
+				WA_LOG(1, (THIS_FILE, "RampLoop: out of memory"));
+				stepsSize = 0;
+				continue;
+			}
+		}
+		num = UpdateRamps(steps);
+		guard.unlock();
+		{
+			std::lock_guard<std::mutex> setGuard(rampSetLock);
+			for (i = 0; i < num; i++) {
+				if (AccessVol(steps[i].devIndex, true, &steps[i].vol) != WAD_OK) {
+					WA_LOG(1, (THIS_FILE, "Ramp devIndex=%d stopped: %s", steps[i].devIndex,
+						errorText));
+					steps[i].isFailed = true;
+				}
+			}
+		}
+		guard.lock();
+		EndRamps(steps, num);
+	}
+#ifdef _WIN32
+	timeEndPeriod(1);
+#endif
+	guard.unlock();
+	free(steps);
+	if (isBackendThread)
+		backend->ThreadExit();
+}
+
+int VolCtl::Ramp(int devIndex, float target, int msec, int curve)
+{
+	CHECK_INIT();
+	DEV_LOCK();
+	return StartRamp(devIndex, target, msec, curve);
+}
+
+int VolCtl::Crossfade(int fromDev, int toDev, float vol, int msec, int curve)
+{
+	int status;
+
+	CHECK_INIT();
+	DEV_LOCK();
+	// both start on the next tick, since the ramp thread can't run between
+	if ((status = StartRamp(fromDev, 0, msec, curve)) != WAD_OK)
+		return status;
+	if ((status = StartRamp(toDev, vol, msec, curve)) != WAD_OK) {
+		EndRamp(fromDev);
+		return status;
+	}
+	return WAD_OK;
+}
+
+int VolCtl::StopRamp(int devIndex)
+{
+	int i;
+
+	DEV_LOCK();
+	if (devIndex == -1) {
+		for (i = 0; i < numDev; i++)
+			EndRamp(i);
+		return WAD_OK;
+	}
+	if (devIndex < 0 || devIndex >= numDev)
+		return WAD_ERR_INVALID_DEVICE;
+	EndRamp(devIndex);
+	return WAD_OK;
+}
+
+//
+// Wait for ramps to finish. Don't call with devLock held, e.g., from a
+// watch callback.
+//
+void VolCtl::WaitRamp(int devIndex)
+{
+	std::unique_lock<std::recursive_mutex> guard(devLock);
+	if (devIndex == -1) {
+		while (numRamps > 0)
+			rampCond.wait(guard);
+	}
+	else if (devIndex >= 0) {
+		while (devIndex < numDev && devState[devIndex].pRamp)
+			rampCond.wait(guard);
+	}
+}
+
+//=============================================================================
+//
+// Application sessions
+//
+// Each process playing or recording on a device has a session with its own
+// volume and mute. Sessions are added to a table like devices, found by ID
+// through a hash, and keep their index while they are active. An expired
+// session gives up its ID and handle, and its slot goes to the next new
+// one, since applications come and go far more often than devices, and on
+// Windows each gets a new ID. A device's
+// sessions are enumerated when first looked up, and with device
+// notifications enabled the backend then reports sessions added and
+// expiring, so later lookups don't enumerate again. Without notifications
+// each lookup enumerates the device.
+//
+
+// state of a session kept out of the session table, indexed like sesTab
+struct WadSesState {
+	char *sessionId;			// allocated, NULL once expired
+	WadHandle hSes;				// cached backend handle or NULL
+	unsigned int idHash;		// hash of the session ID
+	int hashNext;				// next session in the same hash bucket, -1 at the end
+	int freeNext;				// next expired session to reuse, -1 at the end
+	bool isListed;				// T/F if listed by the enumeration in progress
+};
+
+//
+// Double the session table and rehash, the hash has a bucket per slot.
+// Returns false if out of memory.
+//
+bool VolCtl::GrowSessions()
+{
+	int newSize = sesTabSize ? 2 * sesTabSize : 16;
+	WadSessionInfo *newTab;
+	WadSesState *newState;
+	int *newHash;
+	int i;
+
+	newTab = (WadSessionInfo *) realloc(sesTab, newSize * sizeof(WadSessionInfo));
+	if (newTab)
+		sesTab = newTab;
+	newState = (WadSesState *) realloc(sesState, newSize * sizeof(WadSesState));
+	if (newState)
+		sesState = newState;
+	newHash = (int *) malloc(newSize * sizeof(int));
+	if (!newTab || !newState || !newHash) {
+		free(newHash);
+		SetErrorText("out of memory");
+		return false;
+	}
+	memset(sesTab + sesTabSize, 0, (newSize - sesTabSize) * sizeof(WadSessionInfo));
+	free(sesHash);
+	sesHash = newHash;
+	sesTabSize = newSize;
+	for (i = 0; i < sesTabSize; i++)
+		sesHash[i] = -1;
+	for (i = 0; i < numSes; i++) {
+		if (sesState[i].sessionId)
+			HashSession(i, true);
+	}
+	return true;
+}
+
+// Add a session to its hash bucket, or take it out
+void VolCtl::HashSession(int sesIndex, bool add)
+{
+	int *pNext = &sesHash[sesState[sesIndex].idHash & (sesTabSize - 1)];
+
+	if (add) {
+		sesState[sesIndex].hashNext = *pNext;
+		*pNext = sesIndex;
+		return;
+	}
+	while (*pNext != sesIndex)
+		pNext = &sesState[*pNext].hashNext;
+	*pNext = sesState[sesIndex].hashNext;
+}
+
+//
+// Add a session to the table, or update it if known, returns the index
+// or -1 on error. Session IDs are unique across devices, so a known
+// session may have moved device.
+//
+int VolCtl::AddSession(int devIndex, const char *sessionId, unsigned long pid, const char *procName)
+{
+	WadSessionInfo *pSes;
+	WadSesState *pState;
+	char *idStr;
+	int index = FindSessionById(sessionId);
+
+	if (index == -1) {
+		// IDs can be longer than names, e.g., Windows instance IDs, so kept whole
+		if ((idStr = _strdup(sessionId)) == NULL) {
+			SetErrorText("out of memory");
+			return -1;
+		}
+		if ((index = freeSes) != -1) {
+			freeSes = sesState[index].freeNext;
+			WA_LOG(3, (THIS_FILE, "session %d: reused", index));
+		}
+		else {
+			if (numSes >= sesTabSize && !GrowSessions()) {
+				free(idStr);
+				return -1;
+			}
+			index = numSes++;
+		}
+		memset(&sesTab[index], 0, sizeof(WadSessionInfo));
+		pState = &sesState[index];
+		pState->sessionId = idStr;
+		pState->hSes = NULL;
+		pState->idHash = HashStr(sessionId, false);
+		pState->freeNext = -1;
+		pState->isListed = false;
+		HashSession(index, true);
+	}
+	pSes = &sesTab[index];
+	pState = &sesState[index];
+	if (pSes->devIndex != devIndex && pState->hSes) {
+		backend->CloseSession(pState->hSes);
+		pState->hSes = NULL;
+	}
+	pSes->devIndex = devIndex;
+	pSes->pid = pid;
+	strncpy(pSes->procName, procName ? procName : "", WAD_NAME_LEN - 1);
+	pSes->isActive = true;
+	WA_LOG(3, (THIS_FILE, "session %d: device %d '%s' pid %lu '%s'", index, devIndex, pSes->procName,
+		pid, sessionId));
+	return index;
+}
+
+int VolCtl::FindSessionById(const char *sessionId)
+{
+	int i;
+
+	if (!sesHash)
+		return -1;
+	for (i = sesHash[HashStr(sessionId, false) & (sesTabSize - 1)]; i != -1; i = sesState[i].hashNext) {
+		if (!strcmp(sesState[i].sessionId, sessionId))
+			return i;
+	}
+	return -1;
+}
+
+//
+// Expire a session, free its ID and handle, and list its slot for reuse.
+// A session can expire more than once, from a notification and a failed
+// call, and is listed once.
+//
+void VolCtl::EndSession(int sesIndex)
+{
+	WadSesState *pState = &sesState[sesIndex];
+
+	sesTab[sesIndex].isActive = false;
+	if (pState->hSes) {
+		backend->CloseSession(pState->hSes);
+		pState->hSes = NULL;
+	}
+	if (!pState->sessionId)
+		return;
+	HashSession(sesIndex, false);
+	free(pState->sessionId);
+	pState->sessionId = NULL;
+	pState->freeNext = freeSes;
+	freeSes = sesIndex;
+}
+
+void VolCtl::InvalidateSessions(int devIndex)
+{
+	int i;
+
+	if (devState[devIndex].hSesWatch) {
+		backend->UnwatchSessions(devState[devIndex].hSesWatch);
+		devState[devIndex].hSesWatch = NULL;
+	}
+	devState[devIndex].hasSessions = false;
+	for (i = 0; i < numSes; i++) {
+		if (sesTab[i].devIndex == devIndex)
+			EndSession(i);
+	}
+}
+
+typedef struct {
+	VolCtl *pVolCtl;
+	int devIndex;
+} SessionEnumCtx;
+
+// Called by the backend for each session of an enumeration
+void VolCtl::SessionEnumFn(void *arg, const char *sessionId, unsigned long pid, const char *procName)
+{
+	SessionEnumCtx *pCtx = (SessionEnumCtx *) arg;
+	VolCtl *pVolCtl = pCtx->pVolCtl;
+	int sesIndex = pVolCtl->AddSession(pCtx->devIndex, sessionId, pid, procName);
+
+	if (sesIndex >= 0)
+		pVolCtl->sesState[sesIndex].isListed = true;
+}
+
+//
+// Enumerate the sessions of a device unless the table is kept current by
+// notifications. Sessions not listed are marked expired, keeping the
+// handles of those that are listed again.
+//
+int VolCtl::IndexSessions(int devIndex)
+{
+	WadDevState *pState = &devState[devIndex];
+	const char *devId = devTab[devIndex].devId;
+	SessionEnumCtx ctx = { this, devIndex };
+	int i, status;
+
+	if (pState->hasSessions)
+		return WAD_OK;
+	// watch first, so sessions starting while enumerating aren't missed
+	if (isNotify && !pState->hSesWatch &&
+		backend->WatchSessions(devId, &pState->hSesWatch) != WAD_OK)
+		pState->hSesWatch = NULL;
+	for (i = 0; i < numSes; i++)
+		sesState[i].isListed = false;
+	status = backend->EnumSessions(devId, SessionEnumFn, &ctx);
+	for (i = 0; i < numSes; i++) {
+		if (sesTab[i].devIndex == devIndex && sesTab[i].isActive && !sesState[i].isListed)
+			EndSession(i);
+	}
+	if (status != WAD_OK)
+		return BackendError(status);
+	pState->hasSessions = pState->hSesWatch != NULL;
+	return WAD_OK;
+}
+
+//
+// Session added or expired, for devices being watched.
+//
+void VolCtl::OnSessionState(const char *devId, const char *sessionId, unsigned long pid,
+	const char *procName, bool isActive)
+{
+	int devIndex, sesIndex;
+
+	DEV_LOCK();
+	if (isActive) {
+		devIndex = LookupId(devId);
+		if (devIndex >= 0 && devState[devIndex].hasSessions)
+			AddSession(devIndex, sessionId, pid, procName);
+	}
+	else if ((sesIndex = FindSessionById(sessionId)) >= 0) {
+		EndSession(sesIndex);
+	}
+	WA_LOG(3, (THIS_FILE, "OnSessionState: '%s' pid %lu isActive %d", sessionId, pid, isActive));
+}
+
+int VolCtl::UpdateSessions(int devIndex)
+{
+	int i, status;
+
+	CHECK_INIT();
+	DEV_LOCK();
+	if (devIndex == -1) {
+		if (!isEnumerated && (status = EnumerateAll()) != WAD_OK)
+			return status;
+		for (i = 0; i < numDev; i++) {
+			if (devTab[i].isActive && (status = IndexSessions(i)) != WAD_OK)
+				return status;
+		}
+		return WAD_OK;
+	}
+	if (devIndex < 0 || devIndex >= numDev || !devTab[devIndex].isActive) {
+		_snprintf(errorText, sizeof(errorText), "UpdateSessions: device %d is not valid", devIndex);
+		WA_LOG(1, (THIS_FILE, errorText));
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	return IndexSessions(devIndex);
+}
+
+int VolCtl::GetNumSessions()
+{
+	DEV_LOCK();
+	return numSes;
+}
+
+int VolCtl::GetSessionInfo(int sesIndex, WadSessionInfo *pInfo)
+{
+	CHECK_INIT();
+	DEV_LOCK();
+	if (sesIndex < 0 || sesIndex >= numSes)
+		return WAD_ERR_INVALID_SESSION;
+	*pInfo = sesTab[sesIndex];
+	// the table's copy goes when the session expires
+	pInfo->sessionId = _strdup(sesState[sesIndex].sessionId ? sesState[sesIndex].sessionId : "");
+	if (!pInfo->sessionId) {
+		SetErrorText("out of memory");
+		return WAD_ERR_INTERNAL;
+	}
+	return WAD_OK;
+}
+
+//
+// Match a session by ID, by PID if app is a number, or by process name
+// with any case and with or without its extension, e.g., "zoom" matches
+// "Zoom.exe".
+//
+static bool MatchSession(WadSessionInfo *pSes, const char *sessionId, const char *app)
+{
+	const char *s;
+	size_t len;
+
+	if (!strcmp(sessionId, app))
+		return true;
+	for (s = app; isdigit((unsigned char) *s); s++)
+		;
+	if (*app && !*s)
+		return pSes->pid == strtoul(app, NULL, 10);
+	len = strlen(app);
+	return !_strnicmp(pSes->procName, app, len) && (pSes->procName[len] == 0 ||
+		(pSes->procName[len] == '.' && !strchr(pSes->procName + len + 1, '.')));
+}
+
+int VolCtl::FindSession(int devIndex, const char *app, int start)
+{
+	int i;
+
+	DEV_LOCK();
+	// only refresh on the first call of a search
+	if (start == 0 && UpdateSessions(devIndex) != WAD_OK)
+		return -1;
+	for (i = MAX(start, 0); i < numSes; i++) {
+		if (sesTab[i].isActive && (devIndex == -1 || sesTab[i].devIndex == devIndex) &&
+			MatchSession(&sesTab[i], sesState[i].sessionId, app))
+			return i;
+	}
+	return -1;
+}
+
+//
+// Get the backend handle of a session, cached like device handles.
+//
+int VolCtl::OpenSessionHandle(int sesIndex, WadHandle *phSes)
+{
+	WadSesState *pState = &sesState[sesIndex];
+
+	if (pState->hSes) {
+		*phSes = pState->hSes;
+		return WAD_OK;
+	}
+	CHECK_BACKEND(backend->OpenSession(devTab[sesTab[sesIndex].devIndex].devId, pState->sessionId, phSes));
+	if (useIfCache)
+		pState->hSes = *phSes;
+	return WAD_OK;
+}
+
+//
+// Close a handle if not cached, and drop the session if it expired.
+//
+int VolCtl::ReleaseSessionHandle(int sesIndex, WadHandle hSes, int status)
+{
+	if (hSes != sesState[sesIndex].hSes)
+		backend->CloseSession(hSes);
+	if (status == WAD_ERR_DEVICE_LOST) {
+		EndSession(sesIndex);
+		_snprintf(errorText, sizeof(errorText), "session %d expired", sesIndex);
+		WA_LOG(1, (THIS_FILE, errorText));
+		return WAD_ERR_INVALID_SESSION;
+	}
+	if (status != WAD_OK)
+		return BackendError(status);
+	return WAD_OK;
+}
+
+int VolCtl::AccessSessionVol(int sesIndex, bool setVol, float *pVol)
+{
+	WadHandle hSes;
+	int status;
+
+	DEV_LOCK();
+	// check session
+	if (sesIndex < 0 || sesIndex >= numSes || !sesTab[sesIndex].isActive) {
+		_snprintf(errorText, sizeof(errorText), "AccessSessionVol: session %d is not valid", sesIndex);
+		WA_LOG(1, (THIS_FILE, errorText));
+		return WAD_ERR_INVALID_SESSION;
+	}
+	if ((status = OpenSessionHandle(sesIndex, &hSes)) != WAD_OK)
+		return status;
+	if (setVol)
+		status = backend->SetSessionVol(hSes, *pVol);
+	else
+		status = backend->GetSessionVol(hSes, pVol);
+	return ReleaseSessionHandle(sesIndex, hSes, status);
+}
+
+int VolCtl::AccessSessionMute(int sesIndex, bool setMute, bool *pMute)
+{
+	WadHandle hSes;
+	int status;
+
+	DEV_LOCK();
+	// check session
+	if (sesIndex < 0 || sesIndex >= numSes || !sesTab[sesIndex].isActive) {
+		_snprintf(errorText, sizeof(errorText), "AccessSessionMute: session %d is not valid", sesIndex);
+		WA_LOG(1, (THIS_FILE, errorText));
+		return WAD_ERR_INVALID_SESSION;
+	}
+	if ((status = OpenSessionHandle(sesIndex, &hSes)) != WAD_OK)
+		return status;
+	if (setMute)
+		status = backend->SetSessionMute(hSes, *pMute);
+	else
+		status = backend->GetSessionMute(hSes, pMute);
+	return ReleaseSessionHandle(sesIndex, hSes, status);
+}
+
+int VolCtl::SetSessionVol(int sesIndex, float vol)
+{
+	CHECK_INIT();
+	WA_LOG(2, (THIS_FILE, "SetSessionVol sesIndex=%d vol=%f", sesIndex, vol));
+	return AccessSessionVol(sesIndex, true, &vol);
+}
+
+int VolCtl::GetSessionVol(int sesIndex, float *pVol)
+{
+	CHECK_INIT();
+	return AccessSessionVol(sesIndex, false, pVol);
+}
+
+int VolCtl::SetSessionMute(int sesIndex, bool mute)
+{
+	CHECK_INIT();
+	WA_LOG(2, (THIS_FILE, "SetSessionMute sesIndex=%d mute=%d", sesIndex, mute));
+	return AccessSessionMute(sesIndex, true, &mute);
+}
+
+int VolCtl::GetSessionMute(int sesIndex, bool *pMute)
+{
+	CHECK_INIT();
+	return AccessSessionMute(sesIndex, false, pMute);
+}
+
+//=============================================================================
+//
+// Multi-device operations
+//
+// Sweeping many devices one at a time takes one round trip into the audio
+// system after another. Instead the devices are handed out to a small pool
+// of worker threads, which take the next device from a shared counter until
+// none are left. Each worker opens and keeps its own backend handles, so
+// workers don't touch the device table and run without devLock.
+//
+
+#define POOL_DEFAULT_SIZE	4	// workers, the calls wait on the audio system, not the CPU
+
+// job ops for ApplyMulti and snapshots, after the WadMultiOp ops
+#define POOL_OP_APPLY	(WAD_OP_SET_MUTE + 1)
+#define POOL_OP_READ	(WAD_OP_SET_MUTE + 2)
+
+// volumes closer than this are the same, allowing for rounding in the audio system
+#define VOL_EPSILON		1e-4f
+
+struct WadJob {
+	int op;
+	float vol;
+	bool mute;
+	const float *vols;			// per device volumes for POOL_OP_APPLY
+	const bool *mutes;			// per device mutes for POOL_OP_APPLY
+	int *numChans;				// per device channel counts, read by POOL_OP_READ and
+								// applied by POOL_OP_APPLY unless 0 or NULL
+	float *chanVols;			// WAD_MAX_CHANNELS channel volumes per device, as numChans
+	int num;
+	const char **devIds;		// in the string table, NULL if device not valid
+	WadDevResult *results;
+	std::atomic<int> next;		// next device to take
+	std::atomic<int> numSets;	// sets made by POOL_OP_APPLY
+};
+
+// case insensitive match with * and ? wildcards
+static bool GlobMatch(const char *pat, const char *s)
+{
+	const char *star = NULL;
+	const char *starS = NULL;
+
+	while (*s) {
+		if (*pat == '*') {
+			star = pat++;
+			starS = s;
+		}
+		else if (*pat == '?' || (*pat && tolower((unsigned char) *pat) == tolower((unsigned char) *s))) {
+			pat++;
+			s++;
+		}
+		else if (star) {
+			pat = star + 1;
+			s = ++starS;
+		}
+		else
+			return false;
+	}
+	while (*pat == '*')
+		pat++;
+	return *pat == 0;
+}
+
+int VolCtl::SelectDevices(int select, const char *pattern, int *devIndexes, int maxDevs)
+{
+	char glob[WAD_DEV_NAME_LEN + 2];
+	bool isMatch;
+	int i, n = 0;
+
+	CHECK_INIT();
+	DEV_LOCK();
+	if (select < WAD_SELECT_ALL || select > WAD_SELECT_NAME || (select == WAD_SELECT_NAME && !pattern)) {
+		SetErrorText("SelectDevices: invalid argument");
+		return -1;
+	}
+	if (!isEnumerated && EnumerateAll() != WAD_OK)
+		return -1;
+	// no wildcards matches a substring
+	if (select == WAD_SELECT_NAME) {
+		if (strpbrk(pattern, "*?"))
+			_snprintf(glob, sizeof(glob), "%s", pattern);
+		else
+			_snprintf(glob, sizeof(glob), "*%s*", pattern);
+	}
+	for (i = 0; i < numDev && n < maxDevs; i++) {
+		if (!devTab[i].isActive)
+			continue;
+		switch (select) {
+		case WAD_SELECT_INPUTS:
+			isMatch = devTab[i].isInput;
+			break;
+		case WAD_SELECT_OUTPUTS:
+			isMatch = !devTab[i].isInput;
+			break;
+		case WAD_SELECT_NAME:
+			isMatch = EnsureName(i) && GlobMatch(glob, devTab[i].name);
+			break;
+		default:
+			isMatch = true;
+			break;
+		}
+		if (isMatch)
+			devIndexes[n++] = i;
+	}
+	return n;
+}
+
+//
+// Worker thread, runs each job until no devices are left.
+//
+void VolCtl::PoolLoop()
+{
+	WadHandle *handles = NULL;	// this worker's handles, by device index
+	int numHandles = 0;
+	long jobSeq = 0;
+	WadJob *pJob;
+	WadDevResult *pResult;
+	bool isBackendThread = backend->ThreadInit() == WAD_OK;
+	int i, devIndex, status, tries;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> guard(poolLock);
+			while (!poolStop && poolJobSeq == jobSeq)
+				poolCond.wait(guard);
+			if (poolStop)
+				break;
+			jobSeq = poolJobSeq;
+			pJob = poolJob;
+		}
+		while ((i = pJob->next++) < pJob->num) {
+			pResult = &pJob->results[i];
+			devIndex = pResult->devIndex;
+			if (!pJob->devIds[i])
+				continue;
+			if (devIndex >= numHandles) {
+				int newSize = MAX(2 * numHandles, devIndex + 16);
+				WadHandle *newHandles = (WadHandle *) realloc(handles, newSize * sizeof(WadHandle));
+				if (!newHandles) {
+					pResult->status = WAD_ERR_INTERNAL;
+					continue;
+				}
+				memset(newHandles + numHandles, 0, (newSize - numHandles) * sizeof(WadHandle));
+				handles = newHandles;
+				numHandles = newSize;
+			}
+			// as in AccessVol, a stale handle is reopened once
+			tries = 2;
+			do {
+				if (!handles[devIndex] &&
+					(status = backend->OpenDev(pJob->devIds[i], &handles[devIndex])) != WAD_OK) {
+					handles[devIndex] = NULL;
+					break;
+				}
+				switch (pJob->op) {
+				case WAD_OP_GET_VOL:
+					status = backend->GetVol(handles[devIndex], &pResult->vol);
+					break;
+				case WAD_OP_SET_VOL:
+					status = backend->SetVol(handles[devIndex], pJob->vol);
+					break;
+				case WAD_OP_GET_MUTE:
+					status = backend->GetMute(handles[devIndex], &pResult->mute);
+					break;
+				case WAD_OP_SET_MUTE:
+					status = backend->SetMute(handles[devIndex], pJob->mute);
+					break;
+				case POOL_OP_READ:
+					status = ReadDevice(handles[devIndex], pJob, i);
+					break;
+				default:
+					status = ApplyDevice(handles[devIndex], pJob, i);
+					break;
+				}
+				if (status == WAD_ERR_DEVICE_LOST) {
+					backend->CloseDev(handles[devIndex]);
+					handles[devIndex] = NULL;
+				}
+			} while (status == WAD_ERR_DEVICE_LOST && --tries > 0);
+			pResult->status = status;
+		}
+		{
+			std::lock_guard<std::mutex> guard(poolLock);
+			if (--poolBusy == 0)
+				poolDoneCond.notify_all();
+		}
+	}
+	for (i = 0; i < numHandles; i++) {
+		if (handles[i])
+			backend->CloseDev(handles[i]);
+	}
+	free(handles);
+	if (isBackendThread)
+		backend->ThreadExit();
+}
+
+//
+// Read the volume, mute and channel volumes of a device for POOL_OP_READ.
+// A device without channel control gets no channels.
+//
+int VolCtl::ReadDevice(WadHandle hDev, WadJob *pJob, int i)
+{
+	WadDevResult *pResult = &pJob->results[i];
+	int status;
+
+	if ((status = backend->GetVol(hDev, &pResult->vol)) != WAD_OK ||
+		(status = backend->GetMute(hDev, &pResult->mute)) != WAD_OK)
+		return status;
+	status = backend->GetChannelVols(hDev, &pJob->chanVols[i * WAD_MAX_CHANNELS], &pJob->numChans[i]);
+	if (status == WAD_ERR_UNSUPPORTED) {
+		pJob->numChans[i] = 0;
+		return WAD_OK;
+	}
+	return status;
+}
+
+//
+// Set the volume, mute and channel volumes of a device for POOL_OP_APPLY,
+// where they differ from the current state, which is returned in the
+// result. Channels are compared after the volume is set, since that
+// scales them, and are left alone if the device's channel count changed.
+//
+int VolCtl::ApplyDevice(WadHandle hDev, WadJob *pJob, int i)
+{
+	WadDevResult *pResult = &pJob->results[i];
+	const float *chanVols;
+	float cur[WAD_MAX_CHANNELS];
+	int ch, num, status;
+
+	if ((status = backend->GetVol(hDev, &pResult->vol)) != WAD_OK ||
+		(status = backend->GetMute(hDev, &pResult->mute)) != WAD_OK)
+		return status;
+	if (fabsf(pResult->vol - pJob->vols[i]) > VOL_EPSILON) {
+		if ((status = backend->SetVol(hDev, pJob->vols[i])) != WAD_OK)
+			return status;
+		pJob->numSets++;
+	}
+	if (pResult->mute != pJob->mutes[i]) {
+		if ((status = backend->SetMute(hDev, pJob->mutes[i])) != WAD_OK)
+			return status;
+		pJob->numSets++;
+	}
+	if (!pJob->numChans || pJob->numChans[i] == 0)
+		return WAD_OK;
+	if ((status = backend->GetChannelVols(hDev, cur, &num)) != WAD_OK)
+		return status == WAD_ERR_UNSUPPORTED ? WAD_OK : status;
+	if (num != pJob->numChans[i]) {
+		WA_LOG(1, (THIS_FILE, "ApplyDevice: %s has %d channels, not %d", pJob->devIds[i], num,
+			pJob->numChans[i]));
+		return WAD_OK;
+	}
+	chanVols = &pJob->chanVols[i * WAD_MAX_CHANNELS];
+	for (ch = 0; ch < num; ch++) {
+		if (fabsf(cur[ch] - chanVols[ch]) > VOL_EPSILON) {
+			if ((status = backend->SetChannelVols(hDev, chanVols, num)) != WAD_OK)
+				return status;
+			pJob->numSets++;
+			break;
+		}
+	}
+	return WAD_OK;
+}
+
+void VolCtl::StopPool()
+{
+	int i;
+
+	{
+		std::lock_guard<std::mutex> guard(poolLock);
+		poolStop = true;
+	}
+	poolCond.notify_all();
+	for (i = 0; i < numWorkers; i++)
+		poolThreads[i].join();
+	numWorkers = 0;
+	poolStop = false;
+}
+
+void VolCtl::SetPoolSize(int n)
+{
+	std::lock_guard<std::mutex> runGuard(poolRunLock);
+	// restarted at the new size by the next job
+	StopPool();
+	poolSize = MIN(MAX(n, 0), WAD_POOL_MAX);
+}
+
+//
+// Run a job on the pool for the devices, returns the first error.
+//
+int VolCtl::RunJob(WadJob *pJob, const int *devIndexes)
+{
+	WadJob& job = *pJob;
+	WadDevResult *results = job.results;
+	int num = job.num;
+	int op = job.op;
+	int i, devIndex, size;
+	int status = WAD_OK;
+
+	job.next = 0;
+	job.numSets = 0;
+	job.devIds = (const char **) malloc(num * sizeof(const char *));
+	if (!job.devIds) {
+		SetErrorText("out of memory");
+		return WAD_ERR_INTERNAL;
+	}
+	{
+		DEV_LOCK();
+		for (i = 0; i < num; i++) {
+			devIndex = devIndexes[i];
+			memset(&results[i], 0, sizeof(WadDevResult));
+			results[i].devIndex = devIndex;
+			if (devIndex < 0 || devIndex >= numDev || !devTab[devIndex].isActive) {
+				results[i].status = WAD_ERR_INVALID_DEVICE;
+				job.devIds[i] = NULL;
+				continue;
+			}
+			job.devIds[i] = devTab[devIndex].devId;
+			// a direct set overrides a ramp in progress
+			if (op == WAD_OP_SET_VOL || op == POOL_OP_APPLY)
+				EndRamp(devIndex);
+		}
+	}
+	WA_LOG(2, (THIS_FILE, "RunJob: op %d on %d devices", op, num));
+	{
+		std::lock_guard<std::mutex> runGuard(poolRunLock);
+		size = poolSize ? poolSize : POOL_DEFAULT_SIZE;
+		size = MIN(size, num);
+		while (numWorkers < size) {
+			poolThreads[numWorkers] = std::thread(&VolCtl::PoolLoop, this);
+			numWorkers++;
+		}
+		std::unique_lock<std::mutex> guard(poolLock);
+		poolJob = &job;
+		poolBusy = numWorkers;
+		poolJobSeq++;
+		poolCond.notify_all();
+		while (poolBusy > 0)
+			poolDoneCond.wait(guard);
+		poolJob = NULL;
+	}
+	free(job.devIds);
+	for (i = 0; i < num && status == WAD_OK; i++) {
+		if ((status = results[i].status) != WAD_OK)
+			_snprintf(errorText, sizeof(errorText), "device %d failed with status %d",
+				results[i].devIndex, status);
+	}
+	return status;
+}
+
+int VolCtl::AccessMulti(const int *devIndexes, int num, int op, float vol, bool mute, WadDevResult *results)
+{
+	WadJob job;
+
+	CHECK_INIT();
+	if (num < 0 || op < WAD_OP_GET_VOL || op > WAD_OP_SET_MUTE ||
+		(op == WAD_OP_SET_VOL && (vol < 0 || vol > 1))) {
+		SetErrorText("AccessMulti: invalid argument");
+		return WAD_ERR_INVALID_ARG;
+	}
+	if (num == 0)
+		return WAD_OK;
+	job.op = op;
+	job.vol = vol;
+	job.mute = mute;
+	job.vols = NULL;
+	job.mutes = NULL;
+	job.numChans = NULL;
+	job.chanVols = NULL;
+	job.num = num;
+	job.results = results;
+	return RunJob(&job, devIndexes);
+}
+
+int VolCtl::ApplyMulti(const int *devIndexes, int num, const float *vols, const bool *mutes,
+	WadDevResult *results, int *pNumSets)
+{
+	CHECK_INIT();
+	return ApplyJob(devIndexes, num, vols, mutes, NULL, NULL, results, pNumSets);
+}
+
+//
+// ApplyMulti, and channel volumes if numChans isn't NULL, as in WadJob.
+//
+int VolCtl::ApplyJob(const int *devIndexes, int num, const float *vols, const bool *mutes,
+	int *numChans, float *chanVols, WadDevResult *results, int *pNumSets)
+{
+	WadJob job;
+	int i, ch, status;
+
+	*pNumSets = 0;
+	for (i = 0; i < num; i++) {
+		if (!(vols[i] >= 0 && vols[i] <= 1)) {
+			SetErrorText("ApplyMulti: invalid volume");
+			return WAD_ERR_INVALID_ARG;
+		}
+		for (ch = 0; numChans && ch < numChans[i]; ch++) {
+			if (!(chanVols[i * WAD_MAX_CHANNELS + ch] >= 0 && chanVols[i * WAD_MAX_CHANNELS + ch] <= 1)) {
+				SetErrorText("ApplyMulti: invalid channel volume");
+				return WAD_ERR_INVALID_ARG;
+			}
+		}
+	}
+	if (num <= 0)
+		return WAD_OK;
+	job.op = POOL_OP_APPLY;
+	job.vol = 0;
+	job.mute = false;
+	job.vols = vols;
+	job.mutes = mutes;
+	job.numChans = numChans;
+	job.chanVols = chanVols;
+	job.num = num;
+	job.results = results;
+	status = RunJob(&job, devIndexes);
+	*pNumSets = job.numSets;
+	WA_LOG(2, (THIS_FILE, "ApplyMulti: %d sets on %d devices", *pNumSets, num));
+	return status;
+}
+
+//=============================================================================
+//
+// Snapshots
+//
+// A snapshot is the volume, mute and channel volumes of every active device,
+// to put the audio system back the way it was, e.g., after a test. Both
+// directions run on the worker pool, and a restore only sets what changed,
+// since every set notifies each application watching the device.
+//
+// The file has a header and a record per device: the device ID as a 16 bit
+// length and the bytes, the volume as a float, the mute as a byte, and the
+// channel count as a byte followed by a float per channel, in the machine's
+// byte order. Device IDs only mean something on one machine. Version 1
+// records have no channels, and restore volume and mute only.
+//
+
+#define SNAP_MAGIC		"WADSNAP"
+#define SNAP_VERSION	2
+#define SNAP_MIN_RECORD	8		// ID length, volume, mute and channel count
+
+typedef struct {
+	char magic[8];				// SNAP_MAGIC, terminated
+	uint32_t version;			// SNAP_VERSION
+	uint32_t numDev;			// number of records
+} SnapHeader;
+
+//
+// Devices that can't be read are left out, and make the result an error.
+//
+int VolCtl::SaveSnapshot(const char *path)
+{
+	SnapHeader hdr;
+	WadDevResult *results;
+	WadDevInfo info;
+	WadJob job;
+	int *devIndexes, *numChans;
+	float *chanVols;
+	int i, num;
+	int status = WAD_OK;
+	uint16_t idLen;
+	uint8_t mute, numChan;
+	FILE *fp = NULL;
+
+	CHECK_INIT();
+	num = MAX(GetNumDevices(), 1);
+	devIndexes = (int *) malloc(num * sizeof(int));
+	results = (WadDevResult *) malloc(num * sizeof(WadDevResult));
+	numChans = (int *) malloc(num * sizeof(int));
+	chanVols = (float *) malloc(num * WAD_MAX_CHANNELS * sizeof(float));
+	if (!devIndexes || !results || !numChans || !chanVols) {
+		SetErrorText("out of memory");
+		status = WAD_ERR_INTERNAL;
+		goto SaveSnapshot_exit;
+	}
+	if ((num = SelectDevices(WAD_SELECT_ALL, NULL, devIndexes, num)) < 0) {
+		status = WAD_ERR_INTERNAL;
+		goto SaveSnapshot_exit;
+	}
+	if (num > 0) {
+		job.op = POOL_OP_READ;
+		job.vol = 0;
+		job.mute = false;
+		job.vols = NULL;
+		job.mutes = NULL;
+		job.numChans = numChans;
+		job.chanVols = chanVols;
+		job.num = num;
+		job.results = results;
+		status = RunJob(&job, devIndexes);
+	}
+	if ((fp = fopen(path, "wb")) == NULL) {
+		_snprintf(errorText, sizeof(errorText), "can't create snapshot '%s'", path);
+		status = WAD_ERR_INVALID_ARG;
+		goto SaveSnapshot_exit;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SNAP_MAGIC, sizeof(SNAP_MAGIC));
+	hdr.version = SNAP_VERSION;
+	for (i = 0; i < num; i++) {
+		if (results[i].status == WAD_OK)
+			hdr.numDev++;
+	}
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	for (i = 0; i < num; i++) {
+		if (results[i].status != WAD_OK)
+			continue;
+		GetDevInfo(devIndexes[i], &info);
+		idLen = (uint16_t) strlen(info.devId);
+		mute = results[i].mute;
+		numChan = (uint8_t) numChans[i];
+		fwrite(&idLen, sizeof(idLen), 1, fp);
+		fwrite(info.devId, 1, idLen, fp);
+		fwrite(&results[i].vol, sizeof(float), 1, fp);
+		fwrite(&mute, sizeof(mute), 1, fp);
+		fwrite(&numChan, sizeof(numChan), 1, fp);
+		fwrite(&chanVols[i * WAD_MAX_CHANNELS], sizeof(float), numChan, fp);
+	}
+	if (ferror(fp) | fclose(fp)) {
+		_snprintf(errorText, sizeof(errorText), "can't write snapshot '%s'", path);
+		status = WAD_ERR_INTERNAL;
+	}
+	WA_LOG(2, (THIS_FILE, "SaveSnapshot: %u of %d devices to '%s'", hdr.numDev, num, path));
+SaveSnapshot_exit:
+	free(devIndexes);
+	free(results);
+	free(numChans);
+	free(chanVols);
+	return status;
+}
+
+int VolCtl::RestoreSnapshot(const char *path, int *pNumSets)
+{
+	const SnapHeader *pHdr;
+	const unsigned char *p, *end;
+	char devId[WAD_NAME_LEN];
+	WadDevResult *results = NULL;
+	int *devIndexes = NULL;
+	float *vols = NULL;
+	bool *mutes = NULL;
+	int *numChans = NULL;
+	float *chanVols = NULL;
+	size_t len = 0;
+	unsigned i, numRecords, minRecord;
+	int devIndex, num, numMissing, numChan;
+	uint16_t idLen;
+	int status = WAD_OK;
+	const void *data;
+
+	CHECK_INIT();
+	*pNumSets = 0;
+	if ((data = MapFile(path, &len)) == NULL) {
+		_snprintf(errorText, sizeof(errorText), "can't read snapshot '%s'", path);
+		return WAD_ERR_INVALID_ARG;
+	}
+	pHdr = (const SnapHeader *) data;
+	minRecord = len >= sizeof(SnapHeader) && pHdr->version == 1 ? SNAP_MIN_RECORD - 1 : SNAP_MIN_RECORD;
+	if (len < sizeof(SnapHeader) || memcmp(pHdr->magic, SNAP_MAGIC, sizeof(SNAP_MAGIC))
+		|| pHdr->version < 1 || pHdr->version > SNAP_VERSION
+		|| pHdr->numDev > (len - sizeof(SnapHeader)) / minRecord) {
+		_snprintf(errorText, sizeof(errorText), "'%s' isn't a snapshot", path);
+		UnmapFile(data, len);
+		return WAD_ERR_INVALID_ARG;
+	}
+	numRecords = pHdr->numDev;
+	devIndexes = (int *) calloc(MAX(numRecords, 1), sizeof(int));
+	vols = (float *) malloc(MAX(numRecords, 1) * sizeof(float));
+	mutes = (bool *) malloc(MAX(numRecords, 1) * sizeof(bool));
+	numChans = (int *) calloc(MAX(numRecords, 1), sizeof(int));
+	chanVols = (float *) malloc(MAX(numRecords, 1) * WAD_MAX_CHANNELS * sizeof(float));
+	results = (WadDevResult *) malloc(MAX(numRecords, 1) * sizeof(WadDevResult));
+	if (!devIndexes || !vols || !mutes || !numChans || !chanVols || !results) {
+		SetErrorText("out of memory");
+		status = WAD_ERR_INTERNAL;
+	}
+	// find the devices, and apply nothing unless the whole file is good
+	p = (const unsigned char *) (pHdr + 1);
+	end = (const unsigned char *) data + len;
+	num = 0;
+	numMissing = 0;
+	for (i = 0; i < numRecords && status == WAD_OK; i++) {
+		if (end - p < 2)
+			break;
+		memcpy(&idLen, p, sizeof(idLen));
+		p += sizeof(idLen);
+		if (idLen >= WAD_NAME_LEN || end - p < (int) (idLen + minRecord - 2))
+			break;
+		memcpy(devId, p, idLen);
+		devId[idLen] = 0;
+		p += idLen;
+		numChan = minRecord == SNAP_MIN_RECORD ? p[sizeof(float) + 1] : 0;
+		if (numChan > WAD_MAX_CHANNELS || end - p < (int) (minRecord - 2 + numChan * sizeof(float)))
+			break;
+		if ((devIndex = FindDevById(devId)) < 0) {
+			WA_LOG(1, (THIS_FILE, "RestoreSnapshot: no device '%s'", devId));
+			numMissing++;
+			p += minRecord - 2 + numChan * sizeof(float);
+			continue;
+		}
+		devIndexes[num] = devIndex;
+		memcpy(&vols[num], p, sizeof(float));
+		p += sizeof(float);
+		mutes[num] = *p++ != 0;
+		if (minRecord == SNAP_MIN_RECORD)
+			p++;
+		numChans[num] = numChan;
+		memcpy(&chanVols[num * WAD_MAX_CHANNELS], p, numChan * sizeof(float));
+		p += numChan * sizeof(float);
+		num++;
+	}
+	UnmapFile(data, len);
+	if (status == WAD_OK && i < numRecords) {
+		_snprintf(errorText, sizeof(errorText), "snapshot '%s' is truncated", path);
+		status = WAD_ERR_INVALID_ARG;
+	}
+	if (status == WAD_OK)
+		status = ApplyJob(devIndexes, num, vols, mutes, numChans, chanVols, results, pNumSets);
+	if (status == WAD_OK && numMissing > 0) {
+		_snprintf(errorText, sizeof(errorText), "%d devices in snapshot '%s' not found", numMissing, path);
+		status = WAD_ERR_INVALID_DEVICE;
+	}
+	WA_LOG(2, (THIS_FILE, "RestoreSnapshot: %d sets on %d devices from '%s'", *pNumSets, num, path));
+	free(devIndexes);
+	free(vols);
+	free(mutes);
+	free(numChans);
+	free(chanVols);
+	free(results);
+	return status;
+}
+
+//=============================================================================
+//
+// Peak meters
+//
+// A thread of its own reads the meters of a set of devices on a fixed tick,
+// scheduled from the start like ramp ticks, and puts the readings in a ring
+// allocated up front. Readers take them in batches. Meters are opened once
+// and kept, and only opened again if the device goes away, at most once a
+// second. The meter thread calls the backend without devLock, with device
+// IDs taken at the start, so metering doesn't hold up other calls.
+//
+// A meter is reference counted under meterLock, with a reference for VolCtl
+// while metering and one for each ReadMeter in progress. Stopping sets the
+// stop flag, which wakes readers, joins the thread and drops VolCtl's
+// reference, and the last reader out frees the meter.
+//
+
+#define METER_RETRY_SEC	1		// wait before opening a lost meter again
+
+typedef struct {
+	int devIndex;
+	const char *devId;		// in the string table
+	WadHandle hMeter;		// NULL if not open
+	long retryTick;			// tick to try opening again after a failure
+} WadMeterDev;
+
+struct WadMeter {
+	WadMeterDev *devs;
+	int numDevs;
+	int rateHz;
+	long tick;				// ticks since start
+	WadMeterSample *tickSamples;	// readings of one tick, numDevs
+	WadMeterSample *ring;	// ringSize readings
+	int ringSize;
+	long long head;			// readings written, guarded by lock
+	long long tail;			// readings taken, guarded by lock
+	long dropped;			// readings lost since last taken, guarded by lock
+	bool stop;				// guarded by lock
+	std::mutex lock;
+	std::condition_variable cond;	// signals readings or stop
+	std::thread thread;		// reads the meters every tick
+	int refs;				// guarded by VolCtl::meterLock
+};
+
+// Take a reference on the meter in progress, NULL if not metering
+WadMeter *VolCtl::HoldMeter()
+{
+	std::lock_guard<std::mutex> guard(meterLock);
+	if (meter)
+		meter->refs++;
+	return meter;
+}
+
+void VolCtl::ReleaseMeter(WadMeter *pMeter)
+{
+	{
+		std::lock_guard<std::mutex> guard(meterLock);
+		if (--pMeter->refs > 0)
+			return;
+	}
+	free(pMeter->devs);
+	free(pMeter->tickSamples);
+	free(pMeter->ring);
+	delete pMeter;
+}
+
+//
+// Stop a meter that is no longer in progress, and drop VolCtl's reference.
+//
+void VolCtl::EndMeter(WadMeter *pMeter)
+{
+	if (!pMeter)
+		return;
+	if (pMeter->thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> guard(pMeter->lock);
+			pMeter->stop = true;
+		}
+		pMeter->cond.notify_all();
+		pMeter->thread.join();
+	}
+	ReleaseMeter(pMeter);
+}
+
+//
+// Read the meter of device i, opening it if needed. A stale meter is
+// dropped and opened again once, as in AccessVol.
+//
+void VolCtl::ReadPeaks(WadMeter *pMeter, int i, WadMeterSample *pSample)
+{
+	WadMeterDev *pDev = &pMeter->devs[i];
+	int status = WAD_OK;
+	int tries = 2;
+
+	pSample->devIndex = pDev->devIndex;
+	pSample->numChannels = 0;
+	pSample->peak = 0;
+	do {
+		if (!pDev->hMeter) {
+			if (pMeter->tick < pDev->retryTick) {
+				status = WAD_ERR_DEVICE_LOST;
+				break;
+			}
+			if ((status = backend->OpenMeter(pDev->devId, &pDev->hMeter)) != WAD_OK) {
+				pDev->hMeter = NULL;
+				pDev->retryTick = pMeter->tick + METER_RETRY_SEC * pMeter->rateHz;
+				WA_LOG(1, (THIS_FILE, "meter %d: %s", pDev->devIndex, backend->GetErrorText()));
+				break;
+			}
+		}
+		status = backend->GetPeaks(pDev->hMeter, &pSample->peak, pSample->chanPeaks,
+			&pSample->numChannels);
+		if (status == WAD_ERR_DEVICE_LOST) {
+			backend->CloseMeter(pDev->hMeter);
+			pDev->hMeter = NULL;
+		}
+	} while (status == WAD_ERR_DEVICE_LOST && --tries > 0);
+	pSample->status = status;
+	if (status != WAD_OK) {
+		pSample->numChannels = 0;
+		pSample->peak = 0;
+	}
+}
+
+void VolCtl::MeterLoop(WadMeter *pMeter)
+{
+	std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+	std::chrono::microseconds period(1000000 / pMeter->rateHz);
+	long long msec;
+	int i;
+	bool isBackendThread = backend->ThreadInit() == WAD_OK;
+
+#ifdef _WIN32
+	timeBeginPeriod(1);
+#endif
+	for (;;) {
+		msec = std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+		for (i = 0; i < pMeter->numDevs; i++) {
+			pMeter->tickSamples[i].msec = msec;
+			ReadPeaks(pMeter, i, &pMeter->tickSamples[i]);
+		}
+		{
+			std::lock_guard<std::mutex> guard(pMeter->lock);
+			if (pMeter->stop)
+				break;
+			for (i = 0; i < pMeter->numDevs; i++) {
+				// full, lose the oldest
+				if (pMeter->head - pMeter->tail == pMeter->ringSize) {
+					pMeter->tail++;
+					pMeter->dropped++;
+				}
+				pMeter->ring[pMeter->head++ % pMeter->ringSize] = pMeter->tickSamples[i];
+			}
+		}
+		pMeter->cond.notify_all();
+		pMeter->tick++;
+		next += period;
+		std::this_thread::sleep_until(next);
+	}
+#ifdef _WIN32
+	timeEndPeriod(1);
+#endif
+	for (i = 0; i < pMeter->numDevs; i++) {
+		if (pMeter->devs[i].hMeter)
+			backend->CloseMeter(pMeter->devs[i].hMeter);
+	}
+	if (isBackendThread)
+		backend->ThreadExit();
+}
+
+//
+// The new meter is set up and started before it replaces the one in
+// progress, which is then stopped.
+//
+int VolCtl::StartMeter(const int *devIndexes, int num, int rateHz, int bufSamples)
+{
+	WadMeter *pMeter, *pOld;
+	int i;
+
+	CHECK_INIT();
+	if (num < 1 || rateHz < 1 || rateHz > WAD_METER_MAX_RATE || bufSamples < 0) {
+		SetErrorText("StartMeter: invalid argument");
+		return WAD_ERR_INVALID_ARG;
+	}
+	pMeter = new WadMeter();
+	pMeter->refs = 1;
+	pMeter->numDevs = num;
+	pMeter->rateHz = rateHz;
+	pMeter->ringSize = bufSamples > 0 ? bufSamples : num * rateHz;
+	pMeter->devs = (WadMeterDev *) calloc(num, sizeof(WadMeterDev));
+	pMeter->tickSamples = (WadMeterSample *) calloc(num, sizeof(WadMeterSample));
+	pMeter->ring = (WadMeterSample *) calloc(pMeter->ringSize, sizeof(WadMeterSample));
+	if (!pMeter->devs || !pMeter->tickSamples || !pMeter->ring) {
+		ReleaseMeter(pMeter);
+		SetErrorText("out of memory");
+		return WAD_ERR_INTERNAL;
+	}
+	{
+		DEV_LOCK();
+		for (i = 0; i < num; i++) {
+			if (devIndexes[i] < 0 || devIndexes[i] >= numDev || !devTab[devIndexes[i]].isActive) {
+				_snprintf(errorText, sizeof(errorText), "StartMeter: device %d is not valid",
+					devIndexes[i]);
+				ReleaseMeter(pMeter);
+				return WAD_ERR_INVALID_DEVICE;
+			}
+			pMeter->devs[i].devIndex = devIndexes[i];
+			pMeter->devs[i].devId = devTab[devIndexes[i]].devId;
+		}
+	}
+	WA_LOG(2, (THIS_FILE, "StartMeter: %d devices at %d Hz, ring of %d", num, rateHz,
+		pMeter->ringSize));
+	pMeter->thread = std::thread(&VolCtl::MeterLoop, this, pMeter);
+	{
+		std::lock_guard<std::mutex> guard(meterLock);
+		pOld = meter;
+		meter = pMeter;
+	}
+	EndMeter(pOld);
+	return WAD_OK;
+}
+
+int VolCtl::ReadMeter(WadMeterSample *samples, int max, int timeoutMsec, long *pDropped)
+{
+	WadMeter *pMeter = HoldMeter();
+	int i, n;
+
+	if (!pMeter)
+		return -1;
+	{
+		std::unique_lock<std::mutex> guard(pMeter->lock);
+		pMeter->cond.wait_for(guard, std::chrono::milliseconds(timeoutMsec),
+			[pMeter] { return pMeter->head > pMeter->tail || pMeter->stop; });
+		n = (int) MIN(pMeter->head - pMeter->tail, (long long) max);
+		for (i = 0; i < n; i++)
+			samples[i] = pMeter->ring[pMeter->tail++ % pMeter->ringSize];
+		if (pDropped)
+			*pDropped = pMeter->dropped;
+		pMeter->dropped = 0;
+		// stopped while waiting, with nothing left
+		if (n == 0 && pMeter->stop)
+			n = -1;
+	}
+	ReleaseMeter(pMeter);
+	return n;
+}
+
+void VolCtl::StopMeter()
+{
+	WadMeter *pMeter;
+
+	{
+		std::lock_guard<std::mutex> guard(meterLock);
+		pMeter = meter;
+		meter = NULL;
+	}
+	EndMeter(pMeter);
+}
+
+//=============================================================================
+//
+// Latency stats
+//
+// Init and volume and mute access time their stages into per-stage
+// histograms, and the backend times the calls it makes within a stage, to
+// show where a slow call spends its time. Recording is lock-free, so it
+// doesn't serialize concurrent calls.
+//
+
+void VolCtl::EnableStats(bool enable)
+{
+	stats.Enable(enable);
+}
+
+int VolCtl::GetStats(int stage, WadStageStats *pStats)
+{
+	if (stage < 0 || stage >= WAD_NUM_STAGES) {
+		_snprintf(errorText, sizeof(errorText), "GetStats: stage %d is not valid", stage);
+		return WAD_ERR_INVALID_ARG;
+	}
+	stats.Get(stage, pStats);
+	return WAD_OK;
+}
+
+void VolCtl::ResetStats()
+{
+	stats.Reset();
+}
@@ -2,85 +2,410 @@
 #ifndef _VOL_CTL_H
 #define _VOL_CTL_H
 
-#include <MMDeviceAPI.h>
-#include <AudioClient.h>
-#include <AudioPolicy.h>
-
-enum WadStatus {
-	WAD_OK = 0,					//!< success
-	WAD_ERR_INTERNAL,			//!< internal error, see errorText
-	WAD_ERR_UNSUPPORTED,		//!< unsupported feature
-	WAD_ERR_INVALID_ARG,		//!< invalid argument
-	WAD_ERR_NOT_INITIALIZED,	//!< device not initialized
-	WAD_ERR_NOT_OPEN,			//!< device not open
-	WAD_ERR_INVALID_DEVICE,		//!< invalid device
-	// Use GetClosestFormat() to return suggestions for unsupported formats
-	WAD_ERR_IN_FORMAT,			//!< unsupported input format
-	WAD_ERR_OUT_FORMAT,			//!< unsupported output format
-	// more detail...
-	WAD_ERR_IN_SAMPRATE,		//!< unsupported input sampling rate
-	WAD_ERR_OUT_SAMPRATE,		//!< unsupported output sampling rate
-	WAD_ERR_IN_NUMCHAN,			//!< unsupported number input channels
-	WAD_ERR_OUT_NUMCHAN,		//!< unsupported number output channels
-	WAD_ERR_IN_SAMPFORMAT,		//!< unsupported input sample format
-	WAD_ERR_OUT_SAMPFORMAT,		//!< unsupported output sample format
-	WAD_ERR_IN_FRAMESPERBUF,	//!< unsupported buffer length
-	WAD_ERR_OUT_FRAMESPERBUF,	//!< unsupported buffer length
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include "WadBackend.h"
+#include "WadGain.h"
+#include "WadStats.h"
+
+/** Device name matching for FindDevByName
+*/
+enum WadMatch {
+	WAD_MATCH_EXACT = 0,		//!< exact name
+	WAD_MATCH_NOCASE,			//!< case insensitive name
+	WAD_MATCH_PREFIX,			//!< case insensitive prefix of name
+	WAD_MATCH_SUBSTR,			//!< case insensitive substring of name
+	WAD_MATCH_BEST,				//!< first of the above that matches, in order
+};
+
+/** Volume ramp curves
+*/
+enum WadRampCurve {
+	WAD_RAMP_LINEAR = 0,		//!< linear in volume
+	WAD_RAMP_DB,				//!< linear in dB, from -60 dB
+	WAD_RAMP_SCURVE,			//!< smoothstep, slow at both ends
+};
+
+#define WAD_RAMP_TICK_MSEC	10	//!< ramp update period
+
+/** Volume tapers, how a 0..1 fader position maps to dB
+*/
+enum WadTaper {
+	WAD_TAPER_LINEAR = 0,		//!< linear in dB across the device range
+	WAD_TAPER_AUDIO,			//!< position is the cube root of amplitude, -18 dB at half
+	WAD_TAPER_CUSTOM,			//!< straight lines through position, dB breakpoints
 };
 
-#define WAD_NAME_LEN	256
+#define WAD_TAPER_MAX_POINTS	16	//!< most breakpoints of a custom taper
+
+/** Device selection for SelectDevices
+*/
+enum WadSelect {
+	WAD_SELECT_ALL = 0,			//!< all active devices
+	WAD_SELECT_INPUTS,			//!< active input devices
+	WAD_SELECT_OUTPUTS,			//!< active output devices
+	WAD_SELECT_NAME,			//!< active devices matching a name pattern
+};
+
+/** Operations for AccessMulti
+*/
+enum WadMultiOp {
+	WAD_OP_GET_VOL = 0,
+	WAD_OP_SET_VOL,
+	WAD_OP_GET_MUTE,
+	WAD_OP_SET_MUTE,
+};
+
+/** Result for one device of AccessMulti
+*/
+typedef struct {
+	int devIndex;
+	int status;			//!< WadStatus of the operation on this device
+	float vol;			//!< volume, for WAD_OP_GET_VOL
+	bool mute;			//!< mute, for WAD_OP_GET_MUTE
+} WadDevResult;
+
+#define WAD_POOL_MAX	8	//!< maximum worker threads for AccessMulti
+
+/** Peak meter reading of one device
+*/
+typedef struct {
+	long long msec;		//!< time of the reading, msec since 1970
+	int devIndex;
+	int status;			//!< WadStatus of reading the meter, peaks are 0 on error
+	float peak;			//!< peak of all channels, 0..1
+	int numChannels;
+	float chanPeaks[WAD_MAX_CHANNELS];	//!< peak of each channel
+} WadMeterSample;
+
+#define WAD_METER_MAX_RATE	100	//!< most meter readings per second
+
+struct WadRamp;
+struct WadRampStep;
+struct WadJob;
+struct WadMeter;
+struct WadDbScale;
+struct WadDevHandle;
+struct WadDevSnap;
+
+struct WadDevState;
+struct WadSesState;
+struct WadStrBlock;
 
 /** Device information structure
+
+Names and IDs are UTF-8 and point into the VolCtl's string table, so they
+stay valid while the VolCtl lives, also after the device is renamed or
+removed.
 */
 typedef struct {
 	bool isInput;	//! T/F if input device
-	char name[WAD_NAME_LEN];	//!< device name
-	LPWSTR id;			//!< id from GetId, allocated
-	char devId[WAD_NAME_LEN];	//! id converted to multichar
+	bool isActive;		//!< T/F if device active, removed devices keep their index
+	bool hasName;		//!< T/F if name has been read, internal
+	const char *name;	//!< device name, empty until read
+	const char *devId;	//! device ID from the backend
 } WadDevInfo;
 
-class VolCtl {
+/** Application session information, a process playing or recording on a device
+*/
+typedef struct {
+	int devIndex;		//!< device the session is on
+	char *sessionId;	//!< session ID from the backend, from GetSessionInfo a copy to free()
+	unsigned long pid;	//!< process ID, 0 for system sounds
+	char procName[WAD_NAME_LEN];	//!< process executable name, without path
+	bool isActive;		//!< T/F if session active, an expired session's index may go to a new one
+} WadSessionInfo;
+
+/** Volume control
+
+Calls may be made from any number of threads. Lookups read a published copy
+of the device table without locking, and volume and mute calls run
+concurrently, so a refresh of the table doesn't hold them up. Error text is
+kept per thread, so GetErrorText() gives the last error on the calling
+thread.
+*/
+class VolCtl : public WadBackendListener {
 protected:
 	// device discovery
-	IMMDeviceEnumerator *pEnumerator;	//!< device enumerator
+	WadBackend *backend;		//!< audio system backend, owned
 	int numDev;					//!< number devices in device table
+	int devTabSize;				//!< allocated size of device table
 	WadDevInfo *devTab;		//!< device table, allocated
-	//! Get the device name as C string
-	bool GetDeviceName(IMMDevice *device, char *devName, size_t len);
+	WadDevState *devState;		//!< handles, watches and ramps of each device, allocated with devTab
+	WadStrBlock *strBlocks;		//!< string table for names and IDs, newest block first
+	//! Copy a string into the string table, returns NULL if out of memory
+	const char *AddString(const char *str);
+	bool isLazy;				//!< T/F if devices added on demand
+	bool isEnumerated;			//!< T/F if all devices in table
+	int AddDevice(const char *devId, bool isInput, const char *name);
+	int AddDeviceById(const char *devId, bool getName);
+	bool EnsureName(int devIndex);
+	int EnumerateFlow(bool isInput);
+	static void EnumFn(void *arg, const char *devId, const char *name);
+	int EnumerateAll();
+	int ResolveDefault(bool isInput);
+	//! Copy backend error text and return status
+	int BackendError(int status);
+	// published device table
+	std::atomic<WadDevSnap *> devSnap;	//!< current table and indexes for readers, never NULL
+	std::atomic<unsigned> snapEpoch;	//!< moved on by changes once old readers are done
+	std::atomic<int> snapReaders[2];	//!< threads reading a table without devLock, by epoch parity
+	WadDevSnap *retiredSnaps;	//!< replaced tables not yet freed, guarded by devLock
+	//! Publish the device table and defaults to readers, with devLock held
+	void PublishTable();
+	void FreeRetired();
+	//! Lookup by id in the published table, with devLock held
+	int LookupId(const char *devId);
+	bool IsActiveDev(int devIndex);
+	// device cache
+	char *cacheFile;			//!< device cache file name, allocated, or NULL
+	bool cacheDirty;			//!< T/F if table changed since cache saved
+	int LoadCache();
+	bool IsCacheCurrent(const unsigned *numActive);
+	int SaveCache();
+	// device notifications
+	std::recursive_mutex devLock;	//!< serializes changes to the device table and defaults
+	bool isNotify;				//!< T/F if device notifications enabled
+	void OnDeviceState(const char *devId, bool isActive, bool isInput);
+	void OnDefaultDevice(bool isInput, const char *devId);
+	void OnDeviceName(const char *devId);
+	void OnSessionState(const char *devId, const char *sessionId, unsigned long pid,
+		const char *procName, bool isActive);
+	// volume change notifications
+	WadVolChangeFn *watchAllFn;	//!< callback when watching all devices, or NULL
+	void *watchAllArg;			//!< argument to watchAllFn
+	int WatchDevice(int devIndex, WadVolChangeFn *fn, void *arg);
+	void UnwatchDevice(int devIndex);
 	int defaultInDev;			//!< index of default input device, -1 if none
 	int defaultOutDev;			//!< index of default output device, -1 if none
-	// streaming
-	IMMDevice *pCaptureDevice;	//!< capture device, or NULL
-	IMMDevice *pRenderDevice;	//!< render device, or NULL
+	//! Get backend handle, cached if enabled, caller releases with ReleaseHandle
+	int OpenHandle(int devIndex, WadDevHandle **ppHandle);
+	//! Release a handle, dropping it from the cache if the device was lost
+	void ReleaseHandle(int devIndex, WadDevHandle *pHandle, bool isLost);
+	//! Drop cached handle for a device, e.g., when removed
+	void InvalidateDevice(int devIndex);
+	std::mutex handleLock;		//!< guards cached handles and growing the device table
+	bool useIfCache;			//!< T/F if caching backend handles
+	// volume ramps
+	std::thread rampThread;		//!< updates ramps every tick, started by first ramp
+	std::condition_variable_any rampCond;	//!< signals ramp added, done or stop
+	long rampTick;				//!< ticks since ramp thread started
+	std::atomic<int> numRamps;	//!< number of ramps in progress
+	bool rampStop;				//!< T/F to stop ramp thread
+	unsigned rampSerial;		//!< serial of the last ramp started
+	std::mutex rampSetLock;		//!< held by the ramp thread while it sets volumes
+	int StartRamp(int devIndex, float target, int msec, int curve);
+	void EndRamp(int devIndex);
+	int UpdateRamps(WadRampStep *steps);
+	void EndRamps(const WadRampStep *steps, int num);
+	void RampLoop();
+	// application sessions
+	int numSes;					//!< number sessions in session table
+	int sesTabSize;				//!< allocated size of session table
+	WadSessionInfo *sesTab;		//!< session table, allocated
+	WadSesState *sesState;		//!< state of each session, indexed like sesTab
+	int *sesHash;				//!< hash of session ID to first session index, -1 if empty
+	int freeSes;				//!< first expired session to reuse, -1 if none
+	bool GrowSessions();
+	void HashSession(int sesIndex, bool add);
+	int AddSession(int devIndex, const char *sessionId, unsigned long pid, const char *procName);
+	int FindSessionById(const char *sessionId);
+	static void SessionEnumFn(void *arg, const char *sessionId, unsigned long pid, const char *procName);
+	int IndexSessions(int devIndex);
+	void EndSession(int sesIndex);
+	//! Drop the sessions of a device, e.g., when removed
+	void InvalidateSessions(int devIndex);
+	int OpenSessionHandle(int sesIndex, WadHandle *phSes);
+	int ReleaseSessionHandle(int sesIndex, WadHandle hSes, int status);
+	int AccessSessionVol(int sesIndex, bool setVol, float *pVol);
+	int AccessSessionMute(int sesIndex, bool setMute, bool *pMute);
+	// worker pool for multi-device operations
+	std::thread poolThreads[WAD_POOL_MAX];
+	int poolSize;				//!< number of workers to run, 0 for default
+	int numWorkers;				//!< number of workers started
+	std::mutex poolLock;		//!< guards the job fields and serializes jobs
+	std::condition_variable poolCond;	//!< signals a new job or stop
+	std::condition_variable poolDoneCond;	//!< signals job finished
+	WadJob *poolJob;			//!< current job or NULL
+	long poolJobSeq;			//!< incremented for each job
+	int poolBusy;				//!< number of workers on the current job
+	bool poolStop;				//!< T/F to stop workers
+	std::mutex poolRunLock;		//!< held while running a job
+	void PoolLoop();
+	void StopPool();
+	int RunJob(WadJob *pJob, const int *devIndexes);
+	int ReadDevice(WadHandle hDev, WadJob *pJob, int i);
+	int ApplyDevice(WadHandle hDev, WadJob *pJob, int i);
+	int ApplyJob(const int *devIndexes, int num, const float *vols, const bool *mutes,
+		int *numChans, float *chanVols, WadDevResult *results, int *pNumSets);
+	// peak meters
+	WadMeter *meter;			//!< metering in progress or NULL, guarded by meterLock
+	std::mutex meterLock;		//!< guards meter and the meters' reference counts
+	WadMeter *HoldMeter();
+	void ReleaseMeter(WadMeter *pMeter);
+	void EndMeter(WadMeter *pMeter);
+	void ReadPeaks(WadMeter *pMeter, int i, WadMeterSample *pSample);
+	void MeterLoop(WadMeter *pMeter);
 	//! volume control
 	int AccessVol(int devIndex, bool setVol, float *pVol);
 	//! mute control
 	int AccessMute(int devIndex, bool setMute, bool *pMute);
-	char errorText[256];
-	ERole role;
+	//! channel volume control, op is a ChanOp
+	int AccessChannels(int devIndex, int op, float *vols, int *pNum);
+	// volume in dB
+	int taper;					//!< WadTaper for devices without their own
+	float taperPoints[2 * WAD_TAPER_MAX_POINTS];	//!< position, dB pairs of a custom taper
+	int numTaperPoints;
+	//! dB volume control, op is a DbOp
+	int AccessDb(int devIndex, int op, float *vals);
+	//! Get the dB scale of a device, reading the range the first time
+	int GetScale(int devIndex, WadDbScale **ppScale);
+	void BuildScale(WadDbScale *pScale);
+	void FreeScale(int devIndex);
+	void ReplaceScale(int devIndex, WadDbScale *pScale, bool publish);
+	WadDbScale *NewTaper(const WadDbScale *pFrom, int taper, const float *points, int numPoints);
+	WadStats stats;				//!< stage latencies, shared with the backend
+	static THREAD_LOCAL char errorText[256];	//!< error of the last call on this thread
+	int role;					//!< WadRole
 	bool isInitialized;
 
 public:
-	//! Creator
-	VolCtl(ERole role = eCommunications);
+	//! Creator, takes ownership of backend, platform default if NULL
+	VolCtl(int role = WAD_ROLE_COMMUNICATIONS, WadBackend *backend = NULL);
 	//! Destructor
 	~VolCtl();
 
-	int Init();
-	void SetErrorText(char *text);
+	//! Keep the device table in a file between runs, call before Init
+	void SetCacheFile(const char *path);
+	//! Initialize, lazy to add devices to table on demand
+	int Init(bool lazy = false);
+	void SetErrorText(const char *text);
+	//! Text of the last error on this thread
 	const char* GetErrorText();
 
 	int GetNumDevices();
 	int GetDefaultInDevIndex();
 	int GetDefaultOutDevIndex();
 	int FindDevById(const char* devId);
-	int FindDevByName(const char* devName);
+	int FindDevByName(const char* devName, int match = WAD_MATCH_EXACT);
 	// these return errors
 	int GetDevInfo(int devIndex, WadDevInfo *pInfo);
 	int SetVol(int devIndex, float vol);
 	int GetVol(int devIndex, float *pVol);
 	int SetMute(int devIndex, bool mute);
 	int GetMute(int devIndex, bool *pMute);
+	// Channel volumes, in the order the audio system reports them. The
+	// device volume is the loudest channel.
+	int GetChannelCount(int devIndex, int *pNum);
+	//! Get all channel volumes, vols holds WAD_MAX_CHANNELS
+	int GetChannelVols(int devIndex, float *vols, int *pNum);
+	//! Set all channel volumes, num must be the channel count
+	int SetChannelVols(int devIndex, const float *vols, int num);
+	int GetChannelVol(int devIndex, int chan, float *pVol);
+	int SetChannelVol(int devIndex, int chan, float vol);
+	//! Multiply each channel volume by a gain, clamped to 0..1. With fewer gains
+	//! than channels the gains repeat, so one gain is for all channels and two
+	//! are left and right.
+	int ApplyChannelGains(int devIndex, const float *gains, int num);
+	//! Same, with gains in dB
+	int ApplyChannelDb(int devIndex, const float *db, int num);
+	//! Set balance from -1 (left) to 1 (right), law is a WadBalanceLaw. The
+	//! loudest channel stays where it is.
+	int SetBalance(int devIndex, float balance, int law = WAD_BALANCE_LINEAR);
+	// Volume in dB, on the device's own scale, for exact steps. Fader
+	// positions map to dB by a taper, through tables built once per device.
+	//! Get the dB range of a device and its step, 0 if continuous
+	int GetVolRange(int devIndex, float *pMinDb, float *pMaxDb, float *pStepDb);
+	int GetVolDb(int devIndex, float *pDb);
+	//! Set volume in dB, clamped to the range and rounded to the step
+	int SetVolDb(int devIndex, float db);
+	//! Change volume by stepDb, up or down, at least one device step if not 0.
+	//! pDb gets the new volume if not NULL.
+	int StepVolDb(int devIndex, float stepDb, float *pDb = NULL);
+	//! Set the taper of a device, or the default for all devices if -1. A custom
+	//! taper has numPoints position, dB pairs in points, positions increasing
+	//! from 0 to 1 and dB not decreasing.
+	int SetTaper(int devIndex, int taper, const float *points = NULL, int numPoints = 0);
+	//! Convert a fader position, 0..1, to dB on the taper of a device
+	int PosToDb(int devIndex, float pos, float *pDb);
+	//! Convert dB to a fader position on the taper of a device
+	int DbToPos(int devIndex, float db, float *pPos);
+	//! Set volume by fader position on the taper
+	int SetVolPos(int devIndex, float pos);
+	int GetVolPos(int devIndex, float *pPos);
+	//! Enable or disable caching of backend handles, enabled by default
+	void SetInterfaceCache(bool enable);
+	//! Track device changes with notifications instead of re-enumerating
+	int EnableDeviceNotify(bool enable);
+	//! Call fn when volume or mute changes on a device, or all devices if -1
+	int Watch(int devIndex, WadVolChangeFn *fn, void *arg);
+	//! Stop watching a device, or all devices if -1
+	int Unwatch(int devIndex);
+	//! Ramp volume to target over msec, replacing any ramp on the device
+	int Ramp(int devIndex, float target, int msec, int curve = WAD_RAMP_LINEAR);
+	//! Ramp fromDev to 0 and toDev to vol, starting on the same tick
+	int Crossfade(int fromDev, int toDev, float vol, int msec, int curve = WAD_RAMP_LINEAR);
+	//! Stop ramp on a device, or all devices if -1, leaving volume where it is
+	int StopRamp(int devIndex);
+	//! Wait for ramp on a device to finish, or all ramps if -1
+	void WaitRamp(int devIndex);
+
+	//! Bring the session table up to date for a device, or all devices if -1
+	int UpdateSessions(int devIndex);
+	int GetNumSessions();
+	//! Get a session, sessionId is an allocated copy for the caller to free(),
+	//! empty if the session expired
+	int GetSessionInfo(int sesIndex, WadSessionInfo *pInfo);
+	//! Find session by process name, PID or session ID on a device, or all
+	//! devices if -1, starting at session index start. Returns -1 if none.
+	int FindSession(int devIndex, const char *app, int start = 0);
+	int SetSessionVol(int sesIndex, float vol);
+	int GetSessionVol(int sesIndex, float *pVol);
+	int SetSessionMute(int sesIndex, bool mute);
+	int GetSessionMute(int sesIndex, bool *pMute);
+
+	//! Get active devices in table order, pattern is a name with * and ? wildcards for
+	//! WAD_SELECT_NAME, case insensitive, matching a substring if no wildcards. Returns
+	//! the number of devices, up to maxDevs, or -1 on error
+	int SelectDevices(int select, const char *pattern, int *devIndexes, int maxDevs);
+	//! Get or set volume or mute on several devices at once, spread across the worker
+	//! pool. Results are in the order of devIndexes. Returns the first error, if any.
+	int AccessMulti(const int *devIndexes, int num, int op, float vol, bool mute, WadDevResult *results);
+	//! Set each device to its own volume and mute, across the worker pool, skipping
+	//! sets that wouldn't change anything. Results have the values before. pNumSets
+	//! gets the number of sets made. Returns the first error, if any.
+	int ApplyMulti(const int *devIndexes, int num, const float *vols, const bool *mutes,
+		WadDevResult *results, int *pNumSets);
+	//! Set the number of worker threads, 0 for the default
+	void SetPoolSize(int n);
+
+	//! Read the peak meters of devices rateHz times a second, on a thread of its own,
+	//! into a ring of bufSamples readings, 0 for a second's worth. Replaces metering
+	//! in progress.
+	int StartMeter(const int *devIndexes, int num, int rateHz, int bufSamples = 0);
+	//! Take up to max readings, oldest first, waiting up to timeoutMsec for the first.
+	//! Returns the number taken, 0 on timeout, or -1 if not metering. pDropped gets
+	//! the readings lost to a full ring since the last call, if not NULL. Safe to
+	//! call from any thread, while metering is started or stopped.
+	int ReadMeter(WadMeterSample *samples, int max, int timeoutMsec, long *pDropped = NULL);
+	//! Stop metering. A ReadMeter waiting returns the readings left, or -1 if none.
+	void StopMeter();
+
+	//! Record latencies of the stages of Init and of volume and mute calls, call
+	//! before Init to include it. Disabled by default, which costs a flag test.
+	void EnableStats(bool enable);
+	//! Get the latencies of a WadStage, all 0 if none recorded
+	int GetStats(int stage, WadStageStats *pStats);
+	//! Clear recorded latencies
+	void ResetStats();
+
+	//! Save volume, mute and channel volumes of all active devices to a file
+	int SaveSnapshot(const char *path);
+	//! Restore a snapshot, setting only what differs from the current state.
+	//! Devices no longer present are skipped, and make the result an error.
+	int RestoreSnapshot(const char *path, int *pNumSets);
 };
 
 #endif
@@ -0,0 +1,594 @@
+//
+// Command output formats: text, JSON and binary.
+//
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include "VolOut.h"
+#include "MiscDef.h"
+
+VolOut::VolOut(FILE *fp)
+{
+	this->fp = fp;
+	reply = false;
+}
+
+VolOut::~VolOut()
+{
+}
+
+void VolOut::SetReply(bool reply)
+{
+	this->reply = reply;
+}
+
+//==============================================================================
+// Text, the original VolCtl output
+//
+
+class TextOut : public VolOut {
+public:
+	TextOut(FILE *fp) : VolOut(fp) {}
+	void Done();
+	void Error(int status, const char *errorText);
+	void Vol(float vol);
+	void Mute(bool mute);
+	void Db(float db);
+	void VolRange(float minDb, float maxDb, float stepDb);
+	void Channels(const float *vols, int num);
+	void BeginList(int count, const char *key);
+	void EndList();
+	void Device(int devIndex, const WadDevInfo& info, bool isDefault);
+	void Session(const WadSessionInfo& info, const char *devName);
+	void DevResult(const WadDevResult& result, const char *devName, int op);
+	void Stage(const char *name, const WadStageStats& stats);
+	void Change(long long msec, int devIndex, float vol, bool mute);
+	void Meter(const WadMeterSample *samples, int num);
+};
+
+void TextOut::Done()
+{
+	if (reply)
+		fprintf(fp, "OK\n");
+}
+
+// on the command line, errors go to stderr
+void TextOut::Error(int status, const char *errorText)
+{
+	if (reply)
+		fprintf(fp, "ERR %d %s\n", status, errorText);
+	else
+		fprintf(stderr, "%s\n", errorText);
+}
+
+void TextOut::Vol(float vol)
+{
+	fprintf(fp, reply ? "OK %f\n" : "%f\n", vol);
+}
+
+void TextOut::Mute(bool mute)
+{
+	fprintf(fp, reply ? "OK %d\n" : "%d\n", mute);
+}
+
+void TextOut::Db(float db)
+{
+	fprintf(fp, reply ? "OK %f\n" : "%f\n", db);
+}
+
+void TextOut::VolRange(float minDb, float maxDb, float stepDb)
+{
+	fprintf(fp, reply ? "OK %f %f %f\n" : "%f %f %f\n", minDb, maxDb, stepDb);
+}
+
+void TextOut::Channels(const float *vols, int num)
+{
+	int i;
+	if (reply)
+		fprintf(fp, "OK ");
+	for (i = 0; i < num; i++)
+		fprintf(fp, i ? " %f" : "%f", vols[i]);
+	putc('\n', fp);
+}
+
+void TextOut::BeginList(int count, const char *key)
+{
+	UNUSED(key);
+	if (reply)
+		fprintf(fp, "OK %d\n", count);
+}
+
+void TextOut::EndList()
+{
+}
+
+void TextOut::Device(int devIndex, const WadDevInfo& info, bool isDefault)
+{
+	UNUSED(devIndex);
+	UNUSED(isDefault);
+	fprintf(fp, "'%s' '%s' %d\n", info.name, info.devId, info.isInput);
+}
+
+void TextOut::Session(const WadSessionInfo& info, const char *devName)
+{
+	fprintf(fp, "'%s' %lu '%s' '%s'\n", info.procName, info.pid, devName, info.sessionId);
+}
+
+void TextOut::DevResult(const WadDevResult& result, const char *devName, int op)
+{
+	if (result.status != WAD_OK)
+		fprintf(fp, "'%s' ERR %d\n", devName, result.status);
+	else if (op == WAD_OP_GET_VOL)
+		fprintf(fp, "'%s' %f\n", devName, result.vol);
+	else
+		fprintf(fp, "'%s' %d\n", devName, result.mute);
+}
+
+// usec count min p50 p99 p999 max
+void TextOut::Stage(const char *name, const WadStageStats& stats)
+{
+	fprintf(fp, "%s %llu %.3f %.3f %.3f %.3f %.3f\n", name, stats.count, stats.minUsec,
+		stats.p50Usec, stats.p99Usec, stats.p999Usec, stats.maxUsec);
+}
+
+void TextOut::Change(long long msec, int devIndex, float vol, bool mute)
+{
+	char timeStr[32];
+	time_t t = (time_t) (msec / 1000);
+	strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", localtime(&t));
+	fprintf(fp, "%s.%03d %d %f %d\n", timeStr, (int) (msec % 1000), devIndex, vol, mute);
+	fflush(fp);
+}
+
+void TextOut::Meter(const WadMeterSample *samples, int num)
+{
+	char timeStr[32];
+	time_t t;
+	int i, j;
+	for (i = 0; i < num; i++) {
+		t = (time_t) (samples[i].msec / 1000);
+		strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", localtime(&t));
+		fprintf(fp, "%s.%03d %d ", timeStr, (int) (samples[i].msec % 1000), samples[i].devIndex);
+		if (samples[i].status != WAD_OK) {
+			fprintf(fp, "ERR %d\n", samples[i].status);
+			continue;
+		}
+		fprintf(fp, "%f", samples[i].peak);
+		for (j = 0; j < samples[i].numChannels; j++)
+			fprintf(fp, " %f", samples[i].chanPeaks[j]);
+		putc('\n', fp);
+	}
+	fflush(fp);
+}
+
+//==============================================================================
+// JSON, one object per line
+//
+
+class JsonOut : public VolOut {
+protected:
+	int numItems;		//!< items written in the current list
+	void PutString(const char *s);
+	void BeginItem();
+public:
+	JsonOut(FILE *fp) : VolOut(fp), numItems(0) {}
+	void Done();
+	void Error(int status, const char *errorText);
+	void Vol(float vol);
+	void Mute(bool mute);
+	void Db(float db);
+	void VolRange(float minDb, float maxDb, float stepDb);
+	void Channels(const float *vols, int num);
+	void BeginList(int count, const char *key);
+	void EndList();
+	void Device(int devIndex, const WadDevInfo& info, bool isDefault);
+	void Session(const WadSessionInfo& info, const char *devName);
+	void DevResult(const WadDevResult& result, const char *devName, int op);
+	void Stage(const char *name, const WadStageStats& stats);
+	void Change(long long msec, int devIndex, float vol, bool mute);
+	void Meter(const WadMeterSample *samples, int num);
+};
+
+/*
+ * Write a quoted string, escaping quotes, backslashes and control
+ * characters. Other bytes are passed through, so UTF-8 names stay intact.
+ */
+void JsonOut::PutString(const char *s)
+{
+	const unsigned char *p;
+
+	putc('"', fp);
+	for (p = (const unsigned char *) s; *p; p++) {
+		switch (*p) {
+		case '"':
+			fputs("\\\"", fp);
+			break;
+		case '\\':
+			fputs("\\\\", fp);
+			break;
+		case '\n':
+			fputs("\\n", fp);
+			break;
+		case '\r':
+			fputs("\\r", fp);
+			break;
+		case '\t':
+			fputs("\\t", fp);
+			break;
+		default:
+			if (*p < 0x20)
+				fprintf(fp, "\\u%04x", *p);
+			else
+				putc(*p, fp);
+			break;
+		}
+	}
+	putc('"', fp);
+}
+
+void JsonOut::BeginItem()
+{
+	if (numItems++ > 0)
+		putc(',', fp);
+}
+
+void JsonOut::Done()
+{
+	fprintf(fp, "{\"status\":0}\n");
+}
+
+void JsonOut::Error(int status, const char *errorText)
+{
+	fprintf(fp, "{\"status\":%d,\"error\":", status);
+	PutString(errorText);
+	fprintf(fp, "}\n");
+}
+
+void JsonOut::Vol(float vol)
+{
+	fprintf(fp, "{\"status\":0,\"vol\":%g}\n", vol);
+}
+
+void JsonOut::Mute(bool mute)
+{
+	fprintf(fp, "{\"status\":0,\"mute\":%s}\n", mute ? "true" : "false");
+}
+
+void JsonOut::Db(float db)
+{
+	fprintf(fp, "{\"status\":0,\"db\":%g}\n", db);
+}
+
+void JsonOut::VolRange(float minDb, float maxDb, float stepDb)
+{
+	fprintf(fp, "{\"status\":0,\"minDb\":%g,\"maxDb\":%g,\"stepDb\":%g}\n", minDb, maxDb, stepDb);
+}
+
+void JsonOut::Channels(const float *vols, int num)
+{
+	int i;
+	fprintf(fp, "{\"status\":0,\"channels\":[");
+	for (i = 0; i < num; i++)
+		fprintf(fp, i ? ",%g" : "%g", vols[i]);
+	fprintf(fp, "]}\n");
+}
+
+void JsonOut::BeginList(int count, const char *key)
+{
+	numItems = 0;
+	fprintf(fp, "{\"status\":0,\"count\":%d,\"%s\":[", count, key);
+}
+
+void JsonOut::EndList()
+{
+	fprintf(fp, "]}\n");
+}
+
+void JsonOut::Device(int devIndex, const WadDevInfo& info, bool isDefault)
+{
+	BeginItem();
+	fprintf(fp, "{\"index\":%d,\"name\":", devIndex);
+	PutString(info.name);
+	fprintf(fp, ",\"id\":");
+	PutString(info.devId);
+	fprintf(fp, ",\"isInput\":%s,\"isActive\":%s,\"isDefault\":%s}",
+		info.isInput ? "true" : "false", info.isActive ? "true" : "false",
+		isDefault ? "true" : "false");
+}
+
+void JsonOut::Session(const WadSessionInfo& info, const char *devName)
+{
+	BeginItem();
+	fprintf(fp, "{\"process\":");
+	PutString(info.procName);
+	fprintf(fp, ",\"pid\":%lu,\"device\":%d,\"deviceName\":", info.pid, info.devIndex);
+	PutString(devName);
+	fprintf(fp, ",\"id\":");
+	PutString(info.sessionId);
+	putc('}', fp);
+}
+
+void JsonOut::DevResult(const WadDevResult& result, const char *devName, int op)
+{
+	BeginItem();
+	fprintf(fp, "{\"index\":%d,\"name\":", result.devIndex);
+	PutString(devName);
+	fprintf(fp, ",\"status\":%d", result.status);
+	if (result.status == WAD_OK && op == WAD_OP_GET_VOL)
+		fprintf(fp, ",\"vol\":%g", result.vol);
+	else if (result.status == WAD_OK)
+		fprintf(fp, ",\"mute\":%s", result.mute ? "true" : "false");
+	putc('}', fp);
+}
+
+void JsonOut::Stage(const char *name, const WadStageStats& stats)
+{
+	BeginItem();
+	fprintf(fp, "{\"stage\":");
+	PutString(name);
+	fprintf(fp, ",\"count\":%llu,\"minUsec\":%g,\"p50Usec\":%g,\"p99Usec\":%g,"
+		"\"p999Usec\":%g,\"maxUsec\":%g}", stats.count, stats.minUsec, stats.p50Usec,
+		stats.p99Usec, stats.p999Usec, stats.maxUsec);
+}
+
+// formatted first, so changes from different threads don't interleave
+void JsonOut::Change(long long msec, int devIndex, float vol, bool mute)
+{
+	char line[128];
+	_snprintf(line, sizeof(line), "{\"msec\":%lld,\"index\":%d,\"vol\":%g,\"mute\":%s}\n",
+		msec, devIndex, vol, mute ? "true" : "false");
+	fputs(line, fp);
+	fflush(fp);
+}
+
+void JsonOut::Meter(const WadMeterSample *samples, int num)
+{
+	int i, j;
+	for (i = 0; i < num; i++) {
+		fprintf(fp, "{\"msec\":%lld,\"index\":%d,\"status\":%d,\"peak\":%g,\"channels\":[",
+			samples[i].msec, samples[i].devIndex, samples[i].status, samples[i].peak);
+		for (j = 0; j < samples[i].numChannels; j++)
+			fprintf(fp, j ? ",%g" : "%g", samples[i].chanPeaks[j]);
+		fprintf(fp, "]}\n");
+	}
+	fflush(fp);
+}
+
+//==============================================================================
+// Binary records
+//
+
+WA_STATIC_ASSERT(sizeof(float) == 4);
+
+// largest record, three names plus fixed fields
+#define BIN_RECORD_LEN	(4 + 1 + 32 + 3 * (2 + WAD_DEV_NAME_LEN))
+
+/*
+ * A record being built, written with its length prefix by Write.
+ */
+class BinRecord {
+	unsigned char buf[BIN_RECORD_LEN];
+	size_t len;
+public:
+	BinRecord(char type) : len(4) { buf[len++] = (unsigned char) type; }
+	void PutU8(unsigned v) { if (len < sizeof(buf)) buf[len++] = (unsigned char) v; }
+	void PutU16(unsigned v) { PutU8(v & 0xff); PutU8((v >> 8) & 0xff); }
+	void PutU32(uint32_t v) { PutU16(v & 0xffff); PutU16(v >> 16); }
+	void PutI32(int v) { PutU32((uint32_t) v); }
+	void PutI64(long long v) { PutU32((uint32_t) v); PutU32((uint32_t) ((unsigned long long) v >> 32)); }
+	void PutFloat(float v) { uint32_t u; memcpy(&u, &v, 4); PutU32(u); }
+	void PutString(const char *s);
+	void Write(FILE *fp);
+};
+
+void BinRecord::PutString(const char *s)
+{
+	size_t n = strlen(s);
+	if (len + 2 + n > sizeof(buf)) {
+		// cut on a UTF-8 character boundary
+		for (n = sizeof(buf) - len - 2; n > 0 && ((unsigned char) s[n] & 0xc0) == 0x80; n--)
+			;
+	}
+	PutU16((unsigned) n);
+	memcpy(buf + len, s, n);
+	len += n;
+}
+
+void BinRecord::Write(FILE *fp)
+{
+	uint32_t n = (uint32_t) (len - 4);
+	buf[0] = n & 0xff;
+	buf[1] = (n >> 8) & 0xff;
+	buf[2] = (n >> 16) & 0xff;
+	buf[3] = (n >> 24) & 0xff;
+	fwrite(buf, 1, len, fp);
+}
+
+class BinOut : public VolOut {
+public:
+	BinOut(FILE *fp) : VolOut(fp) {}
+	void Done();
+	void Error(int status, const char *errorText);
+	void Vol(float vol);
+	void Mute(bool mute);
+	void Db(float db);
+	void VolRange(float minDb, float maxDb, float stepDb);
+	void Channels(const float *vols, int num);
+	void BeginList(int count, const char *key);
+	void EndList();
+	void Device(int devIndex, const WadDevInfo& info, bool isDefault);
+	void Session(const WadSessionInfo& info, const char *devName);
+	void DevResult(const WadDevResult& result, const char *devName, int op);
+	void Stage(const char *name, const WadStageStats& stats);
+	void Change(long long msec, int devIndex, float vol, bool mute);
+	void Meter(const WadMeterSample *samples, int num);
+};
+
+void BinOut::Done()
+{
+	Error(WAD_OK, "");
+}
+
+void BinOut::Error(int status, const char *errorText)
+{
+	BinRecord rec('S');
+	rec.PutI32(status);
+	rec.PutString(errorText);
+	rec.Write(fp);
+}
+
+void BinOut::Vol(float vol)
+{
+	BinRecord rec('V');
+	rec.PutFloat(vol);
+	rec.Write(fp);
+}
+
+void BinOut::Mute(bool mute)
+{
+	BinRecord rec('M');
+	rec.PutU8(mute);
+	rec.Write(fp);
+}
+
+void BinOut::Db(float db)
+{
+	BinRecord rec('B');
+	rec.PutFloat(db);
+	rec.Write(fp);
+}
+
+void BinOut::VolRange(float minDb, float maxDb, float stepDb)
+{
+	BinRecord rec('G');
+	rec.PutFloat(minDb);
+	rec.PutFloat(maxDb);
+	rec.PutFloat(stepDb);
+	rec.Write(fp);
+}
+
+void BinOut::Channels(const float *vols, int num)
+{
+	BinRecord rec('C');
+	int i;
+	rec.PutU32(num);
+	for (i = 0; i < num; i++)
+		rec.PutFloat(vols[i]);
+	rec.Write(fp);
+}
+
+void BinOut::BeginList(int count, const char *key)
+{
+	BinRecord rec('L');
+	UNUSED(key);
+	rec.PutU32(count);
+	rec.Write(fp);
+}
+
+void BinOut::EndList()
+{
+}
+
+void BinOut::Device(int devIndex, const WadDevInfo& info, bool isDefault)
+{
+	BinRecord rec('D');
+	rec.PutI32(devIndex);
+	rec.PutU8((info.isInput ? 1 : 0) | (info.isActive ? 2 : 0) | (isDefault ? 4 : 0));
+	rec.PutString(info.name);
+	rec.PutString(info.devId);
+	rec.Write(fp);
+}
+
+void BinOut::Session(const WadSessionInfo& info, const char *devName)
+{
+	BinRecord rec('E');
+	rec.PutI32(info.devIndex);
+	rec.PutU32((uint32_t) info.pid);
+	rec.PutString(info.procName);
+	rec.PutString(devName);
+	rec.PutString(info.sessionId);
+	rec.Write(fp);
+}
+
+void BinOut::DevResult(const WadDevResult& result, const char *devName, int op)
+{
+	BinRecord rec('R');
+	UNUSED(op);
+	rec.PutI32(result.devIndex);
+	rec.PutI32(result.status);
+	rec.PutFloat(result.vol);
+	rec.PutU8(result.mute);
+	rec.PutString(devName);
+	rec.Write(fp);
+}
+
+void BinOut::Stage(const char *name, const WadStageStats& stats)
+{
+	BinRecord rec('T');
+	rec.PutString(name);
+	rec.PutI64((long long) stats.count);
+	rec.PutFloat((float) stats.minUsec);
+	rec.PutFloat((float) stats.p50Usec);
+	rec.PutFloat((float) stats.p99Usec);
+	rec.PutFloat((float) stats.p999Usec);
+	rec.PutFloat((float) stats.maxUsec);
+	rec.Write(fp);
+}
+
+// one fwrite per record, so changes from different threads don't interleave
+void BinOut::Change(long long msec, int devIndex, float vol, bool mute)
+{
+	BinRecord rec('W');
+	rec.PutI64(msec);
+	rec.PutI32(devIndex);
+	rec.PutFloat(vol);
+	rec.PutU8(mute);
+	rec.Write(fp);
+	fflush(fp);
+}
+
+void BinOut::Meter(const WadMeterSample *samples, int num)
+{
+	int i, j;
+	for (i = 0; i < num; i++) {
+		BinRecord rec('P');
+		rec.PutI64(samples[i].msec);
+		rec.PutI32(samples[i].devIndex);
+		rec.PutI32(samples[i].status);
+		rec.PutFloat(samples[i].peak);
+		rec.PutU32(samples[i].numChannels);
+		for (j = 0; j < samples[i].numChannels; j++)
+			rec.PutFloat(samples[i].chanPeaks[j]);
+		rec.Write(fp);
+	}
+	fflush(fp);
+}
+
+//==============================================================================
+// Factory
+//
+
+VolOut *VolOutCreate(int format, FILE *fp)
+{
+	switch (format) {
+	case WAD_FORMAT_TEXT:
+		return new TextOut(fp);
+	case WAD_FORMAT_JSON:
+		return new JsonOut(fp);
+	case WAD_FORMAT_BIN:
+		return new BinOut(fp);
+	}
+	return NULL;
+}
+
+int VolOutFormat(const char *name)
+{
+	if (!strcmp(name, "text"))
+		return WAD_FORMAT_TEXT;
+	if (!strcmp(name, "json"))
+		return WAD_FORMAT_JSON;
+	if (!strcmp(name, "bin"))
+		return WAD_FORMAT_BIN;
+	return -1;
+}
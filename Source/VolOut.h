@@ -0,0 +1,100 @@
+/** Command output formats
+
+VolCtl writes command results through a VolOut, which formats them as
+text for people and scripts, one JSON object per response, or compact
+length-prefixed binary records. Results are written as they are produced,
+without building the whole response first.
+
+JSON responses are one line each, so a server client can read a line and
+parse it. Successful responses have "status":0 and the result, errors have
+the WadStatus and error text:
+
+    {"status":0,"vol":0.5}
+    {"status":0,"count":1,"devices":[{"index":0,"name":"Speakers",...}]}
+    {"status":6,"error":"can't find device name 'x'"}
+
+Binary records start with a 32 bit length of the rest of the record, then
+a type byte and the fields. Integers and floats are little endian, strings
+are a 16 bit length followed by the bytes, without terminator. A response
+is one record, except that a list is an 'L' record followed by count item
+records:
+
+    'S' status     int32 status, string error text, empty on success
+    'V' volume     float32 vol
+    'M' mute       uint8 mute
+    'L' list       uint32 count
+    'D' device     int32 index, uint8 flags (1 input, 2 active, 4 default),
+                   string name, string ID
+    'E' session    int32 device index, uint32 pid, string process,
+                   string device name, string session ID
+    'R' dev result int32 index, int32 status, float32 vol, uint8 mute,
+                   string name
+    'W' change     int64 msec since 1970, int32 index, float32 vol, uint8 mute
+    'C' channels   uint32 count, float32 vol per channel
+    'P' peaks      int64 msec since 1970, int32 index, int32 status,
+                   float32 peak, uint32 count, float32 peak per channel
+    'B' dB         float32 dB
+    'G' dB range   float32 min dB, float32 max dB, float32 step dB
+    'T' stage      string stage, uint64 count, float32 usec min, p50, p99,
+                   p999 and max
+
+@file VolOut.h
+*/
+#ifndef _VOL_OUT_H
+#define _VOL_OUT_H
+
+#include <stdio.h>
+#include "VolCtl.h"
+
+/** Output formats
+*/
+enum WadFormat {
+	WAD_FORMAT_TEXT = 0,		//!< text lines, "OK" and "ERR" prefixes in reply mode
+	WAD_FORMAT_JSON,			//!< one JSON object per response
+	WAD_FORMAT_BIN,				//!< length-prefixed binary records
+};
+
+class VolOut {
+protected:
+	FILE *fp;			//!< output stream
+	bool reply;			//!< T/F if answering server requests
+public:
+	VolOut(FILE *fp);
+	virtual ~VolOut();
+	//! Set reply mode, text results then have an "OK" prefix
+	void SetReply(bool reply);
+
+	//! Success without a result, e.g. a set
+	virtual void Done() = 0;
+	//! Failed command, status is a WadStatus
+	virtual void Error(int status, const char *errorText) = 0;
+	virtual void Vol(float vol) = 0;
+	virtual void Mute(bool mute) = 0;
+	//! Volume in dB
+	virtual void Db(float db) = 0;
+	//! Volume range in dB, step is 0 if continuous
+	virtual void VolRange(float minDb, float maxDb, float stepDb) = 0;
+	//! Channel volumes of a device
+	virtual void Channels(const float *vols, int num) = 0;
+	//! Start a list of count items, key names the items: "devices", "sessions" or "stats"
+	virtual void BeginList(int count, const char *key) = 0;
+	virtual void EndList() = 0;
+	// list items
+	virtual void Device(int devIndex, const WadDevInfo& info, bool isDefault) = 0;
+	virtual void Session(const WadSessionInfo& info, const char *devName) = 0;
+	//! Result of a get on several devices, op is a WadMultiOp
+	virtual void DevResult(const WadDevResult& result, const char *devName, int op) = 0;
+	//! Latencies of a WadStage
+	virtual void Stage(const char *name, const WadStageStats& stats) = 0;
+	//! Volume or mute change, may be called on any thread, flushes
+	virtual void Change(long long msec, int devIndex, float vol, bool mute) = 0;
+	//! Peak meter readings, flushes
+	virtual void Meter(const WadMeterSample *samples, int num) = 0;
+};
+
+//! Create a writer for a WadFormat, NULL if unknown
+VolOut *VolOutCreate(int format, FILE *fp);
+//! Get a WadFormat by name: text, json or bin, -1 if unknown
+int VolOutFormat(const char *name);
+
+#endif
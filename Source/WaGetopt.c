@@ -16,7 +16,8 @@
  * will return the ':' error, because "-a" expects an argument. The IRIX
  * version would return "-b" as argument to "-a" option. This version
  * also checks for unary negation, so "-a -5 -b" would be parsed correctly,
- * i.e., -5 is the argument to "-a".
+ * i.e., -5 is the argument to "-a". A lone "-" is accepted as an argument,
+ * conventionally meaning stdin.
  *
  * Bill Gardner, May, 1998.
  */
@@ -50,7 +51,7 @@ int WaGetopt(int argc,  char **argv,  char *optstr)
 					if (optind < argc) {
 						/* OK, point optarg to next argument */
 						optarg = argv[optind++];
-						if (*optarg == '-' && !isdigit(*(optarg+1))) {
+						if (*optarg == '-' && *(optarg+1) && !isdigit(*(optarg+1))) {
 							/* this argument is another option! */
 							return ':';
 						}
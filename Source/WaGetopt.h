@@ -17,7 +17,8 @@ itself an option. The call getopt(argc, argv, "a:b") parsing "-a -b"
 will return the ':' error, because "-a" expects an argument. The IRIX
 version would return "-b" as argument to "-a" option. This version
 also checks for unary negation, so "-a -5 -b" would be parsed correctly,
-i.e., -5 is the argument to "-a".
+i.e., -5 is the argument to "-a". A lone "-" is accepted as an argument,
+conventionally meaning stdin.
 
 @file WaGetopt.h
 */
@@ -21,6 +21,12 @@ At runtime, logging can be disabled by no opening log, or
 setting log level to 0. Note that the log level comparison
 happens in the WA_LOG macro, so it's pretty lightweight.
 
+Logging can optionally be asynchronous with WaLogSetAsync(). Messages are
+then formatted by the caller into a lock-free queue, and written to the
+log by a background thread, so file I/O is off the caller's path. Messages
+at the flush level are never dropped, and wait until they are written and
+flushed.
+
 Note that there is no thread synchronization, and it might not work
 as expected for DLLs or plugins where globals are shared between instances,
 but in practice it works fine, likely due to multithreaded CRT libs.
@@ -55,11 +61,17 @@ enum {
 	WA_LOG_NEWLINE = 8,		//!< output trailing newline automatically
 	WA_LOG_INITNL = 16,		//!< output leading newline before time/date
 	WA_LOG_INITSPACE = 32,	//!< output leading space
-	WA_LOG_THREADID = 64,	//!< output quasi-unique thread ID
+	WA_LOG_THREADID = 64,	//!< output thread ID
 	WA_LOG_THREADSWITCH = 128,	//!< output ! when thread switches
 	WA_LOG_STRIPCR = 256	//!< remove \r chars
 };
 
+//! Async log queue overflow policy
+enum {
+	WA_LOG_ASYNC_DROP = 0,	//!< drop message and count it
+	WA_LOG_ASYNC_BLOCK = 1	//!< wait for room in queue
+};
+
 //! Prototype logging function, to redirect logging
 typedef void WaLogFn(void *arg, int level, const char *buf);
 
@@ -98,6 +110,8 @@ int WaLogGetFlushLevel();
 void WaLogSetFlushLevel(int level);
 //! Log to specified file
 int WaLogOpen(const char *file, int append);
+//! Log to file, rotating through numGen old logs or truncating at maxSize bytes
+int WaLogOpenEx(const char *file, int append, long maxSize, int numGen);
 //! Truncate log
 int WaLogTruncate(const char *file, int maxSize);
 //! Print time and date and log level
@@ -108,8 +122,14 @@ void WaLogClose();
 void WaLogOpenStdout();
 //! Set whether to also log to debugger
 void WaLogToDebugger(int flag);
-//! Get thread ID used by logger, not unique on Posix
+//! Get thread ID used by logger, the system thread ID, cached per thread
 unsigned int WaLogGetThreadID();
+//! Enable or disable async logging, with queue length and overflow policy.
+//! The log function is then called from the writer thread. Disabling, or
+//! WaLogClose(), writes queued messages and stops the writer thread.
+int WaLogSetAsync(int enable, int queueLen, int overflow);
+//! Get number of messages dropped by async logging
+unsigned int WaLogGetDropCount();
 
 extern int gWaLogLevel;
 extern FILE *gWaLogFp;
@@ -64,6 +64,15 @@ Platform OS definitions
 #define WA_32BIT	1
 #endif
 
+/*
+Thread local storage in C.
+*/
+#if WA_WINDOWS
+#define WA_THREAD_LOCAL	__declspec(thread)
+#else
+#define WA_THREAD_LOCAL	__thread
+#endif
+
 #endif  // WA_PLATFORM_H
 
 //=============================================================================
@@ -175,25 +184,27 @@ void WaGetParsedLocalTime(WaParsedTime *pt)
 	pt->weekday = st.wDayOfWeek;
 	pt->day = st.wDay;
 #else
-	struct tm *t;
-	time_t timeval;
-	timeval = time(NULL);
-	t = localtime(&timeval);
-	pt->hour = t->tm_hour;
-	pt->min = t->tm_min;
-	pt->sec = t->tm_sec;
-	pt->msec = 0;
-	pt->year = t->tm_year + 1900;
-    pt->month = t->tm_mon + 1;
-	pt->weekday = t->tm_wday;
-	pt->day = t->tm_mday;
+	struct tm t;
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	localtime_r(&ts.tv_sec, &t);
+	pt->hour = t.tm_hour;
+	pt->min = t.tm_min;
+	pt->sec = t.tm_sec;
+	pt->msec = (int) (ts.tv_nsec / 1000000);
+	pt->year = t.tm_year + 1900;
+	pt->month = t.tm_mon + 1;
+	pt->weekday = t.tm_wday;
+	pt->day = t.tm_mday;
 #endif
 }
 
+// The strings are per thread, so threads don't overwrite each other's.
+
 // format dd-mm-yyyy
 char *WaAsciiDateEuro(WaParsedTime *pt)
 {
-	static char dateBuf[32];
+	static WA_THREAD_LOCAL char dateBuf[32];
 	sprintf(dateBuf, "%02d-%02d-%04d ", pt->day, pt->month, pt->year);
 	return dateBuf;
 }
@@ -201,14 +212,14 @@ char *WaAsciiDateEuro(WaParsedTime *pt)
 // format mm-dd-yyyy
 char *WaAsciiDate(WaParsedTime *pt)
 {
-	static char dateBuf[32];
+	static WA_THREAD_LOCAL char dateBuf[32];
 	sprintf(dateBuf, "%02d-%02d-%04d ", pt->month, pt->day, pt->year);
 	return dateBuf;
 }
 
 char *WaAsciiTime(WaParsedTime *pt)
 {
-	static char timeBuf[32];
+	static WA_THREAD_LOCAL char timeBuf[32];
 	sprintf(timeBuf, "%02d:%02d:%02d.%03d ", pt->hour, pt->min, pt->sec, pt->msec);
 	return timeBuf;
 }
@@ -222,6 +233,12 @@ char *WaAsciiTime(WaParsedTime *pt)
 #pragma warning(disable: 4706)
 #else
 #include <pthread.h>
+#include <unistd.h>
+#if WA_LINUX
+#include <sys/syscall.h>
+#elif WA_MAC
+#include <stdint.h>
+#endif
 #endif
 
 int gWaLogLevel = 3;	// current log level
@@ -230,22 +247,41 @@ int gWaLogFlags = WA_LOG_TIME | WA_LOG_SOURCE | WA_LOG_NEWLINE;	// decoration se
 WaLogFn *gWaLogFn;	// function to call to display or write log message
 void *gWaLogFnArg;	// argument to log function
 FILE *gWaLogFp;		// file pointer
-unsigned int gWaLogLastThreadID;	// last thread ID
+char gWaLogName[FILENAME_MAX];	// log file name, for rotation
+long gWaLogMaxSize;		// rotate log at this size, 0 for no limit
+int gWaLogNumGen;		// number of rotated logs to keep, 0 to truncate instead
+long gWaLogSize;		// current size of log file
 int gWaLogToDebugger;	// T/F if also send to debugger
 
+static WA_THREAD_LOCAL unsigned int tlsThreadID;	// thread ID, 0 until asked for
+
+// Serializes writes to the log file with rotation, which closes and reopens
+// it. Without async logging, any thread can cross gWaLogMaxSize.
+#if WA_WINDOWS
+static SRWLOCK gWaLogFileLock = SRWLOCK_INIT;
+#define WaLogLockFile()		AcquireSRWLockExclusive(&gWaLogFileLock)
+#define WaLogUnlockFile()	ReleaseSRWLockExclusive(&gWaLogFileLock)
+#else
+static pthread_mutex_t gWaLogFileLock = PTHREAD_MUTEX_INITIALIZER;
+#define WaLogLockFile()		pthread_mutex_lock(&gWaLogFileLock)
+#define WaLogUnlockFile()	pthread_mutex_unlock(&gWaLogFileLock)
+#endif
+
+// the system's numeric thread ID, as debuggers and tools show it
 unsigned int WaLogGetThreadID()
 {
+	if (tlsThreadID == 0) {
 #if WA_WINDOWS
-	return GetCurrentThreadId();
-#else
-    pthread_t ptid = pthread_self();
-    unsigned int threadId = 0;
-	unsigned int *p = (unsigned int *) &ptid;
-	// compute a simple hash
-	for (int i = 0; i < sizeof(ptid) / sizeof(unsigned int); i++)
-		threadId |= p[i];
-	return threadId;
+		tlsThreadID = GetCurrentThreadId();
+#elif WA_LINUX
+		tlsThreadID = (unsigned int) syscall(SYS_gettid);
+#elif WA_MAC
+		uint64_t tid = 0;
+		pthread_threadid_np(NULL, &tid);
+		tlsThreadID = (unsigned int) tid;
 #endif
+	}
+	return tlsThreadID;
 }
 
 void WaLogSetDecor(int flags)
@@ -258,6 +294,8 @@ int WaLogGetDecor()
 	return gWaLogFlags;
 }
 
+static void WaLogRotate();
+
 /*
  This is the default log handler.
  */
@@ -265,7 +303,42 @@ void WaLogToFileFn(void *arg, int level, const char *buf)
 {
     WA_UNUSED(level);
     FILE *fp = (FILE *) arg;
-    fputs(buf, fp);
+	long len;
+#if WA_WINDOWS
+	const char *s;
+#endif
+
+	if (gWaLogMaxSize <= 0) {
+		fputs(buf, fp);
+		return;
+	}
+	WaLogLockFile();
+	// arg may be the file another thread's rotation just closed
+	fp = gWaLogFp;
+	if (fp != NULL) {
+		fputs(buf, fp);
+		len = (long) strlen(buf);
+#if WA_WINDOWS
+		// text mode writes each \n as \r\n
+		for (s = buf; (s = strchr(s, '\n')) != NULL; s++)
+			len++;
+#endif
+		gWaLogSize += len;
+		if (gWaLogSize >= gWaLogMaxSize)
+			WaLogRotate();
+	}
+	WaLogUnlockFile();
+}
+
+// flush the log file, if logging to one
+static void WaLogFlushFile()
+{
+	if (gWaLogFn != WaLogToFileFn)
+		return;
+	WaLogLockFile();
+	if (gWaLogFp)
+		fflush(gWaLogFp);
+	WaLogUnlockFile();
 }
 
 void WaLogSetLogFn(WaLogFn *fn, void *arg)
@@ -283,16 +356,247 @@ void WaLogMessageToDebugger(const char *buf)
 #endif
 }
 
-static void WaLogMessageInternal(int level, const char *buf)
+// pass message to log function and debugger
+static void WaLogDispatch(int level, const char *buf)
 {
 	if (gWaLogFn)
 		gWaLogFn(gWaLogFnArg, level, buf);
 	if (gWaLogToDebugger)
 		WaLogMessageToDebugger(buf);
+}
+
+//=============================================================================
+//
+// Asynchronous logging
+//
+// Producers copy formatted messages into a bounded lock-free queue, and a
+// writer thread drains the queue to the log function in batches, flushing
+// the log file once per batch. The queue is the bounded MPMC queue by
+// Dmitry Vyukov, used here with a single consumer: each slot has a sequence
+// number that says whether it is free for the producer at a position, or
+// full for the consumer.
+//
+// Producers count themselves in flight around the check of running and the
+// enqueue, so stopping can wait for them before the last drain and free: a
+// producer either sees running cleared and writes directly, or is waited
+// for, and its message published. A message at the flush level waits for
+// the writer to write and flush it, so it's on disk before a crash.
+//
+
+#if WA_WINDOWS
+typedef volatile LONG WaAtomic;
+#define WaAtomicLoad(p)				InterlockedCompareExchange((p), 0, 0)
+#define WaAtomicStore(p, v)			InterlockedExchange((p), (v))
+#define WaAtomicCAS(p, old, val)	(InterlockedCompareExchange((p), (val), (old)) == (old))
+#define WaAtomicInc(p)				InterlockedIncrement(p)
+#define WaAtomicDec(p)				InterlockedDecrement(p)
+#define WaLogSleepMsec(ms)			Sleep(ms)
+#else
+typedef volatile long WaAtomic;
+#define WaAtomicLoad(p)				__atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define WaAtomicStore(p, v)			__atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define WaAtomicCAS(p, old, val)	__sync_bool_compare_and_swap((p), (old), (val))
+#define WaAtomicInc(p)				__sync_add_and_fetch((p), 1)
+#define WaAtomicDec(p)				__sync_sub_and_fetch((p), 1)
+#define WaLogSleepMsec(ms)			usleep((ms) * 1000)
+#endif
+
+// maximum length of a log message
+#define WA_LOG_LEN	1024
+
+// idle time of writer thread between polls of an empty queue
+#define WA_LOG_ASYNC_IDLE_MSEC	2
+
+typedef struct {
+	WaAtomic seq;			// sequence number
+	int level;
+	char buf[WA_LOG_LEN + 1];
+} WaLogSlot;
+
+typedef struct {
+	WaLogSlot *slots;
+	long mask;				// number of slots - 1
+	WaAtomic enqPos;		// next producer position
+	long deqPos;			// next consumer position, only writer thread
+	WaAtomic flushedPos;	// positions before this are written and flushed
+	WaAtomic dropCount;		// messages dropped when full
+	int overflow;			// WA_LOG_ASYNC_DROP or WA_LOG_ASYNC_BLOCK
+	WaAtomic stop;			// T/F to stop writer thread
+	WaAtomic running;		// T/F if messages go to queue
+	WaAtomic inFlight;		// producers that may be enqueueing
+#if WA_WINDOWS
+	HANDLE thread;
+#else
+	pthread_t thread;
+#endif
+} WaLogQueue;
+
+static WaLogQueue gWaLogQueue;
+static WA_THREAD_LOCAL int tlsIsWriter;	// T/F on the writer thread
+
+// add message to queue, returns FALSE if dropped, and the position in *pPos
+static int WaLogEnqueue(int level, const char *buf, int block, long *pPos)
+{
+	WaLogQueue *q = &gWaLogQueue;
+	WaLogSlot *slot;
+	long pos, diff;
+
+	for (;;) {
+		pos = WaAtomicLoad(&q->enqPos);
+		slot = &q->slots[pos & q->mask];
+		diff = (long) ((unsigned long) WaAtomicLoad(&slot->seq) - (unsigned long) pos);
+		if (diff == 0) {
+			// slot free, claim it
+			if (WaAtomicCAS(&q->enqPos, pos, pos + 1))
+				break;
+		}
+		else if (diff < 0) {
+			// queue full
+			if (q->overflow == WA_LOG_ASYNC_DROP && !block) {
+				WaAtomicInc(&q->dropCount);
+				return FALSE;
+			}
+			WaLogSleepMsec(1);
+		}
+		// otherwise another producer claimed the slot, try again
+	}
+	slot->level = level;
+	strncpy(slot->buf, buf, WA_LOG_LEN);
+	slot->buf[WA_LOG_LEN] = 0;
+	// publish to consumer
+	WaAtomicStore(&slot->seq, pos + 1);
+	*pPos = pos;
+	return TRUE;
+}
+
+// write all queued messages, returns number written
+static int WaLogDrain()
+{
+	WaLogQueue *q = &gWaLogQueue;
+	WaLogSlot *slot;
+	long diff;
+	int n = 0;
+
+	for (;;) {
+		slot = &q->slots[q->deqPos & q->mask];
+		diff = (long) ((unsigned long) WaAtomicLoad(&slot->seq) - (unsigned long) (q->deqPos + 1));
+		if (diff != 0)
+			break;
+		WaLogDispatch(slot->level, slot->buf);
+		// release slot to producers
+		WaAtomicStore(&slot->seq, q->deqPos + q->mask + 1);
+		q->deqPos++;
+		n++;
+	}
+	if (n > 0)
+		WaLogFlushFile();
+	if (n > 0)
+		WaAtomicStore(&q->flushedPos, q->deqPos);
+	return n;
+}
+
+#if WA_WINDOWS
+static DWORD WINAPI WaLogWriterThread(LPVOID arg)
+#else
+static void *WaLogWriterThread(void *arg)
+#endif
+{
+	WA_UNUSED(arg);
+	tlsIsWriter = TRUE;
+	while (!WaAtomicLoad(&gWaLogQueue.stop)) {
+		if (WaLogDrain() == 0)
+			WaLogSleepMsec(WA_LOG_ASYNC_IDLE_MSEC);
+	}
+	// final drain, no producers are left
+	WaLogDrain();
+	return 0;
+}
+
+int WaLogSetAsync(int enable, int queueLen, int overflow)
+{
+	WaLogQueue *q = &gWaLogQueue;
+	long i, n;
+
+	if (enable && !q->running) {
+		// round queue length up to power of 2
+		for (n = 16; n < queueLen; n *= 2)
+			;
+		q->slots = (WaLogSlot *) malloc(n * sizeof(WaLogSlot));
+		if (!q->slots)
+			return FALSE;
+		for (i = 0; i < n; i++)
+			q->slots[i].seq = i;
+		q->mask = n - 1;
+		q->enqPos = 0;
+		q->deqPos = 0;
+		q->flushedPos = 0;
+		q->dropCount = 0;
+		q->overflow = overflow;
+		q->stop = FALSE;
+#if WA_WINDOWS
+		q->thread = CreateThread(NULL, 0, WaLogWriterThread, NULL, 0, NULL);
+		if (q->thread == NULL) {
+#else
+		if (pthread_create(&q->thread, NULL, WaLogWriterThread, NULL) != 0) {
+#endif
+			free(q->slots);
+			q->slots = NULL;
+			return FALSE;
+		}
+		WaAtomicStore(&q->running, TRUE);
+	}
+	else if (!enable && q->running) {
+		// new messages go direct, and once the producers in flight have
+		// published, the writer drains the queue and exits
+		WaAtomicStore(&q->running, FALSE);
+		while (WaAtomicLoad(&q->inFlight) != 0)
+			WaLogSleepMsec(0);
+		WaAtomicStore(&q->stop, TRUE);
+#if WA_WINDOWS
+		WaitForSingleObject(q->thread, INFINITE);
+		CloseHandle(q->thread);
+#else
+		pthread_join(q->thread, NULL);
+#endif
+		free(q->slots);
+		q->slots = NULL;
+	}
+	return TRUE;
+}
+
+unsigned int WaLogGetDropCount()
+{
+	return (unsigned int) gWaLogQueue.dropCount;
+}
+
+//
+// Messages from the writer thread, from a log function that logs, go
+// directly, as the writer can't wait for itself.
+//
+static void WaLogMessageInternal(int level, const char *buf)
+{
+	WaLogQueue *q = &gWaLogQueue;
+	int flush = level <= gWaLogFlushLevel;
+	long pos;
+
+	if (!tlsIsWriter && WaAtomicLoad(&q->running)) {
+		WaAtomicInc(&q->inFlight);
+		if (WaAtomicLoad(&q->running)) {
+			if (WaLogEnqueue(level, buf, flush, &pos) && flush) {
+				// wait for the writer to write and flush it
+				while ((long) ((unsigned long) WaAtomicLoad(&q->flushedPos) - (unsigned long) pos) <= 0)
+					WaLogSleepMsec(1);
+			}
+			WaAtomicDec(&q->inFlight);
+			return;
+		}
+		WaAtomicDec(&q->inFlight);
+	}
+	WaLogDispatch(level, buf);
 	// For critical errors, when using stdio, flush output before we crash.
     // This only works if using the built-in WaLogToFileFn.
-	if (level <= gWaLogFlushLevel && gWaLogFn == WaLogToFileFn && gWaLogFp)
-		fflush(gWaLogFp);
+	if (level <= gWaLogFlushLevel)
+		WaLogFlushFile();
 }
 
 // external entry point, must check level
@@ -303,6 +607,137 @@ void WaLogMessage(int level, const char *buf)
 	}
 }
 
+//=============================================================================
+//
+// Time stamp
+//
+// The date and time prefix of a message is kept rendered per thread. Each
+// message reads the clock, which is cheap, and copies the prefix. Only the
+// fields that changed are rendered again: the msec digits when the msec
+// ticks, and the time, and the date if it changed, from a local time
+// breakdown when the second ticks.
+//
+
+// "mm-dd-yyyy " then "hh:mm:ss.mmm ", as from WaAsciiDate and WaAsciiTime
+#define WA_LOG_DATE_LEN	11
+#define WA_LOG_TIME_LEN	13
+
+typedef struct {
+	long long sec;			// second rendered, -1 if none
+	int msec;				// msec rendered
+	int date;				// date rendered, yyyymmdd
+	char buf[WA_LOG_DATE_LEN + WA_LOG_TIME_LEN];
+} WaLogStamp;
+
+static WA_THREAD_LOCAL WaLogStamp tlsStamp = { -1, -1, -1 };
+
+#if WA_WINDOWS
+#define WA_FILETIME_1970	11644473600LL	// seconds from 1601 to 1970
+#endif
+
+// current time as seconds since 1970 and msec
+static void WaLogGetClock(long long *pSec, int *pMsec)
+{
+#if WA_WINDOWS
+	FILETIME ft;
+	ULARGE_INTEGER t;
+	long long msec;
+	GetSystemTimeAsFileTime(&ft);
+	t.LowPart = ft.dwLowDateTime;
+	t.HighPart = ft.dwHighDateTime;
+	// 100 nsec units since 1601
+	msec = (long long) (t.QuadPart / 10000) - WA_FILETIME_1970 * 1000;
+	*pSec = msec / 1000;
+	*pMsec = (int) (msec % 1000);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	*pSec = ts.tv_sec;
+	*pMsec = (int) (ts.tv_nsec / 1000000);
+#endif
+}
+
+// local time of a second from WaLogGetClock, msec not set
+static void WaLogLocalTime(long long sec, WaParsedTime *pt)
+{
+#if WA_WINDOWS
+	FILETIME ft, localFt;
+	ULARGE_INTEGER t;
+	SYSTEMTIME st;
+	t.QuadPart = (ULONGLONG) (sec + WA_FILETIME_1970) * 10000000;
+	ft.dwLowDateTime = t.LowPart;
+	ft.dwHighDateTime = t.HighPart;
+	FileTimeToLocalFileTime(&ft, &localFt);
+	FileTimeToSystemTime(&localFt, &st);
+	pt->hour = st.wHour;
+	pt->min = st.wMinute;
+	pt->sec = st.wSecond;
+	pt->year = st.wYear;
+	pt->month = st.wMonth;
+	pt->day = st.wDay;
+#else
+	struct tm t;
+	time_t timeval = (time_t) sec;
+	localtime_r(&timeval, &t);
+	pt->hour = t.tm_hour;
+	pt->min = t.tm_min;
+	pt->sec = t.tm_sec;
+	pt->year = t.tm_year + 1900;
+	pt->month = t.tm_mon + 1;
+	pt->day = t.tm_mday;
+#endif
+}
+
+// write v as n decimal digits
+static void WaLogPutDigits(char *p, int v, int n)
+{
+	while (n-- > 0) {
+		p[n] = (char) ('0' + v % 10);
+		v /= 10;
+	}
+}
+
+// get the prefix of this thread for the current msec, not terminated
+static const char *WaLogGetStamp()
+{
+	WaLogStamp *ps = &tlsStamp;
+	WaParsedTime pt;
+	long long sec;
+	int msec, date;
+	char *p;
+
+	WaLogGetClock(&sec, &msec);
+	if (sec != ps->sec) {
+		WaLogLocalTime(sec, &pt);
+		date = pt.year * 10000 + pt.month * 100 + pt.day;
+		if (date != ps->date) {
+			p = ps->buf;
+			WaLogPutDigits(p, pt.month, 2);
+			p[2] = '-';
+			WaLogPutDigits(p + 3, pt.day, 2);
+			p[5] = '-';
+			WaLogPutDigits(p + 6, pt.year, 4);
+			p[10] = ' ';
+			ps->date = date;
+		}
+		p = ps->buf + WA_LOG_DATE_LEN;
+		WaLogPutDigits(p, pt.hour, 2);
+		p[2] = ':';
+		WaLogPutDigits(p + 3, pt.min, 2);
+		p[5] = ':';
+		WaLogPutDigits(p + 6, pt.sec, 2);
+		p[8] = '.';
+		p[12] = ' ';
+		ps->sec = sec;
+		ps->msec = -1;
+	}
+	if (msec != ps->msec) {
+		WaLogPutDigits(ps->buf + WA_LOG_DATE_LEN + 9, msec, 3);
+		ps->msec = msec;
+	}
+	return ps->buf;
+}
+
 static void removeChar(char *str, int c)
 {
 	char *s1, *s2;
@@ -311,16 +746,13 @@ static void removeChar(char *str, int c)
 		if (*str != c) str++;
 }
 
-// maximum length of a log message
-#define WA_LOG_LEN	1024
+static WaAtomic gWaLogLastThreadID;	// thread of the last message, for WA_LOG_THREADSWITCH
 
 void WaLog(const char *source, int level, const char *fmt, va_list args)
 {
 	char buf[WA_LOG_LEN + 1];
-	size_t i, n, len;
+	size_t i, n, len, off;
 	int vn;
-	const char *s;
-	WaParsedTime pt;
 	unsigned int threadID;
 
 	// skip if nothing set up to receive log messages
@@ -343,21 +775,12 @@ void WaLog(const char *source, int level, const char *fmt, va_list args)
 		len--;
 	}
 
-	// get date/time if needed
-	if (gWaLogFlags & (WA_LOG_DATE | WA_LOG_TIME))
-		WaGetParsedLocalTime(&pt);
-
-	if (gWaLogFlags & WA_LOG_DATE) {
-		s = WaAsciiDate(&pt);
-		strncpy(buf + i, s, len);
-		n = MIN(len, strlen(s));
-		i += n;
-		len -= n;
-	}
-	if (gWaLogFlags & WA_LOG_TIME) {
-		s = WaAsciiTime(&pt);
-		strncpy(buf + i, s, len);
-		n = MIN(len, strlen(s));
+	// date and time, one copy of the cached prefix
+	if (gWaLogFlags & (WA_LOG_DATE | WA_LOG_TIME)) {
+		off = (gWaLogFlags & WA_LOG_DATE) ? 0 : WA_LOG_DATE_LEN;
+		n = ((gWaLogFlags & WA_LOG_TIME) ? WA_LOG_DATE_LEN + WA_LOG_TIME_LEN : WA_LOG_DATE_LEN) - off;
+		n = MIN(len, n);
+		memcpy(buf + i, WaLogGetStamp() + off, n);
 		i += n;
 		len -= n;
 	}
@@ -368,9 +791,11 @@ void WaLog(const char *source, int level, const char *fmt, va_list args)
 	}
 	if (gWaLogFlags & WA_LOG_THREADSWITCH) {
 		if (len > 0) {
-			buf[i++] = (threadID == gWaLogLastThreadID) ? ' ' : '!';
+			buf[i++] = (threadID == (unsigned int) WaAtomicLoad(&gWaLogLastThreadID)) ? ' ' : '!';
 			len--;
 		}
+		// only written when shown, so threads don't contend for it otherwise
+		WaAtomicStore(&gWaLogLastThreadID, (long) threadID);
 	}
 	if (gWaLogFlags & WA_LOG_SOURCE) {
 		strncpy(buf + i, source, len);
@@ -382,7 +807,6 @@ void WaLog(const char *source, int level, const char *fmt, va_list args)
 			len--;
 		}
 	}
-	gWaLogLastThreadID = threadID;
 	// sprintf message
 	vn = vsnprintf(buf + i, len, fmt, args);
 	if (vn >= 0 && vn < (int) len) {
@@ -467,63 +891,147 @@ void WaLog5(const char *source, const char *fmt, ...)
 
 int WaLogOpen(const char *file, int append)
 {
+	return WaLogOpenEx(file, append, 0, 0);
+}
+
+// get size of file in bytes, or -1 if can't open
+static long WaLogFileSize(const char *file)
+{
+	FILE *fp;
+	long len = -1;
+
+	// binary mode so size is in bytes, no newline translation
+	if ((fp = fopen(file, "rb")) == NULL)
+		return -1;
+	if (fseek(fp, 0, SEEK_END) == 0)
+		len = ftell(fp);
+	fclose(fp);
+	return len;
+}
+
+// shift file to file.1, file.1 to file.2, etc., dropping file.numGen
+static void WaLogShiftFiles(const char *file, int numGen)
+{
+	char from[FILENAME_MAX + 16];
+	char to[FILENAME_MAX + 16];
+	int i;
+
+	snprintf(to, sizeof(to), "%s.%d", file, numGen);
+	remove(to);
+	for (i = numGen - 1; i >= 1; i--) {
+		snprintf(from, sizeof(from), "%s.%d", file, i);
+		snprintf(to, sizeof(to), "%s.%d", file, i + 1);
+		rename(from, to);
+	}
+	snprintf(to, sizeof(to), "%s.1", file);
+	rename(file, to);
+}
+
+// limit size of log file, either rotating or truncating
+static void WaLogLimit(const char *file)
+{
+	if (gWaLogNumGen > 0)
+		WaLogShiftFiles(file, gWaLogNumGen);
+	else
+		WaLogTruncate(file, gWaLogMaxSize);
+}
+
+/*
+ Called by log handler, holding the file lock, when log file reaches maximum
+ size. Only gWaLogFp changes, as other threads read gWaLogFn and gWaLogFnArg
+ without the lock. If the log can't be reopened, the handler drops messages.
+ */
+static void WaLogRotate()
+{
+	fclose(gWaLogFp);
+	WaLogLimit(gWaLogName);
+	gWaLogFp = fopen(gWaLogName, "a");
+	gWaLogSize = WaLogFileSize(gWaLogName);
+}
+
+/*
+ Open log file with size limit maxSize bytes, 0 for no limit. When the log
+ reaches maxSize, it is renamed file.1, with older logs renamed file.2 and
+ so on up to file.numGen. If numGen is 0, the log is truncated to its last
+ maxSize/2 bytes instead. The limit is also applied when opening.
+ */
+int WaLogOpenEx(const char *file, int append, long maxSize, int numGen)
+{
+	gWaLogMaxSize = maxSize;
+	gWaLogNumGen = numGen;
+	gWaLogSize = 0;
+	if (maxSize > 0) {
+		strncpy(gWaLogName, file, sizeof(gWaLogName) - 1);
+		if (append && WaLogFileSize(file) >= maxSize)
+			WaLogLimit(file);
+	}
 	gWaLogFp = fopen(file, append ? "a" : "w");
 	if (gWaLogFp != NULL) {
+		if (append && maxSize > 0)
+			gWaLogSize = WaLogFileSize(file);
 		WaLogSetLogFn(WaLogToFileFn, gWaLogFp);
 		return TRUE;
 	}
 	return FALSE;
 }
 
+/*
+ If file is larger than maxSize, keep the last maxSize/2 bytes, starting
+ at a line boundary. The tail is copied through a fixed buffer to a temp
+ file which replaces the log, so time and memory don't depend on the size
+ of the log.
+ */
 int WaLogTruncate(const char *file, int maxSize)
 {
 	FILE *fp;
-	size_t len;
-	char *p;
-	char *s;
+	FILE *tmp;
+	long len;
+	char tmpName[FILENAME_MAX + 8];
+	char buf[8192];
 	size_t nr;
+	int c;
+	int ok = TRUE;
 
-	// first get size of file, can't use fseek because of newline translation
-	if ((fp = fopen(file, "r")) == NULL)
+	len = WaLogFileSize(file);
+	if (len < 0)
 		return FALSE;
-	len = 0;
-	while (fgetc(fp) != EOF)
-		len++;
-	fseek(fp, 0, SEEK_SET);
-	if (len <= (size_t) maxSize) {
+	if (len <= (long) maxSize) {
 		// no need to truncate
-		fclose(fp);
 		return TRUE;
 	}
-	// read contents into memory - it would be better to use temp file.
-	p = (char *) malloc(len);
-	nr = fread(p, sizeof(char), len, fp);
-	if (nr != len) {
-		fclose(fp);
-		free(p);
+	if ((fp = fopen(file, "rb")) == NULL)
 		return FALSE;
-	}
-	fclose(fp);
-	// re-create file
-	if ((fp = fopen(file, "w")) == NULL) {
-		free(p);
+	snprintf(tmpName, sizeof(tmpName), "%s.tmp", file);
+	if ((tmp = fopen(tmpName, "wb")) == NULL) {
+		fclose(fp);
 		return FALSE;
 	}
-	// truncate to maxSize/2 to prevent truncation each time
-	s = p + len - maxSize / 2;
+	// truncate to maxSize/2 to prevent truncation each time,
 	// advance to newline
-	while (s < p + len) {
-		if (*s == '\n') {
-			s++;
+	fseek(fp, len - maxSize / 2, SEEK_SET);
+	while ((c = fgetc(fp)) != EOF && c != '\n')
+		;
+#if WA_WINDOWS
+	fputs("truncated...\r\n", tmp);
+#else
+	fputs("truncated...\n", tmp);
+#endif
+	// now copy the rest of the file
+	while ((nr = fread(buf, sizeof(char), sizeof(buf), fp)) > 0) {
+		if (fwrite(buf, sizeof(char), nr, tmp) != nr) {
+			ok = FALSE;
 			break;
 		}
-		s++;
 	}
-	fprintf(fp, "truncated...\n");
-	// now write the end of buffer back to file
-	fwrite(s, sizeof(char), p + len - s, fp);
 	fclose(fp);
-	free(p);
+	if (fclose(tmp) != 0)
+		ok = FALSE;
+	// replace log with temp file, remove first since Windows won't
+	// rename over an existing file
+	if (!ok || remove(file) != 0 || rename(tmpName, file) != 0) {
+		remove(tmpName);
+		return FALSE;
+	}
 	return TRUE;
 }
 
@@ -537,12 +1045,15 @@ void WaLogPrintHeader()
 
 void WaLogOpenStdout()
 {
+	gWaLogMaxSize = 0;
 	gWaLogFp = stdout;
 	WaLogSetLogFn(WaLogToFileFn, gWaLogFp);
 }
 
 void WaLogClose()
 {
+	// write out queued messages
+	WaLogSetAsync(FALSE, 0, 0);
 	if (gWaLogFp) {
 		if (gWaLogFp != stdout)
 			fclose(gWaLogFp);
@@ -0,0 +1,324 @@
+//
+// Audio device backend base class and backend factory.
+//
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "WadBackend.h"
+#include "MiscDef.h"
+#include "SimBackend.h"
+#if WAD_HAVE_WASAPI
+#include "WasapiBackend.h"
+#endif
+#if WAD_HAVE_PULSE
+#include "PulseBackend.h"
+#endif
+
+THREAD_LOCAL char WadBackend::errorText[256];
+
+WadBackend::WadBackend()
+{
+	stats = NULL;
+}
+
+WadBackend::~WadBackend()
+{
+}
+
+void WadBackend::SetErrorText(const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(errorText, sizeof(errorText), fmt, args);
+	va_end(args);
+}
+
+const char *WadBackend::GetErrorText()
+{
+	return errorText;
+}
+
+void WadBackend::SetStats(WadStats *stats)
+{
+	this->stats = stats;
+}
+
+int WadBackend::ThreadInit()
+{
+	return WAD_OK;
+}
+
+void WadBackend::ThreadExit()
+{
+}
+
+static void CountFn(void *arg, const char *devId, const char *name)
+{
+	UNUSED(devId);
+	UNUSED(name);
+	(*(int *) arg)++;
+}
+
+int WadBackend::CountDevices(bool isInput, int *pCount)
+{
+	*pCount = 0;
+	return EnumDevices(isInput, false, CountFn, pCount);
+}
+
+int WadBackend::GetChannelCount(WadHandle hDev, int *pNum)
+{
+	UNUSED(hDev);
+	UNUSED(pNum);
+	SetErrorText("%s: channel volumes not supported", GetName());
+	return WAD_ERR_UNSUPPORTED;
+}
+
+int WadBackend::GetChannelVols(WadHandle hDev, float *vols, int *pNum)
+{
+	UNUSED(hDev);
+	UNUSED(vols);
+	UNUSED(pNum);
+	SetErrorText("%s: channel volumes not supported", GetName());
+	return WAD_ERR_UNSUPPORTED;
+}
+
+int WadBackend::SetChannelVols(WadHandle hDev, const float *vols, int num)
+{
+	UNUSED(hDev);
+	UNUSED(vols);
+	UNUSED(num);
+	SetErrorText("%s: channel volumes not supported", GetName());
+	return WAD_ERR_UNSUPPORTED;
+}
+
+int WadBackend::GetChannelSides(const char *devId, unsigned char *sides, int *pNum)
+{
+	UNUSED(devId);
+	UNUSED(sides);
+	UNUSED(pNum);
+	SetErrorText("%s: channel layout not known", GetName());
+	return WAD_ERR_UNSUPPORTED;
+}
+
+int WadBackend::GetVolRange(WadHandle hDev, float *pMinDb, float *pMaxDb, float *pStepDb)
+{
+	UNUSED(hDev);
+	UNUSED(pMinDb);
+	UNUSED(pMaxDb);
+	UNUSED(pStepDb);
+	SetErrorText("%s: volume in dB not supported", GetName());
+	return WAD_ERR_UNSUPPORTED;
+}
+
+int WadBackend::GetVolDb(WadHandle hDev, float *pDb)
+{
+	UNUSED(hDev);
+	UNUSED(pDb);
+	SetErrorText("%s: volume in dB not supported", GetName());
+	return WAD_ERR_UNSUPPORTED;
+}
+
+int WadBackend::SetVolDb(WadHandle hDev, float db)
+{
+	UNUSED(hDev);
+	UNUSED(db);
+	SetErrorText("%s: volume in dB not supported", GetName());
+	return WAD_ERR_UNSUPPORTED;
+}
+
+int WadBackend::OpenMeter(const char *devId, WadHandle *phMeter)
+{
+	UNUSED(devId);
+	UNUSED(phMeter);
+	SetErrorText("%s: peak meters not supported", GetName());
+	return WAD_ERR_UNSUPPORTED;
+}
+
+void WadBackend::CloseMeter(WadHandle hMeter)
+{
+	UNUSED(hMeter);
+}
+
+// only reached with a handle from OpenMeter, so never without support
+int WadBackend::GetPeaks(WadHandle hMeter, float *pPeak, float *chanPeaks, int *pNum)
+{
+	UNUSED(hMeter);
+	UNUSED(pPeak);
+	UNUSED(chanPeaks);
+	UNUSED(pNum);
+	return WAD_ERR_UNSUPPORTED;
+}
+
+int WadBackend::SetListener(WadBackendListener *listener)
+{
+	UNUSED(listener);
+	SetErrorText("%s: device notifications not supported", GetName());
+	return WAD_ERR_UNSUPPORTED;
+}
+
+int WadBackend::Watch(const char *devId, int devIndex, WadVolChangeFn *fn, void *arg, WadHandle *phWatch)
+{
+	UNUSED(devId);
+	UNUSED(devIndex);
+	UNUSED(fn);
+	UNUSED(arg);
+	UNUSED(phWatch);
+	SetErrorText("%s: volume notifications not supported", GetName());
+	return WAD_ERR_UNSUPPORTED;
+}
+
+void WadBackend::Unwatch(WadHandle hWatch)
+{
+	UNUSED(hWatch);
+}
+
+int WadBackend::EnumSessions(const char *devId, WadSessionEnumFn *fn, void *arg)
+{
+	UNUSED(devId);
+	UNUSED(fn);
+	UNUSED(arg);
+	SetErrorText("%s: sessions not supported", GetName());
+	return WAD_ERR_UNSUPPORTED;
+}
+
+int WadBackend::WatchSessions(const char *devId, WadHandle *phWatch)
+{
+	UNUSED(devId);
+	UNUSED(phWatch);
+	SetErrorText("%s: session notifications not supported", GetName());
+	return WAD_ERR_UNSUPPORTED;
+}
+
+void WadBackend::UnwatchSessions(WadHandle hWatch)
+{
+	UNUSED(hWatch);
+}
+
+int WadBackend::OpenSession(const char *devId, const char *sessionId, WadHandle *phSes)
+{
+	UNUSED(devId);
+	UNUSED(sessionId);
+	UNUSED(phSes);
+	SetErrorText("%s: sessions not supported", GetName());
+	return WAD_ERR_UNSUPPORTED;
+}
+
+void WadBackend::CloseSession(WadHandle hSes)
+{
+	UNUSED(hSes);
+}
+
+// only reached with a handle from OpenSession, so never without support
+int WadBackend::GetSessionVol(WadHandle hSes, float *pVol)
+{
+	UNUSED(hSes);
+	UNUSED(pVol);
+	return WAD_ERR_UNSUPPORTED;
+}
+
+int WadBackend::SetSessionVol(WadHandle hSes, float vol)
+{
+	UNUSED(hSes);
+	UNUSED(vol);
+	return WAD_ERR_UNSUPPORTED;
+}
+
+int WadBackend::GetSessionMute(WadHandle hSes, bool *pMute)
+{
+	UNUSED(hSes);
+	UNUSED(pMute);
+	return WAD_ERR_UNSUPPORTED;
+}
+
+int WadBackend::SetSessionMute(WadHandle hSes, bool mute)
+{
+	UNUSED(hSes);
+	UNUSED(mute);
+	return WAD_ERR_UNSUPPORTED;
+}
+
+//
+// The simulated backend is never the default, so a build without a real
+// backend doesn't pretend to control devices.
+//
+WadBackend *WadCreateBackend(const char *name)
+{
+#if WAD_HAVE_WASAPI
+	if (name == NULL || !strcmp(name, "wasapi"))
+		return new WasapiBackend();
+#endif
+#if WAD_HAVE_PULSE
+	if (name == NULL || !strcmp(name, "pulse"))
+		return new PulseBackend();
+#endif
+	if (name != NULL && !strcmp(name, "sim"))
+		return new SimBackend();
+	return NULL;
+}
+
+const char *WadBackendNames()
+{
+	return
+#if WAD_HAVE_WASAPI
+		"wasapi "
+#endif
+#if WAD_HAVE_PULSE
+		"pulse "
+#endif
+		"sim";
+}
+
+void WadCopyUtf8(char *dst, const char *src, size_t len)
+{
+	size_t n;
+
+	if (len == 0)
+		return;
+	n = strlen(src);
+	if (n >= len) {
+		// back up over continuation bytes to the start of a character
+		for (n = len - 1; n > 0 && ((unsigned char) src[n] & 0xc0) == 0x80; n--)
+			;
+	}
+	memcpy(dst, src, n);
+	dst[n] = 0;
+}
+
+//
+// Speaker bits of a WAVEFORMATEXTENSIBLE channel mask, in channel order.
+// The left and right masks hold the front, back, front of center, side,
+// top front and top back speakers of each side.
+//
+#define SPEAKERS_LEFT	0x9251ul
+#define SPEAKERS_RIGHT	0x244a2ul
+#define SPEAKER_BITS	18
+
+unsigned long WadDefaultSpeakerMask(int num)
+{
+	// mono, stereo, 2.1, quad, 5.0, 5.1, 6.1, 7.1
+	static const unsigned long masks[] = {
+		0x4, 0x3, 0xb, 0x33, 0x37, 0x3f, 0x13f, 0x63f
+	};
+	if (num <= 0)
+		return 0;
+	return num <= (int) NELEMS(masks) ? masks[num - 1] : 0x63f;
+}
+
+void WadMaskToSides(unsigned long mask, unsigned char *sides, int num)
+{
+	int i, bit = 0;
+
+	for (i = 0; i < num; i++) {
+		while (bit < SPEAKER_BITS && !(mask & (1ul << bit)))
+			bit++;
+		if (bit >= SPEAKER_BITS)
+			sides[i] = WAD_SIDE_CENTER;
+		else if (SPEAKERS_LEFT & (1ul << bit))
+			sides[i] = WAD_SIDE_LEFT;
+		else if (SPEAKERS_RIGHT & (1ul << bit))
+			sides[i] = WAD_SIDE_RIGHT;
+		else
+			sides[i] = WAD_SIDE_CENTER;
+		bit++;
+	}
+}
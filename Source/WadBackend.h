@@ -0,0 +1,202 @@
+/** Audio device backend interface
+
+VolCtl keeps the device table, lookup and error handling, and calls a
+backend for everything that talks to the audio system. Backends identify
+devices by ID string and hand out opaque device handles for volume access.
+
+Backend calls come from several threads at once: callers of VolCtl get
+and set volume and mute concurrently, also on the same handle, the worker
+pool does so on handles of its own, and the meter thread reads peak meters
+alongside. Other calls, which change the device table or read and write
+channels, are serialized by VolCtl. Threads VolCtl starts call
+ThreadInit() before using the backend. Listener and watch callbacks may
+arrive on any thread. The error text is per thread, so it belongs to the
+last call that failed on the calling thread.
+
+@file WadBackend.h
+*/
+#ifndef _WAD_BACKEND_H
+#define _WAD_BACKEND_H
+
+#include <stddef.h>
+#include "MiscDef.h"
+#include "WadStats.h"
+#include "WadGain.h"
+
+#ifdef _WIN32
+#define WAD_HAVE_WASAPI	1
+#endif
+// WAD_HAVE_PULSE is set by the build when libpulse is available
+
+enum WadStatus {
+	WAD_OK = 0,					//!< success
+	WAD_ERR_INTERNAL,			//!< internal error, see errorText
+	WAD_ERR_UNSUPPORTED,		//!< unsupported feature
+	WAD_ERR_INVALID_ARG,		//!< invalid argument
+	WAD_ERR_NOT_INITIALIZED,	//!< device not initialized
+	WAD_ERR_NOT_OPEN,			//!< device not open
+	WAD_ERR_INVALID_DEVICE,		//!< invalid device
+	// Use GetClosestFormat() to return suggestions for unsupported formats
+	WAD_ERR_IN_FORMAT,			//!< unsupported input format
+	WAD_ERR_OUT_FORMAT,			//!< unsupported output format
+	// more detail...
+	WAD_ERR_IN_SAMPRATE,		//!< unsupported input sampling rate
+	WAD_ERR_OUT_SAMPRATE,		//!< unsupported output sampling rate
+	WAD_ERR_IN_NUMCHAN,			//!< unsupported number input channels
+	WAD_ERR_OUT_NUMCHAN,		//!< unsupported number output channels
+	WAD_ERR_IN_SAMPFORMAT,		//!< unsupported input sample format
+	WAD_ERR_OUT_SAMPFORMAT,		//!< unsupported output sample format
+	WAD_ERR_IN_FRAMESPERBUF,	//!< unsupported buffer length
+	WAD_ERR_OUT_FRAMESPERBUF,	//!< unsupported buffer length
+	WAD_ERR_DEVICE_LOST,		//!< device removed, handle no longer valid
+	WAD_ERR_INVALID_SESSION,	//!< invalid or expired audio session
+};
+
+/** Device role, selects the default devices
+*/
+enum WadRole {
+	WAD_ROLE_CONSOLE = 0,		//!< games, system sounds
+	WAD_ROLE_MULTIMEDIA,		//!< music, movies
+	WAD_ROLE_COMMUNICATIONS,	//!< voice communications
+	WAD_NUM_ROLES
+};
+
+#define WAD_NAME_LEN	256		//!< buffer for IDs and session names
+#define WAD_DEV_NAME_LEN	1024	//!< buffer for a device name, UTF-8
+#define WAD_MAX_CHANNELS	32	//!< most channels of a device
+
+//! Opaque backend handle
+typedef void *WadHandle;
+
+//! Volume change callback, called on a system thread
+typedef void WadVolChangeFn(void *arg, int devIndex, float vol, bool mute);
+
+//! Device enumeration callback, name is NULL if names not requested
+typedef void WadEnumFn(void *arg, const char *devId, const char *name);
+
+//! Session enumeration callback, pid is 0 for system sounds
+typedef void WadSessionEnumFn(void *arg, const char *sessionId, unsigned long pid, const char *procName);
+
+/** Receives device changes from a backend, on any thread
+*/
+class WadBackendListener {
+public:
+	virtual ~WadBackendListener() {}
+	//! Device added, removed or changed state
+	virtual void OnDeviceState(const char *devId, bool isActive, bool isInput) = 0;
+	//! Default device for the role changed, devId NULL if none
+	virtual void OnDefaultDevice(bool isInput, const char *devId) = 0;
+	//! Device name changed
+	virtual void OnDeviceName(const char *devId) = 0;
+	//! Session added to a watched device, or expired, devId may be NULL if expired
+	virtual void OnSessionState(const char *devId, const char *sessionId, unsigned long pid,
+		const char *procName, bool isActive) = 0;
+};
+
+class WadBackend {
+protected:
+	static THREAD_LOCAL char errorText[256];	//!< error of the last call on this thread
+	WadStats *stats;		//!< times stages within backend calls, or NULL
+	void SetErrorText(const char *fmt, ...);
+	//! Start and end a timed WadStage
+	long long StatStart() { return stats ? stats->Start() : 0; }
+	void StatEnd(int stage, long long start) { if (start) stats->End(stage, start); }
+
+public:
+	WadBackend();
+	virtual ~WadBackend();
+
+	const char *GetErrorText();
+	//! Record the stages of backend calls in stats, call before Init
+	void SetStats(WadStats *stats);
+	//! Backend name, as passed to WadCreateBackend
+	virtual const char *GetName() = 0;
+
+	//! Connect to the audio system, role selects default devices
+	virtual int Init(int role) = 0;
+	//! Prepare a thread other than the one that called Init to use the backend
+	virtual int ThreadInit();
+	virtual void ThreadExit();
+	//! Call fn for each active device of a direction, with names if getNames
+	virtual int EnumDevices(bool isInput, bool getNames, WadEnumFn *fn, void *arg) = 0;
+	//! Count active devices of a direction, by default with an enumeration
+	virtual int CountDevices(bool isInput, int *pCount);
+	//! Get ID of default device, WAD_ERR_INVALID_DEVICE if none
+	virtual int GetDefaultDev(bool isInput, char *devId, size_t len) = 0;
+	//! Get state and direction of a device by ID, WAD_ERR_INVALID_DEVICE if unknown
+	virtual int GetDevState(const char *devId, bool *pIsActive, bool *pIsInput) = 0;
+	virtual int GetDevName(const char *devId, char *name, size_t len) = 0;
+
+	//! Open device for volume access
+	virtual int OpenDev(const char *devId, WadHandle *phDev) = 0;
+	virtual void CloseDev(WadHandle hDev) = 0;
+	// these return WAD_ERR_DEVICE_LOST if the device was removed
+	virtual int GetVol(WadHandle hDev, float *pVol) = 0;
+	virtual int SetVol(WadHandle hDev, float vol) = 0;
+	virtual int GetMute(WadHandle hDev, bool *pMute) = 0;
+	virtual int SetMute(WadHandle hDev, bool mute) = 0;
+	// Channel volumes, 0..1 each. The device volume is the loudest channel,
+	// and setting it scales all channels. A backend without channel control
+	// returns WAD_ERR_UNSUPPORTED.
+	virtual int GetChannelCount(WadHandle hDev, int *pNum);
+	//! Get all channel volumes in one call, vols holds WAD_MAX_CHANNELS
+	virtual int GetChannelVols(WadHandle hDev, float *vols, int *pNum);
+	//! Set all channel volumes in one call, num must be the channel count
+	virtual int SetChannelVols(WadHandle hDev, const float *vols, int num);
+	//! Get the WadChannelSide of each channel from its speaker position, sides
+	//! holds WAD_MAX_CHANNELS. WAD_ERR_UNSUPPORTED if the layout isn't known.
+	virtual int GetChannelSides(const char *devId, unsigned char *sides, int *pNum);
+	// Volume in dB on the device's own scale. The step is the smallest change
+	// the device makes, 0 if continuous. A backend without a dB scale returns
+	// WAD_ERR_UNSUPPORTED.
+	virtual int GetVolRange(WadHandle hDev, float *pMinDb, float *pMaxDb, float *pStepDb);
+	virtual int GetVolDb(WadHandle hDev, float *pDb);
+	//! Set volume in dB, within the range
+	virtual int SetVolDb(WadHandle hDev, float db);
+
+	// Peak meters, the level of the audio passing through a device, 0..1.
+	// Opened once and read repeatedly by the meter thread.
+	virtual int OpenMeter(const char *devId, WadHandle *phMeter);
+	virtual void CloseMeter(WadHandle hMeter);
+	//! Get the recent peak of all channels and of each channel, chanPeaks holds
+	//! WAD_MAX_CHANNELS. Returns WAD_ERR_DEVICE_LOST if the device was removed.
+	virtual int GetPeaks(WadHandle hMeter, float *pPeak, float *chanPeaks, int *pNum);
+
+	//! Send device changes to listener, NULL to stop
+	virtual int SetListener(WadBackendListener *listener);
+	//! Call fn with devIndex when device volume or mute changes
+	virtual int Watch(const char *devId, int devIndex, WadVolChangeFn *fn, void *arg, WadHandle *phWatch);
+	virtual void Unwatch(WadHandle hWatch);
+
+	// Application sessions, the streams of each process on a device. Session
+	// IDs are unique across devices.
+	//! Call fn for each active session on a device
+	virtual int EnumSessions(const char *devId, WadSessionEnumFn *fn, void *arg);
+	//! Send sessions added to or expiring on a device to the listener
+	virtual int WatchSessions(const char *devId, WadHandle *phWatch);
+	virtual void UnwatchSessions(WadHandle hWatch);
+	//! Open session for volume access
+	virtual int OpenSession(const char *devId, const char *sessionId, WadHandle *phSes);
+	virtual void CloseSession(WadHandle hSes);
+	// these return WAD_ERR_DEVICE_LOST if the session expired
+	virtual int GetSessionVol(WadHandle hSes, float *pVol);
+	virtual int SetSessionVol(WadHandle hSes, float vol);
+	virtual int GetSessionMute(WadHandle hSes, bool *pMute);
+	virtual int SetSessionMute(WadHandle hSes, bool mute);
+};
+
+//! Create a backend by name, or the platform default if NULL. Returns NULL if
+//! no such backend, or no default.
+WadBackend *WadCreateBackend(const char *name);
+//! Get names of available backends, space separated
+const char *WadBackendNames();
+//! Copy a UTF-8 string into len bytes, truncated on a character boundary
+void WadCopyUtf8(char *dst, const char *src, size_t len);
+//! Get the usual speaker mask for a channel count, with the bits of a
+//! WAVEFORMATEXTENSIBLE channel mask: stereo, quad, 5.1, 7.1 and so on
+unsigned long WadDefaultSpeakerMask(int num);
+//! Fill the WadChannelSide of num channels from a speaker mask, one channel for
+//! each bit set, lowest first. Channels beyond the mask are center.
+void WadMaskToSides(unsigned long mask, unsigned char *sides, int num);
+
+#endif
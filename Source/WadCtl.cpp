@@ -0,0 +1,273 @@
+//
+// C interface to VolCtl, for the shared library. Each function checks its
+// arguments, calls VolCtl and turns its results into a WadStatus, with the
+// error text left in the VolCtl for the calling thread.
+//
+#include <stdio.h>
+#include <string.h>
+#include "WadCtl.h"
+#include "VolCtl.h"
+#include "MiscDef.h"
+
+struct WadCtl {
+	VolCtl volCtl;
+	WadCtl(int role, WadBackend *backend) : volCtl(role, backend) {}
+};
+
+//
+// Check a device index, as the VolCtl calls that take one do, for the
+// calls that get by with -1 or an empty result instead.
+//
+static int CheckDev(WadCtl *ctl, int devIndex, WadDevInfo *pInfo)
+{
+	char errText[256];
+	int status = ctl->volCtl.GetDevInfo(devIndex, pInfo);
+
+	if (status == WAD_ERR_INVALID_DEVICE) {
+		_snprintf(errText, sizeof(errText), "device %d is not valid", devIndex);
+		ctl->volCtl.SetErrorText(errText);
+	}
+	return status;
+}
+
+static void CopyString(char *dst, const char *src, int len)
+{
+	if (len <= 0)
+		return;
+	WadCopyUtf8(dst, src, len);
+}
+
+int WadCtlVersion(void)
+{
+	return WAD_CTL_VERSION;
+}
+
+int WadCtlCreate(const char *backend, int role, WadCtl **pCtl)
+{
+	WadBackend *pBackend;
+
+	*pCtl = NULL;
+	if (role < 0 || role >= WAD_NUM_ROLES)
+		return WAD_ERR_INVALID_ARG;
+	// with no backend for the platform, Init reports it
+	pBackend = WadCreateBackend(backend);
+	if (!pBackend && backend)
+		return WAD_ERR_INVALID_ARG;
+	*pCtl = new WadCtl(role, pBackend);
+	return WAD_OK;
+}
+
+void WadCtlDestroy(WadCtl *ctl)
+{
+	delete ctl;
+}
+
+void WadCtlSetCacheFile(WadCtl *ctl, const char *path)
+{
+	ctl->volCtl.SetCacheFile(path);
+}
+
+int WadCtlInit(WadCtl *ctl, int lazy)
+{
+	return ctl->volCtl.Init(lazy != 0);
+}
+
+const char *WadCtlGetErrorText(WadCtl *ctl)
+{
+	return ctl->volCtl.GetErrorText();
+}
+
+int WadCtlGetNumDevices(WadCtl *ctl)
+{
+	return ctl->volCtl.GetNumDevices();
+}
+
+int WadCtlGetDefaultDev(WadCtl *ctl, int isInput, int *pDevIndex)
+{
+	*pDevIndex = isInput ? ctl->volCtl.GetDefaultInDevIndex() : ctl->volCtl.GetDefaultOutDevIndex();
+	if (*pDevIndex == -1) {
+		ctl->volCtl.SetErrorText(isInput ? "no default input device" : "no default output device");
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	return WAD_OK;
+}
+
+int WadCtlFindDevByName(WadCtl *ctl, const char *name, int match, int *pDevIndex)
+{
+	char errText[256];
+
+	if (match < WAD_MATCH_EXACT || match > WAD_MATCH_BEST) {
+		ctl->volCtl.SetErrorText("FindDevByName: invalid match");
+		return WAD_ERR_INVALID_ARG;
+	}
+	if ((*pDevIndex = ctl->volCtl.FindDevByName(name, match)) == -1) {
+		_snprintf(errText, sizeof(errText), "can't find device name '%s'", name);
+		ctl->volCtl.SetErrorText(errText);
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	return WAD_OK;
+}
+
+int WadCtlFindDevById(WadCtl *ctl, const char *devId, int *pDevIndex)
+{
+	char errText[256];
+
+	if ((*pDevIndex = ctl->volCtl.FindDevById(devId)) == -1) {
+		_snprintf(errText, sizeof(errText), "can't find device ID '%s'", devId);
+		ctl->volCtl.SetErrorText(errText);
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	return WAD_OK;
+}
+
+int WadCtlGetDevName(WadCtl *ctl, int devIndex, char *name, int len)
+{
+	WadDevInfo info;
+	int status;
+
+	if ((status = CheckDev(ctl, devIndex, &info)) == WAD_OK)
+		CopyString(name, info.name, len);
+	return status;
+}
+
+int WadCtlGetDevId(WadCtl *ctl, int devIndex, char *devId, int len)
+{
+	WadDevInfo info;
+	int status;
+
+	if ((status = CheckDev(ctl, devIndex, &info)) == WAD_OK)
+		CopyString(devId, info.devId, len);
+	return status;
+}
+
+int WadCtlGetDevFlags(WadCtl *ctl, int devIndex, int *pFlags)
+{
+	WadDevInfo info;
+	int status;
+
+	*pFlags = 0;
+	if ((status = CheckDev(ctl, devIndex, &info)) != WAD_OK)
+		return status;
+	if (info.isInput)
+		*pFlags |= WAD_CTL_INPUT;
+	if (info.isActive)
+		*pFlags |= WAD_CTL_ACTIVE;
+	if (devIndex == (info.isInput ? ctl->volCtl.GetDefaultInDevIndex()
+			: ctl->volCtl.GetDefaultOutDevIndex()))
+		*pFlags |= WAD_CTL_DEFAULT;
+	return WAD_OK;
+}
+
+int WadCtlGetVol(WadCtl *ctl, int devIndex, float *pVol)
+{
+	return ctl->volCtl.GetVol(devIndex, pVol);
+}
+
+int WadCtlSetVol(WadCtl *ctl, int devIndex, float vol)
+{
+	return ctl->volCtl.SetVol(devIndex, vol);
+}
+
+int WadCtlGetMute(WadCtl *ctl, int devIndex, int *pMute)
+{
+	bool mute = false;
+	int status = ctl->volCtl.GetMute(devIndex, &mute);
+
+	*pMute = mute;
+	return status;
+}
+
+int WadCtlSetMute(WadCtl *ctl, int devIndex, int mute)
+{
+	return ctl->volCtl.SetMute(devIndex, mute != 0);
+}
+
+int WadCtlGetChannelVols(WadCtl *ctl, int devIndex, float *vols, int max, int *pNum)
+{
+	float chanVols[WAD_MAX_CHANNELS];
+	int status;
+
+	*pNum = 0;
+	if ((status = ctl->volCtl.GetChannelVols(devIndex, chanVols, pNum)) != WAD_OK)
+		return status;
+	memcpy(vols, chanVols, MAX(MIN(*pNum, max), 0) * sizeof(float));
+	return WAD_OK;
+}
+
+int WadCtlSetChannelVols(WadCtl *ctl, int devIndex, const float *vols, int num)
+{
+	return ctl->volCtl.SetChannelVols(devIndex, vols, num);
+}
+
+int WadCtlRamp(WadCtl *ctl, int devIndex, float target, int msec, int curve)
+{
+	return ctl->volCtl.Ramp(devIndex, target, msec, curve);
+}
+
+int WadCtlGetVolRange(WadCtl *ctl, int devIndex, float *pMinDb, float *pMaxDb, float *pStepDb)
+{
+	return ctl->volCtl.GetVolRange(devIndex, pMinDb, pMaxDb, pStepDb);
+}
+
+int WadCtlGetVolDb(WadCtl *ctl, int devIndex, float *pDb)
+{
+	return ctl->volCtl.GetVolDb(devIndex, pDb);
+}
+
+int WadCtlSetVolDb(WadCtl *ctl, int devIndex, float db)
+{
+	return ctl->volCtl.SetVolDb(devIndex, db);
+}
+
+int WadCtlStepVolDb(WadCtl *ctl, int devIndex, float stepDb, float *pDb)
+{
+	return ctl->volCtl.StepVolDb(devIndex, stepDb, pDb);
+}
+
+int WadCtlSetTaper(WadCtl *ctl, int devIndex, int taper, const float *points, int numPoints)
+{
+	return ctl->volCtl.SetTaper(devIndex, taper, points, numPoints);
+}
+
+int WadCtlGetVolPos(WadCtl *ctl, int devIndex, float *pPos)
+{
+	return ctl->volCtl.GetVolPos(devIndex, pPos);
+}
+
+int WadCtlSetVolPos(WadCtl *ctl, int devIndex, float pos)
+{
+	return ctl->volCtl.SetVolPos(devIndex, pos);
+}
+
+void WadCtlEnableStats(WadCtl *ctl, int enable)
+{
+	ctl->volCtl.EnableStats(enable != 0);
+}
+
+int WadCtlGetStats(WadCtl *ctl, int stage, double *vals, int num)
+{
+	WadStageStats stats;
+	double statVals[6];
+	int status;
+
+	if ((status = ctl->volCtl.GetStats(stage, &stats)) != WAD_OK)
+		return status;
+	statVals[0] = (double) stats.count;
+	statVals[1] = stats.minUsec;
+	statVals[2] = stats.p50Usec;
+	statVals[3] = stats.p99Usec;
+	statVals[4] = stats.p999Usec;
+	statVals[5] = stats.maxUsec;
+	memcpy(vals, statVals, MAX(MIN(num, (int) NELEMS(statVals)), 0) * sizeof(double));
+	return WAD_OK;
+}
+
+void WadCtlResetStats(WadCtl *ctl)
+{
+	ctl->volCtl.ResetStats();
+}
+
+const char *WadCtlStageName(int stage)
+{
+	return WadStageName(stage);
+}
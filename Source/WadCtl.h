@@ -0,0 +1,120 @@
+/** C interface to VolCtl
+
+A VolCtl in a shared library, for callers that can't use the C++ class,
+such as Python with ctypes. One initialized instance answers calls at
+function call cost, instead of starting VolCtl and enumerating devices
+for every operation.
+
+The interface is plain C and only passes ints, floats and strings, so it
+stays the same when VolCtl's structures change. An instance is an opaque
+WadCtl handle. Functions return a WadStatus, WAD_OK (0) on success, and on
+error WadCtlGetErrorText has the details. Roles, match modes, ramp curves,
+tapers and statuses are the values of WadRole, WadMatch, WadRampCurve,
+WadTaper and WadStatus in WadBackend.h and VolCtl.h, which are only added
+to at the end.
+A handle may be used from several threads at once. The error text is kept
+per thread, so WadCtlGetErrorText gives the last error on the calling
+thread.
+
+    WadCtl *ctl;
+    int dev;
+    // multimedia role, best name match
+    if (WadCtlCreate(NULL, 1, &ctl) == 0 && WadCtlInit(ctl, 1) == 0
+            && WadCtlFindDevByName(ctl, "Speakers", 4, &dev) == 0)
+        WadCtlSetVol(ctl, dev, 0.5f);
+    WadCtlDestroy(ctl);
+
+@file WadCtl.h
+*/
+#ifndef _WAD_CTL_H
+#define _WAD_CTL_H
+
+#ifdef _WIN32
+#ifdef WAD_CTL_EXPORTS
+#define WAD_CTL_API	__declspec(dllexport)
+#else
+#define WAD_CTL_API	__declspec(dllimport)
+#endif
+#else
+#define WAD_CTL_API	__attribute__((visibility("default")))
+#endif
+
+#define WAD_CTL_VERSION	1	//!< changes when a function changes or is removed
+
+/** Device flags from WadCtlGetDevFlags, as in binary device records
+*/
+#define WAD_CTL_INPUT	1	//!< input device
+#define WAD_CTL_ACTIVE	2	//!< active, removed devices keep their index
+#define WAD_CTL_DEFAULT	4	//!< default device of its direction for the role
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct WadCtl WadCtl;
+
+//! Get WAD_CTL_VERSION of the library
+WAD_CTL_API int WadCtlVersion(void);
+//! Create an instance, backend is a name from WadBackendNames or NULL for the
+//! default, role a WadRole. *pCtl is NULL if there is no backend.
+WAD_CTL_API int WadCtlCreate(const char *backend, int role, WadCtl **pCtl);
+//! Destroy an instance, NULL is ignored
+WAD_CTL_API void WadCtlDestroy(WadCtl *ctl);
+//! Keep the device table in a file between runs, call before WadCtlInit
+WAD_CTL_API void WadCtlSetCacheFile(WadCtl *ctl, const char *path);
+//! Initialize, lazy to look up devices as they're asked for
+WAD_CTL_API int WadCtlInit(WadCtl *ctl, int lazy);
+//! Text of the last error
+WAD_CTL_API const char *WadCtlGetErrorText(WadCtl *ctl);
+
+// Devices are identified by index, which stays the same while the
+// instance lives.
+WAD_CTL_API int WadCtlGetNumDevices(WadCtl *ctl);
+//! Get the default input or output device for the role
+WAD_CTL_API int WadCtlGetDefaultDev(WadCtl *ctl, int isInput, int *pDevIndex);
+//! Find a device by name, match is a WadMatch
+WAD_CTL_API int WadCtlFindDevByName(WadCtl *ctl, const char *name, int match, int *pDevIndex);
+WAD_CTL_API int WadCtlFindDevById(WadCtl *ctl, const char *devId, int *pDevIndex);
+//! Get device name, UTF-8, truncated to len - 1 bytes on a character boundary
+WAD_CTL_API int WadCtlGetDevName(WadCtl *ctl, int devIndex, char *name, int len);
+WAD_CTL_API int WadCtlGetDevId(WadCtl *ctl, int devIndex, char *devId, int len);
+//! Get WAD_CTL_ device flags
+WAD_CTL_API int WadCtlGetDevFlags(WadCtl *ctl, int devIndex, int *pFlags);
+
+WAD_CTL_API int WadCtlGetVol(WadCtl *ctl, int devIndex, float *pVol);
+WAD_CTL_API int WadCtlSetVol(WadCtl *ctl, int devIndex, float vol);
+WAD_CTL_API int WadCtlGetMute(WadCtl *ctl, int devIndex, int *pMute);
+WAD_CTL_API int WadCtlSetMute(WadCtl *ctl, int devIndex, int mute);
+//! Get up to max channel volumes, *pNum gets the channel count
+WAD_CTL_API int WadCtlGetChannelVols(WadCtl *ctl, int devIndex, float *vols, int max, int *pNum);
+//! Set all channel volumes, num must be the channel count
+WAD_CTL_API int WadCtlSetChannelVols(WadCtl *ctl, int devIndex, const float *vols, int num);
+//! Ramp volume to target over msec, without waiting, curve is a WadRampCurve
+WAD_CTL_API int WadCtlRamp(WadCtl *ctl, int devIndex, float target, int msec, int curve);
+
+// Volume in dB on the device's scale, and fader positions on a taper
+WAD_CTL_API int WadCtlGetVolRange(WadCtl *ctl, int devIndex, float *pMinDb, float *pMaxDb, float *pStepDb);
+WAD_CTL_API int WadCtlGetVolDb(WadCtl *ctl, int devIndex, float *pDb);
+WAD_CTL_API int WadCtlSetVolDb(WadCtl *ctl, int devIndex, float db);
+//! Step volume by stepDb, *pDb gets the new volume
+WAD_CTL_API int WadCtlStepVolDb(WadCtl *ctl, int devIndex, float stepDb, float *pDb);
+//! Set the WadTaper of a device, or all if -1, points are numPoints position, dB pairs
+WAD_CTL_API int WadCtlSetTaper(WadCtl *ctl, int devIndex, int taper, const float *points, int numPoints);
+WAD_CTL_API int WadCtlGetVolPos(WadCtl *ctl, int devIndex, float *pPos);
+WAD_CTL_API int WadCtlSetVolPos(WadCtl *ctl, int devIndex, float pos);
+
+// Latency stats of the stages of init and volume and mute calls, stages are
+// WadStage values in WadStats.h
+//! Start or stop recording, call before WadCtlInit to include it
+WAD_CTL_API void WadCtlEnableStats(WadCtl *ctl, int enable);
+//! Get up to num of: count, then min, p50, p99, p999 and max in usec
+WAD_CTL_API int WadCtlGetStats(WadCtl *ctl, int stage, double *vals, int num);
+WAD_CTL_API void WadCtlResetStats(WadCtl *ctl);
+//! Name of a stage, NULL past the last
+WAD_CTL_API const char *WadCtlStageName(int stage);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
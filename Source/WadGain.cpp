@@ -0,0 +1,148 @@
+//
+// Channel gain kernels. Each loop works element by element with no calls
+// or early exits, so it vectorizes; the arrays never overlap, which
+// __restrict tells the compiler so it doesn't add overlap checks.
+//
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "WadGain.h"
+#include "MiscDef.h"
+
+#define DB_TO_LOG2		0.16609640f		// log2(10) / 20
+#define LOG2_TO_DB		6.02059991f		// 20 * log10(2)
+#define GAIN_MIN		1e-5f			// WAD_GAIN_DB_FLOOR as a gain
+#define DB_MAX			750.0f			// 2^+-124.6, within the float exponent range
+#define SQRT2			1.41421356f
+#define PI_4			0.78539816f
+
+//
+// 2^x as 2^floor(x) * 2^f, with f in 0..1. The integer part goes into the
+// exponent bits and 2^f is the Taylor series to the 6th power, within
+// 2e-5 relative. x must be within the exponent range, +-126.
+//
+static inline float Exp2(float x)
+{
+	int32_t i;
+	uint32_t bits;
+	float f, p;
+
+	i = (int32_t) x;
+	i -= x < (float) i;			// floor for negative x
+	f = x - (float) i;
+	p = 1.0f + f * (0.69314718f + f * (0.24022651f + f * (0.05550411f +
+		f * (0.00961813f + f * (0.00133336f + f * 0.00015404f)))));
+	memcpy(&bits, &p, sizeof(bits));
+	bits += (uint32_t) i << 23;
+	memcpy(&p, &bits, sizeof(p));
+	return p;
+}
+
+//
+// log2(x) for x > 0 as the exponent plus log2 of the mantissa m in 1..2,
+// which is 2 / ln(2) * atanh((m - 1) / (m + 1)), the series to the 7th power
+// is within 2e-5.
+//
+static inline float Log2(float x)
+{
+	uint32_t bits;
+	float e, m, t, t2;
+
+	memcpy(&bits, &x, sizeof(bits));
+	e = (float) (int32_t) ((bits >> 23) & 0xff) - 127.0f;
+	bits = (bits & 0x7fffff) | 0x3f800000;
+	memcpy(&m, &bits, sizeof(m));
+	t = (m - 1.0f) / (m + 1.0f);
+	t2 = t * t;
+	return e + 2.88539008f * t * (1.0f + t2 * (0.33333333f + t2 * (0.2f + t2 * 0.14285714f)));
+}
+
+//
+// Clamped in a pass of its own, since with the clamp in the same loop the
+// compiler splits it into branches for the ends of the range, and gives up
+// on vectorizing.
+//
+void WadDbToGains(const float *__restrict db, float *__restrict gains, int n)
+{
+	int i;
+	float x;
+	for (i = 0; i < n; i++) {
+		x = db[i] < -DB_MAX ? -DB_MAX : db[i];
+		gains[i] = x > DB_MAX ? DB_MAX : x;
+	}
+	for (i = 0; i < n; i++)
+		gains[i] = Exp2(gains[i] * DB_TO_LOG2);
+}
+
+void WadGainsToDb(const float *__restrict gains, float *__restrict db, int n)
+{
+	int i;
+	float g;
+	for (i = 0; i < n; i++) {
+		// raise 0, negative and denormal gains to the floor, without a
+		// branch, as max(max(g, 0), GAIN_MIN)
+		g = 0.5f * (gains[i] + fabsf(gains[i]));
+		g = 0.5f * (g + GAIN_MIN + fabsf(g - GAIN_MIN));
+		db[i] = Log2(g) * LOG2_TO_DB;
+	}
+}
+
+void WadApplyGains(float *__restrict vols, const float *__restrict gains, int n)
+{
+	int i;
+	float v;
+	for (i = 0; i < n; i++) {
+		v = vols[i] * gains[i];
+		v = v < 0.0f ? 0.0f : v;
+		vols[i] = v > 1.0f ? 1.0f : v;
+	}
+}
+
+void WadClampVols(float *vols, int n)
+{
+	int i;
+	float v;
+	for (i = 0; i < n; i++) {
+		v = vols[i] < 0.0f ? 0.0f : vols[i];
+		vols[i] = v > 1.0f ? 1.0f : v;
+	}
+}
+
+float WadMaxVol(const float *vols, int n)
+{
+	int i;
+	float m = 0;
+	for (i = 0; i < n; i++)
+		m = vols[i] > m ? vols[i] : m;
+	return m;
+}
+
+//
+// The two side gains are worked out once, then spread across the channels
+// by side, as selects, which vectorize.
+//
+void WadBalanceGains(float balance, int law, const unsigned char *__restrict sides,
+	float *__restrict gains, int n)
+{
+	float left, right, g;
+	int i;
+
+	balance = balance < -1.0f ? -1.0f : balance;
+	balance = balance > 1.0f ? 1.0f : balance;
+	if (law == WAD_BALANCE_POWER) {
+		// sqrt(2) brings the center, cos(pi/4), up to 1
+		left = SQRT2 * cosf((balance + 1.0f) * PI_4);
+		right = SQRT2 * sinf((balance + 1.0f) * PI_4);
+		// and cos(pi/2) comes out just below 0
+		left = MAX(MIN(left, 1.0f), 0.0f);
+		right = MAX(MIN(right, 1.0f), 0.0f);
+	}
+	else {
+		left = MIN(1.0f - balance, 1.0f);
+		right = MIN(1.0f + balance, 1.0f);
+	}
+	for (i = 0; i < n; i++) {
+		g = sides[i] == WAD_SIDE_LEFT ? left : 1.0f;
+		gains[i] = sides[i] == WAD_SIDE_RIGHT ? right : g;
+	}
+}
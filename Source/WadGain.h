@@ -0,0 +1,49 @@
+/** Channel gain kernels
+
+Arithmetic on arrays of channel volumes and gains, used to set all channels
+of a device in one pass: dB conversion, balance and clamping. The loops are
+kept simple, without calls or branches, so the compiler vectorizes them,
+and dB conversion uses exp2 and log2 approximations rather than powf and
+log10f, which don't vectorize. The approximations are within 0.001 dB.
+
+Channels are in the order the audio system reports them. For balance,
+each channel has a side from its speaker position, which the backend
+reports; center, LFE and other middle speakers aren't touched.
+
+@file WadGain.h
+*/
+#ifndef _WAD_GAIN_H
+#define _WAD_GAIN_H
+
+#define WAD_GAIN_DB_FLOOR	(-100.0f)	//!< dB of a zero gain
+
+/** Side of a channel's speaker, for WadBalanceGains
+*/
+enum WadChannelSide {
+	WAD_SIDE_CENTER = 0,		//!< center, LFE, mono, or a position not known
+	WAD_SIDE_LEFT,				//!< front, back, side and top left
+	WAD_SIDE_RIGHT,				//!< front, back, side and top right
+};
+
+/** Balance laws for WadBalanceGains
+*/
+enum WadBalanceLaw {
+	WAD_BALANCE_LINEAR = 0,		//!< the far side falls linearly to 0, the near side stays at 1
+	WAD_BALANCE_POWER,			//!< constant power, sin and cos, normalized to 1 at center
+};
+
+//! Convert dB to gain factors
+void WadDbToGains(const float *db, float *gains, int n);
+//! Convert gain factors to dB, WAD_GAIN_DB_FLOOR for 0 and below
+void WadGainsToDb(const float *gains, float *db, int n);
+//! Multiply volumes by gains, clamped to 0..1
+void WadApplyGains(float *vols, const float *gains, int n);
+//! Clamp volumes to 0..1
+void WadClampVols(float *vols, int n);
+//! Get the largest volume, 0 if n is 0
+float WadMaxVol(const float *vols, int n);
+//! Fill gains for a balance from -1 (left) to 1 (right), by WadBalanceLaw, from
+//! the WadChannelSide of each channel. Center channels get 1.
+void WadBalanceGains(float balance, int law, const unsigned char *sides, float *gains, int n);
+
+#endif
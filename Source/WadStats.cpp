@@ -0,0 +1,216 @@
+//
+// Per-stage latency histograms.
+//
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <chrono>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include "WadStats.h"
+#include "MiscDef.h"
+
+#define SUB_BUCKETS		(1 << WAD_STATS_SUB_BITS)
+
+struct WadStageHist {
+	std::atomic<long long> minNsec;
+	std::atomic<long long> maxNsec;
+	std::atomic<unsigned long long> buckets[WAD_STATS_BUCKETS];
+};
+
+static const char *stageNames[WAD_NUM_STAGES] = {
+	"init",
+	"backendInit",
+	"comInit",
+	"loadCache",
+	"enumerate",
+	"default",
+	"accessVol",
+	"accessMute",
+	"open",
+	"getDevice",
+	"activate",
+	"getVol",
+	"setVol",
+	"getMute",
+	"setMute",
+};
+
+const char *WadStageName(int stage)
+{
+	if (stage < 0 || stage >= WAD_NUM_STAGES)
+		return NULL;
+	return stageNames[stage];
+}
+
+//
+// Bucket of a time. Times under SUB_BUCKETS nsec have a bucket each, and
+// each power of 2 above is split into SUB_BUCKETS buckets by the bits
+// below the top one.
+//
+static int BucketOf(long long nsec)
+{
+	unsigned long long v = nsec > 0 ? (unsigned long long) nsec : 0;
+	int msb = 0;
+
+	if (v < SUB_BUCKETS)
+		return (int) v;
+	if (v >> 32) { v >>= 32; msb += 32; }
+	if (v >> 16) { v >>= 16; msb += 16; }
+	if (v >> 8) { v >>= 8; msb += 8; }
+	if (v >> 4) { v >>= 4; msb += 4; }
+	if (v >> 2) { v >>= 2; msb += 2; }
+	if (v >> 1) msb += 1;
+	if (msb >= WAD_STATS_MAX_BITS)
+		return WAD_STATS_BUCKETS - 1;
+	return ((msb - WAD_STATS_SUB_BITS + 1) << WAD_STATS_SUB_BITS)
+		+ (int) ((nsec >> (msb - WAD_STATS_SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+// middle of a bucket, in nsec
+static double BucketMid(int bucket)
+{
+	int shift;
+
+	if (bucket < SUB_BUCKETS)
+		return bucket;
+	shift = (bucket >> WAD_STATS_SUB_BITS) - 1;
+	return (double) ((SUB_BUCKETS + (bucket & (SUB_BUCKETS - 1))) * 2 + 1) * (1ULL << shift) / 2;
+}
+
+static void ClearHists(WadStageHist *pHist)
+{
+	int i, j;
+
+	for (i = 0; i < WAD_NUM_STAGES; i++) {
+		for (j = 0; j < WAD_STATS_BUCKETS; j++)
+			pHist[i].buckets[j].store(0, std::memory_order_relaxed);
+		pHist[i].minNsec.store(LLONG_MAX, std::memory_order_relaxed);
+		pHist[i].maxNsec.store(0, std::memory_order_relaxed);
+	}
+}
+
+WadStats::WadStats()
+{
+	isEnabled = false;
+	hists = NULL;
+}
+
+WadStats::~WadStats()
+{
+	delete[] hists.load();
+}
+
+//
+// Histograms are allocated when first enabled, and then kept, so a call
+// recording while another thread disables can still use them.
+//
+void WadStats::Enable(bool enable)
+{
+	WadStageHist *newHists;
+	WadStageHist *expected = NULL;
+
+	if (enable && !hists.load()) {
+		newHists = new WadStageHist[WAD_NUM_STAGES];
+		ClearHists(newHists);
+		if (!hists.compare_exchange_strong(expected, newHists))
+			delete[] newHists;
+	}
+	isEnabled = enable;
+}
+
+void WadStats::Add(int stage, long long nsec)
+{
+	WadStageHist *pHist = hists.load(std::memory_order_acquire);
+	long long old;
+
+	if (!pHist || stage < 0 || stage >= WAD_NUM_STAGES)
+		return;
+	pHist += stage;
+	pHist->buckets[BucketOf(nsec)].fetch_add(1, std::memory_order_relaxed);
+	old = pHist->minNsec.load(std::memory_order_relaxed);
+	while (nsec < old && !pHist->minNsec.compare_exchange_weak(old, nsec, std::memory_order_relaxed))
+		;
+	old = pHist->maxNsec.load(std::memory_order_relaxed);
+	while (nsec > old && !pHist->maxNsec.compare_exchange_weak(old, nsec, std::memory_order_relaxed))
+		;
+}
+
+//
+// Percentiles are the middle of the bucket holding the rank, kept within
+// min and max. The count is the sum of the buckets read, so it agrees with
+// the percentiles while calls are being recorded.
+//
+void WadStats::Get(int stage, WadStageStats *pStats)
+{
+	WadStageHist *pHist = hists.load(std::memory_order_acquire);
+	unsigned long long counts[WAD_STATS_BUCKETS];
+	unsigned long long count = 0;
+	unsigned long long sum, rank[3];
+	double *pct[3];
+	double minNsec, maxNsec, v;
+	int i, j;
+
+	memset(pStats, 0, sizeof(*pStats));
+	if (!pHist || stage < 0 || stage >= WAD_NUM_STAGES)
+		return;
+	pHist += stage;
+	for (i = 0; i < WAD_STATS_BUCKETS; i++) {
+		counts[i] = pHist->buckets[i].load(std::memory_order_relaxed);
+		count += counts[i];
+	}
+	if (count == 0)
+		return;
+	minNsec = (double) pHist->minNsec.load(std::memory_order_relaxed);
+	maxNsec = (double) pHist->maxNsec.load(std::memory_order_relaxed);
+	pStats->count = count;
+	pStats->minUsec = minNsec / 1000;
+	pStats->maxUsec = maxNsec / 1000;
+	// rank of each percentile, rounded up
+	rank[0] = (count * 500 + 999) / 1000;
+	rank[1] = (count * 990 + 999) / 1000;
+	rank[2] = (count * 999 + 999) / 1000;
+	pct[0] = &pStats->p50Usec;
+	pct[1] = &pStats->p99Usec;
+	pct[2] = &pStats->p999Usec;
+	sum = 0;
+	for (i = 0, j = 0; i < WAD_STATS_BUCKETS && j < 3; i++) {
+		sum += counts[i];
+		for (; j < 3 && sum >= rank[j]; j++) {
+			v = MIN(MAX(BucketMid(i), minNsec), maxNsec);
+			*pct[j] = v / 1000;
+		}
+	}
+}
+
+// not atomic as a whole, calls recorded meanwhile may be partly kept
+void WadStats::Reset()
+{
+	WadStageHist *pHist = hists.load(std::memory_order_acquire);
+
+	if (pHist)
+		ClearHists(pHist);
+}
+
+//
+// steady_clock in VS2013 only has the resolution of the system time, so
+// Windows reads the performance counter directly.
+//
+long long WadStats::Now()
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER count;
+
+	if (freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	// split to keep the multiply from overflowing
+	return (count.QuadPart / freq.QuadPart) * 1000000000LL
+		+ (count.QuadPart % freq.QuadPart) * 1000000000LL / freq.QuadPart;
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
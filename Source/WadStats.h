@@ -0,0 +1,93 @@
+/** Per-stage latency statistics
+
+Times the stages of VolCtl initialization and of volume and mute access,
+to tell where a slow call spends its time: connecting to the audio system,
+enumeration, opening a device, or the volume call itself. Each stage has a
+histogram with log-linear buckets, 8 per power of 2, so percentiles are
+within 6%, and min and max are exact.
+
+Recording is lock-free, with atomic counters, so calls on several threads
+don't wait for each other. When disabled, the cost of a timed stage is a
+flag test, and no histograms are allocated until first enabled. Stats read
+while calls are recorded, or reset, may be off by the calls in progress.
+
+    long long start = stats.Start();
+    ... stage ...
+    stats.End(WAD_STAGE_SET_VOL, start);
+
+@file WadStats.h
+*/
+#ifndef _WAD_STATS_H
+#define _WAD_STATS_H
+
+#include <atomic>
+
+/** Timed stages
+*/
+enum WadStage {
+	WAD_STAGE_INIT = 0,			//!< all of VolCtl::Init
+	WAD_STAGE_BACKEND_INIT,		//!< backend Init, connecting to the audio system
+	WAD_STAGE_COM_INIT,			//!< WASAPI CoInitializeEx, in backend Init
+	WAD_STAGE_LOAD_CACHE,		//!< reading the device cache
+	WAD_STAGE_ENUMERATE,		//!< enumerating all devices
+	WAD_STAGE_DEFAULT,			//!< looking up the default devices
+	WAD_STAGE_ACCESS_VOL,		//!< all of a get or set volume
+	WAD_STAGE_ACCESS_MUTE,		//!< all of a get or set mute
+	WAD_STAGE_OPEN,				//!< opening a device handle, when not cached
+	WAD_STAGE_GET_DEVICE,		//!< WASAPI GetDevice, in open
+	WAD_STAGE_ACTIVATE,			//!< WASAPI Activate, in open
+	WAD_STAGE_GET_VOL,			//!< backend GetVol
+	WAD_STAGE_SET_VOL,			//!< backend SetVol
+	WAD_STAGE_GET_MUTE,			//!< backend GetMute
+	WAD_STAGE_SET_MUTE,			//!< backend SetMute
+	WAD_NUM_STAGES
+};
+
+/** Latency of a stage, in microseconds
+*/
+struct WadStageStats {
+	unsigned long long count;	//!< calls timed
+	double minUsec;
+	double maxUsec;
+	double p50Usec;				//!< median
+	double p99Usec;
+	double p999Usec;
+};
+
+// buckets cover up to 2^WAD_STATS_MAX_BITS nsec, about 18 minutes, longer
+// times go in the last bucket
+#define WAD_STATS_MAX_BITS	40
+#define WAD_STATS_SUB_BITS	3	//!< log2 of buckets per power of 2
+#define WAD_STATS_BUCKETS	((WAD_STATS_MAX_BITS - WAD_STATS_SUB_BITS + 1) << WAD_STATS_SUB_BITS)
+
+struct WadStageHist;
+
+class WadStats {
+protected:
+	std::atomic<bool> isEnabled;
+	std::atomic<WadStageHist *> hists;	//!< WAD_NUM_STAGES histograms, NULL until enabled
+public:
+	WadStats();
+	~WadStats();
+
+	//! Start or stop recording, stats recorded so far are kept
+	void Enable(bool enable);
+	bool IsEnabled() { return isEnabled.load(std::memory_order_relaxed); }
+	//! Start time of a stage, 0 if disabled
+	long long Start() { return IsEnabled() ? Now() : 0; }
+	//! Record a stage started with Start, ignored if it was disabled then
+	void End(int stage, long long start) { if (start) Add(stage, Now() - start); }
+	//! Record a stage time in nsec
+	void Add(int stage, long long nsec);
+	//! Get the stats of a stage, all 0 if none recorded
+	void Get(int stage, WadStageStats *pStats);
+	void Reset();
+
+	//! Monotonic time in nsec, from the high resolution performance counter
+	static long long Now();
+};
+
+//! Name of a WadStage, NULL if not valid
+const char *WadStageName(int stage);
+
+#endif
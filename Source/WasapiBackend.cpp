@@ -0,0 +1,1372 @@
+//
+// Audio device backend using Windows Audio Services API (WASAPI).
+//
+// Internally we use char for characters, with names and IDs converted
+// from UNICODE to UTF-8 so any device name survives. This code should
+// compile with either multi-byte or UNICODE set.
+//
+#include "WasapiBackend.h"
+#include "MiscDef.h"
+#include "WaLog.h"
+#include "EndpointVolume.h"
+#include "Mmreg.h"
+#include "Functiondiscoverykeys_devpkey.h"
+#include "Strsafe.h"
+
+#define THIS_FILE	"WasapiBackend.cpp"
+
+#ifdef _MSC_VER
+#pragma warning(disable : 4244 4995)
+#endif
+
+#define CHECK(hr, retval, funcName) \
+	if (FAILED(hr)) { \
+		char tmpStr[128]; \
+		GetAudioClientResultStr(hr, tmpStr, sizeof(tmpStr)); \
+		_snprintf(errorText, sizeof(errorText), "%s returned %x (%s)", funcName, hr, tmpStr); \
+		WA_LOG(1, (THIS_FILE, errorText)); \
+		return retval; \
+	}
+
+#define CHECK_GOTO(hr, retval, funcName, label) \
+	if (FAILED(hr)) { \
+		char tmpStr[128]; \
+		GetAudioClientResultStr(hr, tmpStr, sizeof(tmpStr)); \
+		_snprintf(errorText, sizeof(errorText), "%s returned %x (%s)", funcName, hr, tmpStr); \
+		WA_LOG(1, (THIS_FILE, errorText)); \
+		status = retval; \
+		goto label; \
+	}
+
+#define CHECK_HANDLE(h, retval, funcName) \
+	if (h == NULL) { \
+		DWORD err = GetLastError(); \
+		char tmpStr[128]; \
+		GetWindowsErrorStr(err, tmpStr, sizeof(tmpStr)); \
+		_snprintf(errorText, sizeof(errorText), "%s error: %x (%s)", funcName, err, tmpStr); \
+		WA_LOG(1, (THIS_FILE, errorText)); \
+		return retval; \
+	}
+
+#define CHECK_HANDLE_GOTO(h, retval, funcName, label) \
+	if (h == NULL) { \
+		DWORD err = GetLastError(); \
+		char tmpStr[128]; \
+		GetWindowsErrorStr(err, tmpStr, sizeof(tmpStr)); \
+		_snprintf(errorText, sizeof(errorText), "%s error: %x (%s)", funcName, err, tmpStr); \
+		WA_LOG(1, (THIS_FILE, errorText)); \
+		status = retval; \
+		goto label; \
+	}
+
+template <class T> void SafeRelease(T **ppT)
+{
+    if (*ppT)
+    {
+        (*ppT)->Release();
+        *ppT = NULL;
+    }
+}
+
+const CLSID CLSID_MMDeviceEnumerator = __uuidof(MMDeviceEnumerator);
+const IID IID_IMMDeviceEnumerator = __uuidof(IMMDeviceEnumerator);
+const IID IID_IMMEndpoint = __uuidof(IMMEndpoint);
+const IID IID_IMMNotificationClient = __uuidof(IMMNotificationClient);
+const IID IID_IUnknown = __uuidof(IUnknown);
+const IID IID_IAudioEndpointVolumeCallback = __uuidof(IAudioEndpointVolumeCallback);
+const IID IID_IAudioClient = __uuidof(IAudioClient);
+const IID IID_IAudioRenderClient = __uuidof(IAudioRenderClient);
+const IID IID_IAudioCaptureClient = __uuidof(IAudioCaptureClient);
+const IID IID_IAudioEndpointVolume = __uuidof(IAudioEndpointVolume);
+const IID IID_IAudioMeterInformation = __uuidof(IAudioMeterInformation);
+const IID IID_ISimpleAudioVolume = __uuidof(ISimpleAudioVolume);
+const IID IID_IAudioClock = __uuidof(IAudioClock);
+const IID IID_IAudioSessionManager2 = __uuidof(IAudioSessionManager2);
+const IID IID_IAudioSessionControl2 = __uuidof(IAudioSessionControl2);
+const IID IID_IAudioSessionNotification = __uuidof(IAudioSessionNotification);
+const IID IID_IAudioSessionEvents = __uuidof(IAudioSessionEvents);
+
+//
+// Convert a wide string to UTF-8, always null terminated. A string too long
+// for the buffer is cut on a character boundary.
+//
+static void WideToMulti(LPCWSTR wstr, char *str, size_t len)
+{
+	char *tmp;
+	int n;
+
+	if (len == 0)
+		return;
+	n = WideCharToMultiByte(CP_UTF8, 0, wstr, -1, NULL, 0, NULL, NULL);
+	if (n > 0 && (size_t) n <= len) {
+		WideCharToMultiByte(CP_UTF8, 0, wstr, -1, str, n, NULL, NULL);
+		return;
+	}
+	str[0] = 0;
+	if (n > 0 && (tmp = (char *) malloc(n)) != NULL) {
+		WideCharToMultiByte(CP_UTF8, 0, wstr, -1, tmp, n, NULL, NULL);
+		WadCopyUtf8(str, tmp, len);
+		free(tmp);
+	}
+}
+
+// Returns an allocated UTF-8 copy of a wide string, or NULL if out of memory
+static char *WideToMultiAlloc(LPCWSTR wstr)
+{
+	char *str;
+	int n;
+
+	n = WideCharToMultiByte(CP_UTF8, 0, wstr, -1, NULL, 0, NULL, NULL);
+	if ((str = (char *) malloc(MAX(n, 1))) == NULL)
+		return NULL;
+	str[0] = 0;
+	if (n > 0)
+		WideCharToMultiByte(CP_UTF8, 0, wstr, -1, str, n, NULL, NULL);
+	return str;
+}
+
+static bool GetWindowsErrorStr(HRESULT hr, char *errStr, size_t len)
+{
+	LPVOID lpMsgBuf = NULL;
+	FormatMessage( 
+		FORMAT_MESSAGE_ALLOCATE_BUFFER | 
+		FORMAT_MESSAGE_FROM_SYSTEM | 
+		FORMAT_MESSAGE_IGNORE_INSERTS,
+		NULL,
+		hr,
+		MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), // Default language
+		(LPTSTR) &lpMsgBuf,
+		0,
+		NULL 
+		);
+	if (!lpMsgBuf) {
+		errStr[0] = 0;
+		return false;
+	}
+#ifdef UNICODE
+	WideToMulti((WCHAR *) lpMsgBuf, errStr, len);
+#else
+	strncpy(errStr, (char *) lpMsgBuf, len);
+#endif
+	// clobber trailing newline
+	if (errStr[strlen(errStr)-1] == '\n')
+		errStr[strlen(errStr)-1] = 0;
+	// clobber trailing CR
+	if (errStr[strlen(errStr)-1] == '\r')
+		errStr[strlen(errStr)-1] = 0;
+	LocalFree(lpMsgBuf);
+	return true;
+}
+
+// do we really have to do this ourselves?
+typedef struct {
+	HRESULT hr;
+	char *desc;
+} ErrTabEntry;
+#define MAKE_ENTRY(result) { result, #result } 
+ErrTabEntry gErrTab[] = {
+	MAKE_ENTRY(AUDCLNT_E_NOT_INITIALIZED),
+	MAKE_ENTRY(AUDCLNT_E_ALREADY_INITIALIZED),
+	MAKE_ENTRY(AUDCLNT_E_WRONG_ENDPOINT_TYPE),
+	MAKE_ENTRY(AUDCLNT_E_DEVICE_INVALIDATED),
+	MAKE_ENTRY(AUDCLNT_E_NOT_STOPPED),
+	MAKE_ENTRY(AUDCLNT_E_BUFFER_TOO_LARGE),
+	MAKE_ENTRY(AUDCLNT_E_OUT_OF_ORDER),
+	MAKE_ENTRY(AUDCLNT_E_UNSUPPORTED_FORMAT),
+	MAKE_ENTRY(AUDCLNT_E_INVALID_SIZE),
+	MAKE_ENTRY(AUDCLNT_E_DEVICE_IN_USE),
+	MAKE_ENTRY(AUDCLNT_E_BUFFER_OPERATION_PENDING),
+	MAKE_ENTRY(AUDCLNT_E_THREAD_NOT_REGISTERED),
+	MAKE_ENTRY(AUDCLNT_E_EXCLUSIVE_MODE_NOT_ALLOWED),
+	MAKE_ENTRY(AUDCLNT_E_ENDPOINT_CREATE_FAILED),
+	MAKE_ENTRY(AUDCLNT_E_SERVICE_NOT_RUNNING),
+	MAKE_ENTRY(AUDCLNT_E_EVENTHANDLE_NOT_EXPECTED),
+	MAKE_ENTRY(AUDCLNT_E_EXCLUSIVE_MODE_ONLY),
+	MAKE_ENTRY(AUDCLNT_E_BUFDURATION_PERIOD_NOT_EQUAL),
+	MAKE_ENTRY(AUDCLNT_E_EVENTHANDLE_NOT_SET),
+	MAKE_ENTRY(AUDCLNT_E_INCORRECT_BUFFER_SIZE),
+	MAKE_ENTRY(AUDCLNT_E_BUFFER_SIZE_ERROR),
+	MAKE_ENTRY(AUDCLNT_E_CPUUSAGE_EXCEEDED),
+#if MSC_VER >= 1600
+	// these not defined in Win SDK v6.0a
+	MAKE_ENTRY(AUDCLNT_E_BUFFER_ERROR),
+	MAKE_ENTRY(AUDCLNT_E_BUFFER_SIZE_NOT_ALIGNED),
+	MAKE_ENTRY(AUDCLNT_E_INVALID_DEVICE_PERIOD),
+#endif
+	MAKE_ENTRY(AUDCLNT_S_BUFFER_EMPTY),
+	MAKE_ENTRY(AUDCLNT_S_THREAD_ALREADY_REGISTERED),
+	MAKE_ENTRY(AUDCLNT_S_POSITION_STALLED)
+};
+
+static bool GetAudioClientResultStr(HRESULT hr, char *errStr, size_t len)
+{
+	size_t i;
+	size_t n = sizeof(gErrTab) / sizeof(ErrTabEntry);
+	for (i = 0; i < n; i++) {
+		if (gErrTab[i].hr == hr) {
+			strncpy(errStr, gErrTab[i].desc, len);
+			return true;
+		}
+	}
+	return GetWindowsErrorStr(hr, errStr, len);
+}
+
+//
+//  Retrieves the device friendly name for a device, converted to UTF-8.
+//
+bool WasapiBackend::GetDeviceName(IMMDevice *device, char *devName, size_t len)
+{
+    HRESULT hr;
+    IPropertyStore *propertyStore;
+    PROPVARIANT friendlyName;
+
+	hr = device->OpenPropertyStore(STGM_READ, &propertyStore);
+    if (FAILED(hr))
+    {
+        _snprintf(errorText, sizeof(errorText), "OpenPropertyStore returned %x", hr);
+		WA_LOG(1, (THIS_FILE, errorText));
+        return false;
+    }
+
+    PropVariantInit(&friendlyName);
+    hr = propertyStore->GetValue(PKEY_Device_FriendlyName, &friendlyName);
+    SafeRelease(&propertyStore);
+    if (FAILED(hr))
+    {
+        _snprintf(errorText, sizeof(errorText), "GetValue returned %x", hr);
+		WA_LOG(1, (THIS_FILE, errorText));
+        return false;
+    }
+	if (friendlyName.vt == VT_LPWSTR) {
+		// copy wide to UTF-8
+		WideToMulti(friendlyName.pwszVal, devName, len);
+	}
+	else {
+		// should never happen
+		devName[0] = 0;
+	}
+    PropVariantClear(&friendlyName);
+    return true;
+}
+
+//=============================================================================
+//
+// Device notifications
+//
+// Notifications arrive on a system thread and are passed on to the
+// listener with device IDs converted to UTF-8.
+//
+
+class WasapiNotify : public IMMNotificationClient {
+	LONG refCount;
+	WasapiBackend *pBackend;
+public:
+	WasapiNotify(WasapiBackend *p) : refCount(1), pBackend(p) {}
+
+	ULONG STDMETHODCALLTYPE AddRef()
+	{
+		return InterlockedIncrement(&refCount);
+	}
+
+	ULONG STDMETHODCALLTYPE Release()
+	{
+		ULONG n = InterlockedDecrement(&refCount);
+		if (n == 0)
+			delete this;
+		return n;
+	}
+
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, VOID **ppv)
+	{
+		if (riid == IID_IUnknown || riid == IID_IMMNotificationClient) {
+			AddRef();
+			*ppv = (IMMNotificationClient *) this;
+			return S_OK;
+		}
+		*ppv = NULL;
+		return E_NOINTERFACE;
+	}
+
+	HRESULT STDMETHODCALLTYPE OnDefaultDeviceChanged(EDataFlow flow, ERole role, LPCWSTR id)
+	{
+		char devId[WAD_NAME_LEN];
+		if (role != pBackend->role || flow == eAll)
+			return S_OK;
+		if (id)
+			WideToMulti(id, devId, sizeof(devId));
+		pBackend->listener->OnDefaultDevice(flow == eCapture, id ? devId : NULL);
+		return S_OK;
+	}
+
+	HRESULT STDMETHODCALLTYPE OnDeviceAdded(LPCWSTR id)
+	{
+		// state follows in OnDeviceStateChanged, but check in case it doesn't
+		OnDeviceStateChanged(id, 0);
+		return S_OK;
+	}
+
+	HRESULT STDMETHODCALLTYPE OnDeviceRemoved(LPCWSTR id)
+	{
+		return OnDeviceStateChanged(id, DEVICE_STATE_NOTPRESENT);
+	}
+
+	HRESULT STDMETHODCALLTYPE OnDeviceStateChanged(LPCWSTR id, DWORD state)
+	{
+		IMMDevice *pDevice;
+		char devId[WAD_NAME_LEN];
+		bool isInput = false;
+
+		if (SUCCEEDED(pBackend->pEnumerator->GetDevice(id, &pDevice))) {
+			// state 0 if unknown
+			if (state == 0)
+				pDevice->GetState(&state);
+			pBackend->GetIsInput(pDevice, &isInput);
+			SafeRelease(&pDevice);
+		}
+		WideToMulti(id, devId, sizeof(devId));
+		pBackend->listener->OnDeviceState(devId, state == DEVICE_STATE_ACTIVE, isInput);
+		return S_OK;
+	}
+
+	HRESULT STDMETHODCALLTYPE OnPropertyValueChanged(LPCWSTR id, const PROPERTYKEY key)
+	{
+		char devId[WAD_NAME_LEN];
+		if (key.fmtid == PKEY_Device_FriendlyName.fmtid && key.pid == PKEY_Device_FriendlyName.pid) {
+			WideToMulti(id, devId, sizeof(devId));
+			pBackend->listener->OnDeviceName(devId);
+		}
+		return S_OK;
+	}
+};
+
+//=============================================================================
+//
+// Volume change notifications
+//
+// Each watch has a callback registered on its own endpoint volume
+// interface, so changes by the user or other applications are pushed to
+// the caller rather than polled.
+//
+
+class WasapiWatch : public IAudioEndpointVolumeCallback {
+	LONG refCount;
+	int devIndex;
+	WadVolChangeFn *fn;
+	void *arg;
+public:
+	IAudioEndpointVolume *pVol;	//!< interface registered with
+
+	WasapiWatch(int _devIndex, WadVolChangeFn *_fn, void *_arg, IAudioEndpointVolume *_pVol) :
+		refCount(1), devIndex(_devIndex), fn(_fn), arg(_arg), pVol(_pVol) {}
+
+	~WasapiWatch()
+	{
+		SafeRelease(&pVol);
+	}
+
+	ULONG STDMETHODCALLTYPE AddRef()
+	{
+		return InterlockedIncrement(&refCount);
+	}
+
+	ULONG STDMETHODCALLTYPE Release()
+	{
+		ULONG n = InterlockedDecrement(&refCount);
+		if (n == 0)
+			delete this;
+		return n;
+	}
+
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, VOID **ppv)
+	{
+		if (riid == IID_IUnknown || riid == IID_IAudioEndpointVolumeCallback) {
+			AddRef();
+			*ppv = (IAudioEndpointVolumeCallback *) this;
+			return S_OK;
+		}
+		*ppv = NULL;
+		return E_NOINTERFACE;
+	}
+
+	HRESULT STDMETHODCALLTYPE OnNotify(PAUDIO_VOLUME_NOTIFICATION_DATA pNotify)
+	{
+		if (pNotify)
+			fn(arg, devIndex, pNotify->fMasterVolume, pNotify->bMuted != 0);
+		return S_OK;
+	}
+};
+
+//=============================================================================
+//
+// WasapiBackend
+//
+
+WasapiBackend::WasapiBackend()
+{
+	pEnumerator = NULL;
+	role = eCommunications;
+	pNotify = NULL;
+	listener = NULL;
+}
+
+WasapiBackend::~WasapiBackend()
+{
+	SetListener(NULL);
+	SafeRelease(&pEnumerator);
+}
+
+const char *WasapiBackend::GetName()
+{
+	return "wasapi";
+}
+
+int WasapiBackend::Init(int _role)
+{
+	HRESULT hr;
+	long long start;
+
+	// WadRole values match ERole
+	role = (ERole) _role;
+	// initialize COM, multithreaded so session notifications are delivered
+	// and the ramp thread can share the interfaces
+	start = StatStart();
+	hr = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+	StatEnd(WAD_STAGE_COM_INIT, start);
+	// returns S_FALSE if already initialized, and RPC_E_CHANGED_MODE if the
+	// caller initialized single threaded, which works without session watches
+	if (hr != RPC_E_CHANGED_MODE)
+		CHECK(hr, WAD_ERR_INTERNAL, "CoInitializeEx");
+	// create the enumerator
+	hr = CoCreateInstance(
+		CLSID_MMDeviceEnumerator, NULL,
+		CLSCTX_ALL, IID_IMMDeviceEnumerator,
+		(void**)&pEnumerator);
+	CHECK(hr, WAD_ERR_INTERNAL, "CoCreateInstance");
+	return WAD_OK;
+}
+
+//
+// Other threads join the multithreaded apartment, so they can use the
+// interfaces created by any thread.
+//
+int WasapiBackend::ThreadInit()
+{
+	HRESULT hr = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+	CHECK(hr, WAD_ERR_INTERNAL, "CoInitializeEx");
+	return WAD_OK;
+}
+
+void WasapiBackend::ThreadExit()
+{
+	CoUninitialize();
+}
+
+HRESULT WasapiBackend::GetDevice(const char *devId, IMMDevice **ppDevice)
+{
+	WCHAR id[WAD_NAME_LEN];
+
+	memset(id, 0, sizeof(id));
+	MultiByteToWideChar(CP_UTF8, 0, devId, strlen(devId), id, WAD_NAME_LEN - 1);
+	return pEnumerator->GetDevice(id, ppDevice);
+}
+
+HRESULT WasapiBackend::GetIsInput(IMMDevice *pDevice, bool *pIsInput)
+{
+	HRESULT hr;
+	IMMEndpoint *pEndpoint;
+	EDataFlow flow;
+
+	hr = pDevice->QueryInterface(IID_IMMEndpoint, (void **) &pEndpoint);
+	if (FAILED(hr))
+		return hr;
+	hr = pEndpoint->GetDataFlow(&flow);
+	SafeRelease(&pEndpoint);
+	*pIsInput = (flow == eCapture);
+	return hr;
+}
+
+int WasapiBackend::EnumDevices(bool isInput, bool getNames, WadEnumFn *fn, void *arg)
+{
+	HRESULT hr;
+	IMMDeviceCollection *pCollection = NULL;
+	IMMDevice *pDevice = NULL;
+	LPWSTR id = NULL;
+	char devId[WAD_NAME_LEN];
+	char name[WAD_DEV_NAME_LEN];
+	UINT i, num = 0;
+	int status = WAD_OK;
+
+	hr = pEnumerator->EnumAudioEndpoints(isInput ? eCapture : eRender, DEVICE_STATE_ACTIVE, &pCollection);
+	CHECK(hr, WAD_ERR_INTERNAL, "EnumAudioEndpoints");
+	hr = pCollection->GetCount(&num);
+	CHECK_GOTO(hr, WAD_ERR_INTERNAL, "GetCount", EnumDevices_exit);
+	for (i = 0; i < num; i++) {
+		hr = pCollection->Item(i, &pDevice);
+		CHECK_GOTO(hr, WAD_ERR_INTERNAL, "Item", EnumDevices_exit);
+		// get the device ID
+		hr = pDevice->GetId(&id);
+		CHECK_GOTO(hr, WAD_ERR_INTERNAL, "GetId", EnumDevices_exit);
+		WideToMulti(id, devId, sizeof(devId));
+		CoTaskMemFree(id);
+		// get the name
+		name[0] = 0;
+		if (getNames && !GetDeviceName(pDevice, name, sizeof(name))) {
+			status = WAD_ERR_INTERNAL;
+			goto EnumDevices_exit;
+		}
+		fn(arg, devId, getNames ? name : NULL);
+		SafeRelease(&pDevice);
+	}
+EnumDevices_exit:
+	SafeRelease(&pDevice);
+	SafeRelease(&pCollection);
+	return status;
+}
+
+// the collection knows its size, so no need to get each device
+int WasapiBackend::CountDevices(bool isInput, int *pCount)
+{
+	HRESULT hr;
+	IMMDeviceCollection *pCollection = NULL;
+	UINT num = 0;
+
+	hr = pEnumerator->EnumAudioEndpoints(isInput ? eCapture : eRender, DEVICE_STATE_ACTIVE, &pCollection);
+	CHECK(hr, WAD_ERR_INTERNAL, "EnumAudioEndpoints");
+	hr = pCollection->GetCount(&num);
+	SafeRelease(&pCollection);
+	CHECK(hr, WAD_ERR_INTERNAL, "GetCount");
+	*pCount = (int) num;
+	return WAD_OK;
+}
+
+int WasapiBackend::GetDefaultDev(bool isInput, char *devId, size_t len)
+{
+	HRESULT hr;
+	IMMDevice *pDevice;
+	LPWSTR id;
+
+	hr = pEnumerator->GetDefaultAudioEndpoint(isInput ? eCapture : eRender, role, &pDevice);
+	if (hr == E_NOTFOUND) {
+		SetErrorText("no default %s device", isInput ? "input" : "output");
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	CHECK(hr, WAD_ERR_INTERNAL, "GetDefaultAudioEndpoint");
+	hr = pDevice->GetId(&id);
+	SafeRelease(&pDevice);
+	CHECK(hr, WAD_ERR_INTERNAL, "GetId");
+	WideToMulti(id, devId, len);
+	CoTaskMemFree(id);
+	return WAD_OK;
+}
+
+int WasapiBackend::GetDevState(const char *devId, bool *pIsActive, bool *pIsInput)
+{
+	HRESULT hr;
+	IMMDevice *pDevice;
+	DWORD state;
+
+	hr = GetDevice(devId, &pDevice);
+	if (FAILED(hr)) {
+		SetErrorText("unknown device ID '%s'", devId);
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	hr = pDevice->GetState(&state);
+	if (SUCCEEDED(hr))
+		hr = GetIsInput(pDevice, pIsInput);
+	SafeRelease(&pDevice);
+	CHECK(hr, WAD_ERR_INTERNAL, "GetState");
+	*pIsActive = (state == DEVICE_STATE_ACTIVE);
+	return WAD_OK;
+}
+
+int WasapiBackend::GetDevName(const char *devId, char *name, size_t len)
+{
+	HRESULT hr;
+	IMMDevice *pDevice;
+	bool ok;
+
+	hr = GetDevice(devId, &pDevice);
+	CHECK(hr, WAD_ERR_INTERNAL, "GetDevice");
+	memset(name, 0, len);
+	ok = GetDeviceName(pDevice, name, len - 1);
+	SafeRelease(&pDevice);
+	return ok ? WAD_OK : WAD_ERR_INTERNAL;
+}
+
+//
+// Activate the endpoint volume interface, which takes two calls into the
+// audio service, so callers keep the handle for repeated access.
+//
+int WasapiBackend::OpenDev(const char *devId, WadHandle *phDev)
+{
+	HRESULT hr;
+	IMMDevice *pDevice;
+	IAudioEndpointVolume *pVol;
+	long long start;
+
+	start = StatStart();
+	hr = GetDevice(devId, &pDevice);
+	StatEnd(WAD_STAGE_GET_DEVICE, start);
+	CHECK(hr, WAD_ERR_INTERNAL, "GetDevice");
+	start = StatStart();
+	hr = pDevice->Activate(IID_IAudioEndpointVolume, CLSCTX_ALL, NULL,
+		(void **) &pVol);
+	StatEnd(WAD_STAGE_ACTIVATE, start);
+	SafeRelease(&pDevice);
+	CHECK(hr, WAD_ERR_INTERNAL, "Activate");
+	*phDev = pVol;
+	return WAD_OK;
+}
+
+void WasapiBackend::CloseDev(WadHandle hDev)
+{
+	IAudioEndpointVolume *pVol = (IAudioEndpointVolume *) hDev;
+	SafeRelease(&pVol);
+}
+
+// Map result of a volume call, the interface goes stale if the device was
+// removed.
+#define CHECK_VOL(hr, funcName) \
+	if (hr == AUDCLNT_E_DEVICE_INVALIDATED) { \
+		SetErrorText("%s: device removed", funcName); \
+		return WAD_ERR_DEVICE_LOST; \
+	} \
+	CHECK(hr, WAD_ERR_INTERNAL, funcName);
+
+int WasapiBackend::GetVol(WadHandle hDev, float *pVol)
+{
+	HRESULT hr = ((IAudioEndpointVolume *) hDev)->GetMasterVolumeLevelScalar(pVol);
+	CHECK_VOL(hr, "GetMasterVolumeLevelScalar");
+	return WAD_OK;
+}
+
+int WasapiBackend::SetVol(WadHandle hDev, float vol)
+{
+	HRESULT hr = ((IAudioEndpointVolume *) hDev)->SetMasterVolumeLevelScalar(vol, NULL);
+	CHECK_VOL(hr, "SetMasterVolumeLevelScalar");
+	return WAD_OK;
+}
+
+int WasapiBackend::GetMute(WadHandle hDev, bool *pMute)
+{
+	BOOL bMute;
+	HRESULT hr = ((IAudioEndpointVolume *) hDev)->GetMute(&bMute);
+	CHECK_VOL(hr, "GetMute");
+	*pMute = bMute != 0;
+	return WAD_OK;
+}
+
+int WasapiBackend::SetMute(WadHandle hDev, bool mute)
+{
+	HRESULT hr = ((IAudioEndpointVolume *) hDev)->SetMute(mute, NULL);
+	CHECK_VOL(hr, "SetMute");
+	return WAD_OK;
+}
+
+int WasapiBackend::GetVolRange(WadHandle hDev, float *pMinDb, float *pMaxDb, float *pStepDb)
+{
+	HRESULT hr = ((IAudioEndpointVolume *) hDev)->GetVolumeRange(pMinDb, pMaxDb, pStepDb);
+	CHECK_VOL(hr, "GetVolumeRange");
+	return WAD_OK;
+}
+
+int WasapiBackend::GetVolDb(WadHandle hDev, float *pDb)
+{
+	HRESULT hr = ((IAudioEndpointVolume *) hDev)->GetMasterVolumeLevel(pDb);
+	CHECK_VOL(hr, "GetMasterVolumeLevel");
+	return WAD_OK;
+}
+
+int WasapiBackend::SetVolDb(WadHandle hDev, float db)
+{
+	HRESULT hr = ((IAudioEndpointVolume *) hDev)->SetMasterVolumeLevel(db, NULL);
+	CHECK_VOL(hr, "SetMasterVolumeLevel");
+	return WAD_OK;
+}
+
+int WasapiBackend::GetChannelCount(WadHandle hDev, int *pNum)
+{
+	UINT n;
+	HRESULT hr = ((IAudioEndpointVolume *) hDev)->GetChannelCount(&n);
+	CHECK_VOL(hr, "GetChannelCount");
+	*pNum = (int) MIN(n, (UINT) WAD_MAX_CHANNELS);
+	return WAD_OK;
+}
+
+//
+// IAudioEndpointVolume has no call for all channels, but these are calls
+// on the interface in this process, only a set goes to the audio service.
+//
+int WasapiBackend::GetChannelVols(WadHandle hDev, float *vols, int *pNum)
+{
+	IAudioEndpointVolume *pVol = (IAudioEndpointVolume *) hDev;
+	HRESULT hr;
+	UINT i, n;
+
+	hr = pVol->GetChannelCount(&n);
+	CHECK_VOL(hr, "GetChannelCount");
+	n = MIN(n, (UINT) WAD_MAX_CHANNELS);
+	for (i = 0; i < n; i++) {
+		hr = pVol->GetChannelVolumeLevelScalar(i, &vols[i]);
+		CHECK_VOL(hr, "GetChannelVolumeLevelScalar");
+	}
+	*pNum = (int) n;
+	return WAD_OK;
+}
+
+int WasapiBackend::SetChannelVols(WadHandle hDev, const float *vols, int num)
+{
+	IAudioEndpointVolume *pVol = (IAudioEndpointVolume *) hDev;
+	HRESULT hr;
+	UINT i, n;
+
+	hr = pVol->GetChannelCount(&n);
+	CHECK_VOL(hr, "GetChannelCount");
+	if ((int) MIN(n, (UINT) WAD_MAX_CHANNELS) != num) {
+		SetErrorText("SetChannelVols: %d channels given, device has %u", num, n);
+		return WAD_ERR_INVALID_ARG;
+	}
+	for (i = 0; i < n; i++) {
+		hr = pVol->SetChannelVolumeLevelScalar(i, vols[i], NULL);
+		CHECK_VOL(hr, "SetChannelVolumeLevelScalar");
+	}
+	return WAD_OK;
+}
+
+//
+// Speaker positions come from the channel mask of the format the audio
+// engine uses for the device. A format that isn't extensible has no mask,
+// and gets the usual layout for its channel count.
+//
+int WasapiBackend::GetChannelSides(const char *devId, unsigned char *sides, int *pNum)
+{
+	HRESULT hr;
+	IMMDevice *pDevice;
+	IPropertyStore *pStore = NULL;
+	PROPVARIANT format;
+	const WAVEFORMATEX *pFormat;
+	unsigned long mask;
+	int status = WAD_OK;
+
+	PropVariantInit(&format);
+	hr = GetDevice(devId, &pDevice);
+	if (FAILED(hr)) {
+		SetErrorText("unknown device ID '%s'", devId);
+		return WAD_ERR_INVALID_DEVICE;
+	}
+	hr = pDevice->OpenPropertyStore(STGM_READ, &pStore);
+	CHECK_GOTO(hr, WAD_ERR_INTERNAL, "OpenPropertyStore", GetChannelSides_exit);
+	hr = pStore->GetValue(PKEY_AudioEngine_DeviceFormat, &format);
+	CHECK_GOTO(hr, WAD_ERR_INTERNAL, "GetValue", GetChannelSides_exit);
+	if (format.vt != VT_BLOB || format.blob.cbSize < sizeof(WAVEFORMATEX)) {
+		SetErrorText("GetChannelSides: no device format");
+		status = WAD_ERR_UNSUPPORTED;
+		goto GetChannelSides_exit;
+	}
+	pFormat = (const WAVEFORMATEX *) format.blob.pBlobData;
+	if (pFormat->wFormatTag == WAVE_FORMAT_EXTENSIBLE
+			&& format.blob.cbSize >= sizeof(WAVEFORMATEXTENSIBLE))
+		mask = ((const WAVEFORMATEXTENSIBLE *) pFormat)->dwChannelMask;
+	else
+		mask = WadDefaultSpeakerMask(pFormat->nChannels);
+	*pNum = MIN((int) pFormat->nChannels, WAD_MAX_CHANNELS);
+	WadMaskToSides(mask, sides, *pNum);
+
+GetChannelSides_exit:
+	PropVariantClear(&format);
+	SafeRelease(&pStore);
+	SafeRelease(&pDevice);
+	return status;
+}
+
+//
+// The meter is activated from the device like the endpoint volume, and
+// then read without further calls into the audio service.
+//
+int WasapiBackend::OpenMeter(const char *devId, WadHandle *phMeter)
+{
+	HRESULT hr;
+	IMMDevice *pDevice;
+	IAudioMeterInformation *pMeter;
+
+	hr = GetDevice(devId, &pDevice);
+	CHECK(hr, WAD_ERR_INTERNAL, "GetDevice");
+	hr = pDevice->Activate(IID_IAudioMeterInformation, CLSCTX_ALL, NULL,
+		(void **) &pMeter);
+	SafeRelease(&pDevice);
+	CHECK(hr, WAD_ERR_INTERNAL, "Activate");
+	*phMeter = pMeter;
+	return WAD_OK;
+}
+
+void WasapiBackend::CloseMeter(WadHandle hMeter)
+{
+	IAudioMeterInformation *pMeter = (IAudioMeterInformation *) hMeter;
+	SafeRelease(&pMeter);
+}
+
+int WasapiBackend::GetPeaks(WadHandle hMeter, float *pPeak, float *chanPeaks, int *pNum)
+{
+	IAudioMeterInformation *pMeter = (IAudioMeterInformation *) hMeter;
+	HRESULT hr;
+	UINT n;
+
+	hr = pMeter->GetPeakValue(pPeak);
+	CHECK_VOL(hr, "GetPeakValue");
+	hr = pMeter->GetMeteringChannelCount(&n);
+	CHECK_VOL(hr, "GetMeteringChannelCount");
+	n = MIN(n, (UINT) WAD_MAX_CHANNELS);
+	hr = pMeter->GetChannelsPeakValues(n, chanPeaks);
+	CHECK_VOL(hr, "GetChannelsPeakValues");
+	*pNum = (int) n;
+	return WAD_OK;
+}
+
+int WasapiBackend::SetListener(WadBackendListener *_listener)
+{
+	HRESULT hr;
+
+	if (pNotify) {
+		// blocks until any callback in progress returns
+		pEnumerator->UnregisterEndpointNotificationCallback(pNotify);
+		SafeRelease(&pNotify);
+	}
+	listener = _listener;
+	if (listener) {
+		pNotify = new WasapiNotify(this);
+		hr = pEnumerator->RegisterEndpointNotificationCallback(pNotify);
+		if (FAILED(hr)) {
+			SafeRelease(&pNotify);
+			listener = NULL;
+		}
+		CHECK(hr, WAD_ERR_INTERNAL, "RegisterEndpointNotificationCallback");
+	}
+	return WAD_OK;
+}
+
+int WasapiBackend::Watch(const char *devId, int devIndex, WadVolChangeFn *fn, void *arg, WadHandle *phWatch)
+{
+	HRESULT hr;
+	WadHandle hDev;
+	WasapiWatch *pWatch;
+	int status;
+
+	// the watch holds its own interface
+	if ((status = OpenDev(devId, &hDev)) != WAD_OK)
+		return status;
+	pWatch = new WasapiWatch(devIndex, fn, arg, (IAudioEndpointVolume *) hDev);
+	hr = pWatch->pVol->RegisterControlChangeNotify(pWatch);
+	if (FAILED(hr))
+		SafeRelease(&pWatch);
+	CHECK(hr, WAD_ERR_INTERNAL, "RegisterControlChangeNotify");
+	*phWatch = pWatch;
+	return WAD_OK;
+}
+
+void WasapiBackend::Unwatch(WadHandle hWatch)
+{
+	WasapiWatch *pWatch = (WasapiWatch *) hWatch;
+	pWatch->pVol->UnregisterControlChangeNotify(pWatch);
+	SafeRelease(&pWatch);
+}
+
+//=============================================================================
+//
+// Sessions
+//
+// A session is found by instance ID, which includes the device ID, so it is
+// unique across devices. Session handles keep the control interface to
+// check for expiry, since ISimpleAudioVolume keeps working on an expired
+// session.
+//
+
+typedef struct {
+	IAudioSessionControl2 *pControl;
+	ISimpleAudioVolume *pVol;
+} WasapiSession;
+
+//
+// Get the executable name of a process, without path, empty if the
+// process can't be opened, e.g., a protected process.
+//
+static void GetProcessName(DWORD pid, char *name, size_t len)
+{
+	char path[MAX_PATH];
+	DWORD size = sizeof(path);
+	HANDLE hProcess;
+	char *s;
+
+	memset(name, 0, len);
+	hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+	if (!hProcess)
+		return;
+	if (QueryFullProcessImageNameA(hProcess, 0, path, &size)) {
+		s = strrchr(path, '\\');
+		strncpy(name, s ? s + 1 : path, len - 1);
+	}
+	CloseHandle(hProcess);
+}
+
+//
+// Get ID, process and state of a session. The ID holds the device ID and
+// the application's path, so has no fixed length, and *pSessionId gets an
+// allocated copy to free.
+//
+static HRESULT GetSessionInfo(IAudioSessionControl2 *pControl, char **pSessionId, DWORD *pPid,
+	char *procName, size_t nameLen, AudioSessionState *pState)
+{
+	HRESULT hr;
+	LPWSTR id;
+
+	hr = pControl->GetState(pState);
+	if (FAILED(hr))
+		return hr;
+	hr = pControl->GetSessionInstanceIdentifier(&id);
+	if (FAILED(hr))
+		return hr;
+	*pSessionId = WideToMultiAlloc(id);
+	CoTaskMemFree(id);
+	if (!*pSessionId)
+		return E_OUTOFMEMORY;
+	if (pControl->IsSystemSoundsSession() == S_OK) {
+		*pPid = 0;
+		strncpy(procName, "System Sounds", nameLen - 1);
+		procName[nameLen - 1] = 0;
+		return S_OK;
+	}
+	// fails for sessions spanning processes, which have no single name
+	if (FAILED(pControl->GetProcessId(pPid)))
+		*pPid = 0;
+	GetProcessName(*pPid, procName, nameLen);
+	return S_OK;
+}
+
+int WasapiBackend::GetSessionManager(const char *devId, IAudioSessionManager2 **ppManager)
+{
+	HRESULT hr;
+	IMMDevice *pDevice;
+
+	hr = GetDevice(devId, &pDevice);
+	CHECK(hr, WAD_ERR_INVALID_DEVICE, "GetDevice");
+	hr = pDevice->Activate(IID_IAudioSessionManager2, CLSCTX_ALL, NULL, (void **) ppManager);
+	SafeRelease(&pDevice);
+	CHECK(hr, WAD_ERR_INTERNAL, "Activate");
+	return WAD_OK;
+}
+
+int WasapiBackend::EnumSessions(const char *devId, WadSessionEnumFn *fn, void *arg)
+{
+	HRESULT hr;
+	IAudioSessionManager2 *pManager = NULL;
+	IAudioSessionEnumerator *pSessionEnum = NULL;
+	IAudioSessionControl *pSession = NULL;
+	IAudioSessionControl2 *pControl = NULL;
+	AudioSessionState state;
+	char *sessionId = NULL;
+	char procName[WAD_NAME_LEN];
+	DWORD pid;
+	int i, num = 0;
+	int status = WAD_OK;
+
+	if ((status = GetSessionManager(devId, &pManager)) != WAD_OK)
+		return status;
+	hr = pManager->GetSessionEnumerator(&pSessionEnum);
+	CHECK_GOTO(hr, WAD_ERR_INTERNAL, "GetSessionEnumerator", EnumSessions_exit);
+	hr = pSessionEnum->GetCount(&num);
+	CHECK_GOTO(hr, WAD_ERR_INTERNAL, "GetCount", EnumSessions_exit);
+	for (i = 0; i < num; i++) {
+		hr = pSessionEnum->GetSession(i, &pSession);
+		CHECK_GOTO(hr, WAD_ERR_INTERNAL, "GetSession", EnumSessions_exit);
+		hr = pSession->QueryInterface(IID_IAudioSessionControl2, (void **) &pControl);
+		CHECK_GOTO(hr, WAD_ERR_INTERNAL, "QueryInterface", EnumSessions_exit);
+		hr = GetSessionInfo(pControl, &sessionId, &pid, procName, sizeof(procName), &state);
+		CHECK_GOTO(hr, WAD_ERR_INTERNAL, "GetSessionInfo", EnumSessions_exit);
+		if (state != AudioSessionStateExpired)
+			fn(arg, sessionId, pid, procName);
+		free(sessionId);
+		sessionId = NULL;
+		SafeRelease(&pControl);
+		SafeRelease(&pSession);
+	}
+EnumSessions_exit:
+	free(sessionId);
+	SafeRelease(&pControl);
+	SafeRelease(&pSession);
+	SafeRelease(&pSessionEnum);
+	SafeRelease(&pManager);
+	return status;
+}
+
+int WasapiBackend::OpenSession(const char *devId, const char *sessionId, WadHandle *phSes)
+{
+	HRESULT hr;
+	IAudioSessionManager2 *pManager = NULL;
+	IAudioSessionEnumerator *pSessionEnum = NULL;
+	IAudioSessionControl *pSession = NULL;
+	IAudioSessionControl2 *pControl = NULL;
+	ISimpleAudioVolume *pVol = NULL;
+	WasapiSession *pHandle;
+	AudioSessionState state;
+	char *id = NULL;
+	char procName[WAD_NAME_LEN];
+	DWORD pid;
+	int i, num = 0;
+	int status = WAD_OK;
+
+	if ((status = GetSessionManager(devId, &pManager)) != WAD_OK)
+		return status;
+	hr = pManager->GetSessionEnumerator(&pSessionEnum);
+	CHECK_GOTO(hr, WAD_ERR_INTERNAL, "GetSessionEnumerator", OpenSession_exit);
+	hr = pSessionEnum->GetCount(&num);
+	CHECK_GOTO(hr, WAD_ERR_INTERNAL, "GetCount", OpenSession_exit);
+	status = WAD_ERR_DEVICE_LOST;
+	for (i = 0; i < num && status == WAD_ERR_DEVICE_LOST; i++) {
+		hr = pSessionEnum->GetSession(i, &pSession);
+		CHECK_GOTO(hr, WAD_ERR_INTERNAL, "GetSession", OpenSession_exit);
+		hr = pSession->QueryInterface(IID_IAudioSessionControl2, (void **) &pControl);
+		CHECK_GOTO(hr, WAD_ERR_INTERNAL, "QueryInterface", OpenSession_exit);
+		hr = GetSessionInfo(pControl, &id, &pid, procName, sizeof(procName), &state);
+		CHECK_GOTO(hr, WAD_ERR_INTERNAL, "GetSessionInfo", OpenSession_exit);
+		if (!strcmp(id, sessionId) && state != AudioSessionStateExpired) {
+			hr = pSession->QueryInterface(IID_ISimpleAudioVolume, (void **) &pVol);
+			CHECK_GOTO(hr, WAD_ERR_INTERNAL, "QueryInterface", OpenSession_exit);
+			pHandle = new WasapiSession;
+			pHandle->pControl = pControl;
+			pHandle->pVol = pVol;
+			pControl = NULL;
+			*phSes = pHandle;
+			status = WAD_OK;
+		}
+		free(id);
+		id = NULL;
+		SafeRelease(&pControl);
+		SafeRelease(&pSession);
+	}
+	if (status == WAD_ERR_DEVICE_LOST)
+		SetErrorText("OpenSession: session '%s' not found", sessionId);
+OpenSession_exit:
+	free(id);
+	SafeRelease(&pControl);
+	SafeRelease(&pSession);
+	SafeRelease(&pSessionEnum);
+	SafeRelease(&pManager);
+	return status;
+}
+
+void WasapiBackend::CloseSession(WadHandle hSes)
+{
+	WasapiSession *pHandle = (WasapiSession *) hSes;
+	SafeRelease(&pHandle->pVol);
+	SafeRelease(&pHandle->pControl);
+	delete pHandle;
+}
+
+// Check a session hasn't expired before using it
+#define CHECK_SESSION(pHandle, funcName) \
+	{ \
+		AudioSessionState state; \
+		HRESULT hrState = pHandle->pControl->GetState(&state); \
+		CHECK_VOL(hrState, funcName); \
+		if (state == AudioSessionStateExpired) { \
+			SetErrorText("%s: session expired", funcName); \
+			return WAD_ERR_DEVICE_LOST; \
+		} \
+	}
+
+int WasapiBackend::GetSessionVol(WadHandle hSes, float *pVol)
+{
+	WasapiSession *pHandle = (WasapiSession *) hSes;
+	HRESULT hr;
+
+	CHECK_SESSION(pHandle, "GetSessionVol");
+	hr = pHandle->pVol->GetMasterVolume(pVol);
+	CHECK_VOL(hr, "GetMasterVolume");
+	return WAD_OK;
+}
+
+int WasapiBackend::SetSessionVol(WadHandle hSes, float vol)
+{
+	WasapiSession *pHandle = (WasapiSession *) hSes;
+	HRESULT hr;
+
+	CHECK_SESSION(pHandle, "SetSessionVol");
+	hr = pHandle->pVol->SetMasterVolume(vol, NULL);
+	CHECK_VOL(hr, "SetMasterVolume");
+	return WAD_OK;
+}
+
+int WasapiBackend::GetSessionMute(WadHandle hSes, bool *pMute)
+{
+	WasapiSession *pHandle = (WasapiSession *) hSes;
+	BOOL bMute;
+	HRESULT hr;
+
+	CHECK_SESSION(pHandle, "GetSessionMute");
+	hr = pHandle->pVol->GetMute(&bMute);
+	CHECK_VOL(hr, "GetMute");
+	*pMute = bMute != 0;
+	return WAD_OK;
+}
+
+int WasapiBackend::SetSessionMute(WadHandle hSes, bool mute)
+{
+	WasapiSession *pHandle = (WasapiSession *) hSes;
+	HRESULT hr;
+
+	CHECK_SESSION(pHandle, "SetSessionMute");
+	hr = pHandle->pVol->SetMute(mute, NULL);
+	CHECK_VOL(hr, "SetMute");
+	return WAD_OK;
+}
+
+//=============================================================================
+//
+// Session notifications
+//
+// New sessions on a device arrive through IAudioSessionNotification, and
+// each session has an IAudioSessionEvents to learn when it expires or its
+// device goes away. Both are called on system threads.
+//
+
+class WasapiSessionEvents : public IAudioSessionEvents {
+	LONG refCount;
+	WasapiSessionWatch *pWatch;
+public:
+	IAudioSessionControl2 *pControl;	//!< interface registered with
+	char *sessionId;					//!< instance ID, allocated
+	DWORD pid;
+	char procName[WAD_NAME_LEN];
+	WasapiSessionEvents *next;
+
+	WasapiSessionEvents(WasapiSessionWatch *_pWatch, IAudioSessionControl2 *_pControl) :
+		refCount(1), pWatch(_pWatch), pControl(_pControl), sessionId(NULL), pid(0), next(NULL)
+	{
+		pControl->AddRef();
+		memset(procName, 0, sizeof(procName));
+	}
+
+	~WasapiSessionEvents()
+	{
+		SafeRelease(&pControl);
+		free(sessionId);
+	}
+
+	ULONG STDMETHODCALLTYPE AddRef()
+	{
+		return InterlockedIncrement(&refCount);
+	}
+
+	ULONG STDMETHODCALLTYPE Release()
+	{
+		ULONG n = InterlockedDecrement(&refCount);
+		if (n == 0)
+			delete this;
+		return n;
+	}
+
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, VOID **ppv)
+	{
+		if (riid == IID_IUnknown || riid == IID_IAudioSessionEvents) {
+			AddRef();
+			*ppv = (IAudioSessionEvents *) this;
+			return S_OK;
+		}
+		*ppv = NULL;
+		return E_NOINTERFACE;
+	}
+
+	HRESULT STDMETHODCALLTYPE OnStateChanged(AudioSessionState state);
+
+	HRESULT STDMETHODCALLTYPE OnSessionDisconnected(AudioSessionDisconnectReason reason)
+	{
+		UNUSED(reason);
+		return OnStateChanged(AudioSessionStateExpired);
+	}
+
+	// the rest aren't needed
+	HRESULT STDMETHODCALLTYPE OnDisplayNameChanged(LPCWSTR name, LPCGUID context)
+	{
+		return S_OK;
+	}
+
+	HRESULT STDMETHODCALLTYPE OnIconPathChanged(LPCWSTR path, LPCGUID context)
+	{
+		return S_OK;
+	}
+
+	HRESULT STDMETHODCALLTYPE OnSimpleVolumeChanged(float vol, BOOL mute, LPCGUID context)
+	{
+		return S_OK;
+	}
+
+	HRESULT STDMETHODCALLTYPE OnChannelVolumeChanged(DWORD count, float vols[], DWORD channel, LPCGUID context)
+	{
+		return S_OK;
+	}
+
+	HRESULT STDMETHODCALLTYPE OnGroupingParamChanged(LPCGUID param, LPCGUID context)
+	{
+		return S_OK;
+	}
+};
+
+class WasapiSessionWatch : public IAudioSessionNotification {
+	LONG refCount;
+	WasapiBackend *pBackend;
+public:
+	char devId[WAD_NAME_LEN];
+	IAudioSessionManager2 *pManager;	//!< manager registered with
+	WasapiSessionEvents *events;	//!< per-session events, guarded by lock
+	CRITICAL_SECTION lock;
+
+	WasapiSessionWatch(WasapiBackend *p, const char *_devId, IAudioSessionManager2 *_pManager) :
+		refCount(1), pBackend(p), pManager(_pManager), events(NULL)
+	{
+		memset(devId, 0, sizeof(devId));
+		strncpy(devId, _devId, sizeof(devId) - 1);
+		InitializeCriticalSection(&lock);
+	}
+
+	~WasapiSessionWatch()
+	{
+		SafeRelease(&pManager);
+		DeleteCriticalSection(&lock);
+	}
+
+	ULONG STDMETHODCALLTYPE AddRef()
+	{
+		return InterlockedIncrement(&refCount);
+	}
+
+	ULONG STDMETHODCALLTYPE Release()
+	{
+		ULONG n = InterlockedDecrement(&refCount);
+		if (n == 0)
+			delete this;
+		return n;
+	}
+
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, VOID **ppv)
+	{
+		if (riid == IID_IUnknown || riid == IID_IAudioSessionNotification) {
+			AddRef();
+			*ppv = (IAudioSessionNotification *) this;
+			return S_OK;
+		}
+		*ppv = NULL;
+		return E_NOINTERFACE;
+	}
+
+	//
+	// Register for events on a session, returns NULL if expired or the
+	// registration failed.
+	//
+	WasapiSessionEvents *AddSession(IAudioSessionControl *pSession)
+	{
+		IAudioSessionControl2 *pControl;
+		WasapiSessionEvents *pEvents;
+		AudioSessionState state;
+		HRESULT hr;
+
+		if (FAILED(pSession->QueryInterface(IID_IAudioSessionControl2, (void **) &pControl)))
+			return NULL;
+		pEvents = new WasapiSessionEvents(this, pControl);
+		SafeRelease(&pControl);
+		hr = GetSessionInfo(pEvents->pControl, &pEvents->sessionId, &pEvents->pid, pEvents->procName,
+			sizeof(pEvents->procName), &state);
+		if (SUCCEEDED(hr) && state != AudioSessionStateExpired)
+			hr = pEvents->pControl->RegisterAudioSessionNotification(pEvents);
+		if (FAILED(hr) || state == AudioSessionStateExpired) {
+			SafeRelease(&pEvents);
+			return NULL;
+		}
+		EnterCriticalSection(&lock);
+		pEvents->next = events;
+		events = pEvents;
+		LeaveCriticalSection(&lock);
+		return pEvents;
+	}
+
+	void OnSessionState(WasapiSessionEvents *pEvents, bool isActive)
+	{
+		if (pBackend->listener)
+			pBackend->listener->OnSessionState(devId, pEvents->sessionId, pEvents->pid, pEvents->procName,
+				isActive);
+	}
+
+	HRESULT STDMETHODCALLTYPE OnSessionCreated(IAudioSessionControl *pSession)
+	{
+		WasapiSessionEvents *pEvents;
+		if (pSession && (pEvents = AddSession(pSession)) != NULL)
+			OnSessionState(pEvents, true);
+		return S_OK;
+	}
+};
+
+HRESULT STDMETHODCALLTYPE WasapiSessionEvents::OnStateChanged(AudioSessionState state)
+{
+	if (state == AudioSessionStateExpired)
+		pWatch->OnSessionState(this, false);
+	return S_OK;
+}
+
+int WasapiBackend::WatchSessions(const char *devId, WadHandle *phWatch)
+{
+	HRESULT hr;
+	APTTYPE aptType;
+	APTTYPEQUALIFIER aptQualifier;
+	IAudioSessionManager2 *pManager;
+	IAudioSessionEnumerator *pSessionEnum = NULL;
+	IAudioSessionControl *pSession;
+	WasapiSessionWatch *pWatch;
+	int i, num = 0;
+	int status;
+
+	// session notifications are only sent to multithreaded apartments
+	hr = CoGetApartmentType(&aptType, &aptQualifier);
+	if (FAILED(hr) || aptType == APTTYPE_STA || aptType == APTTYPE_MAINSTA) {
+		SetErrorText("WatchSessions: COM is single threaded");
+		return WAD_ERR_UNSUPPORTED;
+	}
+	if ((status = GetSessionManager(devId, &pManager)) != WAD_OK)
+		return status;
+	pWatch = new WasapiSessionWatch(this, devId, pManager);
+	hr = pManager->RegisterSessionNotification(pWatch);
+	if (FAILED(hr))
+		SafeRelease(&pWatch);
+	CHECK(hr, WAD_ERR_INTERNAL, "RegisterSessionNotification");
+	// enumerating starts the notifications, and each existing session
+	// needs events to learn when it expires
+	hr = pManager->GetSessionEnumerator(&pSessionEnum);
+	if (SUCCEEDED(hr))
+		hr = pSessionEnum->GetCount(&num);
+	for (i = 0; i < num && SUCCEEDED(hr); i++) {
+		if (SUCCEEDED(hr = pSessionEnum->GetSession(i, &pSession))) {
+			pWatch->AddSession(pSession);
+			SafeRelease(&pSession);
+		}
+	}
+	SafeRelease(&pSessionEnum);
+	if (FAILED(hr)) {
+		UnwatchSessions(pWatch);
+		CHECK(hr, WAD_ERR_INTERNAL, "GetSessionEnumerator");
+	}
+	*phWatch = pWatch;
+	return WAD_OK;
+}
+
+void WasapiBackend::UnwatchSessions(WadHandle hWatch)
+{
+	WasapiSessionWatch *pWatch = (WasapiSessionWatch *) hWatch;
+	WasapiSessionEvents *pEvents;
+
+	pWatch->pManager->UnregisterSessionNotification(pWatch);
+	EnterCriticalSection(&pWatch->lock);
+	while ((pEvents = pWatch->events) != NULL) {
+		pWatch->events = pEvents->next;
+		pEvents->pControl->UnregisterAudioSessionNotification(pEvents);
+		SafeRelease(&pEvents);
+	}
+	LeaveCriticalSection(&pWatch->lock);
+	SafeRelease(&pWatch);
+}
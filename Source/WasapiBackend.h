@@ -0,0 +1,87 @@
+/** Windows Audio Services (WASAPI) backend
+
+Devices are endpoints from the MMDevice API, and volume is controlled with
+IAudioEndpointVolume. A device handle is an activated IAudioEndpointVolume,
+and a meter handle an activated IAudioMeterInformation.
+Sessions come from the device's IAudioSessionManager2, identified by
+session instance ID, with volume controlled by ISimpleAudioVolume.
+
+COM is initialized multithreaded, which session notifications need, and
+which lets other threads use the interfaces. If the caller's thread is
+already single threaded, sessions work but aren't watched.
+
+@file WasapiBackend.h
+*/
+#ifndef _WASAPI_BACKEND_H
+#define _WASAPI_BACKEND_H
+
+#include <MMDeviceAPI.h>
+#include <AudioClient.h>
+#include <AudioPolicy.h>
+#include <EndpointVolume.h>
+#include "WadBackend.h"
+
+class WasapiNotify;
+class WasapiSessionWatch;
+
+class WasapiBackend : public WadBackend {
+	friend class WasapiNotify;
+	friend class WasapiSessionWatch;
+protected:
+	IMMDeviceEnumerator *pEnumerator;	//!< device enumerator
+	ERole role;
+	WasapiNotify *pNotify;		//!< device notification client, or NULL
+	WadBackendListener *listener;	//!< receives device notifications
+	//! Get the device name as C string
+	bool GetDeviceName(IMMDevice *device, char *devName, size_t len);
+	//! Get device by UTF-8 ID
+	HRESULT GetDevice(const char *devId, IMMDevice **ppDevice);
+	//! Get direction of a device
+	HRESULT GetIsInput(IMMDevice *pDevice, bool *pIsInput);
+	//! Activate the session manager of a device
+	int GetSessionManager(const char *devId, IAudioSessionManager2 **ppManager);
+
+public:
+	WasapiBackend();
+	~WasapiBackend();
+
+	const char *GetName();
+	int Init(int role);
+	int ThreadInit();
+	void ThreadExit();
+	int EnumDevices(bool isInput, bool getNames, WadEnumFn *fn, void *arg);
+	int CountDevices(bool isInput, int *pCount);
+	int GetDefaultDev(bool isInput, char *devId, size_t len);
+	int GetDevState(const char *devId, bool *pIsActive, bool *pIsInput);
+	int GetDevName(const char *devId, char *name, size_t len);
+	int OpenDev(const char *devId, WadHandle *phDev);
+	void CloseDev(WadHandle hDev);
+	int GetVol(WadHandle hDev, float *pVol);
+	int SetVol(WadHandle hDev, float vol);
+	int GetMute(WadHandle hDev, bool *pMute);
+	int SetMute(WadHandle hDev, bool mute);
+	int GetChannelCount(WadHandle hDev, int *pNum);
+	int GetChannelVols(WadHandle hDev, float *vols, int *pNum);
+	int SetChannelVols(WadHandle hDev, const float *vols, int num);
+	int GetChannelSides(const char *devId, unsigned char *sides, int *pNum);
+	int GetVolRange(WadHandle hDev, float *pMinDb, float *pMaxDb, float *pStepDb);
+	int GetVolDb(WadHandle hDev, float *pDb);
+	int SetVolDb(WadHandle hDev, float db);
+	int OpenMeter(const char *devId, WadHandle *phMeter);
+	void CloseMeter(WadHandle hMeter);
+	int GetPeaks(WadHandle hMeter, float *pPeak, float *chanPeaks, int *pNum);
+	int SetListener(WadBackendListener *listener);
+	int Watch(const char *devId, int devIndex, WadVolChangeFn *fn, void *arg, WadHandle *phWatch);
+	void Unwatch(WadHandle hWatch);
+	int EnumSessions(const char *devId, WadSessionEnumFn *fn, void *arg);
+	int WatchSessions(const char *devId, WadHandle *phWatch);
+	void UnwatchSessions(WadHandle hWatch);
+	int OpenSession(const char *devId, const char *sessionId, WadHandle *phSes);
+	void CloseSession(WadHandle hSes);
+	int GetSessionVol(WadHandle hSes, float *pVol);
+	int SetSessionVol(WadHandle hSes, float vol);
+	int GetSessionMute(WadHandle hSes, bool *pMute);
+	int SetSessionMute(WadHandle hSes, bool mute);
+};
+
+#endif